@@ -0,0 +1,79 @@
+#
+# Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+# Decode the binary (dictionary) logs of the production logging profile
+# (overlays/logging_dictionary.conf) with the Zephyr dictionary logging parser.
+#
+# Usage:
+#   python3 scripts/log_decode.py log_0000 log_0001 ...
+#   python3 scripts/log_decode.py --hex console.txt
+#   python3 scripts/log_decode.py --elf path/to/zephyr.elf log_0000
+#
+# The rotating files (CONFIG_LOG_BACKEND_FS_FILE_PREFIX) are concatenated in
+# index order before decoding. The dictionary database must match the image
+# which produced the logs: it is generated from the ELF when --elf is given or
+# when the build database is missing.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+DEFAULT_ELF = "build/zephyr/zephyr.elf"
+DEFAULT_DB = "build/zephyr/log_dictionary.json"
+
+
+def zephyr_script(name: str) -> str:
+    base = os.environ.get("ZEPHYR_BASE")
+    if not base:
+        sys.exit("ZEPHYR_BASE is not set, activate the Zephyr environment first")
+    return os.path.join(base, "scripts", "logging", "dictionary", name)
+
+
+def generate_db(elf: str, db: str):
+    print(f"Generating dictionary database {db} from {elf}")
+    subprocess.run([sys.executable, zephyr_script("database_gen.py"), elf,
+                    "--json", db], check=True)
+
+
+def file_index(path: str):
+    # log_0003 -> 3, files without index last
+    m = re.search(r"(\d+)$", os.path.basename(path))
+    return (0, int(m.group(1))) if m else (1, path)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Dictionary logs decoder")
+    parser.add_argument("files", nargs="+", help="Binary log files (or hex capture)")
+    parser.add_argument("--elf", help="ELF of the image, regenerates the database")
+    parser.add_argument("--db", default=DEFAULT_DB, help="Dictionary database")
+    parser.add_argument("--hex", action="store_true",
+                        help="Files are hexadecimal captures of the UART backend")
+    args = parser.parse_args()
+
+    db = args.db
+    if args.elf:
+        db = os.path.join(tempfile.gettempdir(), "log_dictionary.json")
+        generate_db(args.elf, db)
+    elif not os.path.exists(db):
+        generate_db(DEFAULT_ELF, db)
+
+    files = args.files if args.hex else sorted(args.files, key=file_index)
+
+    with tempfile.NamedTemporaryFile(suffix=".log", delete=False) as out:
+        for path in files:
+            with open(path, "rb") as fp:
+                out.write(fp.read())
+
+    try:
+        cmd = [sys.executable, zephyr_script("log_parser.py")]
+        if args.hex:
+            cmd.append("--hex")
+        subprocess.run(cmd + [db, out.name], check=True)
+    finally:
+        os.unlink(out.name)
@@ -17,4 +17,25 @@ s.city_id = 234
 s.area_id = 2345
 s.name = "Hamburg"
 
-print(s.area_id .. s.name)
\ No newline at end of file
+print(s.area_id .. s.name)
+
+-- Rooms and devices
+for rid, name, count in ha.rooms() do
+    print(string.format("room %d: %s (%d devices)", rid, name, count))
+end
+
+for dev in ha.devices() do
+    print(string.format("%s temperature=%s", tostring(dev), tostring(dev:value("temperature"))))
+end
+
+-- React to a few data events, the event view is reused
+local sub = ha.subscribe({data = true})
+local ev = nil
+for i = 1, 10 do
+    ev = ha.pend(sub, 1000, ev)
+    if ev then
+        print(string.format("%s %s temperature=%s", tostring(ev), ev:device():addr(),
+            tostring(ev:get("temperature"))))
+    end
+end
+sub:close()
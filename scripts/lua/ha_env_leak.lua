@@ -0,0 +1,14 @@
+--
+-- Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+--
+-- SPDX-License-Identifier: Apache-2.0
+--
+
+require("ha")
+
+-- Subscription and event kept in globals and never released explicitly:
+-- both must be collected at the end of the run (see lua_env_leak_test.py)
+sub = ha.subscribe({data = true})
+ev = ha.pend(sub, 1000)
+
+print(string.format("ha_env_leak.lua ev=%s", tostring(ev)))
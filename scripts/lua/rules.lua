@@ -0,0 +1,30 @@
+--
+-- Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+--
+-- SPDX-License-Identifier: Apache-2.0
+--
+
+-- Rules script, loaded with lua_rules_load()
+
+local alerts = 0
+
+-- Run for each temperature reported by the Xiaomi sensors
+rules.on({data = true, type = "xiaomi_mijia"}, function(ev)
+    local t = ev:get("temperature")
+    if t and t > 3000 then
+        alerts = alerts + 1
+        print(string.format("%s too hot: %d", tostring(ev:device()), t))
+    end
+end)
+
+-- Periodic rule, rules.sleep() suspends it without blocking the others
+local summary = rules.every(60000, function()
+    for dev in ha.devices() do
+        print(string.format("%s temperature=%s", tostring(dev),
+                            tostring(dev:value("temperature"))))
+        rules.sleep(10)
+    end
+    print(string.format("alerts: %d", alerts))
+end)
+
+print("rules loaded", summary)
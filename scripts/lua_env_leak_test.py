@@ -0,0 +1,52 @@
+#
+# Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+# Run a script storing an HA subscription and event in globals several times
+# and check that the free HA events count (ha_ev_free_count(), reported as
+# "mem_ev_remaining" by /api/ha/stats) is back to its initial value, i.e.
+# that the environment of each run is released.
+
+import sys
+import time
+
+import requests
+from caniot.controller import Controller
+
+ip = "192.0.2.1"
+
+N = 10
+
+lua_script = "ha_env_leak.lua"
+
+
+def ev_free_count() -> int:
+    resp = requests.get(f"http://{ip}/api/ha/stats")
+    resp.raise_for_status()
+    return resp.json()["mem_ev_remaining"]
+
+
+c = Controller(ip, False)
+
+res = c.upload(f"./scripts/lua/{lua_script}", chunks_size=1024)
+
+before = ev_free_count()
+
+for i in range(N):
+    res = c.run_script(lua_script)
+    print(i, res, res.status_code, res.text)
+
+# Let the events in flight be delivered and released
+time.sleep(1)
+
+after = ev_free_count()
+
+print(f"free events: before={before} after={after}")
+
+if after < before:
+    print(f"FAILED: {before - after} events leaked over {N} runs")
+    sys.exit(1)
+
+print("OK")
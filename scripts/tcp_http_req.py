@@ -13,6 +13,9 @@ ip = "192.0.2.1"
 parallel_requests = 1
 requests_count = 5
 
+# Send all requests back-to-back before reading the responses (HTTP/1.1 pipelining)
+pipelined = False
+
 req = b"""GET /info HTTP/1.1
 Host: 192.168.10.240
 User-Agent: python-requests/2.26.0
@@ -50,6 +53,16 @@ b = time.time()
 
 shuffle(sock)
 
+if pipelined:
+        for i in range(parallel_requests):
+                sock[i].send(req * requests_count)
+        for i in range(parallel_requests):
+                data = b""
+                while data.count(b"HTTP/1.1 ") < requests_count:
+                        data += sock[i].recv(1024)
+                print("Received :", len(data), data.count(b"HTTP/1.1 "), "responses")
+        requests_count = 0
+
 for j in range(requests_count):
         for i in range(parallel_requests):
                 print("Sent : ", len(req), req)
@@ -0,0 +1,158 @@
+#
+# Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+# Per-stage latency histograms from the trace rings (CONFIG_APP_TRACE).
+#
+# Usage:
+#   python3 scripts/trace_histograms.py --ip 192.168.10.240
+#   python3 scripts/trace_histograms.py --file trace.bin
+#   python3 scripts/trace_histograms.py --ip 192.168.10.240 --save trace.bin
+
+import argparse
+import struct
+from collections import defaultdict, deque
+
+import requests
+
+# struct trace_dump_header and struct trace_record (src/utils/trace.h)
+HEADER_FMT = "<IBBHII"
+RECORD_FMT = "<IBBHII"
+TRACE_DUMP_MAGIC = 0x45435254
+
+# trace_ev_t
+CAN_RXQ_GET = 1
+CANIOT_RX_FRAME = 2
+CANIOT_TELEMETRY = 3
+CAN_RXQ_PUT = 4
+HA_NOTIFY_BEGIN = 10
+HA_NOTIFY_END = 11
+HA_EV_QUEUED = 12
+HA_EV_DEQUEUED = 13
+HTTP_REQ_BEGIN = 20
+HTTP_REQ_HANDLED = 21
+HTTP_RESP_SENT = 22
+
+# (name, start event, end event, key)
+# key "cpu": stages executed sequentially by the same thread, the end record
+#   is paired with the last start record of the same CPU
+# key "arg0" or "args": paired on the record arguments
+# key "arg0_fifo": paired on arg0, in order, for queues which can hold several
+#   records with the same argument
+STAGES = [
+    ("can_rxq wait", CAN_RXQ_PUT, CAN_RXQ_GET, "arg0_fifo"),
+    ("can_rxq -> caniot_rx", CAN_RXQ_GET, CANIOT_RX_FRAME, "arg0"),
+    ("caniot_rx -> telemetry", CANIOT_RX_FRAME, CANIOT_TELEMETRY, "cpu"),
+    ("telemetry -> ha_notify", CANIOT_TELEMETRY, HA_NOTIFY_BEGIN, "cpu"),
+    ("ha_notify (all subs)", HA_NOTIFY_BEGIN, HA_NOTIFY_END, "arg0"),
+    ("ha_ev queued -> dequeued", HA_EV_QUEUED, HA_EV_DEQUEUED, "args"),
+    ("http handle", HTTP_REQ_BEGIN, HTTP_REQ_HANDLED, "arg0"),
+    ("http send", HTTP_REQ_HANDLED, HTTP_RESP_SENT, "arg0"),
+    ("http total", HTTP_REQ_BEGIN, HTTP_RESP_SENT, "arg0"),
+]
+
+
+def parse_dump(data: bytes):
+    hdr_size = struct.calcsize(HEADER_FMT)
+    magic, version, cpus, record_size, cycles_per_sec, capacity = \
+        struct.unpack_from(HEADER_FMT, data, 0)
+
+    if magic != TRACE_DUMP_MAGIC:
+        raise ValueError(f"Invalid trace dump magic 0x{magic:08x}")
+    if record_size != struct.calcsize(RECORD_FMT):
+        raise ValueError(f"Unexpected record size {record_size}")
+
+    # Cycle counters are 32 bits, unwrap them per CPU
+    records = []
+    last = {}
+    wraps = defaultdict(int)
+    for off in range(hdr_size, len(data) - record_size + 1, record_size):
+        cycles, ev, cpu, seq, arg0, arg1 = struct.unpack_from(RECORD_FMT, data, off)
+        if cpu in last and cycles < last[cpu]:
+            wraps[cpu] += 1
+        last[cpu] = cycles
+        records.append((cycles + (wraps[cpu] << 32), ev, cpu, arg0, arg1))
+
+    records.sort(key=lambda r: r[0])
+
+    print(f"Trace dump v{version}: {cpus} CPU(s), {capacity} records/CPU, "
+          f"{cycles_per_sec} cycles/s, {len(records)} records")
+
+    return cycles_per_sec, records
+
+
+def stage_latencies(records, cycles_per_sec: int):
+    latencies = defaultdict(list)
+
+    for name, start_ev, end_ev, key in STAGES:
+        pending = defaultdict(deque)
+        for cycles, ev, cpu, arg0, arg1 in records:
+            if key == "cpu":
+                k = cpu
+            elif key in ("arg0", "arg0_fifo"):
+                k = arg0
+            else:
+                k = (arg0, arg1)
+
+            if ev == start_ev:
+                if key != "arg0_fifo":
+                    pending[k].clear()
+                pending[k].append(cycles)
+            elif ev == end_ev and pending[k]:
+                delta = cycles - pending[k].popleft()
+                latencies[name].append(delta * 1e6 / cycles_per_sec)
+
+    return latencies
+
+
+def percentile(values, p: float):
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def print_histogram(name: str, values, width: int = 50):
+    values = sorted(values)
+    print(f"\n{name}: {len(values)} samples, min {values[0]:.1f} us, "
+          f"p50 {percentile(values, 50):.1f} us, p90 {percentile(values, 90):.1f} us, "
+          f"p99 {percentile(values, 99):.1f} us, max {values[-1]:.1f} us")
+
+    # Power of 2 buckets (us)
+    buckets = defaultdict(int)
+    for v in values:
+        buckets[max(0, int(v).bit_length())] += 1
+
+    peak = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        lo, hi = (0 if b == 0 else 1 << (b - 1)), 1 << b
+        count = buckets.get(b, 0)
+        bar = "#" * ((count * width + peak - 1) // peak)
+        print(f"  [{lo:>8}, {hi:>8}) us {count:>7} {bar}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Trace rings latency histograms")
+    parser.add_argument("--ip", help="Controller address, GET /api/trace")
+    parser.add_argument("--file", help="Read a saved dump instead")
+    parser.add_argument("--save", help="Save the fetched dump to a file")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as fp:
+            data = fp.read()
+    elif args.ip:
+        resp = requests.get(f"http://{args.ip}/api/trace")
+        resp.raise_for_status()
+        data = resp.content
+        if args.save:
+            with open(args.save, "wb") as fp:
+                fp.write(data)
+    else:
+        parser.error("--ip or --file required")
+
+    cycles_per_sec, records = parse_dump(data)
+    latencies = stage_latencies(records, cycles_per_sec)
+
+    for name, _, _, _ in STAGES:
+        if latencies[name]:
+            print_histogram(name, latencies[name])
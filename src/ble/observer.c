@@ -18,7 +18,9 @@
 
 #include <ha/devices/xiaomi.h>
 #include <system.h>
+#include <utils/log_ratelimit.h>
 LOG_MODULE_REGISTER(ble_obv, LOG_LEVEL_INF);
+LOG_RATELIMIT_REGISTER(10u, 1000u);
 
 /*___________________________________________________________________________*/
 
@@ -78,7 +80,7 @@ static bool adv_data_cb(struct bt_data *data, void *user_data)
 			memcpy(name, data->data, copy_len);
 			name[copy_len] = '\0';
 
-			LOG_INF("[XIAOMI] name: %s", name);
+			LOG_INF_RL("[XIAOMI] name: %s", name);
 		}
 	} break;
 	case BT_DATA_SVC_DATA16: {
@@ -129,12 +131,14 @@ static void device_found(const bt_addr_le_t *addr,
 			xc.measurements.rssi = rssi;
 			xc.time				 = sys_time_get();
 
-			char mac_str[BT_ADDR_STR_LEN];
-			bt_addr_to_str(&addr->a, mac_str, sizeof(mac_str));
-			LOG_INF("[XIAOMI] mac: %s rssi: %d bat: %u mV temp: %u "
-					"°C hum: %u %%",
-					mac_str, (int)rssi, xc.measurements.battery_mv,
-					xc.measurements.temperature / 100, xc.measurements.humidity / 100);
+			/* The address bytes are passed as arguments so that nothing is
+			 * formatted on the BT RX path in deferred/binary logging mode */
+			const uint8_t *const a = addr->a.val;
+			LOG_INF_RL("[XIAOMI] mac: %02X:%02X:%02X:%02X:%02X:%02X rssi: %d bat: %u mV "
+					   "temp: %u °C hum: %u %%",
+					   a[5], a[4], a[3], a[2], a[1], a[0], (int)rssi,
+					   xc.measurements.battery_mv, xc.measurements.temperature / 100,
+					   xc.measurements.humidity / 100);
 #if defined(CONFIG_APP_HA)
 			ha_dev_xiaomi_register_record(&xc);
 #endif
@@ -5,12 +5,16 @@
  */
 
 #include "can/can_interface.h"
+#include "utils/trace.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(if_can, LOG_LEVEL_WRN);
 
 const struct device *can_dev = DEVICE_DT_GET(DT_NODELABEL(can1));
 
+static if_can_tap_cb_t tap_cb;
+static void *tap_user_data;
+
 int if_can_init(void)
 {
 	/* wait for device ready */
@@ -27,6 +31,23 @@ int if_can_init(void)
 	return 0;
 }
 
+/* Same as the driver msgq callback, with a trace point to measure the time
+ * frames wait in the queue */
+static void rx_msgq_put(const struct device *dev,
+						struct can_frame *frame,
+						void *user_data)
+{
+	struct k_msgq *msgq = (struct k_msgq *)user_data;
+
+	ARG_UNUSED(dev);
+
+	if (k_msgq_put(msgq, frame, K_NO_WAIT) == 0) {
+		TRACE(TRACE_EV_CAN_RXQ_PUT, frame->id, 0u);
+	} else {
+		LOG_WRN("CAN: rx msgq %p full, frame 0x%x dropped", (void *)msgq, frame->id);
+	}
+}
+
 int if_can_attach_rx_msgq(can_bus_id_t canbus,
 						  struct k_msgq *rx_msgq,
 						  struct can_filter *filter)
@@ -39,9 +60,9 @@ int if_can_attach_rx_msgq(can_bus_id_t canbus,
 
 	if ((rx_msgq != NULL) && (filter != NULL)) {
 		/* attach message q */
-		ret = can_add_rx_filter_msgq(can_dev, rx_msgq, filter);
+		ret = can_add_rx_filter(can_dev, rx_msgq_put, rx_msgq, filter);
 		if (ret < 0) {
-			LOG_ERR("can_add_rx_filter_msgq failed: %d", ret);
+			LOG_ERR("can_add_rx_filter failed: %d", ret);
 		}
 	}
 
@@ -50,10 +71,42 @@ exit:
 }
 
 int if_can_send(can_bus_id_t canbus, struct can_frame *frame)
+{
+	return if_can_send_timeout(canbus, frame, K_FOREVER);
+}
+
+int if_can_send_timeout(can_bus_id_t canbus,
+						struct can_frame *frame,
+						k_timeout_t timeout)
 {
 	if (canbus != CAN_BUS_1) {
 		return -EINVAL;
 	}
 
-	return can_send(can_dev, frame, K_FOREVER, NULL, NULL);
-}
\ No newline at end of file
+	int ret = can_send(can_dev, frame, timeout, NULL, NULL);
+
+	if ((ret == 0) && (tap_cb != NULL)) {
+		tap_cb(canbus, frame, true, tap_user_data);
+	}
+
+	return ret;
+}
+
+int if_can_tap_set(if_can_tap_cb_t cb, void *user_data)
+{
+	if ((cb != NULL) && (tap_cb != NULL)) {
+		return -EBUSY;
+	}
+
+	tap_user_data = user_data;
+	tap_cb		  = cb;
+
+	return 0;
+}
+
+void if_can_tap_rx(can_bus_id_t canbus, const struct can_frame *frame)
+{
+	if (tap_cb != NULL) {
+		tap_cb(canbus, frame, false, tap_user_data);
+	}
+}
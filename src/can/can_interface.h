@@ -40,4 +40,48 @@ int if_can_attach_rx_msgq(can_bus_id_t canbus,
  */
 int if_can_send(can_bus_id_t canbus, struct can_frame *frame);
 
+/**
+ * @brief Send a CAN frame on a CAN bus, waiting at most timeout for a free
+ * TX mailbox
+ *
+ * @param canbus
+ * @param frame
+ * @param timeout
+ * @return int 0 on success, -EAGAIN on timeout, negative error code otherwise
+ */
+int if_can_send_timeout(can_bus_id_t canbus,
+						struct can_frame *frame,
+						k_timeout_t timeout);
+
+/**
+ * @brief Callback called for each frame sent or received on a CAN bus
+ *
+ * Note: Called from the sending thread or the thread consuming the RX queue,
+ * it must not block.
+ */
+typedef void (*if_can_tap_cb_t)(can_bus_id_t canbus,
+								const struct can_frame *frame,
+								bool tx,
+								void *user_data);
+
+/**
+ * @brief Set the callback monitoring the CAN bus traffic (NULL to remove it)
+ *
+ * @param cb
+ * @param user_data
+ * @return int
+ */
+int if_can_tap_set(if_can_tap_cb_t cb, void *user_data);
+
+/**
+ * @brief Report a received frame to the monitoring callback
+ *
+ * Note: Hardware filters deliver a frame to a single RX queue, this function
+ * should be called by the consumer of the queue.
+ *
+ * @param canbus
+ * @param frame
+ */
+void if_can_tap_rx(can_bus_id_t canbus, const struct can_frame *frame);
+
 #endif /* _CAN_INTERFACE_H */
\ No newline at end of file
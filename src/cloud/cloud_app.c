@@ -15,8 +15,17 @@
 #include <zephyr/net/mqtt.h>
 LOG_MODULE_REGISTER(cloud_app, LOG_LEVEL_WRN);
 
+/* Maximum number of events processed per wake-up of the cloud thread */
+#define CLOUD_APP_EV_BATCH 8u
+
 static struct ha_ev_subs *sub = NULL;
 
+/* Events dequeued but not published yet (e.g. the connection was lost in the
+ * middle of a batch), they are published first on the next call of
+ * cloud_app_process(), even after a reconnection */
+static ha_ev_t *pending_evs[CLOUD_APP_EV_BATCH];
+static size_t pending_count = 0u;
+
 const struct json_obj_descr json_cloud_xiaomi_record_measures_descr[] = {
 	JSON_OBJ_DESCR_PRIM_NAMED(
 		struct json_xiaomi_record_measures, "rssi", rssi, JSON_TOK_NUMBER),
@@ -39,6 +48,8 @@ const struct json_obj_descr json_cloud_xiaomi_record_descr[] = {
 		struct json_xiaomi_record, "bt_mac", bt_mac, JSON_TOK_STRING),
 	JSON_OBJ_DESCR_PRIM_NAMED(
 		struct json_xiaomi_record, "timestamp", base.timestamp, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM_NAMED(
+		struct json_xiaomi_record, "timestamp_ms", base.timestamp_ms, JSON_TOK_INT64),
 	JSON_OBJ_DESCR_OBJECT_NAMED(struct json_xiaomi_record,
 								"measures",
 								measures,
@@ -57,19 +68,38 @@ static struct ha_subs_ext_lookup_table sub_lt;
 
 int cloud_app_init(void)
 {
-	static struct ha_ev_subs_conf sub_conf = {
+	int ret;
+	static struct ha_ev_subs_conf sub_conf;
+
+	/* Called on every connection, the extended filter of the previous one
+	 * was released by cloud_app_cleanup() */
+	sub_conf = (struct ha_ev_subs_conf){
+		/* Only the latest measurement of each device matters while the
+		 * cloud is unreachable */
 		.flags = HA_EV_SUBS_CONF_DEVICE_DATA | HA_EV_SUBS_CONF_ON_QUEUED_HOOK |
-				 HA_EV_SUBS_CONF_DEVICE_TYPE,
+				 HA_EV_SUBS_CONF_DEVICE_TYPE | HA_EV_SUBS_CONF_LATEST_VALUE,
 		.device_type  = HA_DEV_TYPE_XIAOMI_MIJIA,
 		.on_queued_cb = cloud_on_queued,
 	};
 
-	ha_subs_ext_conf_set(
+	ret = ha_subs_ext_conf_set(
 		&sub_conf, &sub_lt, HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID,
 		HA_SUBS_EXT_FILTERING_TYPE_INTERVAL,
 		HA_SUBS_EXT_FILTERING_PARAM_INTERVAL(CONFIG_APP_CLOUD_TELEMETRY_INTERVAL));
+	if (ret < 0) {
+		LOG_ERR("Failed to set the subscription interval filter: %d", ret);
+		return ret;
+	}
 
-	return ha_subscribe(&sub_conf, &sub);
+	ret = ha_subscribe(&sub_conf, &sub);
+	if (ret < 0) {
+		LOG_ERR("Failed to subscribe: %d", ret);
+		ha_subs_ext_lt_clear(&sub_lt);
+	} else if (pending_count != 0u) {
+		cloud_notify(0u);
+	}
+
+	return ret;
 }
 
 int process_event(ha_ev_t *event)
@@ -91,8 +121,9 @@ int process_event(ha_ev_t *event)
 
 		bt_addr_to_str(&event->dev->addr.mac.addr.ble.a, bt_mac_str, BT_ADDR_LE_STR_LEN);
 
-		json_data.bt_mac		 = bt_mac_str;
-		json_data.base.timestamp = event->timestamp;
+		json_data.bt_mac			= bt_mac_str;
+		json_data.base.timestamp	= event->timestamp;
+		json_data.base.timestamp_ms = (int64_t)ha_ev_timestamp_ms(event);
 
 		json_data.measures.rssi			   = data->rssi.value;
 		json_data.measures.temperature	   = temp_str;
@@ -122,16 +153,38 @@ int process_event(ha_ev_t *event)
 
 int cloud_app_process(atomic_val_t flags)
 {
-	int ret = 0;
-	ha_ev_t *ev;
+	int ret			 = 0;
+	size_t done		 = 0u;
+	bool more_queued = false;
+
+	if (pending_count == 0u) {
+		ret = ha_ev_wait_many(sub, pending_evs, ARRAY_SIZE(pending_evs), K_NO_WAIT);
+		if (ret <= 0) {
+			return 0;
+		}
+
+		pending_count = ret;
+		more_queued	  = pending_count == ARRAY_SIZE(pending_evs);
+		ret			  = 0;
+	}
 
-	if ((ev = ha_ev_wait(sub, K_NO_WAIT)) != NULL) {
-		LOG_INF("Processing event: %p", ev);
+	for (; done < pending_count; done++) {
+		LOG_INF("Processing event: %p", pending_evs[done]);
+
+		ret = process_event(pending_evs[done]);
+		if (ret < 0) {
+			break;
+		}
+	}
 
-		ret = process_event(ev);
-		ha_ev_unref(ev);
+	/* Release the published events only, keep the others for a retry */
+	ha_ev_unref_many(pending_evs, done);
+	memmove(pending_evs, &pending_evs[done],
+			(pending_count - done) * sizeof(pending_evs[0]));
+	pending_count -= done;
 
-		/* Maybe more events to process ? */
+	/* Maybe more events to process ? */
+	if ((ret >= 0) && (more_queued || (pending_count != 0u))) {
 		cloud_notify(0u);
 	}
 
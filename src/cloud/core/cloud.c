@@ -131,7 +131,11 @@ static bool state_machine(void)
 
 			set_state(STATE_CONNECTED);
 
-			cloud_app_init();
+			ret = cloud_app_init();
+			if (ret < 0) {
+				LOG_ERR("Failed to initialize the cloud application err=%d", ret);
+				set_state(STATE_ERROR);
+			}
 		} else {
 			LOG_ERR("Failed to connect to MQTT broker err=%d", ret);
 			set_state(STATE_ERROR);
@@ -154,7 +154,42 @@ static void process_read(struct fs_async *afile)
 #if defined(CONFIG_APP_FS_ASYNC_WRITE)
 static void process_write(struct fs_async *afile)
 {
-	/* TODO */
+	ssize_t ret;
+	k_spinlock_key_t key;
+	struct fs_async_buf *buf;
+
+	do {
+		for (;;) {
+			key = k_spin_lock(&fs_async_lock);
+			buf = (struct fs_async_buf *)sys_slist_get(&afile->buf_q);
+			k_spin_unlock(&fs_async_lock, key);
+
+			if (buf == NULL) {
+				break;
+			}
+
+			/* Drop remaining blocks on error */
+			if (afile->status == FS_ASYNC_STATUS_ACTIVE) {
+				ret = fs_write(&afile->_zfp, buf->data, buf->len);
+				if (ret != buf->len) {
+					LOG_ERR("(%p) fs_write(. %p %u) -> %d", afile, buf->data,
+							buf->len, ret);
+					afile->status = FS_ASYNC_STATUS_ERR;
+				} else {
+					afile->file_final_size += buf->len;
+				}
+			}
+
+			/* Block is available again for the writer */
+			buf_free(afile, buf);
+			k_sem_give(&afile->_sem);
+		}
+
+		atomic_clear_bit(&afile->_flags, FS_ASYNC_FLAG_ACTIVE_BIT);
+
+		/* A block could have been queued before the flag was cleared */
+	} while (!sys_slist_is_empty(&afile->buf_q) &&
+			 atomic_cas(&afile->_flags, 0u, FS_ASYNC_FLAG_ACTIVE));
 }
 #endif
 
@@ -205,7 +240,10 @@ int fs_async_open(struct fs_async *afile, struct fs_async_config *cfg)
 						  cfg->ms_block_count);
 	if (ret != 0) return ret;
 
-	ret = k_sem_init(&afile->_sem, 0u, cfg->ms_block_count);
+	/* In write mode, the semaphore counts the free blocks */
+	ret = k_sem_init(&afile->_sem,
+					 (cfg->opt & FS_ASYNC_WRITE) ? cfg->ms_block_count : 0u,
+					 cfg->ms_block_count);
 	if (ret != 0) return ret;
 
 	atomic_set(&afile->_flags, 0u);
@@ -391,13 +429,67 @@ int fs_async_read(struct fs_async *afile, void *data, size_t len, k_timeout_t ti
 	return ret;
 }
 
+#if defined(CONFIG_APP_FS_ASYNC_WRITE)
+static int write_async(struct fs_async *afile, void *data, size_t len, k_timeout_t timeout)
+{
+#if FS_ASYNC_ARGS_CHECK
+	if (!afile || !data || !len) return -EINVAL;
+	if (!(afile->opt & FS_ASYNC_WRITE)) return -EINVAL;
+#endif
+
+	int ret;
+	size_t copy_len;
+	k_spinlock_key_t key;
+	struct fs_async_buf *buf;
+	size_t sent_len = 0u;
+
+	while (sent_len < len) {
+		if (afile->status != FS_ASYNC_STATUS_ACTIVE) {
+			return -EIO;
+		}
+
+		/* Wait for a free block */
+		ret = k_sem_take(&afile->_sem, timeout);
+		if (ret != 0) {
+			break;
+		}
+
+		ret = buf_alloc(afile, &buf);
+		if (ret != 0) {
+			k_sem_give(&afile->_sem);
+			return -ENOMEM;
+		}
+
+		copy_len = MIN(len - sent_len, (size_t)buf->len);
+		memcpy(buf->data, (uint8_t *)data + sent_len, copy_len);
+		buf->len = copy_len;
+		sent_len += copy_len;
+
+		key = k_spin_lock(&fs_async_lock);
+		sys_slist_append(&afile->buf_q, &buf->_handle);
+		k_spin_unlock(&fs_async_lock, key);
+
+		schedule_rw(afile);
+	}
+
+	return (sent_len != 0u) ? (int)sent_len : -EAGAIN;
+}
+
+/* Wait for all queued blocks to be written */
+static void write_flush(struct fs_async *afile)
+{
+	while (k_mem_slab_num_used_get(&afile->_ms) != 0u) {
+		k_sem_take(&afile->_sem, K_FOREVER);
+	}
+}
+#endif
+
 int fs_async_write(struct fs_async *afile, void *data, size_t len, k_timeout_t timeout)
 {
 	int ret;
 
 #if defined(CONFIG_APP_FS_ASYNC_WRITE)
-	/* TODO */
-	ret = -ENOTSUP;
+	ret = write_async(afile, data, len, timeout);
 #else
 	ret = fs_write(&afile->_zfp, data, len);
 #endif
@@ -412,7 +504,14 @@ int fs_async_close(struct fs_async *afile)
 	if (afile->status == FS_ASYNC_STATUS_CLOSED) return -EBADF;
 #endif
 
-	atomic_set_bit(&afile->_flags, FS_ASYNC_FLAG_ABORT);
+#if defined(CONFIG_APP_FS_ASYNC_WRITE)
+	if (afile->opt & FS_ASYNC_WRITE) {
+		write_flush(afile);
+	}
+#endif
+
+	atomic_set_bit(&afile->_flags, FS_ASYNC_FLAG_ABORT_BIT);
+	afile->status = FS_ASYNC_STATUS_CLOSED;
 
 	return fs_close(&afile->_zfp);
 }
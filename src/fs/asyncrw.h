@@ -117,6 +117,10 @@ int fs_async_read(struct fs_async *afile, void *data, size_t len, k_timeout_t ti
  * Note: If timeout is K_FOREVER, this function will block until requested data
  *     length is written.
  *
+ * Note: With CONFIG_APP_FS_ASYNC_WRITE, data is copied into the context blocks
+ *     and written by the async thread, the function only blocks while no block
+ *     is free. fs_async_close() waits for all blocks to be written.
+ *
  * @param afile Async file context
  * @param data Data to write
  * @param len Length of data to write
@@ -11,7 +11,9 @@
 #include "ha/core/utils.h"
 #include "ha/devices/caniot.h"
 #include "net_time.h"
+#include "utils/log_ratelimit.h"
 #include "utils/misc.h"
+#include "utils/trace.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -23,6 +25,7 @@
 #include <caniot/controller.h>
 #include <caniot/datatype.h>
 LOG_MODULE_REGISTER(caniot, LOG_LEVEL_INF);
+LOG_RATELIMIT_REGISTER(20u, 1000u);
 
 #define HA_CIOT_QUERY_TIMEOUT_TOLERANCE_MS 200u
 
@@ -155,20 +158,83 @@ struct syncq {
 		/* Duration if answered (or timeout) */
 		uint32_t delta;
 	};
+
+	/* Asynchronous query completion callback, NULL for synchronous queries */
+	ha_ciot_ctrl_query_cb_t cb;
+	void *user_data;
+
+	/* Asynchronous query frames, as the caller doesn't wait for completion */
+	struct caniot_frame _query;
+	struct caniot_frame _response;
 };
 
 K_MEM_SLAB_DEFINE(sq_pool, sizeof(struct syncq), CONFIG_CANIOT_MAX_PENDING_QUERIES, 4U);
 
+static int syncq_status_to_ret(struct syncq *qx)
+{
+	switch (qx->status) {
+	case SYNCQ_IMMEDIATE:
+		qx->delta = 0; /* no delta */
+		return 0;
+	case SYNCQ_ANSWERED:
+		return 1;
+	case SYNCQ_ANSWERED_WITH_ERROR:
+		return 2;
+	case SYNCQ_TIMEOUT:
+		return -EAGAIN;
+	case SYNCQ_ERROR:
+		return qx->query_error;
+	case SYNCQ_CANCELLED:
+		return -ECANCELED;
+	default:
+		LOG_ERR("Unhandled status %d", qx->status);
+		return -1; /* any unhandled error */
+	}
+}
+
+static void syncq_complete(struct syncq *qx, bool response_is_set)
+{
+	qx->delta = k_uptime_delta32(&qx->uptime);
+
+	if (qx->cb != NULL) {
+		/* Asynchronous query, nobody is waiting for the context */
+		const int ret = syncq_status_to_ret(qx);
+
+		qx->cb(ret, response_is_set ? qx->response : NULL, qx->delta, qx->user_data);
+		k_mem_slab_free(&sq_pool, (void *)qx);
+	} else {
+		k_sem_give(&qx->_sem);
+	}
+}
+
+#if !defined(CONFIG_LOG_DICTIONARY_SUPPORT)
+static const char *frame_repr(const struct caniot_frame *frame, char *buf, size_t len)
+{
+	int ret = caniot_explain_frame_str(frame, buf, len);
+	if (ret <= 0) {
+		snprintf(buf, len, "<failed to encode frame, ret = %d>", ret);
+	}
+
+	return buf;
+}
+#endif
+
 /* requires ~80B of stack */
 void log_caniot_frame(const struct caniot_frame *frame)
 {
+#if defined(CONFIG_LOG_DICTIONARY_SUPPORT)
+	/* Binary logs only package the arguments, keep the raw frame instead of
+	 * formatting its explanation on the hot path */
+	LOG_INF_RL("CAN 0x%03x [%u] %02x %02x %02x %02x %02x %02x %02x %02x",
+			   caniot_id_to_canid(frame->id), frame->len, frame->buf[0], frame->buf[1],
+			   frame->buf[2], frame->buf[3], frame->buf[4], frame->buf[5], frame->buf[6],
+			   frame->buf[7]);
+#else
 	char repr[64];
-	int ret = caniot_explain_frame_str(frame, repr, sizeof(repr));
-	if (ret > 0) {
-		LOG_INF("%s", repr);
-	} else {
-		LOG_WRN("Failed to encode frame, ret = %d", ret);
-	}
+
+	/* The frame is only explained if the message is not rate limited */
+	LOG_INF_RL("%s", frame_repr(frame, repr, sizeof(repr)));
+#endif
 }
 
 bool event_cb(const caniot_controller_event_t *ev, void *user_data)
@@ -230,8 +296,7 @@ bool event_cb(const caniot_controller_event_t *ev, void *user_data)
 			memcpy(qx->response, ev->response, sizeof(struct caniot_frame));
 		}
 
-		qx->delta = k_uptime_delta32(&qx->uptime);
-		k_sem_give(&qx->_sem);
+		syncq_complete(qx, response_is_set);
 	}
 
 	return true;
@@ -300,6 +365,8 @@ static void thread(void *_a, void *_b, void *_c)
 			if (!resp && (events.can.state == K_POLL_STATE_MSGQ_DATA_AVAILABLE)) {
 				ret = k_msgq_get(&can_rxq, &zframe, K_NO_WAIT);
 				if (ret == 0) {
+					TRACE(TRACE_EV_CAN_RXQ_GET, zframe.id, 0u);
+					if_can_tap_rx(CAN_BUS_CANIOT, &zframe);
 					zcan_to_caniot(&zframe, &frame);
 					log_caniot_frame(&frame);
 					resp = &frame;
@@ -326,6 +393,9 @@ static void thread(void *_a, void *_b, void *_c)
 			 * because the timeout queue was not shifted in time
 			 */
 			const uint32_t delta = k_uptime_delta32(&reftime);
+			if (resp != NULL) {
+				TRACE(TRACE_EV_CANIOT_RX_FRAME, caniot_id_to_canid(resp->id), 0u);
+			}
 			caniot_controller_rx_frame(&ctrl, delta, resp);
 
 			struct syncq *qx;
@@ -355,8 +425,7 @@ static void thread(void *_a, void *_b, void *_c)
 						qx->query_error = ret;
 					}
 
-					qx->delta = k_uptime_delta32(&qx->uptime);
-					k_sem_give(&qx->_sem);
+					syncq_complete(qx, false);
 				}
 
 				events.query.state = K_POLL_STATE_NOT_READY;
@@ -406,6 +475,7 @@ int ha_caniot_controller_query(struct caniot_frame *__restrict req,
 	qx->timeout		= *timeout;
 	qx->uptime		= k_uptime_get_32();
 	qx->query_error = 0;
+	qx->cb			= NULL;
 
 	/* queue synchronous query */
 	k_fifo_put(&fifo_queries, qx);
@@ -418,31 +488,7 @@ int ha_caniot_controller_query(struct caniot_frame *__restrict req,
 		goto exit;
 	}
 
-	switch (qx->status) {
-	case SYNCQ_IMMEDIATE:
-		ret		  = 0;
-		qx->delta = 0; /* no delta */
-		break;
-	case SYNCQ_ANSWERED:
-		ret = 1;
-		break;
-	case SYNCQ_ANSWERED_WITH_ERROR:
-		ret = 2;
-		break;
-	case SYNCQ_TIMEOUT:
-		ret = -EAGAIN;
-		break;
-	case SYNCQ_ERROR:
-		ret = qx->query_error;
-		break;
-	case SYNCQ_CANCELLED:
-		ret = -ECANCELED;
-		break;
-	default:
-		LOG_ERR("Unhandled error ret=%d", ret);
-		ret = -1; /* any unhandled error */
-		break;
-	}
+	ret = syncq_status_to_ret(qx);
 
 	*timeout = qx->delta; /* actual time the query took */
 
@@ -458,13 +504,167 @@ exit:
 	return ret;
 }
 
+int ha_caniot_controller_query_async(const struct caniot_frame *req,
+									 caniot_did_t did,
+									 uint32_t timeout,
+									 ha_ciot_ctrl_query_cb_t cb,
+									 void *user_data)
+{
+	int ret;
+	struct syncq *qx = NULL;
+
+	if (!req || !cb || (timeout == CANIOT_TIMEOUT_FOREVER)) {
+		return -EINVAL;
+	}
+
+	ret = k_mem_slab_alloc(&sq_pool, (void **)&qx, K_NO_WAIT);
+	if (ret != 0) {
+		LOG_ERR("k_mem_slab_alloc() failed: %d", ret);
+		return -ENOMEM;
+	}
+
+	memcpy(&qx->_query, req, sizeof(struct caniot_frame));
+	qx->did			= did;
+	qx->query		= &qx->_query;
+	qx->response	= &qx->_response;
+	qx->timeout		= timeout;
+	qx->uptime		= k_uptime_get_32();
+	qx->query_error = 0;
+	qx->cb			= cb;
+	qx->user_data	= user_data;
+
+	/* context is freed by the controller thread on completion */
+	k_fifo_put(&fifo_queries, qx);
+
+	return 0;
+}
+
 int ha_caniot_controller_send(struct caniot_frame *__restrict req, caniot_did_t did)
 {
 	/* this is safe because no context is allocated */
 	return caniot_controller_send(&ctrl, did, req);
 }
 
-int ha_controller_caniot_discover(uint32_t timeout, ha_ciot_ctrl_did_cb_t cb)
+/* Discovery probes in flight, bounded by the queries contexts available */
+#define HA_CIOT_DISCOVERY_WINDOW MIN(8u, CONFIG_CANIOT_MAX_PENDING_QUERIES)
+
+K_MUTEX_DEFINE(discovery_mutex);
+
+struct discovery {
+	/* Probes which can be sent */
+	struct k_sem window;
+
+	ha_ciot_ctrl_did_cb_t cb;
+	void *user_data;
+
+	/* Devices which answered */
+	ATOMIC_DEFINE(dids, CANIOT_DID_MAX_COUNT);
+};
+
+/* Called from the controller thread */
+static void discovery_probe_cb(int status,
+							   const struct caniot_frame *resp,
+							   uint32_t delta,
+							   void *user_data)
+{
+	struct discovery *const dx = user_data;
+
+	/* A device answering with a CANIOT error is present as well, telemetry
+	 * responses are registered in HA by event_cb() */
+	if (resp != NULL) {
+		const caniot_did_t did = CANIOT_DID(resp->id.cls, resp->id.sid);
+
+		atomic_set_bit(dx->dids, did);
+
+		if (dx->cb != NULL) {
+			dx->cb(did, resp, dx->user_data);
+		}
+	}
+
+	k_sem_give(&dx->window);
+}
+
+int ha_controller_caniot_discover(uint32_t timeout,
+								  ha_ciot_ctrl_did_cb_t cb,
+								  void *user_data,
+								  struct ha_ciot_discovery_result *result)
 {
-	return -ENOTSUP;
+	int ret;
+	struct caniot_frame req;
+	struct discovery dx = {
+		.cb		   = cb,
+		.user_data = user_data,
+	};
+	uint32_t reftime = k_uptime_get_32();
+
+	if ((timeout == 0u) || (timeout == CANIOT_TIMEOUT_FOREVER)) {
+		return -EINVAL;
+	}
+
+	/* Concurrent sweeps would compete for the queries contexts */
+	if (k_mutex_lock(&discovery_mutex, K_NO_WAIT) != 0) {
+		return -EBUSY;
+	}
+
+	k_sem_init(&dx.window, HA_CIOT_DISCOVERY_WINDOW, HA_CIOT_DISCOVERY_WINDOW);
+	atomic_clear(dx.dids);
+
+	if (result != NULL) {
+		memset(result, 0, sizeof(*result));
+	}
+
+	caniot_build_query_telemetry(&req, CANIOT_ENDPOINT_BOARD_CONTROL);
+
+	/* Keep HA_CIOT_DISCOVERY_WINDOW probes in flight, so that the sweep
+	 * takes about (devices count / window) * timeout */
+	for (caniot_did_t did = 0u; did < CANIOT_DID_MAX_COUNT; did++) {
+		if (did == CANIOT_DID_BROADCAST) {
+			continue;
+		}
+
+		k_sem_take(&dx.window, K_FOREVER);
+
+		ret = ha_caniot_controller_query_async(&req, did, timeout, discovery_probe_cb,
+											   &dx);
+		if (ret != 0) {
+			/* Query contexts used by other queries */
+			k_sem_give(&dx.window);
+			if (result != NULL) {
+				result->errors++;
+			}
+			continue;
+		}
+
+		if (result != NULL) {
+			result->probed++;
+		}
+	}
+
+	/* Wait for the last probes, dx is referenced until they complete */
+	for (uint32_t i = 0u; i < HA_CIOT_DISCOVERY_WINDOW; i++) {
+		k_sem_take(&dx.window, K_FOREVER);
+	}
+
+	k_mutex_unlock(&discovery_mutex);
+
+	ret = 0;
+	for (caniot_did_t did = 0u; did < CANIOT_DID_MAX_COUNT; did++) {
+		if (atomic_test_bit(dx.dids, did)) {
+			if (result != NULL) {
+				result->dids |= BIT64(did);
+			}
+			ret++;
+		}
+	}
+
+	const uint32_t duration = k_uptime_delta32(&reftime);
+
+	if (result != NULL) {
+		result->found		= ret;
+		result->duration_ms = duration;
+	}
+
+	LOG_INF("Discovery: %d device(s) found in %u ms", ret, duration);
+
+	return ret;
 }
\ No newline at end of file
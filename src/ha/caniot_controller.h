@@ -48,6 +48,41 @@ int ha_caniot_controller_query(struct caniot_frame *__restrict req,
 							   caniot_did_t did,
 							   uint32_t *timeout);
 
+/**
+ * @brief Asynchronous CANIOT query completion callback
+ *
+ * Note: Called from the CANIOT controller thread, must not block
+ *
+ * @param status Same values as ha_caniot_controller_query() return value
+ * @param resp Response frame if the query was answered, NULL otherwise
+ * @param delta Time spent for the query (ms)
+ * @param user_data
+ */
+typedef void (*ha_ciot_ctrl_query_cb_t)(int status,
+										const struct caniot_frame *resp,
+										uint32_t delta,
+										void *user_data);
+
+/**
+ * @brief Do a non-blocking CANIOT query, cb is called when the query completes
+ *
+ * Note: Thread safe, the request is copied
+ *
+ * @param req
+ * @param did
+ * @param timeout Timeout in milliseconds
+ * @param cb Completion callback
+ * @param user_data
+ * @retval 0 Query queued, cb will be called in any case
+ * @retval -EINVAL Invalid data supplied
+ * @retval -ENOMEM No memory available for allocating context
+ */
+int ha_caniot_controller_query_async(const struct caniot_frame *req,
+									 caniot_did_t did,
+									 uint32_t timeout,
+									 ha_ciot_ctrl_query_cb_t cb,
+									 void *user_data);
+
 /**
  * @brief CANIOT device discovery callback
  *
@@ -59,14 +94,35 @@ typedef void (*ha_ciot_ctrl_did_cb_t)(caniot_did_t did,
 									  const struct caniot_frame *frame,
 									  void *user_data);
 
+struct ha_ciot_discovery_result {
+	uint32_t duration_ms; /* Sweep duration */
+	uint32_t probed;	  /* Devices IDs probed */
+	uint32_t errors;	  /* Probes which couldn't be sent */
+	uint32_t found;		  /* Devices which answered */
+	uint64_t dids;		  /* Bitmask of the devices IDs which answered */
+};
+
 /**
  * @brief Discover all CANIOT devices, call cb for each one
  *
- * @param timeout
- * @param cb
- * @return int
+ * All devices IDs (except broadcast) are probed with board control telemetry
+ * queries, several probes being in flight at a time. Devices which answer are
+ * registered in HA.
+ *
+ * Note: Blocks until all probes completed, cb is called from the controller
+ * thread and must not block.
+ *
+ * @param timeout Probe timeout in milliseconds
+ * @param cb Called for each device which answers, can be NULL
+ * @param user_data Passed to cb
+ * @param result Filled with the sweep result, can be NULL
+ * @return int Number of devices found, negative error code otherwise
+ * @retval -EBUSY Discovery already in progress
  */
-int ha_controller_caniot_discover(uint32_t timeout, ha_ciot_ctrl_did_cb_t cb);
+int ha_controller_caniot_discover(uint32_t timeout,
+								  ha_ciot_ctrl_did_cb_t cb,
+								  void *user_data,
+								  struct ha_ciot_discovery_result *result);
 
 /*
 IDEAS
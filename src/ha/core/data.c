@@ -7,7 +7,7 @@
 	case _x:                                                                             \
 		return #_x
 
-size_t get_data_size(ha_data_type_t type)
+size_t ha_data_type_size(ha_data_type_t type)
 {
 	static const uint32_t std_sizes[] = {
 		[HA_DATA_TEMPERATURE]	   = sizeof(struct ha_data_temperature),
@@ -136,7 +136,7 @@ int ha_data_descr_extract(const struct ha_data_descr *descr,
 	if (index >= data_descr_size) return -ENOENT;
 
 	memcpy(destination, (uint8_t *)data_structure + descr[index].offset,
-		   get_data_size(descr[index].type));
+		   ha_data_type_size(descr[index].type));
 
 	return 0;
 }
\ No newline at end of file
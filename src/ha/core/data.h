@@ -180,6 +180,14 @@ bool ha_data_descr_data_type_has(const struct ha_data_descr *descr,
 uint32_t ha_data_descr_data_types_mask(const struct ha_data_descr *descr,
 									   size_t data_descr_size);
 
+/**
+ * @brief Get the size of a data type value (e.g. struct ha_data_temperature)
+ *
+ * @param type
+ * @return size_t Size of the value, 0 if unknown
+ */
+size_t ha_data_type_size(ha_data_type_t type);
+
 /**
  * @brief Extract data at given index from a data structure using a descriptor
  *
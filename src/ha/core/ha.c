@@ -8,6 +8,7 @@
 #include "ha.h"
 #include "net_time.h"
 #include "system.h"
+#include "utils/trace.h"
 
 #include <stdio.h>
 
@@ -15,6 +16,13 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
+#if defined(CONFIG_APP_HA_DEV_STORAGE)
+#include <zephyr/drivers/flash.h>
+#include <zephyr/fs/nvs.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/crc.h>
+#endif
+
 #include <malloc.h>
 LOG_MODULE_REGISTER(ha_dev, LOG_LEVEL_INF);
 
@@ -28,7 +36,7 @@ static void ha_ev_free(struct ha_event *ev);
 struct {
 	struct k_mutex mutex;
 	ha_dev_t list[HA_DEVICES_MAX_COUNT];
-	uint8_t count;
+	uint16_t count;
 	uint32_t sdevuid; /* Session Device Unique ID reference */
 } devices = {
 	.mutex	 = Z_MUTEX_INITIALIZER(devices.mutex),
@@ -49,6 +57,22 @@ typedef int (*addr_cmp_func_t)(const ha_dev_mac_addr_t *a, const ha_dev_mac_addr
 
 typedef int (*addr_str_func_t)(const ha_dev_mac_addr_t *a, char *str, size_t len);
 
+typedef uint32_t (*addr_hash_func_t)(const ha_dev_mac_addr_t *a, uint32_t hash);
+
+/* FNV-1a */
+#define ADDR_HASH_INIT 2166136261u
+
+static uint32_t addr_hash_update(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		hash = (hash ^ *p++) * 16777619u;
+	}
+
+	return hash;
+}
+
 static int internal_caniot_addr_cmp(const ha_dev_mac_addr_t *a,
 									const ha_dev_mac_addr_t *b)
 {
@@ -70,6 +94,23 @@ static int internal_can_addr_cmp(const ha_dev_mac_addr_t *a, const ha_dev_mac_ad
 	return id_a - id_b;
 }
 
+static uint32_t internal_caniot_addr_hash(const ha_dev_mac_addr_t *a, uint32_t hash)
+{
+	return addr_hash_update(hash, &a->caniot, sizeof(a->caniot));
+}
+
+static uint32_t internal_ble_addr_hash(const ha_dev_mac_addr_t *a, uint32_t hash)
+{
+	return addr_hash_update(hash, &a->ble, sizeof(a->ble));
+}
+
+static uint32_t internal_can_addr_hash(const ha_dev_mac_addr_t *a, uint32_t hash)
+{
+	const uint32_t id = a->can.id & (a->can.ext ? CAN_EXT_ID_MASK : CAN_STD_ID_MASK);
+
+	return addr_hash_update(hash, &id, sizeof(id));
+}
+
 static int internal_ble_addr_str(const ha_dev_mac_addr_t *a, char *str, size_t len)
 {
 	return bt_addr_le_to_str(&a->ble, str, len);
@@ -91,20 +132,26 @@ static int internal_can_addr_str(const ha_dev_mac_addr_t *a, char *str, size_t l
 struct mac_funcs {
 	addr_cmp_func_t cmp;
 	addr_str_func_t str;
+	addr_hash_func_t hash;
 };
 
 #define MAC_FUNCS_CANIOT 0u
 #define MAC_FUNCS_BLE	 1u
 
 static const struct mac_funcs mac_medium_funcs[] = {
-	[HA_DEV_MEDIUM_CAN] = {.cmp = internal_can_addr_cmp, .str = internal_can_addr_str},
-	[HA_DEV_MEDIUM_BLE] = {.cmp = internal_ble_addr_cmp, .str = internal_ble_addr_str},
+	[HA_DEV_MEDIUM_CAN] = {.cmp	 = internal_can_addr_cmp,
+						   .str	 = internal_can_addr_str,
+						   .hash = internal_can_addr_hash},
+	[HA_DEV_MEDIUM_BLE] = {.cmp	 = internal_ble_addr_cmp,
+						   .str	 = internal_ble_addr_str,
+						   .hash = internal_ble_addr_hash},
 };
 
 /* Overload the medium mac address functions */
 static const struct mac_funcs mac_type_funcs[] = {
-	[HA_DEV_TYPE_CANIOT] = {.cmp = internal_caniot_addr_cmp,
-							.str = internal_caniot_addr_str},
+	[HA_DEV_TYPE_CANIOT] = {.cmp  = internal_caniot_addr_cmp,
+							.str  = internal_caniot_addr_str,
+							.hash = internal_caniot_addr_hash},
 };
 
 static addr_cmp_func_t get_mac_medium_cmp_func(ha_dev_medium_type_t medium)
@@ -155,6 +202,21 @@ static addr_str_func_t get_addr_str_func(ha_dev_type_t type, ha_dev_medium_type_
 	return func;
 }
 
+static addr_hash_func_t get_addr_hash_func(ha_dev_type_t type, ha_dev_medium_type_t medium)
+{
+	addr_hash_func_t func = NULL;
+
+	if (type < ARRAY_SIZE(mac_type_funcs)) {
+		func = mac_type_funcs[type].hash;
+	}
+
+	if (!func && (medium < ARRAY_SIZE(mac_medium_funcs))) {
+		func = mac_medium_funcs[medium].hash;
+	}
+
+	return func;
+}
+
 int ha_dev_addr_to_str(const ha_dev_addr_t *addr, char *buf, size_t buf_len)
 {
 	if (!buf || !buf_len) {
@@ -240,6 +302,15 @@ ha_dev_t *ha_dev_get_by_addr(const ha_dev_addr_t *addr)
 	return device;
 }
 
+int ha_dev_get_index(const ha_dev_t *dev)
+{
+	if ((dev < devices.list) || (dev >= devices.list + devices.count)) {
+		return -EINVAL;
+	}
+
+	return dev - devices.list;
+}
+
 int ha_dev_addr_cmp(const ha_dev_addr_t *a, const ha_dev_addr_t *b)
 {
 	if (addr_valid(a) && addr_valid(b)) {
@@ -249,11 +320,297 @@ int ha_dev_addr_cmp(const ha_dev_addr_t *a, const ha_dev_addr_t *b)
 	}
 }
 
+uint32_t ha_dev_addr_hash(const ha_dev_addr_t *addr)
+{
+	uint32_t hash = addr_hash_update(ADDR_HASH_INIT, &addr->type, sizeof(addr->type));
+
+	if (addr_valid(addr)) {
+		hash = get_addr_hash_func(addr->type, addr->mac.medium)(&addr->mac.addr, hash);
+	}
+
+	return hash;
+}
+
 static void ha_dev_clear(ha_dev_t *dev)
 {
 	memset(dev, 0U, sizeof(*dev));
 }
 
+#if defined(CONFIG_APP_HA_LATEST_VALUES)
+
+/* Latest values of the devices, as one array per value indexed like
+ * devices.list, so that aggregations are tight loops over contiguous memory
+ * instead of walking each device last events. */
+static struct {
+	struct k_spinlock lock;
+
+	/* Number of slots in use, follows devices.count */
+	uint16_t count;
+
+	/* Bit ha_value_t set if the value was reported */
+	uint8_t flags[HA_DEVICES_MAX_COUNT];
+	uint8_t rid[HA_DEVICES_MAX_COUNT];
+
+	int16_t temperature[HA_DEVICES_MAX_COUNT];
+	uint16_t humidity[HA_DEVICES_MAX_COUNT];
+	uint8_t battery_level[HA_DEVICES_MAX_COUNT];
+	int8_t rssi[HA_DEVICES_MAX_COUNT];
+	uint32_t digital[HA_DEVICES_MAX_COUNT];
+} values;
+
+BUILD_ASSERT(_HA_VALUE_COUNT <= 8u, "values flags too small");
+
+/* Devices context must be locked, called once the device room is known */
+static void values_dev_bind(ha_dev_t *dev)
+{
+	const uint32_t index = dev - devices.list;
+
+	K_SPINLOCK(&values.lock)
+	{
+		values.flags[index] = 0u;
+		values.rid[index]	= dev->room ? (uint8_t)dev->room->rid : HA_ROOM_NONE;
+		values.count		= MAX(values.count, index + 1u);
+	}
+}
+
+static void values_update(ha_dev_t *dev,
+						  const struct ha_device_endpoint_config *ep_cfg,
+						  void *data)
+{
+	const uint32_t index = dev - devices.list;
+	const struct ha_data_descr *const descr = ep_cfg->data_descr;
+	const size_t size						= ep_cfg->data_descr_size;
+
+	if ((descr == NULL) || (data == NULL)) {
+		return;
+	}
+
+	/* Pointers into the event data, converted out of the lock */
+	const struct ha_data_temperature *temp =
+		ha_data_get(data, descr, size, HA_DATA_TEMPERATURE, 0u);
+	const struct ha_data_humidity *hum =
+		ha_data_get(data, descr, size, HA_DATA_HUMIDITY, 0u);
+	const struct ha_data_battery_level *bat =
+		ha_data_get(data, descr, size, HA_DATA_BATTERY_LEVEL, 0u);
+	const struct ha_data_rssi *rssi = ha_data_get(data, descr, size, HA_DATA_RSSI, 0u);
+	const struct ha_data_digital *dio =
+		ha_data_get(data, descr, size, HA_DATA_DIGITAL_INOUT, 0u);
+	if (dio == NULL) {
+		dio = ha_data_get(data, descr, size, HA_DATA_DIGITAL_IN, 0u);
+	}
+
+	K_SPINLOCK(&values.lock)
+	{
+		if (temp) {
+			values.temperature[index] = temp->value;
+			values.flags[index] |= BIT(HA_VALUE_TEMPERATURE);
+		}
+		if (hum) {
+			values.humidity[index] = hum->value;
+			values.flags[index] |= BIT(HA_VALUE_HUMIDITY);
+		}
+		if (bat) {
+			values.battery_level[index] = bat->level;
+			values.flags[index] |= BIT(HA_VALUE_BATTERY_LEVEL);
+		}
+		if (rssi) {
+			values.rssi[index] = rssi->value;
+			values.flags[index] |= BIT(HA_VALUE_RSSI);
+		}
+		if (dio) {
+			values.digital[index] = dio->value & dio->mask;
+			values.flags[index] |= BIT(HA_VALUE_DIGITAL);
+		}
+	}
+}
+
+int ha_values_get(const ha_dev_t *dev, ha_value_t value, int32_t *out)
+{
+	int ret = 0;
+	uint32_t index;
+
+	if ((dev == NULL) || (out == NULL) || (value >= _HA_VALUE_COUNT)) {
+		return -EINVAL;
+	}
+
+	index = dev - devices.list;
+	if (index >= HA_DEVICES_MAX_COUNT) {
+		return -EINVAL;
+	}
+
+	K_SPINLOCK(&values.lock)
+	{
+		if (!(values.flags[index] & BIT(value))) {
+			ret = -ENODATA;
+			K_SPINLOCK_BREAK;
+		}
+
+		switch (value) {
+		case HA_VALUE_TEMPERATURE:
+			*out = values.temperature[index];
+			break;
+		case HA_VALUE_HUMIDITY:
+			*out = values.humidity[index];
+			break;
+		case HA_VALUE_BATTERY_LEVEL:
+			*out = values.battery_level[index];
+			break;
+		case HA_VALUE_RSSI:
+			*out = values.rssi[index];
+			break;
+		default:
+			*out = (int32_t)values.digital[index];
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/* Branchless loops (selection computed for every slot) so that the compiler
+ * can vectorize them, values lock must be held */
+#define VALUES_AGGREGATE(_column, _flag, _rid, _agg)                                     \
+	do {                                                                                 \
+		int32_t _min = INT32_MAX, _max = INT32_MIN, _sum = 0;                            \
+		uint32_t _count = 0u;                                                            \
+		for (uint32_t _i = 0u; _i < values.count; _i++) {                                \
+			const bool _sel = (values.flags[_i] & (_flag)) &&                            \
+							  (((_rid) == HA_ROOM_ANY) || (values.rid[_i] == (_rid)));   \
+			const int32_t _v = values._column[_i];                                       \
+			_min			 = (_sel && (_v < _min)) ? _v : _min;                        \
+			_max			 = (_sel && (_v > _max)) ? _v : _max;                        \
+			_sum += _sel ? _v : 0;                                                       \
+			_count += _sel;                                                              \
+		}                                                                                \
+		(_agg)->count = _count;                                                          \
+		(_agg)->min	  = _count ? _min : 0;                                               \
+		(_agg)->max	  = _count ? _max : 0;                                               \
+		(_agg)->avg	  = _count ? _sum / (int32_t)_count : 0;                             \
+	} while (0)
+
+#define VALUES_COUNT_BELOW(_column, _flag, _rid, _threshold, _count)                     \
+	do {                                                                                 \
+		for (uint32_t _i = 0u; _i < values.count; _i++) {                                \
+			_count += (values.flags[_i] & (_flag)) &&                                    \
+					  (((_rid) == HA_ROOM_ANY) || (values.rid[_i] == (_rid))) &&         \
+					  ((int32_t)values._column[_i] < (_threshold));                      \
+		}                                                                                \
+	} while (0)
+
+int ha_values_aggregate(ha_value_t value,
+						ha_room_id_t rid,
+						struct ha_values_aggregate *agg)
+{
+	int ret = 0;
+
+	if (agg == NULL) {
+		return -EINVAL;
+	}
+
+	K_SPINLOCK(&values.lock)
+	{
+		switch (value) {
+		case HA_VALUE_TEMPERATURE:
+			VALUES_AGGREGATE(temperature, BIT(value), rid, agg);
+			break;
+		case HA_VALUE_HUMIDITY:
+			VALUES_AGGREGATE(humidity, BIT(value), rid, agg);
+			break;
+		case HA_VALUE_BATTERY_LEVEL:
+			VALUES_AGGREGATE(battery_level, BIT(value), rid, agg);
+			break;
+		case HA_VALUE_RSSI:
+			VALUES_AGGREGATE(rssi, BIT(value), rid, agg);
+			break;
+		default:
+			ret = -ENOTSUP;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int ha_values_count_below(ha_value_t value, ha_room_id_t rid, int32_t threshold)
+{
+	int count = 0;
+
+	K_SPINLOCK(&values.lock)
+	{
+		switch (value) {
+		case HA_VALUE_TEMPERATURE:
+			VALUES_COUNT_BELOW(temperature, BIT(value), rid, threshold, count);
+			break;
+		case HA_VALUE_HUMIDITY:
+			VALUES_COUNT_BELOW(humidity, BIT(value), rid, threshold, count);
+			break;
+		case HA_VALUE_BATTERY_LEVEL:
+			VALUES_COUNT_BELOW(battery_level, BIT(value), rid, threshold, count);
+			break;
+		case HA_VALUE_RSSI:
+			VALUES_COUNT_BELOW(rssi, BIT(value), rid, threshold, count);
+			break;
+		default:
+			count = -ENOTSUP;
+			break;
+		}
+	}
+
+	return count;
+}
+
+int ha_values_count_digital(ha_room_id_t rid, uint32_t mask)
+{
+	int count = 0;
+
+	K_SPINLOCK(&values.lock)
+	{
+		for (uint32_t i = 0u; i < values.count; i++) {
+			count += (values.flags[i] & BIT(HA_VALUE_DIGITAL)) &&
+					 ((rid == HA_ROOM_ANY) || (values.rid[i] == rid)) &&
+					 ((values.digital[i] & mask) != 0u);
+		}
+	}
+
+	return count;
+}
+
+#else
+
+static inline void values_dev_bind(ha_dev_t *dev)
+{
+}
+
+static inline void values_update(ha_dev_t *dev,
+								 const struct ha_device_endpoint_config *ep_cfg,
+								 void *data)
+{
+}
+
+int ha_values_get(const ha_dev_t *dev, ha_value_t value, int32_t *out)
+{
+	return -ENOTSUP;
+}
+
+int ha_values_aggregate(ha_value_t value,
+						ha_room_id_t rid,
+						struct ha_values_aggregate *agg)
+{
+	return -ENOTSUP;
+}
+
+int ha_values_count_below(ha_value_t value, ha_room_id_t rid, int32_t threshold)
+{
+	return -ENOTSUP;
+}
+
+int ha_values_count_digital(ha_room_id_t rid, uint32_t mask)
+{
+	return -ENOTSUP;
+}
+
+#endif /* CONFIG_APP_HA_LATEST_VALUES */
+
 extern const struct ha_device_api ha_device_api_xiaomi;
 extern const struct ha_device_api ha_device_api_caniot;
 extern const struct ha_device_api ha_device_api_f429zi;
@@ -272,25 +629,39 @@ static const struct ha_device_api *ha_device_get_default_api(ha_dev_type_t type)
 	}
 }
 
+static void dev_room_bind(ha_dev_t *dev, struct ha_room *room)
+{
+	dev->room = room;
+
+	if (room != NULL) {
+		atomic_inc(&room->devices_count);
+		sys_slist_append(&room->_devices, &dev->_room_handle);
+	}
+
+	/* (Re)initialize the latest values slot */
+	values_dev_bind(dev);
+}
+
 /**
- * @brief Register a new device in the list, addr duplicates are not verified
+ * @brief Allocate and initialize a device in the list, devices context must be
+ * locked and addr duplicates are not verified
  *
- * @param medium
- * @param type
  * @param addr
- * @return int
+ * @param sdevuid Session Device Unique ID to assign to the device
+ * @param registered_timestamp
+ * @return ha_dev_t* Device, NULL on error
  */
-static ha_dev_t *ha_dev_register(const ha_dev_addr_t *addr)
+static ha_dev_t *dev_register_locked(const ha_dev_addr_t *addr,
+									 uint16_t sdevuid,
+									 uint32_t registered_timestamp)
 {
-	int ret;
 	ha_dev_t *dev = NULL;
-
-	__DEV_CONTEXT_LOCK();
+	const struct ha_device_api *api;
 
 	if (devices.count >= ARRAY_SIZE(devices.list)) {
 		stats.dev_dropped++;
 		stats.dev_no_mem++;
-		goto exit;
+		goto error;
 	}
 
 	/* Allocate memory */
@@ -298,49 +669,41 @@ static ha_dev_t *ha_dev_register(const ha_dev_addr_t *addr)
 
 	ha_dev_clear(dev);
 
-	dev->sdevuid			  = devices.sdevuid;
+	dev->sdevuid			  = sdevuid;
 	dev->addr				  = *addr;
-	dev->registered_timestamp = sys_time_get();
+	dev->registered_timestamp = registered_timestamp;
 
-	dev->api = ha_device_get_default_api(addr->type);
-	if (dev->api == NULL) {
+	api = ha_device_get_default_api(addr->type);
+	if (api == NULL) {
 		stats.dev_dropped++;
 		stats.dev_no_api++;
 		LOG_WRN("No api for device type %p", addr);
-		goto exit;
+		goto error;
 	}
 
-	ret = dev->api->init_endpoints(&dev->addr, dev->endpoints, &dev->endpoints_count);
-	if (ret < 0) {
+	dev->cls = api->get_class(&dev->addr);
+	if (dev->cls == NULL) {
 		stats.dev_dropped++;
 		stats.dev_ep_init++;
 		LOG_ERR("Failed to register device %p", addr);
-		goto exit;
+		goto error;
 	}
 
-	if (dev->endpoints_count == 0) {
+	if (dev->cls->endpoints_count == 0) {
 		stats.dev_dropped++;
 		stats.dev_ep_init++;
 		LOG_WRN("No endpoints for device %p", addr);
-		goto exit;
+		goto error;
 	}
 
-	if (dev->endpoints_count > HA_DEV_EP_MAX_COUNT) {
+	if (dev->cls->endpoints_count > HA_DEV_EP_MAX_COUNT) {
 		stats.dev_dropped++;
 		stats.dev_toomuch_ep++;
 		LOG_ERR("Too many endpoints (%hhu) defined for device addr %p",
-				dev->endpoints_count, addr);
-		goto exit;
+				dev->cls->endpoints_count, addr);
+		goto error;
 	}
 
-#if HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION
-	/* Finalize endpoints initialization */
-	for (int i = 0; i < dev->endpoints_count; i++) {
-		dev->endpoints[i]._data_types = ha_data_descr_data_types_mask(
-			dev->endpoints[i].cfg->data_descr, dev->endpoints[i].cfg->data_descr_size);
-	}
-#endif /* HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION */
-
 	/* Increment device count */
 	devices.count++;
 
@@ -349,17 +712,34 @@ static ha_dev_t *ha_dev_register(const ha_dev_addr_t *addr)
 	 * Then we need a counter which doesn't get decremented when a device
 	 * is removed to guarantee that the "sdevuid" is unique.
 	 */
-	devices.sdevuid++;
+	devices.sdevuid = MAX(devices.sdevuid, (uint32_t)sdevuid + 1u);
 
 	stats.mem_device_count++;
 	stats.mem_device_remaining--;
 
 	/* Reference the room */
-	if ((dev->room = ha_dev_get_room(dev)) != NULL) {
-		atomic_inc(&dev->room->devices_count);
-	}
+	dev_room_bind(dev, ha_dev_get_room(dev));
 
-exit:
+	return dev;
+
+error:
+	return NULL;
+}
+
+/**
+ * @brief Register a new device in the list, addr duplicates are not verified
+ *
+ * @param medium
+ * @param type
+ * @param addr
+ * @return int
+ */
+static ha_dev_t *ha_dev_register(const ha_dev_addr_t *addr)
+{
+	ha_dev_t *dev;
+
+	__DEV_CONTEXT_LOCK();
+	dev = dev_register_locked(addr, (uint16_t)devices.sdevuid, sys_time_get());
 	__DEV_CONTEXT_UNLOCK();
 
 	return dev;
@@ -405,7 +785,7 @@ static bool ha_dev_match_filter(ha_dev_t *dev, const ha_dev_filter_t *filter)
 	if (filter->flags & HA_DEV_FILTER_DATA_EXIST) {
 		if (filter->endpoint_id == HA_DEV_EP_NONE) {
 			/* Find first valid event through endpoints */
-			for (int i = 0; i < dev->endpoints_count; i++) {
+			for (int i = 0; i < dev->cls->endpoints_count; i++) {
 				ep = &dev->endpoints[i];
 				if (ep->last_data_event != NULL) {
 					break;
@@ -427,8 +807,8 @@ static bool ha_dev_match_filter(ha_dev_t *dev, const ha_dev_filter_t *filter)
 		}
 	}
 
-	if (((filter->flags & HA_DEV_FILTER_ROOM_ID) != 0) && dev->room) {
-		if (dev->room->rid != filter->rid) {
+	if ((filter->flags & HA_DEV_FILTER_ROOM_ID) != 0) {
+		if (!dev->room || (dev->room->rid != filter->rid)) {
 			return false;
 		}
 	}
@@ -441,7 +821,7 @@ static uint32_t dev_ep_lock_ev_mask(ha_dev_t *dev, uint32_t mask)
 	uint32_t ep_index	 = 0u;
 	uint32_t locked_mask = 0u;
 	while (mask) {
-		if (ep_index < dev->endpoints_count) {
+		if (ep_index < dev->cls->endpoints_count) {
 			if (mask & 1u) {
 				ha_ev_t *ev = dev->endpoints[ep_index].last_data_event;
 				ha_ev_ref(ev);
@@ -469,6 +849,69 @@ static void dev_ep_unlock_ev_mask(ha_dev_t *dev, uint32_t locked_mask)
 	}
 }
 
+/* Call the callback for a device matching the filter, devices context must
+ * be locked and is released during the callback */
+static bool dev_iterate_visit(ha_dev_t *dev,
+							  ha_dev_iterate_cb_t callback,
+							  const ha_dev_iter_opt_t *options,
+							  void *user_data)
+{
+	/*
+	 * Reference endpoints devices event in case the
+	 * callback wants to keep a reference to it/them.
+	 */
+	/* TODO only lock necessary events and not all */
+	const uint32_t locked_mask = dev_ep_lock_ev_mask(dev, options->ep_lock_last_ev_mask);
+
+	__DEV_CONTEXT_UNLOCK(); /* TODO, evaluate if good idea
+							 */
+
+	/* Mutex should not be locked in application callback
+	 * context as it could last a lot of time */
+	bool zcontinue = callback(dev, user_data);
+
+	__DEV_CONTEXT_LOCK(); /* TODO, evaluate if good idea */
+
+	dev_ep_unlock_ev_mask(dev, locked_mask);
+
+	return zcontinue;
+}
+
+/* Iterate over the devices of a room only */
+static ssize_t room_dev_iterate(struct ha_room *room,
+								ha_dev_iterate_cb_t callback,
+								const ha_dev_filter_t *filter,
+								const ha_dev_iter_opt_t *options,
+								void *user_data)
+{
+	size_t count	 = 0u;
+	size_t max_count = devices.count;
+	ha_dev_t *dev;
+
+	if (filter->flags & HA_DEV_FILTER_TO_COUNT) {
+		max_count = filter->to_count;
+	}
+
+	__DEV_CONTEXT_LOCK();
+
+	/* Devices are never removed from the room list */
+	SYS_SLIST_FOR_EACH_CONTAINER (&room->_devices, dev, _room_handle) {
+		if (ha_dev_match_filter(dev, filter) == true) {
+			const bool zcontinue = dev_iterate_visit(dev, callback, options, user_data);
+
+			count++;
+
+			if (!zcontinue || (count >= max_count)) {
+				break;
+			}
+		}
+	}
+
+	__DEV_CONTEXT_UNLOCK();
+
+	return count;
+}
+
 ssize_t ha_dev_iterate(ha_dev_iterate_cb_t callback,
 					   const ha_dev_filter_t *filter,
 					   const ha_dev_iter_opt_t *options,
@@ -486,6 +929,19 @@ ssize_t ha_dev_iterate(ha_dev_iterate_cb_t callback,
 
 	/* Take boundaries into account */
 	if (filter) {
+		/* Room members are indexed, index boundaries apply to the
+		 * whole list though */
+		if ((filter->flags & HA_DEV_FILTER_ROOM_ID) &&
+			!(filter->flags & (HA_DEV_FILTER_FROM_INDEX | HA_DEV_FILTER_TO_INDEX))) {
+			struct ha_room *room = ha_room_get_by_rid(filter->rid);
+
+			if (room == NULL) {
+				return -ENOENT;
+			}
+
+			return room_dev_iterate(room, callback, filter, options, user_data);
+		}
+
 		if (filter->flags & HA_DEV_FILTER_FROM_INDEX) {
 			dev += filter->from_index;
 		}
@@ -510,24 +966,7 @@ ssize_t ha_dev_iterate(ha_dev_iterate_cb_t callback,
 
 	while (dev < last) {
 		if (ha_dev_match_filter(dev, filter) == true) {
-			/*
-			 * Reference endpoints devices event in case the
-			 * callback wants to keep a reference to it/them.
-			 */
-			/* TODO only lock necessary events and not all */
-			const uint32_t locked_mask =
-				dev_ep_lock_ev_mask(dev, options->ep_lock_last_ev_mask);
-
-			__DEV_CONTEXT_UNLOCK(); /* TODO, evaluate if good idea
-									 */
-
-			/* Mutex should not be locked in application callback
-			 * context as it could last a lot of time */
-			bool zcontinue = callback(dev, user_data);
-
-			__DEV_CONTEXT_LOCK(); /* TODO, evaluate if good idea */
-
-			dev_ep_unlock_ev_mask(dev, locked_mask);
+			const bool zcontinue = dev_iterate_visit(dev, callback, options, user_data);
 
 			count++;
 
@@ -571,7 +1010,7 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 	struct ha_device_endpoint *ep;
 
 	__ASSERT_NO_MSG(dev != NULL);
-	__ASSERT_NO_MSG(dev->api != NULL);
+	__ASSERT_NO_MSG(dev->cls != NULL);
 	__ASSERT_NO_MSG(pl->buffer != NULL);
 
 	/* Allocate memory */
@@ -588,11 +1027,12 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 	ev->dev		  = dev;
 	ev->type	  = HA_EV_TYPE_DATA;
 	ev->timestamp = pl->timestamp ? pl->timestamp : sys_time_get();
+	ev->uptime_ms = k_uptime_get_32();
 	sys_slist_init(&ev->slist);
 
 	/* Find endpoint */
-	if (dev->api->select_endpoint != NULL) {
-		ret = dev->api->select_endpoint(&dev->addr, pl);
+	if (dev->cls->select_endpoint != NULL) {
+		ret = dev->cls->select_endpoint(&dev->addr, pl);
 		if (ret < 0) {
 			dev->stats.err_flags |= HA_DEV_STATS_ERR_FLAG_EV_NO_EP;
 			stats.ev_no_ep++;
@@ -602,7 +1042,7 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 		ep_index = (uint8_t)ret;
 	}
 
-	if (ep_index >= MIN(dev->endpoints_count, HA_DEV_EP_MAX_COUNT)) {
+	if (ep_index >= MIN(dev->cls->endpoints_count, HA_DEV_EP_MAX_COUNT)) {
 		dev->stats.err_flags |= HA_DEV_STATS_ERR_FLAG_EV_EP;
 		stats.ev_ep++;
 		ret = -ENOENT;
@@ -610,8 +1050,9 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 		goto exit;
 	}
 
-	ep	   = &dev->endpoints[ep_index];
-	ep_cfg = ep->cfg;
+	ep			 = &dev->endpoints[ep_index];
+	ep_cfg		 = dev->cls->endpoints[ep_index];
+	ev->ep_index = ep_index;
 
 	if (ep_cfg->eid == HA_DEV_EP_NONE) {
 		dev->stats.err_flags |= HA_DEV_STATS_ERR_FLAG_EV_NO_EP;
@@ -656,6 +1097,8 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 		goto exit;
 	}
 
+	values_update(dev, ep_cfg, ev->data);
+
 	/* If a previous data event is referenced here, unref it */
 	prev_data_ev = ep->last_data_event;
 	if (prev_data_ev != NULL) {
@@ -668,7 +1111,7 @@ static int device_process_data(ha_dev_t *dev, const struct ha_device_payload *pl
 
 	atomic_set(&ev->ref_count, 0u);
 
-	if (ep->cfg->flags & HA_DEV_EP_FLAG_RETAIN_LAST_EVENT) {
+	if (ep_cfg->flags & HA_DEV_EP_FLAG_RETAIN_LAST_EVENT) {
 		ha_ev_ref(ev);
 		ep->last_data_event = ev;
 	}
@@ -716,30 +1159,235 @@ int ha_dev_register_data(const ha_dev_addr_t *addr,
 	return ret;
 }
 
-int ha_dev_command(struct ha_cmd_query *query, ha_ev_t **ev)
+/* Additional time given to the device implementation to complete a
+ * synchronous command before giving up */
+#define HA_CMD_TIMEOUT_TOLERANCE_MS 500u
+
+enum {
+	HA_CMD_STATE_PENDING = 0u,
+	HA_CMD_STATE_COMPLETED,
+	HA_CMD_STATE_ABANDONED, /* Waiter timed out, context freed on completion */
+};
+
+K_MEM_SLAB_DEFINE(cmd_slab, sizeof(struct ha_cmd_ctx), HA_CMD_MAX_PENDING_COUNT, 4);
+
+static atomic_t cmd_id = ATOMIC_INIT(0);
+
+static inline bool cmd_cb_expected(struct ha_cmd_ctx *ctx, int status)
 {
-	return -ENOTSUP;
+	return (ctx->_cb != NULL) &&
+		   ((status != -ETIMEDOUT) || (ctx->_flags & HA_CMD_FLAG_CB_ON_TIMEOUT));
 }
 
-struct ha_device_endpoint *ha_dev_ep_get(ha_dev_t *dev, uint32_t ep_index)
+static void cmd_ctx_free(struct ha_cmd_ctx *ctx)
 {
-	if (!dev || (ep_index >= dev->endpoints_count)) {
-		return NULL;
-	}
-
-	return &dev->endpoints[ep_index];
+	k_mem_slab_free(&cmd_slab, (void *)ctx);
 }
 
-struct ha_device_endpoint *ha_dev_ep_get_by_id(ha_dev_t *dev, ha_endpoint_id_t eid)
+int ha_dev_command(struct ha_cmd_query *query, ha_ev_t **ev)
 {
-	if (!dev) {
-		return NULL;
+	int ret;
+	struct ha_cmd_ctx *ctx = NULL;
+	const struct ha_device_endpoint_config *ep_cfg;
+
+	if (!query || !query->dev || !query->cmd ||
+		K_TIMEOUT_EQ(query->timeout, K_FOREVER)) {
+		return -EINVAL;
 	}
 
-	for (uint8_t i = 0; i < dev->endpoints_count; i++) {
-		if (dev->endpoints[i].cfg->eid == eid) {
-			return &dev->endpoints[i];
-		}
+	ep_cfg = ha_dev_ep_cfg_get(query->dev, query->endpoint_index);
+	if (ep_cfg == NULL) {
+		return -ENOENT;
+	}
+
+	if (ep_cfg->command == NULL) {
+		return -ENOTSUP;
+	}
+
+	if (k_mem_slab_alloc(&cmd_slab, (void **)&ctx, K_NO_WAIT) != 0) {
+		stats.cmd_no_mem++;
+		stats.ev_cmd_dropped++;
+		LOG_WRN("(%p) No command context available", query->dev);
+		return -ENOMEM;
+	}
+
+	ctx->id			= (uint32_t)atomic_inc(&cmd_id) + 1u;
+	ctx->dev		= (ha_dev_t *)query->dev;
+	ctx->ep_index	= query->endpoint_index;
+	ctx->type		= query->cmd->type;
+	ctx->timeout_ms = k_ticks_to_ms_ceil32(query->timeout.ticks);
+	ctx->_flags		= query->flags;
+	ctx->_uptime	= k_uptime_get_32();
+	ctx->_cb		= query->cb;
+	ctx->_user_data = query->user_data;
+	ctx->_status	= 0;
+	ctx->_ev		= NULL;
+	atomic_set(&ctx->_state, HA_CMD_STATE_PENDING);
+	k_sem_init(&ctx->_sem, 0u, 1u);
+
+	query->id = ctx->id;
+
+	/* Once submitted, an asynchronous context (or an abandoned one) can be
+	 * completed and freed at any time, only use these locals afterwards */
+	const uint32_t id		  = ctx->id;
+	const uint32_t timeout_ms = ctx->timeout_ms;
+	const bool async		  = (query->flags & HA_CMD_FLAG_ASYNC) != 0u;
+
+	ret = ep_cfg->command(ctx->dev, query->cmd, ctx);
+	if (ret < 0) {
+		stats.ev_cmd_dropped++;
+		LOG_DBG("(%p) Failed to send command %u, err=%d", query->dev, id, ret);
+		cmd_ctx_free(ctx);
+		return ret;
+	}
+
+	stats.cmd_sent++;
+	ha_dev_inc_stats_tx((ha_dev_t *)query->dev, query->cmd->len);
+
+	/* Context belongs to the completion from now on */
+	if (async) {
+		return 0;
+	}
+
+	ret = k_sem_take(&ctx->_sem, K_MSEC(timeout_ms + HA_CMD_TIMEOUT_TOLERANCE_MS));
+	if ((ret != 0) && atomic_cas(&ctx->_state, HA_CMD_STATE_PENDING,
+								 HA_CMD_STATE_ABANDONED)) {
+		LOG_WRN("(%p) Command %u not completed in time", query->dev, id);
+		return -ETIMEDOUT;
+	} else if (ret != 0) {
+		/* Completion is in progress */
+		k_sem_take(&ctx->_sem, K_FOREVER);
+	}
+
+	if (cmd_cb_expected(ctx, ctx->_status)) {
+		ctx->_cb(ctx->_ev, ctx->_user_data);
+	}
+
+	/* Reference held for the waiter is passed to the caller */
+	if (ev != NULL) {
+		*ev = ctx->_ev;
+	} else {
+		ha_ev_unref(ctx->_ev);
+	}
+
+	ret = ctx->_status;
+	cmd_ctx_free(ctx);
+
+	return ret;
+}
+
+static ha_ev_t *cmd_ev_create(struct ha_cmd_ctx *ctx, int status)
+{
+	struct ha_cmd_result *result;
+	ha_ev_t *ev = ha_ev_alloc_and_reset();
+
+	if (ev == NULL) {
+		stats.ev_no_mem++;
+		return NULL;
+	}
+
+	result = malloc(sizeof(struct ha_cmd_result));
+	if (result == NULL) {
+		stats.ev_no_data_mem++;
+		ha_ev_free(ev);
+		return NULL;
+	}
+
+	result->id		 = ctx->id;
+	result->status	 = status;
+	result->duration = k_uptime_get_32() - ctx->_uptime;
+	result->type	 = ctx->type;
+
+	ev->type	  = HA_EV_TYPE_COMMAND;
+	ev->data	  = result;
+	ev->data_size = sizeof(struct ha_cmd_result);
+	ev->dev		  = ctx->dev;
+	ev->ep_index  = ctx->ep_index;
+	ev->timestamp = sys_time_get();
+	ev->uptime_ms = k_uptime_get_32();
+	sys_slist_init(&ev->slist);
+
+	stats.mem_heap_alloc += sizeof(struct ha_cmd_result);
+	stats.mem_heap_total += sizeof(struct ha_cmd_result);
+
+	return ev;
+}
+
+int ha_dev_command_complete(struct ha_cmd_ctx *ctx, int status)
+{
+	int ret = 0;
+	ha_ev_t *ev;
+
+	__ASSERT_NO_MSG(ctx != NULL);
+
+	stats.cmd_completed++;
+	if (status == -ETIMEDOUT) {
+		stats.cmd_timeout++;
+	}
+
+	ev = cmd_ev_create(ctx, status);
+	if (ev != NULL) {
+		/* Hold the event until the caller got it */
+		ha_ev_ref(ev);
+		ret = ha_ev_notify_all(ev);
+		stats.ev++;
+	} else {
+		stats.ev_dropped++;
+		stats.ev_cmd_dropped++;
+		LOG_ERR("(%p) Failed to allocate command %u event", ctx->dev, ctx->id);
+	}
+
+	LOG_DBG("(%p) Command %u completed status=%d", ctx->dev, ctx->id, status);
+
+	if (ctx->_flags & HA_CMD_FLAG_ASYNC) {
+		if (cmd_cb_expected(ctx, status)) {
+			ctx->_cb(ev, ctx->_user_data);
+		}
+		cmd_ctx_free(ctx);
+		ha_ev_unref(ev);
+	} else if (atomic_cas(&ctx->_state, HA_CMD_STATE_PENDING,
+						  HA_CMD_STATE_COMPLETED)) {
+		ctx->_status = status;
+		ctx->_ev	 = ev;
+		k_sem_give(&ctx->_sem);
+	} else {
+		/* Waiter gave up */
+		cmd_ctx_free(ctx);
+		ha_ev_unref(ev);
+	}
+
+	return ret;
+}
+
+struct ha_device_endpoint *ha_dev_ep_get(ha_dev_t *dev, uint32_t ep_index)
+{
+	if (!dev || (ep_index >= dev->cls->endpoints_count)) {
+		return NULL;
+	}
+
+	return &dev->endpoints[ep_index];
+}
+
+const struct ha_device_endpoint_config *ha_dev_ep_cfg_get(const ha_dev_t *dev,
+														  uint32_t ep_index)
+{
+	if (!dev || (ep_index >= dev->cls->endpoints_count)) {
+		return NULL;
+	}
+
+	return dev->cls->endpoints[ep_index];
+}
+
+struct ha_device_endpoint *ha_dev_ep_get_by_id(ha_dev_t *dev, ha_endpoint_id_t eid)
+{
+	if (!dev) {
+		return NULL;
+	}
+
+	for (uint8_t i = 0; i < dev->cls->endpoints_count; i++) {
+		if (dev->cls->endpoints[i]->eid == eid) {
+			return &dev->endpoints[i];
+		}
 	}
 
 	return NULL;
@@ -751,8 +1399,8 @@ int ha_dev_ep_get_index_by_id(ha_dev_t *dev, ha_endpoint_id_t eid)
 		return -EINVAL;
 	}
 
-	for (uint8_t i = 0; i < dev->endpoints_count; i++) {
-		if (dev->endpoints[i].cfg->eid == eid) {
+	for (uint8_t i = 0; i < dev->cls->endpoints_count; i++) {
+		if (dev->cls->endpoints[i]->eid == eid) {
 			return i;
 		}
 	}
@@ -780,6 +1428,22 @@ const void *ha_dev_get_last_event_data(ha_dev_t *dev, uint32_t ep_index)
  * protect it */
 K_MEM_SLAB_DEFINE(sub_slab, sizeof(struct ha_ev_subs), HA_SUBSCRIPTIONS_MAX_COUNT, 4);
 
+/* Slow subscribers must not be able to drain the events pool, the events
+ * kept by the devices excluded */
+BUILD_ASSERT(HA_SUBSCRIPTIONS_MAX_COUNT * CONFIG_APP_HA_SUBS_QUEUE_DEFAULT_LIMIT <=
+				 (HA_EVENTS_MAX_COUNT - HA_EVENTS_RETAINED_MAX_COUNT) / 2,
+			 "Default subscriptions queue limit too large for the events pool");
+
+/* Queues of the latest value subscriptions, sized for all device endpoints,
+ * followed by their index by event source */
+#define SUB_LATEST_EVQ_BLOCK_SIZE                                                        \
+	ROUND_UP(HA_SUBS_LATEST_QUEUE_LEN * (sizeof(ha_ev_t *) + sizeof(uint16_t)), 4u)
+
+K_MEM_SLAB_DEFINE(sub_latest_evq_slab,
+				  SUB_LATEST_EVQ_BLOCK_SIZE,
+				  CONFIG_APP_HA_SUBS_LATEST_VALUE_MAX_COUNT,
+				  4);
+
 K_MUTEX_DEFINE(sub_mutex);
 static sys_dlist_t sub_dlist = SYS_DLIST_STATIC_INIT(&sub_dlist);
 
@@ -799,6 +1463,9 @@ static struct ha_ev_subs *sub_alloc(void)
 static void sub_free(struct ha_ev_subs *sub)
 {
 	if (sub != NULL) {
+		if (sub->_evq != sub->_evq_buf) {
+			k_mem_slab_free(&sub_latest_evq_slab, (void *)sub->_evq);
+		}
 		k_mem_slab_free(&sub_slab, (void *)sub);
 		stats.mem_sub_count--;
 		stats.mem_sub_remaining++;
@@ -808,12 +1475,160 @@ static void sub_free(struct ha_ev_subs *sub)
 
 static void sub_init(struct ha_ev_subs *sub)
 {
-	k_fifo_init(&sub->_evq);
+	sub->_evq		= sub->_evq_buf;
+	sub->_evq_src	= NULL;
+	sub->_evq_size	= HA_SUBS_QUEUE_MAX_LEN;
+	sub->_evq_head	= 0u;
+	sub->_evq_count = 0u;
+	sub->_evq_limit = CONFIG_APP_HA_SUBS_QUEUE_DEFAULT_LIMIT;
+	k_sem_init(&sub->_evq_sem, 0u, HA_SUBS_QUEUE_MAX_LEN);
+	memset(&sub->_stats, 0, sizeof(sub->_stats));
 	atomic_set(&sub->_ctrl, 0u);
 	sub->conf = NULL;
 	sys_dnode_init(&sub->_handle);
 }
 
+/* Index of the n-th oldest event of the subscription queue */
+#define SUB_EVQ_INDEX(_sub, _n) (((_sub)->_evq_head + (_n)) % (_sub)->_evq_size)
+
+/* Entry of the latest value index for the source of the event, NULL if the
+ * subscription doesn't have an index */
+static inline uint16_t *sub_evq_src_entry(struct ha_ev_subs *sub, const ha_ev_t *event)
+{
+	const uint32_t index = event->dev - devices.list;
+
+	if ((sub->_evq_src == NULL) || (index >= HA_DEVICES_MAX_COUNT) ||
+		(event->ep_index >= HA_DEV_EP_MAX_COUNT)) {
+		return NULL;
+	}
+
+	return &sub->_evq_src[index * HA_DEV_EP_MAX_COUNT + event->ep_index];
+}
+
+/* Must be called with the queue locked */
+static ha_ev_t *sub_evq_pop(struct ha_ev_subs *sub)
+{
+	ha_ev_t *ev = NULL;
+
+	if (sub->_evq_count != 0u) {
+		ev = sub->_evq[sub->_evq_head];
+
+		uint16_t *const src = sub_evq_src_entry(sub, ev);
+		if ((src != NULL) && (*src == sub->_evq_head + 1u)) {
+			*src = 0u;
+		}
+
+		sub->_evq_head = SUB_EVQ_INDEX(sub, 1u);
+		sub->_evq_count--;
+		sub->_stats.held = sub->_evq_count;
+	}
+
+	return ev;
+}
+
+/* Must be called with the queue locked */
+static void sub_evq_push(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	const uint16_t pos	= SUB_EVQ_INDEX(sub, sub->_evq_count);
+	uint16_t *const src = sub_evq_src_entry(sub, event);
+
+	sub->_evq[pos] = event;
+	if (src != NULL) {
+		*src = pos + 1u;
+	}
+	sub->_evq_count++;
+	sub->_stats.held	 = sub->_evq_count;
+	sub->_stats.held_max = MAX(sub->_stats.held_max, sub->_evq_count);
+}
+
+/* Must be called with the queue locked, O(1) lookup of latest value queues */
+static ha_ev_t **sub_evq_find_latest(struct ha_ev_subs *sub, const ha_ev_t *event)
+{
+	const uint16_t *const src = sub_evq_src_entry(sub, event);
+
+	if ((src != NULL) && (*src != 0u) && (sub->_evq[*src - 1u]->type == event->type)) {
+		return &sub->_evq[*src - 1u];
+	}
+
+	return NULL;
+}
+
+/* Must be called with the queue locked */
+static ha_ev_t **sub_evq_find_same_source(struct ha_ev_subs *sub, const ha_ev_t *event)
+{
+	for (uint16_t n = 0u; n < sub->_evq_count; n++) {
+		ha_ev_t **const slot = &sub->_evq[SUB_EVQ_INDEX(sub, n)];
+
+		if (((*slot)->dev == event->dev) && ((*slot)->ep_index == event->ep_index) &&
+			((*slot)->type == event->type)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Queue a referenced event to the subscription, applying the overflow
+ * policy if the queue is full
+ *
+ * Note: Called with sub_mutex held
+ *
+ * @param sub
+ * @param event
+ * @return ha_ev_t* Event which didn't fit in the queue (new, oldest or
+ * replaced one) and whose reference must be released, NULL if none
+ */
+static ha_ev_t *sub_evq_put(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	ha_ev_t *released = NULL;
+	bool grown		  = false;
+
+	const bool latest	= (sub->conf->flags & HA_EV_SUBS_CONF_LATEST_VALUE) != 0u;
+	const bool coalesce = sub->conf->overflow == HA_EV_SUBS_OVERFLOW_COALESCE;
+
+	K_SPINLOCK(&sub->_evq_lock)
+	{
+		const bool full = sub->_evq_count >= sub->_evq_limit;
+		ha_ev_t **slot	= NULL;
+
+		sub->_stats.queued++;
+
+		if (latest) {
+			slot = sub_evq_find_latest(sub, event);
+		} else if (full && coalesce) {
+			slot = sub_evq_find_same_source(sub, event);
+		}
+
+		if (slot != NULL) {
+			/* Keep the position of the replaced event */
+			released = *slot;
+			*slot	 = event;
+			sub->_stats.coalesced++;
+			stats.sub_ev_coalesced++;
+		} else if (sub->_evq_count < sub->_evq_limit) {
+			sub_evq_push(sub, event);
+			grown = true;
+		} else if (sub->conf->overflow == HA_EV_SUBS_OVERFLOW_DROP_NEWEST) {
+			released = event;
+			sub->_stats.dropped++;
+			stats.sub_ev_dropped++;
+		} else {
+			released = sub_evq_pop(sub);
+			sub_evq_push(sub, event);
+			sub->_stats.dropped++;
+			stats.sub_ev_dropped++;
+		}
+	}
+
+	/* The waiter is given one count per event in the queue */
+	if (grown) {
+		k_sem_give(&sub->_evq_sem);
+	}
+
+	return released;
+}
+
 K_MEM_SLAB_DEFINE(ev_slab, sizeof(struct ha_event), HA_EVENTS_MAX_COUNT, 4);
 
 static struct ha_event *ha_ev_alloc(void)
@@ -890,10 +1705,17 @@ void ha_ev_unref(struct ha_event *event)
 	}
 }
 
-static bool event_match_sub(struct ha_ev_subs *sub, struct ha_event *event)
+void ha_ev_unref_many(ha_ev_t **events, size_t count)
 {
-	const struct ha_ev_subs_conf *const conf = sub->conf;
+	if (events != NULL) {
+		for (size_t i = 0u; i < count; i++) {
+			ha_ev_unref(events[i]);
+		}
+	}
+}
 
+bool ha_ev_subs_conf_match(const ha_ev_subs_conf_t *conf, const ha_ev_t *event)
+{
 	if (conf->flags & HA_EV_SUBS_CONF_DEVICE_TYPE) {
 		if (event->dev->addr.type != conf->device_type) {
 			return false;
@@ -925,6 +1747,17 @@ static bool event_match_sub(struct ha_ev_subs *sub, struct ha_event *event)
 		}
 	}
 
+	return true;
+}
+
+static bool event_match_sub(struct ha_ev_subs *sub, struct ha_event *event)
+{
+	const struct ha_ev_subs_conf *const conf = sub->conf;
+
+	if (!ha_ev_subs_conf_match(conf, event)) {
+		return false;
+	}
+
 	if (conf->flags & HA_EV_SUBS_CONF_FILTER_FUNCTION) {
 		if (conf->filter_cb(sub, event) == false) {
 			return false;
@@ -954,7 +1787,18 @@ static int event_notify_single(struct ha_ev_subs *sub, struct ha_event *event)
 		 * when it will don't need it anymore */
 		ha_ev_ref(event);
 
-		k_fifo_put(&sub->_evq, event);
+		ha_ev_t *const released = sub_evq_put(sub, event);
+		if (released == event) {
+			/* Not queued, undo our reference without freeing the event,
+			 * it is still owned by the notifier */
+			atomic_dec(&event->ref_count);
+			return 0;
+		}
+
+		/* Release the event dropped from the full queue */
+		ha_ev_unref(released);
+
+		TRACE(TRACE_EV_HA_EV_QUEUED, event, sub);
 
 		const struct ha_ev_subs_conf *const conf = sub->conf;
 
@@ -974,6 +1818,8 @@ int ha_ev_notify_all(struct ha_event *event)
 	int ret = 0, notified = 0;
 	struct ha_ev_subs *_dnode, *sub;
 
+	TRACE(TRACE_EV_HA_NOTIFY_BEGIN, event, event->dev);
+
 	k_mutex_lock(&sub_mutex, K_FOREVER);
 	SYS_DLIST_FOR_EACH_CONTAINER_SAFE (&sub_dlist, sub, _dnode, _handle) {
 		ret = event_notify_single(sub, event);
@@ -986,6 +1832,8 @@ int ha_ev_notify_all(struct ha_event *event)
 	}
 	k_mutex_unlock(&sub_mutex);
 
+	TRACE(TRACE_EV_HA_NOTIFY_END, event, notified);
+
 	if (ret < 0) {
 		LOG_ERR("Failed to notify event %p to %p, err=%d", event, sub, ret);
 	} else {
@@ -1068,6 +1916,27 @@ int ha_subscribe(const ha_ev_subs_conf_t *conf, struct ha_ev_subs **sub)
 	/* Reference configuration */
 	psub->conf = conf;
 
+	if (conf->flags & HA_EV_SUBS_CONF_LATEST_VALUE) {
+		/* A slot for the latest event of each device endpoint */
+		ret = k_mem_slab_alloc(&sub_latest_evq_slab, (void **)&psub->_evq, K_NO_WAIT);
+		if (ret != 0) {
+			psub->_evq = psub->_evq_buf;
+			ret		   = -ENOMEM;
+			goto exit;
+		}
+
+		psub->_evq_src = (uint16_t *)&psub->_evq[HA_SUBS_LATEST_QUEUE_LEN];
+		memset(psub->_evq_src, 0, HA_SUBS_LATEST_QUEUE_LEN * sizeof(uint16_t));
+
+		psub->_evq_size	 = HA_SUBS_LATEST_QUEUE_LEN;
+		psub->_evq_limit = HA_SUBS_LATEST_QUEUE_LEN;
+		k_sem_init(&psub->_evq_sem, 0u, HA_SUBS_LATEST_QUEUE_LEN);
+	}
+
+	if (conf->queue_limit != 0u) {
+		psub->_evq_limit = MIN(conf->queue_limit, psub->_evq_size);
+	}
+
 	/* prefer k_spin_lock() to mutex here */
 	k_mutex_lock(&sub_mutex, K_FOREVER);
 	sys_dlist_append(&sub_dlist, &psub->_handle);
@@ -1100,23 +1969,29 @@ int ha_unsubscribe(struct ha_ev_subs *sub)
 		sys_dlist_remove(&sub->_handle);
 		k_mutex_unlock(&sub_mutex);
 
-		if (k_fifo_is_empty(&sub->_evq)) {
-			/* TODO how to cancel all threads waiting on this sub ?
-			 */
-			k_fifo_cancel_wait(&sub->_evq);
-		} else {
-			/* Empty the fifo if not empty */
-			ha_ev_t *ev;
-			uint32_t count = 0u;
-			while ((ev = k_fifo_get(&sub->_evq, K_NO_WAIT)) != NULL) {
+		/* Empty the queue */
+		ha_ev_t *ev;
+		uint32_t count = 0u;
+		do {
+			K_SPINLOCK(&sub->_evq_lock)
+			{
+				ev = sub_evq_pop(sub);
+			}
+			if (ev != NULL) {
 				ha_ev_unref(ev);
 				count++;
 			}
+		} while (ev != NULL);
+
+		if (count != 0u) {
 			LOG_WRN("%u events not consumed because of "
 					"unsubscription of %p",
 					count, sub);
 		}
 
+		/* Threads waiting on the subscription get -EAGAIN */
+		k_sem_reset(&sub->_evq_sem);
+
 		LOG_DBG("%p unsubscribed", sub);
 
 		sub_free(sub);
@@ -1127,103 +2002,825 @@ int ha_unsubscribe(struct ha_ev_subs *sub)
 
 ha_ev_t *ha_ev_wait(struct ha_ev_subs *sub, k_timeout_t timeout)
 {
-	if ((sub != NULL) && HA_EV_SUBS_CONF_SUBSCRIBED(sub)) {
-		return (ha_ev_t *)k_fifo_get(&sub->_evq, timeout);
+	ha_ev_t *ev = NULL;
+
+	if ((sub != NULL) && HA_EV_SUBS_CONF_SUBSCRIBED(sub) &&
+		(k_sem_take(&sub->_evq_sem, timeout) == 0)) {
+		K_SPINLOCK(&sub->_evq_lock)
+		{
+			ev = sub_evq_pop(sub);
+		}
+		if (ev != NULL) {
+			TRACE(TRACE_EV_HA_EV_DEQUEUED, ev, sub);
+		}
 	}
-	return NULL;
+
+	return ev;
 }
 
-void *ha_ev_get_data(const ha_ev_t *event)
+int ha_ev_wait_many(struct ha_ev_subs *sub,
+					ha_ev_t **events,
+					size_t count,
+					k_timeout_t timeout)
 {
-	if (event != NULL) {
-		return event->data;
+	size_t n = 0u;
+
+	if ((sub == NULL) || (events == NULL) || (count == 0u)) {
+		return -EINVAL;
 	}
-	return NULL;
-}
 
-struct ha_room *ha_dev_get_room(ha_dev_t *const dev)
-{
-	struct ha_room_assoc *assoc = NULL;
-	struct ha_room *room		= NULL;
+	if (!HA_EV_SUBS_CONF_SUBSCRIBED(sub) ||
+		(k_sem_take(&sub->_evq_sem, timeout) != 0)) {
+		return 0;
+	}
 
-	/* Find the room associated to the device */
-	for (uint32_t i = 0u; i < ha_cfg_rooms_assoc_count; i++) {
-		if (ha_dev_addr_cmp(&dev->addr, &ha_cfg_rooms_assoc[i].addr) == 0) {
-			assoc = &ha_cfg_rooms_assoc[i];
-			break;
+	K_SPINLOCK(&sub->_evq_lock)
+	{
+		while ((n < count) && (sub->_evq_count != 0u)) {
+			events[n++] = sub_evq_pop(sub);
 		}
 	}
 
-	if (assoc != NULL) {
-		/* Retrieve room structure addr */
-		for (uint32_t i = 0u; i < ha_cfg_rooms_count; i++) {
-			if (assoc->rid == ha_cfg_rooms[i].rid) {
-				room = &ha_cfg_rooms[i];
-				break;
-			}
-		}
+	/* The count of the first event was taken above, consume the ones of the
+	 * others. If a producer did not give its count yet, the next call returns
+	 * without events. */
+	for (size_t i = 1u; i < n; i++) {
+		(void)k_sem_take(&sub->_evq_sem, K_NO_WAIT);
+	}
+
+	for (size_t i = 0u; i < n; i++) {
+		TRACE(TRACE_EV_HA_EV_DEQUEUED, events[i], sub);
 	}
 
-	return room;
+	return (int)n;
 }
 
-int ha_stats_copy(struct ha_stats *dest)
+int ha_subs_stats_get(struct ha_ev_subs *sub, struct ha_ev_subs_stats *stats)
 {
-	if (dest == NULL) {
+	if ((sub == NULL) || (stats == NULL)) {
 		return -EINVAL;
 	}
 
-	memcpy(dest, &stats, sizeof(struct ha_stats));
+	K_SPINLOCK(&sub->_evq_lock)
+	{
+		*stats = sub->_stats;
+	}
 
 	return 0;
 }
 
-bool ha_dev_ep_exists(const ha_dev_t *dev, uint8_t endpoint_index)
+void *ha_ev_get_data(const ha_ev_t *event)
 {
-	return dev && (endpoint_index < dev->endpoints_count);
+	if (event != NULL) {
+		return event->data;
+	}
+	return NULL;
 }
 
-bool ha_dev_ep_has_datatype(const ha_dev_t *dev,
-							uint8_t endpoint_index,
-							const ha_data_type_t datatype)
+uint64_t ha_ev_timestamp_ms(const ha_ev_t *event)
 {
-	if (!ha_dev_ep_exists(dev, endpoint_index)) {
-		return false;
+	if (event == NULL) {
+		return 0u;
 	}
 
-	const struct ha_device_endpoint *const ep = &dev->endpoints[endpoint_index];
+	/* Extend the 32-bit uptime to the current 64-bit uptime */
+	const int64_t now = k_uptime_get();
 
-#if HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION
-	return (bool)(ep->_data_types & (1u << datatype));
-#else
-	return ha_data_descr_data_type_has(ep->data_descr, ep->data_descr_count, datatype);
-#endif
+	return net_time_from_uptime_ms(now - (uint32_t)((uint32_t)now - event->uptime_ms));
 }
 
-bool ha_dev_ep_check_data_support(const ha_dev_t *dev, uint8_t endpoint_index)
+struct ha_room *ha_room_get_by_rid(ha_room_id_t rid)
 {
-	bool support = false;
+	for (uint32_t i = 0u; i < ha_cfg_rooms_count; i++) {
+		if (ha_cfg_rooms[i].rid == rid) {
+			return &ha_cfg_rooms[i];
+		}
+	}
 
-	if (ha_dev_ep_exists(dev, endpoint_index)) {
-		const struct ha_device_endpoint_config *const ep_cfg =
-			dev->endpoints[endpoint_index].cfg;
+	return NULL;
+}
 
-		support = ep_cfg->ingest && ep_cfg->data_descr && ep_cfg->data_descr_size;
+static bool rooms_assoc_indexed = false;
+
+/* Sort the rooms association table by address hash and resolve the rooms,
+ * done once, devices context must be locked */
+static void rooms_assoc_index(void)
+{
+	struct ha_room_assoc *const table = ha_cfg_rooms_assoc;
+
+	for (size_t i = 0u; i < ha_cfg_rooms_assoc_count; i++) {
+		table[i]._hash = ha_dev_addr_hash(&table[i].addr);
+		table[i]._room = ha_room_get_by_rid(table[i].rid);
 	}
 
-	return support == true;
+	/* Insertion sort, stable to keep the first association defined for
+	 * an address first */
+	for (size_t i = 1u; i < ha_cfg_rooms_assoc_count; i++) {
+		const struct ha_room_assoc tmp = table[i];
+		size_t j					   = i;
+
+		while ((j > 0u) && (table[j - 1u]._hash > tmp._hash)) {
+			table[j] = table[j - 1u];
+			j--;
+		}
+		table[j] = tmp;
+	}
+
+	rooms_assoc_indexed = true;
 }
 
-bool ha_dev_ep_check_cmd_support(const ha_dev_t *dev, uint8_t endpoint_index)
+static struct ha_room_assoc *rooms_assoc_find(const ha_dev_addr_t *addr, uint32_t hash)
 {
-	bool support = false;
+	size_t lo = 0u;
+	size_t hi = ha_cfg_rooms_assoc_count;
 
-	if (ha_dev_ep_exists(dev, endpoint_index)) {
-		const struct ha_device_endpoint_config *const ep_cfg =
-			dev->endpoints[endpoint_index].cfg;
+	/* Find the first association with given hash */
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2u;
 
-		support = ep_cfg->command && ep_cfg->cmd_descr && ep_cfg->cmd_descr_size;
+		if (ha_cfg_rooms_assoc[mid]._hash < hash) {
+			lo = mid + 1u;
+		} else {
+			hi = mid;
+		}
 	}
 
-	return support == true;
-}
\ No newline at end of file
+	for (; (lo < ha_cfg_rooms_assoc_count) && (ha_cfg_rooms_assoc[lo]._hash == hash);
+		 lo++) {
+		if (ha_dev_addr_cmp(addr, &ha_cfg_rooms_assoc[lo].addr) == 0) {
+			return &ha_cfg_rooms_assoc[lo];
+		}
+	}
+
+	return NULL;
+}
+
+struct ha_room *ha_dev_get_room(ha_dev_t *const dev)
+{
+	struct ha_room_assoc *assoc = NULL;
+
+	__DEV_CONTEXT_LOCK();
+
+	if (!rooms_assoc_indexed) {
+		rooms_assoc_index();
+	}
+
+	assoc = rooms_assoc_find(&dev->addr, ha_dev_addr_hash(&dev->addr));
+
+	/* Associations can also be defined by device type only */
+	if ((assoc == NULL) && addr_valid(&dev->addr)) {
+		const ha_dev_addr_t type_addr = {.type = dev->addr.type};
+
+		assoc = rooms_assoc_find(&dev->addr, ha_dev_addr_hash(&type_addr));
+	}
+
+	__DEV_CONTEXT_UNLOCK();
+
+	return assoc ? assoc->_room : NULL;
+}
+
+int ha_stats_copy(struct ha_stats *dest)
+{
+	if (dest == NULL) {
+		return -EINVAL;
+	}
+
+	memcpy(dest, &stats, sizeof(struct ha_stats));
+
+	/* Events held by the subscriptions queues */
+	struct ha_ev_subs *sub;
+	dest->sub_ev_held	  = 0u;
+	dest->sub_ev_held_max = 0u;
+
+	k_mutex_lock(&sub_mutex, K_FOREVER);
+	SYS_DLIST_FOR_EACH_CONTAINER (&sub_dlist, sub, _handle) {
+		K_SPINLOCK(&sub->_evq_lock)
+		{
+			dest->sub_ev_held += sub->_stats.held;
+			dest->sub_ev_held_max = MAX(dest->sub_ev_held_max, sub->_stats.held_max);
+		}
+	}
+	k_mutex_unlock(&sub_mutex);
+
+	return 0;
+}
+
+bool ha_dev_ep_exists(const ha_dev_t *dev, uint8_t endpoint_index)
+{
+	return dev && (endpoint_index < dev->cls->endpoints_count);
+}
+
+bool ha_dev_ep_has_datatype(const ha_dev_t *dev,
+							uint8_t endpoint_index,
+							const ha_data_type_t datatype)
+{
+	if (!ha_dev_ep_exists(dev, endpoint_index)) {
+		return false;
+	}
+
+	const struct ha_device_endpoint_config *const ep_cfg =
+		dev->cls->endpoints[endpoint_index];
+
+	return ha_data_descr_data_type_has(ep_cfg->data_descr, ep_cfg->data_descr_size,
+									   datatype);
+}
+
+bool ha_dev_ep_check_data_support(const ha_dev_t *dev, uint8_t endpoint_index)
+{
+	bool support = false;
+
+	if (ha_dev_ep_exists(dev, endpoint_index)) {
+		const struct ha_device_endpoint_config *const ep_cfg =
+			dev->cls->endpoints[endpoint_index];
+
+		support = ep_cfg->ingest && ep_cfg->data_descr && ep_cfg->data_descr_size;
+	}
+
+	return support == true;
+}
+
+bool ha_dev_ep_check_cmd_support(const ha_dev_t *dev, uint8_t endpoint_index)
+{
+	bool support = false;
+
+	if (ha_dev_ep_exists(dev, endpoint_index)) {
+		const struct ha_device_endpoint_config *const ep_cfg =
+			dev->cls->endpoints[endpoint_index];
+
+		support = ep_cfg->command && ep_cfg->cmd_descr && ep_cfg->cmd_descr_size;
+	}
+
+	return support == true;
+}
+#if defined(CONFIG_APP_HA_DEV_STORAGE)
+
+/* Devices registry snapshot, stored in the "storage" flash partition as NVS
+ * entries: a header entry and one entry per device (by index in the list).
+ *
+ * Entries are only rewritten if their content changed (NVS compares the
+ * data with the last written entry), so only devices with new data wear the
+ * flash.
+ */
+
+#define STORAGE_PARTITION storage_partition
+
+#define STORAGE_MAGIC	0x53444148u /* "HADS" */
+#define STORAGE_VERSION 1u
+
+#define STORAGE_ID_HEADER		   1u
+#define STORAGE_ID_DEVICE(_index) (0x100u + (_index))
+
+/* Maximum size of a device entry, endpoint data not fitting in are not
+ * saved */
+#define STORAGE_DEV_ENTRY_MAX_SIZE 256u
+
+struct storage_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;	  /* Number of device entries */
+	uint32_t sdevuid; /* Session Device Unique ID reference */
+	uint32_t crc;	  /* CRC32 of the fields above */
+} __packed;
+
+struct storage_ep {
+	uint32_t timestamp; /* Last data timestamp, 0 if no data */
+	uint16_t data_size; /* Size of the data which follows */
+	uint8_t data[];
+} __packed;
+
+struct storage_dev {
+	uint32_t crc; /* CRC32 of the whole entry, excluding this field */
+	ha_dev_addr_t addr;
+	uint32_t registered_timestamp;
+	uint16_t sdevuid;
+	uint8_t rid; /* Room ID */
+	uint8_t endpoints_count;
+	uint8_t endpoints[]; /* struct storage_ep for each endpoint */
+} __packed;
+
+static struct nvs_fs nvs = {
+	.flash_device = FIXED_PARTITION_DEVICE(STORAGE_PARTITION),
+	.offset		  = FIXED_PARTITION_OFFSET(STORAGE_PARTITION),
+};
+
+static bool nvs_mounted = false;
+
+/* Protects the NVS, storage_count and storage_buf. Taken before the devices
+ * context mutex, which is only held to serialize or restore the entries, never
+ * during flash operations. */
+static K_MUTEX_DEFINE(storage_mutex);
+
+/* Number of device entries stored */
+static uint16_t storage_count = 0u;
+
+/* Entry buffer */
+static uint8_t storage_buf[STORAGE_DEV_ENTRY_MAX_SIZE] __aligned(4);
+
+static void storage_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(storage_work, storage_work_handler);
+
+/* Periodic snapshots erase and write flash sectors, which takes long enough
+ * to delay the system workqueue users, they run on their own queue instead. */
+K_THREAD_STACK_DEFINE(storage_work_q_stack, CONFIG_APP_HA_DEV_STORAGE_WORK_Q_STACK_SIZE);
+
+static struct k_work_q storage_work_q;
+
+static bool storage_work_q_started = false;
+
+static int storage_mount(void)
+{
+	int ret;
+	struct flash_pages_info info;
+
+	if (nvs_mounted) {
+		return 0;
+	}
+
+	if (!device_is_ready(nvs.flash_device)) {
+		LOG_ERR("Flash device %s not ready", nvs.flash_device->name);
+		return -ENODEV;
+	}
+
+	ret = flash_get_page_info_by_offs(nvs.flash_device, nvs.offset, &info);
+	if (ret < 0) {
+		LOG_ERR("Failed to get flash page info ret=%d", ret);
+		return ret;
+	}
+
+	nvs.sector_size	 = info.size;
+	nvs.sector_count = FIXED_PARTITION_SIZE(STORAGE_PARTITION) / info.size;
+
+	ret = nvs_mount(&nvs);
+	if (ret < 0) {
+		LOG_ERR("Failed to mount NVS ret=%d", ret);
+		return ret;
+	}
+
+	nvs_mounted = true;
+
+	return 0;
+}
+
+/* Storage mutex must be held */
+static int storage_header_write(void)
+{
+	ssize_t ret;
+	struct storage_header hdr = {
+		.magic	 = STORAGE_MAGIC,
+		.version = STORAGE_VERSION,
+		.count	 = storage_count,
+	};
+
+	__DEV_CONTEXT_LOCK();
+	hdr.sdevuid = devices.sdevuid;
+	__DEV_CONTEXT_UNLOCK();
+
+	hdr.crc = crc32_ieee((const uint8_t *)&hdr, offsetof(struct storage_header, crc));
+
+	ret = nvs_write(&nvs, STORAGE_ID_HEADER, &hdr, sizeof(hdr));
+
+	return ret < 0 ? (int)ret : 0;
+}
+
+static int storage_header_read(struct storage_header *hdr)
+{
+	ssize_t ret;
+
+	ret = nvs_read(&nvs, STORAGE_ID_HEADER, hdr, sizeof(*hdr));
+	if (ret < 0) {
+		return (int)ret;
+	} else if (ret != sizeof(*hdr)) {
+		return -EINVAL;
+	}
+
+	if ((hdr->magic != STORAGE_MAGIC) || (hdr->version != STORAGE_VERSION)) {
+		LOG_WRN("Unsupported snapshot version %hu (magic %x)", hdr->version,
+				hdr->magic);
+		return -ENOTSUP;
+	}
+
+	if (hdr->crc != crc32_ieee((const uint8_t *)hdr,
+							   offsetof(struct storage_header, crc))) {
+		LOG_WRN("Invalid snapshot header CRC");
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+/* Storage mutex must be held and devices context locked, returns the length
+ * of the entry serialized in storage_buf */
+static size_t storage_dev_serialize(ha_dev_t *dev)
+{
+	size_t len = sizeof(struct storage_dev);
+	struct storage_dev *const entry = (struct storage_dev *)storage_buf;
+
+	entry->addr					= dev->addr;
+	entry->registered_timestamp = dev->registered_timestamp;
+	entry->sdevuid				= dev->sdevuid;
+	entry->rid					= dev->room ? dev->room->rid : HA_ROOM_NONE;
+	entry->endpoints_count		= dev->cls->endpoints_count;
+
+	for (uint8_t i = 0u; i < dev->cls->endpoints_count; i++) {
+		struct storage_ep *const sep = (struct storage_ep *)&storage_buf[len];
+		ha_ev_t *const ev			 = dev->endpoints[i].last_data_event;
+
+		/* Keep room for the headers of the remaining endpoints */
+		const size_t room = sizeof(storage_buf) - len -
+							(dev->cls->endpoints_count - i) * sizeof(struct storage_ep);
+
+		sep->timestamp = 0u;
+		sep->data_size = 0u;
+
+		if ((ev != NULL) && (ev->data_size <= room)) {
+			ha_ev_ref(ev);
+			sep->timestamp = ev->timestamp;
+			sep->data_size = ev->data_size;
+			memcpy(sep->data, ev->data, ev->data_size);
+			ha_ev_unref(ev);
+		}
+
+		len += sizeof(struct storage_ep) + sep->data_size;
+	}
+
+	entry->crc = crc32_ieee(&storage_buf[sizeof(entry->crc)], len - sizeof(entry->crc));
+
+	return len;
+}
+
+/* Storage mutex must be held, devices context must NOT be locked: the entry
+ * is serialized under the lock, which is released before writing the flash */
+static int storage_dev_write(uint32_t index)
+{
+	ssize_t ret;
+	size_t len = 0u;
+
+	__DEV_CONTEXT_LOCK();
+	if (index < devices.count) {
+		len = storage_dev_serialize(&devices.list[index]);
+	}
+	__DEV_CONTEXT_UNLOCK();
+
+	if (len == 0u) {
+		return -ENOENT;
+	}
+
+	ret = nvs_write(&nvs, STORAGE_ID_DEVICE(index), storage_buf, len);
+	if (ret < 0) {
+		LOG_ERR("Failed to save device entry %u ret=%d", index, (int)ret);
+		return (int)ret;
+	}
+
+	return 0;
+}
+
+/* Storage mutex must be held, entry is read in storage_buf */
+static int storage_dev_read(uint32_t index)
+{
+	ssize_t ret;
+	size_t len					   = sizeof(struct storage_dev);
+	struct storage_dev *const entry = (struct storage_dev *)storage_buf;
+
+	ret = nvs_read(&nvs, STORAGE_ID_DEVICE(index), storage_buf, sizeof(storage_buf));
+	if (ret < 0) {
+		return (int)ret;
+	} else if ((ret < sizeof(struct storage_dev)) || (ret > sizeof(storage_buf))) {
+		return -EINVAL;
+	}
+
+	if (entry->crc != crc32_ieee(&storage_buf[sizeof(entry->crc)],
+								 ret - sizeof(entry->crc))) {
+		LOG_WRN("Invalid CRC for device entry %u", index);
+		return -EBADMSG;
+	}
+
+	/* Check endpoints bounds */
+	for (uint8_t i = 0u; i < entry->endpoints_count; i++) {
+		if (len + sizeof(struct storage_ep) > ret) {
+			return -EINVAL;
+		}
+
+		const struct storage_ep *sep = (const struct storage_ep *)&storage_buf[len];
+		len += sizeof(struct storage_ep) + sep->data_size;
+	}
+
+	return (len == ret) ? 0 : -EINVAL;
+}
+
+/* Age of a stored timestamp, 0 if unknown (e.g. time not synced yet) */
+static uint64_t age_ms(uint32_t timestamp)
+{
+	const uint64_t now_ms = sys_time_get_ms();
+	const uint64_t ts_ms  = (uint64_t)timestamp * MSEC_PER_SEC;
+
+	return (now_ms > ts_ms) ? (now_ms - ts_ms) : 0u;
+}
+
+/* Storage mutex must be held and devices context locked, entry in storage_buf */
+static void storage_dev_restore_data(ha_dev_t *dev)
+{
+	size_t len						= sizeof(struct storage_dev);
+	const struct storage_dev *entry = (const struct storage_dev *)storage_buf;
+
+	for (uint8_t i = 0u; i < entry->endpoints_count; i++) {
+		const struct storage_ep *sep = (const struct storage_ep *)&storage_buf[len];
+		len += sizeof(struct storage_ep) + sep->data_size;
+
+		if ((i >= dev->cls->endpoints_count) || (sep->timestamp == 0u)) {
+			continue;
+		}
+
+		struct ha_device_endpoint *const ep				   = &dev->endpoints[i];
+		const struct ha_device_endpoint_config *const ep_cfg = dev->cls->endpoints[i];
+
+		/* Endpoint data format may have changed with the firmware */
+		if (!(ep_cfg->flags & HA_DEV_EP_FLAG_RETAIN_LAST_EVENT) ||
+			(ep->last_data_event != NULL) || (sep->data_size != ep_cfg->data_size)) {
+			continue;
+		}
+
+		ha_ev_t *ev = ha_ev_alloc_and_reset();
+		if (ev == NULL) {
+			stats.ev_no_mem++;
+			return;
+		}
+
+		ev->type	  = HA_EV_TYPE_DATA;
+		ev->dev		  = dev;
+		ev->ep_index  = i;
+		ev->timestamp = sep->timestamp;
+		ev->uptime_ms = k_uptime_get_32() - (uint32_t)age_ms(sep->timestamp);
+		sys_slist_init(&ev->slist);
+
+		if (sep->data_size) {
+			ev->data = malloc(sep->data_size);
+			if (ev->data == NULL) {
+				stats.ev_no_data_mem++;
+				ha_ev_free(ev);
+				return;
+			}
+			memcpy(ev->data, sep->data, sep->data_size);
+			ev->data_size = sep->data_size;
+			stats.mem_heap_alloc += sep->data_size;
+			stats.mem_heap_total += sep->data_size;
+		}
+
+		ha_ev_ref(ev);
+		ep->last_data_event = ev;
+
+		values_update(dev, ep_cfg, ev->data);
+	}
+}
+
+/* Storage mutex must be held and devices context locked */
+static int storage_restore_all(void)
+{
+	int ret;
+	int restored = 0;
+	struct storage_header hdr;
+
+	ret = storage_header_read(&hdr);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (uint32_t index = 0u; index < MIN(hdr.count, HA_DEVICES_MAX_COUNT); index++) {
+		const struct storage_dev *entry = (const struct storage_dev *)storage_buf;
+		ha_dev_addr_t addr;
+		ha_dev_t *dev;
+
+		ret = storage_dev_read(index);
+		if (ret < 0) {
+			LOG_DBG("Skipping device entry %u ret=%d", index, ret);
+			continue;
+		}
+
+		addr = entry->addr;
+		if ((addr.type == HA_DEV_TYPE_NONE) || (ha_dev_get_by_addr(&addr) != NULL)) {
+			continue;
+		}
+
+		dev = dev_register_locked(&addr, entry->sdevuid, entry->registered_timestamp);
+		if (dev == NULL) {
+			continue;
+		}
+
+		/* Room association from the configuration takes precedence */
+		if ((dev->room == NULL) && (entry->rid != HA_ROOM_NONE)) {
+			dev_room_bind(dev, ha_room_get_by_rid(entry->rid));
+		}
+
+		storage_dev_restore_data(dev);
+
+		restored++;
+	}
+
+	devices.sdevuid = MAX(devices.sdevuid, hdr.sdevuid);
+	storage_count	= hdr.count;
+
+	return restored;
+}
+
+/* Storage mutex must be held, devices context must NOT be locked */
+static int storage_save_all(void)
+{
+	int ret;
+	int saved = 0;
+	uint32_t count;
+
+	__DEV_CONTEXT_LOCK();
+	count = devices.count;
+	__DEV_CONTEXT_UNLOCK();
+
+	for (uint32_t index = 0u; index < count; index++) {
+		ret = storage_dev_write(index);
+		if (ret == 0) {
+			saved++;
+		}
+	}
+
+	/* Remove entries of devices which are not registered anymore */
+	for (uint32_t index = count; index < storage_count; index++) {
+		(void)nvs_delete(&nvs, STORAGE_ID_DEVICE(index));
+	}
+
+	storage_count = count;
+
+	ret = storage_header_write();
+	if (ret < 0) {
+		LOG_ERR("Failed to save snapshot header ret=%d", ret);
+		return ret;
+	}
+
+	return saved;
+}
+
+static void storage_work_handler(struct k_work *work)
+{
+	int ret = ha_dev_storage_save(NULL);
+
+	LOG_DBG("Periodic snapshot of %d device(s)", ret);
+
+	k_work_reschedule_for_queue(&storage_work_q, &storage_work,
+								K_SECONDS(CONFIG_APP_HA_DEV_STORAGE_SAVE_INTERVAL));
+}
+
+/* Get the index of a registered device, devices context must be locked */
+static int storage_dev_index(const ha_dev_t *dev)
+{
+	if ((dev < devices.list) || (dev >= devices.list + devices.count)) {
+		return -EINVAL;
+	}
+
+	return dev - devices.list;
+}
+
+int ha_dev_storage_save(ha_dev_t *dev)
+{
+	int ret;
+	int index = 0;
+
+	if (dev != NULL) {
+		__DEV_CONTEXT_LOCK();
+		index = storage_dev_index(dev);
+		__DEV_CONTEXT_UNLOCK();
+
+		if (index < 0) {
+			return index;
+		}
+	}
+
+	k_mutex_lock(&storage_mutex, K_FOREVER);
+
+	ret = storage_mount();
+	if (ret < 0) {
+		goto exit;
+	}
+
+	if (dev == NULL) {
+		ret = storage_save_all();
+	} else {
+		ret = storage_dev_write(index);
+		if (ret == 0) {
+			storage_count = MAX(storage_count, (uint16_t)index + 1u);
+			ret			  = storage_header_write();
+		}
+	}
+
+exit:
+	k_mutex_unlock(&storage_mutex);
+
+	return ret;
+}
+
+int ha_dev_storage_load(ha_dev_t *dev)
+{
+	int ret;
+	int index						= 0;
+	const struct storage_dev *entry = (const struct storage_dev *)storage_buf;
+
+	k_mutex_lock(&storage_mutex, K_FOREVER);
+	__DEV_CONTEXT_LOCK();
+
+	if (dev != NULL) {
+		index = storage_dev_index(dev);
+		if (index < 0) {
+			ret = index;
+			goto exit;
+		}
+	}
+
+	ret = storage_mount();
+	if (ret < 0) {
+		goto exit;
+	}
+
+	if (dev == NULL) {
+		ret = storage_restore_all();
+		if (ret >= 0) {
+			LOG_INF("Restored %d device(s) from snapshot, sdevuid=%u", ret,
+					devices.sdevuid);
+		} else if (ret != -ENOENT) {
+			LOG_WRN("Failed to restore snapshot ret=%d", ret);
+		}
+
+		/* Start periodic snapshots */
+		if (!storage_work_q_started) {
+			const struct k_work_queue_config cfg = {.name = "ha_storage"};
+
+			k_work_queue_init(&storage_work_q);
+			k_work_queue_start(&storage_work_q, storage_work_q_stack,
+							   K_THREAD_STACK_SIZEOF(storage_work_q_stack),
+							   CONFIG_APP_HA_DEV_STORAGE_WORK_Q_PRIORITY, &cfg);
+			storage_work_q_started = true;
+		}
+
+		k_work_schedule_for_queue(&storage_work_q, &storage_work,
+								  K_SECONDS(CONFIG_APP_HA_DEV_STORAGE_SAVE_INTERVAL));
+	} else {
+		ret = storage_dev_read(index);
+		if (ret == 0) {
+			const ha_dev_addr_t addr = entry->addr;
+
+			if (ha_dev_addr_cmp(&addr, &dev->addr) == 0) {
+				storage_dev_restore_data(dev);
+			} else {
+				ret = -ENOENT;
+			}
+		}
+	}
+
+exit:
+	__DEV_CONTEXT_UNLOCK();
+	k_mutex_unlock(&storage_mutex);
+
+	return ret;
+}
+
+int ha_dev_storage_delete(ha_dev_t *dev)
+{
+	int ret;
+	int index = 0;
+
+	if (dev != NULL) {
+		__DEV_CONTEXT_LOCK();
+		index = storage_dev_index(dev);
+		__DEV_CONTEXT_UNLOCK();
+
+		if (index < 0) {
+			return index;
+		}
+	}
+
+	k_mutex_lock(&storage_mutex, K_FOREVER);
+
+	ret = storage_mount();
+	if (ret < 0) {
+		goto exit;
+	}
+
+	if (dev == NULL) {
+		for (uint32_t index = 0u; index < storage_count; index++) {
+			(void)nvs_delete(&nvs, STORAGE_ID_DEVICE(index));
+		}
+		storage_count = 0u;
+		ret			  = nvs_delete(&nvs, STORAGE_ID_HEADER);
+	} else {
+		ret = nvs_delete(&nvs, STORAGE_ID_DEVICE(index));
+
+		/* Shrink the stored count when the last entry is removed, entries
+		 * removed in the middle are skipped when restoring */
+		if ((ret == 0) && ((uint32_t)index + 1u == storage_count)) {
+			storage_count = (uint16_t)index;
+			ret			  = storage_header_write();
+		}
+	}
+
+exit:
+	k_mutex_unlock(&storage_mutex);
+
+	return ret;
+}
+
+#endif /* CONFIG_APP_HA_DEV_STORAGE */
@@ -25,6 +25,7 @@ struct ha_device_endpoint;
 struct ha_device_stats;
 struct ha_device_payload;
 struct ha_device_command;
+struct ha_cmd_ctx;
 struct ha_device_filter;
 struct ha_device_iter_opt;
 struct ha_ev_subs_conf;
@@ -33,18 +34,27 @@ struct ha_event;
 struct ha_device;
 
 /* Defines */
-#define HA_DEV_EP_MAX_COUNT				   2u
-#define HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION 1u
+#define HA_DEV_EP_MAX_COUNT 2u
 
 #define HA_DEV_ADDR_STR_MAX_LEN		   MAX(BT_ADDR_LE_STR_LEN, sizeof("0x1FFFFFFF"))
 #define HA_DEV_ADDR_TYPE_STR_MAX_LEN   16u
 #define HA_DEV_ADDR_MEDIUM_STR_MAX_LEN 10u
 
-#define HA_UUID_STR_LEN sizeof("00000000-0000-0000-0000-000000000000")
-
 #define HA_DEVICES_MAX_COUNT	   CONFIG_APP_HA_DEVICES_MAX_COUNT
-#define HA_EVENTS_MAX_COUNT		   CONFIG_APP_HA_EVENTS_MAX_COUNT
 #define HA_SUBSCRIPTIONS_MAX_COUNT CONFIG_APP_HA_SUBSCRIPTIONS_MAX_COUNT
+#define HA_SUBS_QUEUE_MAX_LEN	   CONFIG_APP_HA_SUBS_QUEUE_MAX_LEN
+#define HA_CMD_MAX_PENDING_COUNT   CONFIG_APP_HA_CMD_MAX_PENDING_COUNT
+
+/* Events kept by the devices, the last event of each endpoint */
+#define HA_EVENTS_RETAINED_MAX_COUNT (HA_DEVICES_MAX_COUNT * HA_DEV_EP_MAX_COUNT)
+
+/* Events in flight (dispatched or held by subscriptions) */
+#define HA_EVENTS_INFLIGHT_MAX_COUNT CONFIG_APP_HA_EVENTS_MAX_COUNT
+
+#define HA_EVENTS_MAX_COUNT (HA_EVENTS_RETAINED_MAX_COUNT + HA_EVENTS_INFLIGHT_MAX_COUNT)
+
+/* Queue length of the latest value subscriptions: one slot per device endpoint */
+#define HA_SUBS_LATEST_QUEUE_LEN (HA_DEVICES_MAX_COUNT * HA_DEV_EP_MAX_COUNT)
 
 typedef enum {
 	HA_EV_TYPE_DATA = 0u,
@@ -127,6 +137,22 @@ struct ha_device_command {
 
 typedef struct ha_device_command ha_dev_cmd_t;
 
+/* Data of HA_EV_TYPE_COMMAND events */
+struct ha_cmd_result {
+	/* Command identifier, as returned in the query */
+	uint32_t id;
+
+	/* 0 on success, negative error code otherwise (-ETIMEDOUT if the device
+	 * didn't answer in time) */
+	int32_t status;
+
+	/* Time the command took to complete (ms) */
+	uint32_t duration;
+
+	/* Command type */
+	ha_dev_cmd_type_t type;
+};
+
 enum {
 	/* Tells whether the endpoint should retain the last event */
 	HA_DEV_EP_FLAG_RETAIN_LAST_EVENT = BIT(0),
@@ -155,23 +181,35 @@ struct ha_device_endpoint_config {
 
 	int (*ingest)(struct ha_event *ev, const struct ha_device_payload *pl);
 
-	int (*command)(struct ha_device *dev, const struct ha_device_command *cmd);
+	/* Send a command to the device, the command buffer is only valid during
+	 * the call. Once the device answers (or the command times out),
+	 * ha_dev_command_complete() must be called with the context. */
+	int (*command)(struct ha_device *dev,
+				   const struct ha_device_command *cmd,
+				   struct ha_cmd_ctx *ctx);
 };
 typedef struct ha_device_endpoint_config ha_dev_ep_cfg_t;
 
-struct ha_device_endpoint {
-	/* Describe the endpoint */
-	const struct ha_device_endpoint_config *cfg;
+/* Endpoints layout shared by all devices of the same kind */
+struct ha_device_class {
+	/* Describe the endpoints */
+	const struct ha_device_endpoint_config *endpoints[HA_DEV_EP_MAX_COUNT];
 
-	/* Endpoint last data event item */
-	struct ha_event *last_data_event;
+	/* Endpoints count */
+	uint8_t endpoints_count;
 
-#if HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION
-	/* Flags telling what kind of data types can be found in the endpoint
-	 * For optimization purpose
+	/**
+	 * @brief Choose which endpoint to use for a given payload
+	 *
+	 * If NULL, the first endpoint is used
 	 */
-	uint32_t _data_types;
-#endif /* HA_DEV_EP_TYPE_SEARCH_OPTIMIZATION */
+	int (*select_endpoint)(const ha_dev_addr_t *addr, const struct ha_device_payload *pl);
+};
+
+/* Per-device endpoint state, the endpoint is described by the device class */
+struct ha_device_endpoint {
+	/* Endpoint last data event item */
+	struct ha_event *last_data_event;
 };
 typedef struct ha_device_endpoint ha_dev_ep_t;
 
@@ -231,28 +269,23 @@ struct ha_device_stats {
 };
 
 struct ha_device {
-	char uuid[HA_UUID_STR_LEN];
-
 	/* Addr which uniquely identifies the device */
 	struct ha_device_address addr;
 
 	/* UNIX timestamps in seconds */
 	uint32_t registered_timestamp;
 
-	/* Device API */
-	const struct ha_device_api *api;
+	/* Device class, describing its endpoints */
+	const struct ha_device_class *cls;
 
 #if defined(CONFIG_APP_HA_DEVICE_STATS)
 	/* Device statistics */
 	struct ha_device_stats stats;
 #endif
 
-	/* Endpoints */
+	/* Endpoints state, see cls->endpoints_count */
 	struct ha_device_endpoint endpoints[HA_DEV_EP_MAX_COUNT];
 
-	/* Endpoints count */
-	uint8_t endpoints_count;
-
 	/* Session Device Unique ID
 	 * ID guaranteed to be unique accross the current session.
 	 * i.e. Between two reboots of the controller.
@@ -263,38 +296,33 @@ struct ha_device {
 	 * addresses.
 	 * - Also, devices with higher sdevuid are more recent than
 	 * devices with lower sdevuid.
-	 * - This ID is not persistent accross reboots.
+	 * - This ID is not persistent accross reboots, unless the devices are
+	 * restored from flash (CONFIG_APP_HA_DEV_STORAGE).
 	 * - It starts as 1 and is incremented for each new device.
 	 */
 	uint16_t sdevuid;
 
 	/* Room where the device is located */
 	struct ha_room *room;
+
+	/* Handle in the room devices list */
+	sys_snode_t _room_handle;
 };
 typedef struct ha_device ha_dev_t;
 
 struct ha_device_api {
 	/**
-	 * @brief
+	 * @brief Get the class of the device with the given address
 	 *
 	 * @param addr Device address
-	 * @param api Allow to overwrite the default device API
-	 * @return true to accept the device, false to refuse the registration
-	 */
-	int (*init_endpoints)(const ha_dev_addr_t *addr,
-						  struct ha_device_endpoint *endpoints,
-						  uint8_t *endpoints_count);
-
-	/**
-	 * @brief Choose which endpoint to use for a given payload
-	 *
-	 * If NULL, the first endpoint is used
+	 * @return Device class, NULL to refuse the registration
 	 */
-	int (*select_endpoint)(const ha_dev_addr_t *addr, const struct ha_device_payload *pl);
+	const struct ha_device_class *(*get_class)(const ha_dev_addr_t *addr);
 };
 
 struct ha_event {
-	/* First word reserved for use by FIFO */
+	/* First word reserved for use by FIFO (unused by the subscriptions
+	 * queues, which hold references to the events) */
 	void *_handle;
 
 	/******************/
@@ -318,17 +346,22 @@ struct ha_event {
 	/* Public members */
 	/******************/
 
-	/* Event time */
+	/* Event time (seconds since the epoch), may come from the payload */
 	uint32_t timestamp;
 
+	/* Time the event was created by the HA core, as uptime in ms
+	 * (k_uptime_get_32()). Monotonic, only differences between two values
+	 * are meaningful, see ha_ev_timestamp_ms() for the absolute time. */
+	uint32_t uptime_ms;
+
 	/* Event payload */
 	void *data;
 
 	/* Device the event is related to */
 	struct ha_device *dev;
 
-	/* Endpoint the event is related to */
-	// struct ha_device_endpoint *ep;
+	/* Index of the device endpoint the event is related to */
+	uint8_t ep_index;
 
 #if defined(CONFIG_APP_HA_STATS)
 	uint16_t data_size;
@@ -358,17 +391,55 @@ typedef bool (*ha_subs_ev_filter_func_t)(struct ha_ev_subs *sub, ha_ev_t *event)
  */
 typedef void (*ha_subs_ev_on_queued_func_t)(struct ha_ev_subs *sub, ha_ev_t *event);
 
+/**
+ * @brief What to do with a new event when the subscription queue is full
+ */
+typedef enum {
+	/* Drop the oldest queued event */
+	HA_EV_SUBS_OVERFLOW_DROP_OLDEST = 0u,
+	/* Drop the new event */
+	HA_EV_SUBS_OVERFLOW_DROP_NEWEST,
+	/* Replace the queued event of the same device endpoint and type by the new
+	 * one (the subscriber only gets the latest), drop the oldest event if
+	 * there is none. See HA_EV_SUBS_CONF_LATEST_VALUE to always coalesce. */
+	HA_EV_SUBS_OVERFLOW_COALESCE,
+} ha_ev_subs_overflow_t;
+
+struct ha_ev_subs_stats {
+	uint32_t queued;	/* Number of events queued */
+	uint32_t dropped;	/* Number of events dropped because the queue was full */
+	uint32_t coalesced; /* Number of queued events replaced by a newer one */
+	uint16_t held;		/* Number of events currently held in the queue */
+	uint16_t held_max;	/* Maximum number of events held in the queue */
+};
+
 struct ha_ev_subs {
 	sys_dnode_t _handle;
 
-	/* Queue of events to be notified to the waiter */
-	struct k_fifo _evq;
+	/* Queue of events to be notified to the waiter, ring of references to
+	 * the events (an event can be queued to several subscriptions) */
+	ha_ev_t **_evq;		 /* _evq_buf, or a ring of HA_SUBS_LATEST_QUEUE_LEN slots */
+	ha_ev_t *_evq_buf[HA_SUBS_QUEUE_MAX_LEN];
+	/* Latest value subscriptions only (NULL otherwise): ring position + 1 of
+	 * the event queued for each (device index, endpoint), 0 if none */
+	uint16_t *_evq_src;
+	uint16_t _evq_size;	 /* Number of slots of the ring */
+	uint16_t _evq_head;	 /* Index of the oldest event */
+	uint16_t _evq_count; /* Number of events queued */
+	uint16_t _evq_limit; /* Queue limit, from the configuration */
+	struct k_spinlock _evq_lock;
+
+	/* Given for each event queued, taken by the waiter */
+	struct k_sem _evq_sem;
 
 	/* Subscription Control flags */
 	atomic_t _ctrl;
 
 	/* Subscription Configuration */
 	const struct ha_ev_subs_conf *conf;
+
+	/* Queue statistics, protected by _evq_lock */
+	struct ha_ev_subs_stats _stats;
 };
 typedef struct ha_ev_subs ha_ev_subs_t;
 
@@ -383,6 +454,19 @@ typedef struct ha_ev_subs ha_ev_subs_t;
 #define HA_EV_SUBS_CONF_DEVICE_ERROR	BIT(5u)
 #define HA_EV_SUBS_CONF_FILTER_FUNCTION BIT(6u)
 
+/* Event subscription queueing flags */
+
+/* Keep at most one pending event per device endpoint (and event type), a new
+ * event replaces the queued one in place. A late subscriber processes the
+ * latest value of each device instead of all the events it missed.
+ *
+ * The queue of such a subscription has a slot for each device endpoint
+ * (HA_SUBS_LATEST_QUEUE_LEN), taken from a dedicated pool of
+ * CONFIG_APP_HA_SUBS_LATEST_VALUE_MAX_COUNT queues. The queued events are
+ * the last data events also held by the devices, so they don't drain the
+ * events pool. */
+#define HA_EV_SUBS_CONF_LATEST_VALUE BIT(7u)
+
 #define HA_EV_SUBS_CONF_SUBSCRIBED(_subs)                                                \
 	(atomic_test_bit(&_subs->_ctrl, HA_EV_SUBS_FLAG_SUBSCRIBED_BIT))
 
@@ -397,6 +481,15 @@ struct ha_ev_subs_conf {
 	/* Callback */
 	ha_subs_ev_on_queued_func_t on_queued_cb;
 
+	/* Maximum number of events held in the subscription queue, 0 for
+	 * CONFIG_APP_HA_SUBS_QUEUE_DEFAULT_LIMIT, capped to HA_SUBS_QUEUE_MAX_LEN.
+	 * For latest value subscriptions, 0 for HA_SUBS_LATEST_QUEUE_LEN which is
+	 * also the cap. */
+	uint16_t queue_limit;
+
+	/* Policy applied when the queue is full */
+	ha_ev_subs_overflow_t overflow;
+
 	/* User data */
 	void *user_data;
 };
@@ -488,6 +581,12 @@ struct ha_stats {
 	uint32_t ev_ingest;		  /* DATA Ingestion failed */
 	uint32_t ev_never_ref;	  /* Event never referenced */
 
+	/* Commands */
+	uint32_t cmd_sent;		/* Number of commands sent to devices */
+	uint32_t cmd_completed; /* Number of commands completed (answered or not) */
+	uint32_t cmd_timeout;	/* Number of commands which timed out */
+	uint32_t cmd_no_mem;	/* No command context available */
+
 	/* Memory, buffers, blocks usage */
 	uint32_t mem_ev_count;		   /* Number of events currently in use (allocated)
 									*/
@@ -501,6 +600,12 @@ struct ha_stats {
 
 	uint32_t mem_heap_alloc; /* Heap currently allocated */
 	uint32_t mem_heap_total; /* Heap allocated in total */
+
+	/* Subscriptions queues */
+	uint32_t sub_ev_dropped;   /* Events dropped because a queue was full */
+	uint32_t sub_ev_coalesced; /* Queued events replaced by a newer one */
+	uint32_t sub_ev_held;	   /* Events currently held by all the queues */
+	uint32_t sub_ev_held_max;  /* Maximum number of events held by a single queue */
 };
 
 struct ha_event_stats {
@@ -511,6 +616,10 @@ struct ha_event_stats {
 struct ha_room_assoc {
 	ha_room_id_t rid;
 	ha_dev_addr_t addr;
+
+	/* Set when the association table is indexed (sorted by hash) */
+	uint32_t _hash;
+	struct ha_room *_room;
 };
 
 /**
@@ -522,6 +631,17 @@ struct ha_room_assoc {
  */
 int ha_dev_addr_cmp(const ha_dev_addr_t *a, const ha_dev_addr_t *b);
 
+/**
+ * @brief Hash a device address
+ *
+ * Note: Two valid addresses equal according to ha_dev_addr_cmp() have the
+ * same hash, an address without valid MAC is hashed from its type only.
+ *
+ * @param addr
+ * @return uint32_t
+ */
+uint32_t ha_dev_addr_hash(const ha_dev_addr_t *addr);
+
 /**
  * @brief Convert a device address to a string
  *
@@ -540,6 +660,17 @@ int ha_dev_addr_to_str(const ha_dev_addr_t *addr, char *buf, size_t buf_len);
  */
 ha_dev_t *ha_dev_get_by_addr(const ha_dev_addr_t *addr);
 
+/**
+ * @brief Get the index of a device in the devices list
+ *
+ * Note: The index can be used with HA_DEV_FILTER_FROM_INDEX, devices are
+ * never moved in the list.
+ *
+ * @param dev
+ * @return int Index of the device, negative value on error
+ */
+int ha_dev_get_index(const ha_dev_t *dev);
+
 /**
  * @brief Propagate a payload issued from a device
  *
@@ -553,7 +684,8 @@ int ha_dev_register_data(const ha_dev_addr_t *addr,
 /**
  * @brief Callback for handling a device command response
  *
- * @param ev Event containing the response
+ * @param ev Event containing the response (struct ha_cmd_result data), can be
+ * NULL if no event could be allocated
  * @param user_data User data passed to the command query
  */
 typedef void (*ha_dev_command_cb_t)(ha_ev_t *ev, void *user_data);
@@ -564,12 +696,16 @@ enum {
 
 	/* Tells whether the command should be sent asynchronously,
 	 * if set, function ha_dev_command() will return immediately
-	 * and the callback will be called when the response is received in a
-	 * dedicated thread.
+	 * and the callback will be called when the response is received in the
+	 * context of the thread completing the command (e.g. CANIOT controller
+	 * thread), so it must not block.
 	 *
 	 * Otherwise, the function will block until the response is received,
 	 * and the callback will be called in the context of the function
 	 * before returning.
+	 *
+	 * In both cases, an HA_EV_TYPE_COMMAND event is notified to the
+	 * subscribers when the command completes.
 	 */
 	HA_CMD_FLAG_ASYNC = BIT(1),
 };
@@ -596,6 +732,41 @@ struct ha_cmd_query {
 
 	/* Additional flags */
 	uint8_t flags;
+
+	/* Command identifier (set by ha_dev_command()), to match the
+	 * HA_EV_TYPE_COMMAND event */
+	uint32_t id;
+};
+
+/* Context of a pending command, passed to the endpoint command function */
+struct ha_cmd_ctx {
+	/* Command identifier */
+	uint32_t id;
+
+	/* Device and endpoint the command is sent to */
+	ha_dev_t *dev;
+	uint8_t ep_index;
+
+	/* Command type */
+	ha_dev_cmd_type_t type;
+
+	/* Timeout the device has to answer */
+	uint32_t timeout_ms;
+
+	/******************/
+	/* Private members */
+	/******************/
+
+	uint8_t _flags;
+	uint32_t _uptime;
+	ha_dev_command_cb_t _cb;
+	void *_user_data;
+
+	/* Synchronous commands only */
+	struct k_sem _sem;
+	atomic_t _state;
+	int _status;
+	ha_ev_t *_ev;
 };
 
 /**
@@ -607,13 +778,14 @@ struct ha_cmd_query {
  * @note if flag HA_CMD_FLAG_CB_ON_TIMEOUT is set, the callback will be called
  * if the timeout is reached (async or not)
  *
- * @param query Query to send
- * @param ev Pointer to the event that will be notified when the response is received
+ * @param query Query to send, its identifier is set on success
+ * @param ev Pointer to the event that will be notified when the response is
+ * received (synchronous commands only, can be NULL), it must be released with
+ * ha_ev_unref().
  * @return int 0 on success, negative error code otherwise
- * 	-EINVAL if the query is invalid
- * 	-ENOSUP if the command is not supported by the device/endpoint
- * 	-ENOMEM if no memory is available to allocate the event
- * 	-EAGAIN if the event queue is full
+ * 	-EINVAL if the query is invalid (K_FOREVER timeout is not supported)
+ * 	-ENOTSUP if the command is not supported by the device/endpoint
+ * 	-ENOMEM if no command context is available
  * 	-ETIMEDOUT if the timeout is reached (if HA_CMD_FLAG_ASYNC is not set)
  *
  * 	Possibly:
@@ -623,6 +795,19 @@ struct ha_cmd_query {
  */
 int ha_dev_command(struct ha_cmd_query *query, ha_ev_t **ev);
 
+/**
+ * @brief Complete a pending command, called by the device endpoint
+ * implementation once the device answered or the command timed out.
+ *
+ * An HA_EV_TYPE_COMMAND event is notified to the subscribers, the command
+ * context must not be used after this call.
+ *
+ * @param ctx Context passed to the endpoint command function
+ * @param status 0 on success, negative error code otherwise
+ * @return int Number of subscribers notified, negative error code otherwise
+ */
+int ha_dev_command_complete(struct ha_cmd_ctx *ctx, int status);
+
 /**
  * @brief Get device endpoint last event
  *
@@ -689,6 +874,18 @@ void ha_ev_ref(ha_ev_t *event);
  */
 void ha_ev_unref(ha_ev_t *event);
 
+/**
+ * @brief Unreference an array of events, e.g. filled by ha_ev_wait_many()
+ *
+ * Note:
+ * - This function is thread-safe
+ * - NULL entries are ignored
+ *
+ * @param events
+ * @param count Number of events in the array
+ */
+void ha_ev_unref_many(ha_ev_t **events, size_t count);
+
 /**
  * @brief Get the data associated with an event if any
  *
@@ -702,6 +899,17 @@ void *ha_ev_get_data(const ha_ev_t *event);
  */
 #define HA_EV_GET_CAST_DATA(_ev, _type) ((_type *)ha_ev_get_data(_ev))
 
+/**
+ * @brief Get the time the event was created, in milliseconds since the epoch
+ *
+ * Note: Derived from the event uptime and the current SNTP offset, only
+ * valid for events younger than ~49 days.
+ *
+ * @param event
+ * @return uint64_t 0 if event is NULL
+ */
+uint64_t ha_ev_timestamp_ms(const ha_ev_t *event);
+
 /**
  * @brief Notify an event to all subscribers
  *
@@ -719,6 +927,20 @@ int ha_ev_notify_all(ha_ev_t *event);
  */
 int ha_ev_subs_conf_init(ha_ev_subs_conf_t *conf);
 
+/**
+ * @brief Check whether an event matches the filters of a subscription
+ * configuration, the filter function (HA_EV_SUBS_CONF_FILTER_FUNCTION) is not
+ * evaluated.
+ *
+ * Allows a subscriber to dispatch the events of a single subscription to
+ * several consumers with their own filters.
+ *
+ * @param conf Subscription configuration
+ * @param event Event to check
+ * @return true if the event matches the filters
+ */
+bool ha_ev_subs_conf_match(const ha_ev_subs_conf_t *conf, const ha_ev_t *event);
+
 /**
  * @brief Subscribe to a specific type of event, using given subscription
  *  configuration. If subscription succeeds, the subscription handle is returned
@@ -748,6 +970,38 @@ int ha_unsubscribe(struct ha_ev_subs *sub);
  */
 ha_ev_t *ha_ev_wait(struct ha_ev_subs *sub, k_timeout_t timeout);
 
+/**
+ * @brief Wait for events to be notified on given subscription handle and
+ * dequeue up to count of them at once, oldest first.
+ *
+ * Only the first event is waited for, the call returns as soon as at least one
+ * event is available. Every returned event must be unreferenced, e.g. with
+ * ha_ev_unref_many().
+ *
+ * Note: 0 can be returned before the timeout expires if the pending events
+ * were already dequeued by a previous call.
+ *
+ * @param sub Subscription handle, set by ha_subscribe()
+ * @param events Array to fill with the dequeued events
+ * @param count Size of the array
+ * @param timeout Timeout to wait for the first event
+ * @return int Number of events dequeued (0 on timeout), negative error code on
+ * error
+ */
+int ha_ev_wait_many(struct ha_ev_subs *sub,
+					ha_ev_t **events,
+					size_t count,
+					k_timeout_t timeout);
+
+/**
+ * @brief Get the queue statistics of a subscription
+ *
+ * @param sub Subscription handle, set by ha_subscribe()
+ * @param stats
+ * @return int 0 on success, negative error code otherwise
+ */
+int ha_subs_stats_get(struct ha_ev_subs *sub, struct ha_ev_subs_stats *stats);
+
 /**
  * @brief Get the room associated with a device
  *
@@ -756,6 +1010,14 @@ ha_ev_t *ha_ev_wait(struct ha_ev_subs *sub, k_timeout_t timeout);
  */
 struct ha_room *ha_dev_get_room(ha_dev_t *const dev);
 
+/**
+ * @brief Get a room from the configuration by its ID
+ *
+ * @param rid
+ * @return struct ha_room* NULL if the room is not configured
+ */
+struct ha_room *ha_room_get_by_rid(ha_room_id_t rid);
+
 /**
  * @brief Get device endpoint by index
  *
@@ -765,6 +1027,16 @@ struct ha_room *ha_dev_get_room(ha_dev_t *const dev);
  */
 struct ha_device_endpoint *ha_dev_ep_get(ha_dev_t *dev, uint32_t ep_index);
 
+/**
+ * @brief Get the configuration of a device endpoint by index
+ *
+ * @param dev
+ * @param ep_index Index of the endpoint
+ * @return const struct ha_device_endpoint_config* NULL if no such endpoint
+ */
+const struct ha_device_endpoint_config *ha_dev_ep_cfg_get(const ha_dev_t *dev,
+														  uint32_t ep_index);
+
 /**
  * @brief Get device endpoint by its type id
  *
@@ -867,26 +1139,103 @@ uint32_t ha_ev_free_count(void);
  */
 int ha_stats_copy(struct ha_stats *dest);
 
+typedef enum {
+	HA_VALUE_TEMPERATURE = 0u, /* 1e-2 °C */
+	HA_VALUE_HUMIDITY,		   /* 1e-2 % */
+	HA_VALUE_BATTERY_LEVEL,	   /* % */
+	HA_VALUE_RSSI,			   /* dBm */
+	HA_VALUE_DIGITAL,		   /* 1 bit per pin */
+
+	_HA_VALUE_COUNT,
+} ha_value_t;
+
+struct ha_values_aggregate {
+	uint32_t count; /* Number of devices having a value */
+	int32_t min;
+	int32_t max;
+	int32_t avg;
+};
+
 /**
- * @brief Save the device configuration and main information to flash
+ * @brief Get the latest value of a device
+ *
+ * The latest values table is updated on each data event, with the first
+ * occurrence of the matching data type in the endpoint data.
  *
  * @param dev
- * @return int
+ * @param value Value to get
+ * @param out Value (in the unit of the value, see ha_value_t)
+ * @return int 0 on success, -ENODATA if the device never reported the value
+ */
+int ha_values_get(const ha_dev_t *dev, ha_value_t value, int32_t *out);
+
+/**
+ * @brief Aggregate the latest values of all devices or of the devices
+ * located in a room
+ *
+ * @param value Value to aggregate (HA_VALUE_DIGITAL is not supported)
+ * @param rid Room to aggregate, HA_ROOM_ANY for all devices
+ * @param agg Aggregate, min/max/avg are 0 if no device has the value
+ * @return int 0 on success, negative value on error
+ */
+int ha_values_aggregate(ha_value_t value,
+						ha_room_id_t rid,
+						struct ha_values_aggregate *agg);
+
+/**
+ * @brief Count the devices whose latest value is below a threshold
+ * (e.g. low battery sensors)
+ *
+ * @param value Value to compare (HA_VALUE_DIGITAL is not supported)
+ * @param rid Room to look into, HA_ROOM_ANY for all devices
+ * @param threshold Threshold (excluded)
+ * @return int Number of devices, negative value on error
+ */
+int ha_values_count_below(ha_value_t value, ha_room_id_t rid, int32_t threshold);
+
+/**
+ * @brief Count the devices having at least one of the given digital pins set
+ *
+ * @param rid Room to look into, HA_ROOM_ANY for all devices
+ * @param mask Pins to check
+ * @return int Number of devices, negative value on error
+ */
+int ha_values_count_digital(ha_room_id_t rid, uint32_t mask);
+
+/**
+ * @brief Save the device configuration and main information to flash
+ *
+ * The snapshot contains the device address, its session unique ID, its
+ * registration timestamp, its room and the last data of its endpoints.
+ *
+ * Note: Snapshots are also saved periodically once ha_dev_storage_load()
+ * has been called (see CONFIG_APP_HA_DEV_STORAGE_SAVE_INTERVAL).
+ *
+ * @param dev Device to save, NULL to save all registered devices
+ * @return int Number of devices saved if dev is NULL, 0 on success
+ * otherwise, negative value on error
  */
 int ha_dev_storage_save(ha_dev_t *dev);
 
 /**
  * @brief Load the device configuration and main information from flash
  *
- * @param dev
- * @return int
+ * If dev is NULL, devices are registered again from the snapshot (with their
+ * previous session unique ID), this should be called at boot before any
+ * device registers.
+ *
+ * If dev is not NULL, endpoints without data get the last data saved.
+ *
+ * @param dev Device to load, NULL to restore all devices
+ * @return int Number of devices restored if dev is NULL, 0 on success
+ * otherwise, negative value on error
  */
 int ha_dev_storage_load(ha_dev_t *dev);
 
 /**
  * @brief Delete the device configuration and main information from flash
  *
- * @param dev
+ * @param dev Device to delete, NULL to delete the whole snapshot
  * @return int
  */
 int ha_dev_storage_delete(ha_dev_t *dev);
@@ -48,6 +48,9 @@ typedef enum ha_room_id {
 
 	HA_ROOM_ATTIC_SOUTH,
 	HA_ROOM_ATTIC_NORTH,
+
+	/* Not a room, selects the devices of all the rooms (and without room) */
+	HA_ROOM_ANY = 0xFFu,
 } ha_room_id_t;
 
 struct ha_room {
@@ -55,6 +58,9 @@ struct ha_room {
 	const char *name;
 
 	atomic_t devices_count;
+
+	/* Devices located in the room (struct ha_device), in registration order */
+	sys_slist_t _devices;
 };
 
 #define HA_ROOM(_rid, _name)                                                             \
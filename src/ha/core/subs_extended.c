@@ -5,85 +5,164 @@
  */
 #include "subs_extended.h"
 
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(subs_ext, LOG_LEVEL_WRN);
 
-typedef bool (*lt_cmp_func_t)(ha_subs_ext_lte_t *lte, ha_ev_t *event);
+/* Number of distinct endpoint ids (ha_endpoint_id_t) */
+#define LT_ENDPOINTID_KEYS_COUNT 16u
 
-static bool lt_cmd_any(ha_subs_ext_lte_t *lte, ha_ev_t *event)
-{
-	return true;
-}
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_HA_SUBS_EXT_LT_MAX_ENTRIES),
+			 "Lookup tables capacity must be a power of 2");
+
+/* Lookup tables are allocated from their own pool, not from the system heap */
+K_HEAP_DEFINE(lt_pool, CONFIG_APP_HA_SUBS_EXT_LT_POOL_SIZE);
 
-static bool lt_cmd_sdevuid(ha_subs_ext_lte_t *lte, ha_ev_t *event)
+static bool lt_type_devaddr(ha_subs_ext_lookup_type_t lookup_type)
 {
-	return (lte->sdevuid == event->dev->sdevuid);
+	return (lookup_type == HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR) ||
+		   (lookup_type == HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT);
 }
 
-static bool lt_cmd_sdevuid_endpoint(ha_subs_ext_lte_t *lte, ha_ev_t *event)
+static inline ha_subs_ext_lte_t *lt_entry(ha_subs_ext_lt_t *lt, uint32_t index)
 {
-	/* TODO */
-	return false;
+	return (ha_subs_ext_lte_t *)&lt->_entries[index * lt->_entry_size];
 }
 
-static bool lt_cmd_endpoint(ha_subs_ext_lte_t *lte, ha_ev_t *event)
+static uint32_t lt_hash_u32(uint32_t x)
 {
-	/* TODO */
-	return false;
+	x ^= x >> 16u;
+	x *= 0x45d9f3bu;
+	x ^= x >> 16u;
+
+	return x;
 }
 
-static lt_cmp_func_t lte_cmp_func_get(ha_subs_ext_lookup_type_t lt_type)
+static uint32_t lt_keys_max(ha_subs_ext_lookup_type_t lookup_type)
 {
-	switch (lt_type) {
+	switch (lookup_type) {
 	case HA_SUBS_EXT_LOOKUP_TYPE_ANY:
-		return lt_cmd_any;
+		return 1u;
 	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID:
-		return lt_cmd_sdevuid;
-	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
-		return lt_cmd_endpoint;
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
+		return HA_DEVICES_MAX_COUNT;
 	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT:
-		return lt_cmd_sdevuid_endpoint;
 	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT:
-	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
+		return HA_DEVICES_MAX_COUNT * HA_DEV_EP_MAX_COUNT;
+	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
+		return LT_ENDPOINTID_KEYS_COUNT;
 	default:
-		return NULL;
+		return 0u;
 	}
 }
 
-static ha_subs_ext_lte_t *lt_find(ha_subs_ext_lt_t *lt, ha_ev_t *event)
+static ha_endpoint_id_t lt_event_eid(ha_ev_t *event)
 {
-	const lt_cmp_func_t cmp_func = lte_cmp_func_get(lt->lookup_type);
+	const struct ha_device_endpoint_config *ep_cfg =
+		ha_dev_ep_cfg_get(event->dev, event->ep_index);
 
-	if (cmp_func != NULL) {
-		ha_subs_ext_lte_t *lte;
-		SYS_SLIST_FOR_EACH_CONTAINER (&lt->_list, lte, _node) {
-			if (cmp_func(lte, event) == true) {
-				LOG_DBG("Event %p found in LT %p -> %p", event, lt, lte);
-				return lte;
-			}
-		}
+	return ep_cfg ? ep_cfg->eid : HA_DEV_EP_NONE;
+}
+
+static uint32_t lt_event_hash(ha_subs_ext_lt_t *lt, ha_ev_t *event)
+{
+	switch (lt->lookup_type) {
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID:
+		return lt_hash_u32(event->dev->sdevuid);
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT:
+		return lt_hash_u32(((uint32_t)event->dev->sdevuid << 8u) | event->ep_index);
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
+		return ha_dev_addr_hash(&event->dev->addr);
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT:
+		return lt_hash_u32(ha_dev_addr_hash(&event->dev->addr) + event->ep_index);
+	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
+		return lt_hash_u32(lt_event_eid(event));
+	case HA_SUBS_EXT_LOOKUP_TYPE_ANY:
+	default:
+		return 0u;
 	}
+}
 
-	LOG_DBG("Event %p not found in LT %p", event, lt);
+static bool lte_match(ha_subs_ext_lt_t *lt, ha_subs_ext_lte_t *lte, ha_ev_t *event)
+{
+	switch (lt->lookup_type) {
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID:
+		return lte->sdevuid == event->dev->sdevuid;
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT:
+		return (lte->sdevuid == event->dev->sdevuid) &&
+			   (lte->endpoint_index == event->ep_index);
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
+		return ha_dev_addr_cmp(lte->devaddr, &event->dev->addr) == 0;
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT:
+		return (lte->endpoint_index == event->ep_index) &&
+			   (ha_dev_addr_cmp(lte->devaddr, &event->dev->addr) == 0);
+	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
+		return lte->endpointid == lt_event_eid(event);
+	case HA_SUBS_EXT_LOOKUP_TYPE_ANY:
+	default:
+		return true;
+	}
+}
+
+static void lte_set_key(ha_subs_ext_lt_t *lt, ha_subs_ext_lte_t *lte, ha_ev_t *event)
+{
+	switch (lt->lookup_type) {
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID:
+	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT:
+		lte->sdevuid = event->dev->sdevuid;
+		break;
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
+	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT:
+		lte->devaddr[0] = event->dev->addr;
+		break;
+	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
+		lte->endpointid = lt_event_eid(event);
+		break;
+	default:
+		break;
+	}
 
-	return NULL;
+	lte->endpoint_index = event->ep_index;
 }
 
+/* Linear probing, entries are never removed while the subscription is
+ * active so the first free slot ends the probe sequence. */
 static ha_subs_ext_lte_t *
 lt_find_otherwise_allocate(ha_subs_ext_lt_t *lt, ha_ev_t *event, bool *created)
 {
 	bool zcreated		   = false;
-	ha_subs_ext_lte_t *lte = lt_find(lt, event);
-
-	if (lte == NULL) {
-		lte = k_malloc(sizeof(ha_subs_ext_lte_t));
-		if (lte) {
-			sys_slist_append(&lt->_list, &lte->_node);
-			lte->sdevuid = event->dev->sdevuid;
-
-			zcreated = true;
-		} else {
-			LOG_ERR("(LT %p) Failed to allocate memory for new LT entry", lt);
+	ha_subs_ext_lte_t *lte = NULL;
+
+	const uint32_t hash = lt_event_hash(lt, event);
+	const uint32_t mask = lt->_capacity - 1u;
+
+	for (uint32_t i = 0u; i < lt->_capacity; i++) {
+		ha_subs_ext_lte_t *const cur = lt_entry(lt, (hash + i) & mask);
+
+		if (!cur->_used) {
+			/* Keep a free slot so that the table never fills up
+			 * completely and probes always terminate early */
+			if (lt->_count + 1u < lt->_capacity) {
+				memset(cur, 0x00u, lt->_entry_size);
+				cur->_used = 1u;
+				cur->_hash = hash;
+				lte_set_key(lt, cur, event);
+				lt->_count++;
+
+				lte		 = cur;
+				zcreated = true;
+			} else {
+				LOG_DBG("(LT %p) Table full (%u entries)", lt, lt->_count);
+			}
+			break;
+		} else if ((cur->_hash == hash) && lte_match(lt, cur, event)) {
+			LOG_DBG("Event %p found in LT %p -> %p", event, lt, cur);
+			lte = cur;
+			break;
 		}
 	}
 
@@ -122,29 +201,39 @@ static bool lt_filter_count_cb(struct ha_ev_subs *sub, ha_ev_t *event)
 	}
 }
 
-static bool lt_filter_interval_cb(struct ha_ev_subs *sub, ha_ev_t *event)
+/* Intervals are measured on the events uptime, which is monotonic
+ * (unlike the events timestamp, which follows SNTP adjustments) */
+static bool
+lt_filter_interval_ms(ha_subs_ext_lt_t *lt, ha_ev_t *event, uint32_t interval_ms)
 {
 	bool created;
-	ha_subs_ext_lt_t *const lt = (ha_subs_ext_lt_t *)sub->conf->user_data;
-	ha_subs_ext_lte_t *lte	   = lt_find_otherwise_allocate(lt, event, &created);
-
-	const uint32_t interval = lt->filtering_param.interval;
+	ha_subs_ext_lte_t *lte = lt_find_otherwise_allocate(lt, event, &created);
 
 	if (lte == NULL) {
 		return false;
-	} else if (created) {
-		lte->param_value.timestamp = event->timestamp;
+	} else if (created ||
+			   (event->uptime_ms - lte->param_value.timestamp_ms >= interval_ms)) {
+		lte->param_value.timestamp_ms = event->uptime_ms;
 		return true;
 	} else {
-		if (event->timestamp - lte->param_value.timestamp >= interval) {
-			lte->param_value.timestamp = event->timestamp;
-			return true;
-		} else {
-			return false;
-		}
+		return false;
 	}
 }
 
+static bool lt_filter_interval_cb(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	ha_subs_ext_lt_t *const lt = (ha_subs_ext_lt_t *)sub->conf->user_data;
+
+	return lt_filter_interval_ms(lt, event, lt->filtering_param.interval * MSEC_PER_SEC);
+}
+
+static bool lt_filter_interval_ms_cb(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	ha_subs_ext_lt_t *const lt = (ha_subs_ext_lt_t *)sub->conf->user_data;
+
+	return lt_filter_interval_ms(lt, event, lt->filtering_param.interval_ms);
+}
+
 static bool lt_filter_subsampling_cb(struct ha_ev_subs *sub, ha_ev_t *event)
 {
 	bool created;
@@ -177,19 +266,8 @@ int ha_subs_ext_conf_set(struct ha_ev_subs_conf *conf,
 	if (conf->flags & HA_EV_SUBS_CONF_FILTER_FUNCTION) return -EINVAL;
 
 	/* Check if lookup type is supported */
-	switch (lookup_type) {
-	case HA_SUBS_EXT_LOOKUP_TYPE_ANY:
-	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID:
-		break;
-	case HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT:
-	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR:
-	case HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT:
-	case HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID:
-		LOG_WRN("Lookup type %d not supported yet", lookup_type);
-		return -ENOTSUP; /* TODO: not supported yet */
-	default:
-		return -ENOTSUP;
-	}
+	const uint32_t keys = lt_keys_max(lookup_type);
+	if (keys == 0u) return -ENOTSUP;
 
 	switch (filtering_type) {
 	case HA_SUBS_EXT_FILTERING_TYPE_NONE:
@@ -204,21 +282,41 @@ int ha_subs_ext_conf_set(struct ha_ev_subs_conf *conf,
 	case HA_SUBS_EXT_FILTERING_TYPE_INTERVAL:
 		conf->filter_cb = lt_filter_interval_cb;
 		break;
+	case HA_SUBS_EXT_FILTERING_TYPE_INTERVAL_MS:
+		conf->filter_cb = lt_filter_interval_ms_cb;
+		break;
 	case HA_SUBS_EXT_FILTERING_TYPE_SUBSAMPLING:
 		conf->filter_cb = lt_filter_subsampling_cb;
 		break;
-	case HA_SUBS_EXT_FILTERING_TYPE_INTERVAL_MS:
 	default:
 		return -ENOTSUP;
 	}
 
+	/* Allocate the lookup table once, with at most half of the entries
+	 * used so that probe sequences stay short. */
+	const uint32_t capacity =
+		MIN(1u << LOG2CEIL(2u * keys), CONFIG_APP_HA_SUBS_EXT_LT_MAX_ENTRIES);
+	const size_t entry_size = sizeof(ha_subs_ext_lte_t) +
+							  (lt_type_devaddr(lookup_type) ? sizeof(ha_dev_addr_t) : 0u);
+
+	lookup_table->_entries = k_heap_alloc(&lt_pool, capacity * entry_size, K_NO_WAIT);
+	if (lookup_table->_entries == NULL) {
+		LOG_ERR("(LT %p) Failed to allocate %u entries of %u B", lookup_table, capacity,
+				entry_size);
+		return -ENOMEM;
+	}
+
+	memset(lookup_table->_entries, 0x00u, capacity * entry_size);
+
 	conf->flags |= HA_EV_SUBS_CONF_FILTER_FUNCTION;
 
 	/* Initialize lookup table */
+	lookup_table->_entry_size	  = entry_size;
+	lookup_table->_capacity		  = capacity;
+	lookup_table->_count		  = 0u;
 	lookup_table->filtering_type  = filtering_type;
 	lookup_table->filtering_param = filtering_param;
 	lookup_table->lookup_type	  = lookup_type;
-	sys_slist_init(&lookup_table->_list);
 
 	/* Set extended filter context */
 	conf->user_data = (void *)lookup_table;
@@ -230,11 +328,35 @@ int ha_subs_ext_lt_clear(struct ha_subs_ext_lookup_table *lt)
 {
 	if (!lt) return -EINVAL;
 
-	sys_snode_t *node;
-
-	while ((node = sys_slist_get(&lt->_list)) != NULL) {
-		k_free(node);
+	if (lt->_entries != NULL) {
+		k_heap_free(&lt_pool, lt->_entries);
 	}
 
+	lt->_entries	= NULL;
+	lt->_entry_size = 0u;
+	lt->_capacity	= 0u;
+	lt->_count		= 0u;
+
 	return 0;
+}
+
+int ha_subs_ext_lt_iterate(struct ha_subs_ext_lookup_table *lt,
+						   int (*cb)(struct ha_subs_ext_lookup_table_entry *lte,
+									 void *user_data),
+						   void *user_data)
+{
+	int count = 0;
+
+	if (!lt || !cb) return -EINVAL;
+
+	for (uint32_t i = 0u; i < lt->_capacity; i++) {
+		ha_subs_ext_lte_t *const lte = lt_entry(lt, i);
+
+		if (lte->_used) {
+			count++;
+			if (cb(lte, user_data) != 0) break;
+		}
+	}
+
+	return count;
 }
\ No newline at end of file
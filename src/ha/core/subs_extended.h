@@ -11,8 +11,6 @@
 
 #include "ha.h"
 
-#include <zephyr/sys/dlist.h>
-#include <zephyr/sys/slist.h>
 
 typedef enum {
 	/* No filtering, simply update lookup table */
@@ -117,35 +115,51 @@ typedef union {
 	uint32_t any;		   /* 0 if uninitialized */
 	uint32_t found;		   /* HA_SUBS_EXT_FILTERING_TYPE_DUPLICATE */
 	uint32_t count;		   /* HA_SUBS_EXT_FILTERING_TYPE_COUNT */
-	uint32_t timestamp;	   /* HA_SUBS_EXT_FILTERING_TYPE_INTERVAL */
-	uint32_t timestamp_ms; /* HA_SUBS_EXT_FILTERING_TYPE_INTERVAL_MS */
+	uint32_t timestamp_ms; /* HA_SUBS_EXT_FILTERING_TYPE_INTERVAL(_MS), uptime */
 	uint32_t mod;		   /* HA_SUBS_EXT_FILTERING_TYPE_SUBSAMPLING */
 } ha_subs_ext_lookup_param_value_t;
 
 struct ha_subs_ext_lookup_table_entry {
-	/* slist handle */
-	sys_snode_t _node;
+	/* Hash of the key, only valid if the entry is used */
+	uint32_t _hash;
 
-	/* Session Device Unique ID */
-	uint16_t sdevuid;
+	/* Attribute */
+	ha_subs_ext_lookup_param_value_t param_value;
 
-	/* Endpoint index */
-	uint16_t endpoint_index;
+	/* Tells whether the entry is used */
+	uint8_t _used;
 
-	// /* Device address */
-	// ha_dev_addr_t devaddr;
+	/* Endpoint index (HA_SUBS_EXT_LOOKUP_TYPE_*_ENDPOINT) */
+	uint8_t endpoint_index;
 
-	// /* Device endpoint id */
-	// ha_endpoint_id_t endpointid;
+	/* Compact key, depending on the lookup type */
+	union {
+		/* Session Device Unique ID (HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID*) */
+		uint16_t sdevuid;
 
-	/* Attribute */
-	ha_subs_ext_lookup_param_value_t param_value;
+		/* Device endpoint id, ha_endpoint_id_t
+		 * (HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID) */
+		uint16_t endpointid;
+	};
+
+	/* Device address (HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR*), only allocated
+	 * for these lookup types so that the other entries stay 12 bytes */
+	ha_dev_addr_t devaddr[];
 };
 typedef struct ha_subs_ext_lookup_table_entry ha_subs_ext_lte_t;
 
 struct ha_subs_ext_lookup_table {
-	/* Lookup table list */
-	sys_slist_t _list;
+	/* Open addressing table, allocated by ha_subs_ext_conf_set() */
+	uint8_t *_entries;
+
+	/* Size of an entry, depends on the lookup type */
+	uint16_t _entry_size;
+
+	/* Table capacity (power of 2) */
+	uint16_t _capacity;
+
+	/* Number of used entries */
+	uint16_t _count;
 
 	/* Lookup table type */
 	ha_subs_ext_lookup_type_t lookup_type;
@@ -167,8 +181,18 @@ typedef struct ha_subs_ext_lookup_table ha_subs_ext_lt_t;
  * support.
  *
  * The filtering type allows to choose type of lookup table to use:
+ * - HA_SUBS_EXT_LOOKUP_TYPE_ANY: single entry shared by all events
  * - HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT: match pair (sdevuid, endpoint)
  * - HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID: match (sdevuid) only
+ * - HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT: match pair (address, endpoint)
+ * - HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR: match (address) only
+ * - HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID: match (endpoint id) only
+ *
+ * The table is allocated once here from a dedicated pool
+ * (CONFIG_APP_HA_SUBS_EXT_LT_POOL_SIZE), with a capacity derived from
+ * HA_DEVICES_MAX_COUNT and capped to CONFIG_APP_HA_SUBS_EXT_LT_MAX_ENTRIES.
+ * No allocation happens while filtering events. When the table is full,
+ * events of new keys are dropped (except for HA_SUBS_EXT_FILTERING_TYPE_NONE).
  *
  * @param conf Configuration to wrap
  * @param lookup_table Lookup table to use
@@ -176,7 +200,7 @@ typedef struct ha_subs_ext_lookup_table ha_subs_ext_lt_t;
  * @param filtering_type Filtering type
  * @param filtering_param Parameter for the filtering type (ignored in some
  * cases)
- * @return int
+ * @return int 0 on success, -ENOMEM if the table could not be allocated
  */
 int ha_subs_ext_conf_set(struct ha_ev_subs_conf *conf,
 						 struct ha_subs_ext_lookup_table *lookup_table,
@@ -198,10 +222,14 @@ int ha_subs_ext_lt_clear(struct ha_subs_ext_lookup_table *lt);
 /**
  * @brief Iterate over the lookup table entries.
  *
+ * Iteration stops if the callback returns a non-zero value. The table
+ * must not be modified concurrently, i.e. the subscription should be
+ * inactive.
+ *
  * @param lt Lookup table to iterate over
  * @param cb Callback to call for each entry
  * @param user_data User data to pass to the callback
- * @return int
+ * @return int Number of entries iterated, negative error code otherwise
  */
 int ha_subs_ext_lt_iterate(struct ha_subs_ext_lookup_table *lt,
 						   int (*cb)(struct ha_subs_ext_lookup_table_entry *lte,
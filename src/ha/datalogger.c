@@ -4,4 +4,593 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include "datalogger.h"
\ No newline at end of file
+#include "datalogger.h"
+
+#if defined(CONFIG_APP_HA_DATALOGGER)
+
+#include "fs/app_utils.h"
+#include "fs/asyncrw.h"
+#include "ha/core/data.h"
+#include "ha/core/ha.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(datalogger, LOG_LEVEL_INF);
+
+#define DL_DIR				 CONFIG_APP_HA_DATALOGGER_DIR
+#define DL_PAGE_SIZE		 CONFIG_APP_HA_DATALOGGER_PAGE_SIZE
+#define DL_SEGMENT_SIZE		 CONFIG_APP_HA_DATALOGGER_SEGMENT_SIZE
+#define DL_SEGMENTS_MAX		 CONFIG_APP_HA_DATALOGGER_SEGMENTS_MAX
+#define DL_INDEX_STRIDE		 CONFIG_APP_HA_DATALOGGER_INDEX_STRIDE
+#define DL_FLUSH_INTERVAL_MS (CONFIG_APP_HA_DATALOGGER_FLUSH_INTERVAL * MSEC_PER_SEC)
+
+#define DL_PAGE_RECORDS	 (DL_PAGE_SIZE / DATALOGGER_RECORD_SIZE)
+#define DL_SEGMENT_PAGES (DL_SEGMENT_SIZE / DL_PAGE_SIZE)
+#define DL_INDEX_ENTRIES DIV_ROUND_UP(DL_SEGMENT_PAGES, DL_INDEX_STRIDE)
+
+BUILD_ASSERT(sizeof(struct datalogger_record) == DATALOGGER_RECORD_SIZE,
+			 "Invalid datalogger record size");
+BUILD_ASSERT((DL_PAGE_SIZE % DATALOGGER_RECORD_SIZE) == 0u,
+			 "Page size must be a multiple of the record size");
+BUILD_ASSERT((DL_SEGMENT_SIZE % DL_PAGE_SIZE) == 0u,
+			 "Segment size must be a multiple of the page size");
+
+/* Segment files are named after their id, in 8.3 format */
+#define DL_SEGMENT_EXT	".DLG"
+#define DL_PATH_MAX_LEN (sizeof(DL_DIR) + sizeof("/00000000" DL_SEGMENT_EXT))
+
+/* A page is written while the next one is being filled */
+#define DL_ASYNC_BLOCKS		2u
+#define DL_ASYNC_BLOCK_SIZE ROUND_UP(sizeof(struct fs_async_buf) + DL_PAGE_SIZE, 4u)
+
+/* Give the file systems time to be mounted */
+#define DL_THREAD_START_DELAY_MS 3000u
+#define DL_THREAD_STACK_SIZE	 0x600u
+
+/* Timestamps range of the records of DL_INDEX_STRIDE pages */
+struct dl_index_entry {
+	uint32_t ts_min;
+	uint32_t ts_max;
+};
+
+struct dl_segment {
+	uint32_t id;
+
+	/* Size written, always a multiple of the page size */
+	uint32_t size;
+
+	/* Timestamps range of all the records */
+	uint32_t ts_min;
+	uint32_t ts_max;
+
+	/* Sparse time index */
+	struct dl_index_entry index[DL_INDEX_ENTRIES];
+};
+
+static K_MUTEX_DEFINE(dl_mutex);
+
+/* Segments, oldest first, the last one is being written */
+static struct dl_segment segments[DL_SEGMENTS_MAX];
+static uint32_t segments_count;
+
+static struct datalogger_stats stats;
+
+/* Current segment file */
+static struct fs_async afile;
+static bool afile_opened;
+static char __aligned(4) afile_ms_buf[DL_ASYNC_BLOCKS * DL_ASYNC_BLOCK_SIZE];
+
+/* Page being filled, only accessed by the datalogger thread */
+static struct datalogger_record page[DL_PAGE_RECORDS];
+static uint32_t page_fill;
+static uint32_t page_uptime; /* Uptime of the first record of the page */
+
+/* Page read by queries and index rebuild, protected by dl_mutex */
+static struct datalogger_record rpage[DL_PAGE_RECORDS];
+
+static void segment_path(uint32_t id, char path[DL_PATH_MAX_LEN])
+{
+	snprintf(path, DL_PATH_MAX_LEN, DL_DIR "/%08X" DL_SEGMENT_EXT, id);
+}
+
+static void segment_reset(struct dl_segment *seg, uint32_t id)
+{
+	seg->id		= id;
+	seg->size	= 0u;
+	seg->ts_min = UINT32_MAX;
+	seg->ts_max = 0u;
+}
+
+static void index_update(struct dl_segment *seg,
+						 uint32_t page_no,
+						 const struct datalogger_record *records)
+{
+	struct dl_index_entry *const e = &seg->index[page_no / DL_INDEX_STRIDE];
+
+	/* First page of the entry */
+	if ((page_no % DL_INDEX_STRIDE) == 0u) {
+		e->ts_min = UINT32_MAX;
+		e->ts_max = 0u;
+	}
+
+	for (const struct datalogger_record *r = records; r < records + DL_PAGE_RECORDS;
+		 r++) {
+		if (r->sdevuid == DATALOGGER_SDEVUID_NONE) {
+			continue;
+		}
+
+		e->ts_min	= MIN(e->ts_min, r->timestamp);
+		e->ts_max	= MAX(e->ts_max, r->timestamp);
+		seg->ts_min = MIN(seg->ts_min, r->timestamp);
+		seg->ts_max = MAX(seg->ts_max, r->timestamp);
+	}
+}
+
+static inline bool range_overlaps(uint32_t min, uint32_t max, uint32_t from, uint32_t to)
+{
+	return (min <= to) && (max >= from);
+}
+
+/* Rebuild the index of a segment written during a previous session */
+static int segment_rebuild(struct dl_segment *seg)
+{
+	int ret;
+	ssize_t rlen;
+	struct fs_file_t file;
+	struct fs_dirent dirent;
+	char path[DL_PATH_MAX_LEN];
+
+	segment_path(seg->id, path);
+
+	ret = fs_stat(path, &dirent);
+	if (ret < 0) {
+		return ret;
+	}
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, path, FS_O_RDWR);
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Drop the incomplete page of an interrupted write */
+	const uint32_t size = MIN(ROUND_DOWN(dirent.size, DL_PAGE_SIZE), DL_SEGMENT_SIZE);
+	if (size != dirent.size) {
+		LOG_WRN("Segment %s truncated from %u to %u B", path, dirent.size, size);
+		ret = fs_truncate(&file, size);
+		if (ret < 0) {
+			goto exit;
+		}
+	}
+
+	for (uint32_t page_no = 0u; page_no < size / DL_PAGE_SIZE; page_no++) {
+		rlen = fs_read(&file, rpage, DL_PAGE_SIZE);
+		if (rlen != DL_PAGE_SIZE) {
+			ret = (rlen < 0) ? rlen : -EIO;
+			goto exit;
+		}
+
+		index_update(seg, page_no, rpage);
+		seg->size += DL_PAGE_SIZE;
+	}
+
+exit:
+	fs_close(&file);
+	return ret;
+}
+
+struct scan_ctx {
+	/* Files not kept by the retention policy */
+	uint32_t evicted[DL_SEGMENTS_MAX];
+	uint32_t evicted_count;
+};
+
+static void scan_evict(struct scan_ctx *x, uint32_t id)
+{
+	if (x->evicted_count < ARRAY_SIZE(x->evicted)) {
+		x->evicted[x->evicted_count++] = id;
+	}
+}
+
+static bool scan_cb(const char *path, struct fs_dirent *dirent, void *user_data)
+{
+	char *end;
+	uint32_t id, i;
+	struct scan_ctx *const x = user_data;
+
+	if (dirent->type != FS_DIR_ENTRY_FILE) {
+		return true;
+	}
+
+	id = strtoul(dirent->name, &end, 16);
+	if ((end != dirent->name + 8u) || (strcmp(end, DL_SEGMENT_EXT) != 0)) {
+		return true;
+	}
+
+	/* Keep the most recent segments sorted */
+	if (segments_count == DL_SEGMENTS_MAX) {
+		if (id < segments[0].id) {
+			scan_evict(x, id);
+			return true;
+		}
+
+		scan_evict(x, segments[0].id);
+		memmove(&segments[0], &segments[1], (segments_count - 1u) * sizeof(segments[0]));
+		segments_count--;
+	}
+
+	for (i = segments_count; (i > 0u) && (segments[i - 1u].id > id); i--) {
+		segments[i] = segments[i - 1u];
+	}
+
+	segment_reset(&segments[i], id);
+	segments_count++;
+
+	return true;
+}
+
+static int segments_load(void)
+{
+	int ret;
+	char path[DL_PATH_MAX_LEN];
+	struct scan_ctx x = {.evicted_count = 0u};
+
+	ret = app_fs_mkdir_intermediate(DL_DIR, false);
+	if (ret < 0) {
+		LOG_ERR("Failed to create " DL_DIR " ret=%d", ret);
+		return ret;
+	}
+
+	ret = app_fs_iterate_dir_files(DL_DIR, scan_cb, &x);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (uint32_t i = 0u; i < x.evicted_count; i++) {
+		segment_path(x.evicted[i], path);
+		fs_unlink(path);
+		stats.segments_removed++;
+	}
+
+	for (uint32_t i = 0u; i < segments_count; i++) {
+		ret = segment_rebuild(&segments[i]);
+		if (ret < 0) {
+			LOG_ERR("Failed to rebuild segment %08X index ret=%d", segments[i].id, ret);
+		}
+	}
+
+	stats.segments = segments_count;
+
+	LOG_INF("%u segments loaded", segments_count);
+
+	return 0;
+}
+
+static int segment_open(struct dl_segment *seg)
+{
+	int ret;
+	char path[DL_PATH_MAX_LEN];
+
+	struct fs_async_config cfg = {
+		.file_path		= path,
+		.opt			= FS_ASYNC_WRITE | FS_ASYNC_APPEND | FS_ASYNC_CREATE,
+		.ms_buf			= afile_ms_buf,
+		.ms_block_size	= DL_ASYNC_BLOCK_SIZE,
+		.ms_block_count = DL_ASYNC_BLOCKS,
+	};
+
+	segment_path(seg->id, path);
+
+	ret = fs_async_open(&afile, &cfg);
+	afile_opened = (ret == 0);
+
+	return ret;
+}
+
+static void segment_close(void)
+{
+	if (afile_opened) {
+		fs_async_close(&afile);
+		afile_opened = false;
+	}
+}
+
+/* Must be called with dl_mutex locked */
+static int segment_rotate(void)
+{
+	char path[DL_PATH_MAX_LEN];
+	const uint32_t id = segments_count ? segments[segments_count - 1u].id + 1u : 1u;
+
+	segment_close();
+
+	/* Retention */
+	if (segments_count == DL_SEGMENTS_MAX) {
+		segment_path(segments[0].id, path);
+		fs_unlink(path);
+		memmove(&segments[0], &segments[1], (segments_count - 1u) * sizeof(segments[0]));
+		segments_count--;
+		stats.segments_removed++;
+	}
+
+	segment_reset(&segments[segments_count], id);
+	segments_count++;
+	stats.segments = segments_count;
+
+	LOG_INF("Rotated to segment %08X", id);
+
+	return segment_open(&segments[segments_count - 1u]);
+}
+
+static void page_flush(void)
+{
+	int ret;
+	struct dl_segment *seg;
+
+	if (page_fill == 0u) {
+		return;
+	}
+
+	if (page_fill < DL_PAGE_RECORDS) {
+		memset(&page[page_fill], 0x00u,
+			   (DL_PAGE_RECORDS - page_fill) * sizeof(struct datalogger_record));
+		stats.pages_padded++;
+	}
+
+	k_mutex_lock(&dl_mutex, K_FOREVER);
+
+	seg = segments_count ? &segments[segments_count - 1u] : NULL;
+	if (!afile_opened || !seg || (seg->size + DL_PAGE_SIZE > DL_SEGMENT_SIZE)) {
+		ret = segment_rotate();
+		if (ret < 0) {
+			LOG_ERR("Failed to open segment ret=%d", ret);
+			goto exit;
+		}
+		seg = &segments[segments_count - 1u];
+	}
+
+	/* Data is copied, the page can be reused immediately */
+	ret = fs_async_write(&afile, page, DL_PAGE_SIZE, K_FOREVER);
+	if (ret != DL_PAGE_SIZE) {
+		LOG_ERR("Failed to write page ret=%d", ret);
+		/* Continue in a new segment */
+		segment_close();
+		goto exit;
+	}
+
+	index_update(seg, seg->size / DL_PAGE_SIZE, page);
+	seg->size += DL_PAGE_SIZE;
+	stats.pages++;
+
+exit:
+	if (ret != DL_PAGE_SIZE) {
+		stats.write_errors++;
+		stats.records_dropped += page_fill;
+	}
+
+	k_mutex_unlock(&dl_mutex);
+
+	page_fill = 0u;
+}
+
+static int record_build(const ha_ev_t *ev, struct datalogger_record *rec)
+{
+	size_t size, offset = 0u;
+	const struct ha_device_endpoint_config *cfg;
+
+	cfg = ha_dev_ep_cfg_get(ev->dev, ev->ep_index);
+	if (!cfg || !ev->data || !cfg->data_descr) {
+		return -ENOENT;
+	}
+
+	rec->timestamp = ev->timestamp;
+	rec->sdevuid   = ev->dev->sdevuid;
+	rec->ep_index  = ev->ep_index;
+	rec->count	   = 0u;
+	memset(rec->values, 0x00u, sizeof(rec->values));
+
+	for (uint8_t i = 0u; i < cfg->data_descr_size; i++) {
+		size = ha_data_type_size(cfg->data_descr[i].type);
+		if (offset + size > sizeof(rec->values)) {
+			break;
+		}
+
+		ha_data_descr_extract(cfg->data_descr, cfg->data_descr_size, ev->data,
+							  &rec->values[offset], i);
+		offset += size;
+		rec->count++;
+	}
+
+	return 0;
+}
+
+static void datalogger_thread(void *_a, void *_b, void *_c)
+{
+	ARG_UNUSED(_a);
+	ARG_UNUSED(_b);
+	ARG_UNUSED(_c);
+
+	int ret;
+	ha_ev_t *ev;
+	struct ha_ev_subs *sub;
+	k_timeout_t timeout;
+
+	struct ha_ev_subs_conf conf;
+
+	ha_ev_subs_conf_init(&conf);
+	conf.flags = HA_EV_SUBS_CONF_DEVICE_DATA;
+
+	k_mutex_lock(&dl_mutex, K_FOREVER);
+	ret = segments_load();
+	k_mutex_unlock(&dl_mutex);
+	if (ret < 0) {
+		LOG_ERR("Failed to load segments ret=%d", ret);
+		return;
+	}
+
+	ret = ha_subscribe(&conf, &sub);
+	if (ret < 0) {
+		LOG_ERR("Failed to subscribe to HA events ret=%d", ret);
+		return;
+	}
+
+	for (;;) {
+		/* Flush a partial page if its first record is too old */
+		if (page_fill == 0u) {
+			timeout = K_FOREVER;
+		} else {
+			const uint32_t elapsed = k_uptime_get_32() - page_uptime;
+			timeout = (elapsed < DL_FLUSH_INTERVAL_MS)
+						  ? K_MSEC(DL_FLUSH_INTERVAL_MS - elapsed)
+						  : K_NO_WAIT;
+		}
+
+		ev = ha_ev_wait(sub, timeout);
+		if (ev == NULL) {
+			page_flush();
+			continue;
+		}
+
+		if (record_build(ev, &page[page_fill]) == 0) {
+			if (page_fill == 0u) {
+				page_uptime = k_uptime_get_32();
+			}
+			page_fill++;
+			stats.records++;
+		} else {
+			stats.records_dropped++;
+		}
+
+		ha_ev_unref(ev);
+
+		if (page_fill == DL_PAGE_RECORDS) {
+			page_flush();
+		}
+	}
+}
+
+K_THREAD_DEFINE(datalogger,
+				DL_THREAD_STACK_SIZE,
+				datalogger_thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(8u),
+				0u,
+				DL_THREAD_START_DELAY_MS);
+
+/* Must be called with dl_mutex locked */
+static int segment_query(const struct dl_segment *seg,
+						 uint16_t sdevuid,
+						 uint32_t from,
+						 uint32_t to,
+						 struct datalogger_record *records,
+						 size_t max_count)
+{
+	int ret;
+	ssize_t rlen;
+	size_t count = 0u;
+	struct fs_file_t file;
+	char path[DL_PATH_MAX_LEN];
+	const uint32_t pages = seg->size / DL_PAGE_SIZE;
+
+	segment_path(seg->id, path);
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, path, FS_O_READ);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (uint32_t e = 0u; (e < DIV_ROUND_UP(pages, DL_INDEX_STRIDE)) && (count < max_count);
+		 e++) {
+		if (!range_overlaps(seg->index[e].ts_min, seg->index[e].ts_max, from, to)) {
+			continue;
+		}
+
+		ret = fs_seek(&file, e * DL_INDEX_STRIDE * DL_PAGE_SIZE, FS_SEEK_SET);
+		if (ret < 0) {
+			goto exit;
+		}
+
+		for (uint32_t p = e * DL_INDEX_STRIDE;
+			 (p < MIN(pages, (e + 1u) * DL_INDEX_STRIDE)) && (count < max_count); p++) {
+			/* Page may not be written yet */
+			rlen = fs_read(&file, rpage, DL_PAGE_SIZE);
+			if (rlen != DL_PAGE_SIZE) {
+				goto exit;
+			}
+
+			stats.query_pages_read++;
+
+			for (uint32_t i = 0u; (i < DL_PAGE_RECORDS) && (count < max_count); i++) {
+				const struct datalogger_record *const r = &rpage[i];
+
+				if ((r->sdevuid == sdevuid) && (r->timestamp >= from) &&
+					(r->timestamp <= to)) {
+					memcpy(&records[count++], r, sizeof(*r));
+				}
+			}
+		}
+	}
+
+exit:
+	fs_close(&file);
+
+	return (ret < 0) ? ret : (int)count;
+}
+
+int datalogger_query(uint16_t sdevuid,
+					 uint32_t from,
+					 uint32_t to,
+					 struct datalogger_record *records,
+					 size_t max_count)
+{
+	int ret		 = 0;
+	size_t count = 0u;
+
+	if (!records || (sdevuid == DATALOGGER_SDEVUID_NONE) || (from > to)) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&dl_mutex, K_FOREVER);
+
+	stats.queries++;
+
+	for (uint32_t i = 0u; (i < segments_count) && (count < max_count); i++) {
+		const struct dl_segment *const seg = &segments[i];
+
+		if ((seg->size == 0u) || !range_overlaps(seg->ts_min, seg->ts_max, from, to)) {
+			continue;
+		}
+
+		ret = segment_query(seg, sdevuid, from, to, &records[count], max_count - count);
+		if (ret < 0) {
+			LOG_ERR("Failed to query segment %08X ret=%d", seg->id, ret);
+			break;
+		}
+
+		count += ret;
+	}
+
+	k_mutex_unlock(&dl_mutex);
+
+	return (ret < 0) ? ret : (int)count;
+}
+
+int datalogger_stats_get(struct datalogger_stats *dest)
+{
+	if (dest == NULL) {
+		return -EINVAL;
+	}
+
+	memcpy(dest, &stats, sizeof(struct datalogger_stats));
+
+	return 0;
+}
+
+#endif /* CONFIG_APP_HA_DATALOGGER */
@@ -7,4 +7,76 @@
 #ifndef _HA_DATALOGGER_H_
 #define _HA_DATALOGGER_H_
 
-#endif /* _HA_DATALOGGER_H_ */
\ No newline at end of file
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/toolchain.h>
+
+#define DATALOGGER_RECORD_SIZE		  32u
+#define DATALOGGER_RECORD_VALUES_SIZE 24u
+
+/* Record with sdevuid 0 are padding (partial pages flushed) */
+#define DATALOGGER_SDEVUID_NONE 0u
+
+/* Record stored in the segment files, little endian */
+struct datalogger_record {
+	/* Event timestamp */
+	uint32_t timestamp;
+
+	/* Session device unique ID */
+	uint16_t sdevuid;
+
+	/* Device endpoint index */
+	uint8_t ep_index;
+
+	/* Number of values extracted from the endpoint data descriptor */
+	uint8_t count;
+
+	/* Values extracted with ha_data_descr_extract(), concatenated in the order
+	 * of the endpoint data descriptor (truncated if too large) */
+	uint8_t values[DATALOGGER_RECORD_VALUES_SIZE];
+} __packed;
+
+struct datalogger_stats {
+	uint32_t records;		  /* Records logged */
+	uint32_t records_dropped; /* Events which could not be logged */
+	uint32_t pages;			  /* Pages written */
+	uint32_t pages_padded;	  /* Partial pages flushed */
+	uint32_t write_errors;	  /* Page write errors */
+	uint32_t segments;		  /* Segments currently stored */
+	uint32_t segments_removed; /* Segments removed by the retention policy */
+	uint32_t queries;		   /* Queries processed */
+	uint32_t query_pages_read; /* Pages read by queries */
+};
+
+/**
+ * @brief Get records of a device logged between "from" and "to" (included).
+ *
+ * The time index of the segments is used to read only the pages which
+ * can contain matching records.
+ *
+ * Note: Records are visible once their page is written (see
+ * CONFIG_APP_HA_DATALOGGER_FLUSH_INTERVAL).
+ *
+ * @param sdevuid Device session unique ID
+ * @param from First timestamp
+ * @param to Last timestamp
+ * @param records Array to fill with the matching records
+ * @param max_count Size of the records array
+ * @return int Number of records copied, negative value on error
+ */
+int datalogger_query(uint16_t sdevuid,
+					 uint32_t from,
+					 uint32_t to,
+					 struct datalogger_record *records,
+					 size_t max_count);
+
+/**
+ * @brief Copy datalogger statistics
+ *
+ * @param dest
+ * @return int
+ */
+int datalogger_stats_get(struct datalogger_stats *dest);
+
+#endif /* _HA_DATALOGGER_H_ */
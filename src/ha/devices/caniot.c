@@ -1,5 +1,6 @@
 #include "caniot.h"
 #include "ha/caniot_controller.h"
+#include "utils/trace.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -164,7 +165,87 @@ static int select_endpoint(const ha_dev_addr_t *addr, const struct ha_device_pay
 	}
 }
 
-/* TODO reference endpoint instead of allocating two for EACH device */
+#if defined(CONFIG_APP_HA_CANIOT_CONTROLLER)
+
+static void command_query_cb(int status,
+							 const struct caniot_frame *resp,
+							 uint32_t delta,
+							 void *user_data)
+{
+	ARG_UNUSED(resp);
+	ARG_UNUSED(delta);
+
+	/* Telemetry responses are already registered by the controller */
+	switch (status) {
+	case 0: /* Not answered as timeout was null */
+	case 1:
+		status = 0;
+		break;
+	case 2:
+		status = -EPROTO; /* CANIOT error returned by the device */
+		break;
+	case -EAGAIN:
+		status = -ETIMEDOUT;
+		break;
+	default:
+		break;
+	}
+
+	ha_dev_command_complete(user_data, status);
+}
+
+static int ep_command(struct ha_device *dev,
+					  const struct ha_device_command *cmd,
+					  struct ha_cmd_ctx *ctx)
+{
+	int ret;
+	struct caniot_frame q;
+	struct caniot_blc_command blc;
+
+	switch (cmd->type) {
+	case HA_DEV_CMD_TYPE_COMMAND:
+		if (cmd->len > 8u) {
+			return -EINVAL;
+		}
+		ret = caniot_build_query_command(&q,
+										 (ctx->ep_index == HA_DEV_EP_INDEX(0))
+											 ? CANIOT_ENDPOINT_BOARD_CONTROL
+											 : CANIOT_ENDPOINT_APP,
+										 cmd->buffer, cmd->len);
+		break;
+	case HA_DEV_CMD_TYPE_PING:
+		ret = caniot_build_query_telemetry(&q, (ctx->ep_index == HA_DEV_EP_INDEX(0))
+												   ? CANIOT_ENDPOINT_BOARD_CONTROL
+												   : CANIOT_ENDPOINT_APP);
+		break;
+	case HA_DEV_CMD_TYPE_REBOOT:
+	case HA_DEV_CMD_TYPE_RESET_FACTORY_SETTINGS:
+		caniot_blc_command_init(&blc);
+		if (cmd->type == HA_DEV_CMD_TYPE_REBOOT) {
+			caniot_blc_sys_req_reboot(&blc.sys);
+		} else {
+			caniot_blc_sys_req_factory_reset(&blc.sys);
+		}
+		ret = caniot_build_query_command(&q, CANIOT_ENDPOINT_BOARD_CONTROL,
+										 (uint8_t *)&blc, sizeof(blc));
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	if (ret) {
+		return -EINVAL;
+	}
+
+	/* ctx is completed in command_query_cb() */
+	return ha_caniot_controller_query_async(&q, dev->addr.mac.addr.caniot,
+											ctx->timeout_ms, command_query_cb, ctx);
+}
+
+#define CANIOT_EP_COMMAND ep_command
+#else
+#define CANIOT_EP_COMMAND NULL
+#endif /* CONFIG_APP_HA_CANIOT_CONTROLLER */
 
 static const struct ha_data_descr ha_ds_caniot_blc0_descr[] = {
 	HA_DATA_DESCR(struct ha_ds_caniot_blc0,
@@ -205,7 +286,7 @@ static const struct ha_device_endpoint_config ep_blc0 = {
 	.cmd_descr			   = ha_cmd_caniot_blc0_descr,
 	.cmd_descr_size		   = ARRAY_SIZE(ha_cmd_caniot_blc0_descr),
 	.ingest				   = blc0_ingest,
-	.command			   = NULL,
+	.command			   = CANIOT_EP_COMMAND,
 };
 
 static const struct ha_data_descr ha_ds_caniot_blc1_descr[] = {
@@ -239,7 +320,7 @@ static const struct ha_device_endpoint_config ep_blc1 = {
 	.cmd_descr			   = NULL,
 	.cmd_descr_size		   = 0u,
 	.ingest				   = blc1_ingest,
-	.command			   = NULL};
+	.command			   = CANIOT_EP_COMMAND};
 
 static const struct ha_data_descr ha_ds_caniot_ep_heating_control_descr[] = {
 	HA_DATA_DESCR_UNASSIGNED(
@@ -275,7 +356,7 @@ static const struct ha_device_endpoint_config ep_heating_control = {
 	.cmd_descr			   = ha_cmd_caniot_ep_heating_control_descr,
 	.cmd_descr_size		   = ARRAY_SIZE(ha_cmd_caniot_ep_heating_control_descr),
 	.ingest				   = ep_heating_control_ingest,
-	.command			   = NULL,
+	.command			   = CANIOT_EP_COMMAND,
 };
 
 static const struct ha_data_descr ha_ds_caniot_ep_shutters_control_descr[] = {
@@ -310,47 +391,71 @@ static const struct ha_device_endpoint_config ep_shutters_control = {
 	.cmd_descr			   = ha_cmd_caniot_ep_shutters_control_descr,
 	.cmd_descr_size		   = ARRAY_SIZE(ha_cmd_caniot_ep_shutters_control_descr),
 	.ingest				   = ep_shutters_control_ingest,
-	.command			   = NULL,
+	.command			   = CANIOT_EP_COMMAND,
+};
+
+#define CANIOT_CLASS(_ep_blc)                                                            \
+	{                                                                                    \
+		.endpoints = {&_ep_blc}, .endpoints_count = 1u,                                  \
+		.select_endpoint = select_endpoint,                                              \
+	}
+
+#define CANIOT_CLASS_APP(_ep_blc, _ep_app)                                               \
+	{                                                                                    \
+		.endpoints = {&_ep_blc, &_ep_app}, .endpoints_count = 2u,                        \
+		.select_endpoint = select_endpoint,                                              \
+	}
+
+enum {
+	CANIOT_APP_NONE = 0u,
+	CANIOT_APP_HEATING,
+	CANIOT_APP_SHUTTERS,
+	CANIOT_APP_COUNT,
+};
+
+/* Classes by CANIOT device class and application endpoint */
+static const struct ha_device_class classes[][CANIOT_APP_COUNT] = {
+	[CANIOT_DEVICE_CLASS0] =
+		{
+			[CANIOT_APP_NONE]	  = CANIOT_CLASS(ep_blc0),
+			[CANIOT_APP_HEATING]  = CANIOT_CLASS_APP(ep_blc0, ep_heating_control),
+			[CANIOT_APP_SHUTTERS] = CANIOT_CLASS_APP(ep_blc0, ep_shutters_control),
+		},
+	[CANIOT_DEVICE_CLASS1] =
+		{
+			[CANIOT_APP_NONE]	  = CANIOT_CLASS(ep_blc1),
+			[CANIOT_APP_HEATING]  = CANIOT_CLASS_APP(ep_blc1, ep_heating_control),
+			[CANIOT_APP_SHUTTERS] = CANIOT_CLASS_APP(ep_blc1, ep_shutters_control),
+		},
 };
 
-static int init_endpoints(const ha_dev_addr_t *addr,
-						  struct ha_device_endpoint *endpoints,
-						  uint8_t *endpoints_count)
+static const struct ha_device_class *get_class(const ha_dev_addr_t *addr)
 {
-	/* Get class endpoint */
-	switch (CANIOT_DID_CLS(addr->mac.addr.caniot)) {
-	case CANIOT_DEVICE_CLASS0:
-		endpoints[0u].cfg = &ep_blc0;
-		*endpoints_count  = 1U;
-		break;
-	case CANIOT_DEVICE_CLASS1:
-		endpoints[0u].cfg = &ep_blc1;
-		*endpoints_count  = 1U;
-		break;
-	default:
-		return -ENOTSUP;
+	uint32_t app;
+	const uint32_t cls = CANIOT_DID_CLS(addr->mac.addr.caniot);
+
+	if (cls >= ARRAY_SIZE(classes)) {
+		return NULL;
 	}
 
 	/* Get device application endpoint */
 	switch (addr->mac.addr.caniot) {
 	case HEATING_CONTROLLER_DID:
-		endpoints[1u].cfg = &ep_heating_control;
-		*endpoints_count  = 2u;
+		app = CANIOT_APP_HEATING;
 		break;
 	case SHUTTERS_CONTROLLER_DID:
-		endpoints[1u].cfg = &ep_shutters_control;
-		*endpoints_count  = 2u;
+		app = CANIOT_APP_SHUTTERS;
 		break;
 	default:
+		app = CANIOT_APP_NONE;
 		break;
 	}
 
-	return 0;
+	return &classes[cls][app];
 }
 
 const struct ha_device_api ha_device_api_caniot = {
-	.init_endpoints	 = init_endpoints,
-	.select_endpoint = select_endpoint,
+	.get_class = get_class,
 };
 
 int ha_dev_register_caniot_telemetry(uint32_t timestamp,
@@ -371,6 +476,8 @@ int ha_dev_register_caniot_telemetry(uint32_t timestamp,
 	const struct ha_device_payload pl = {
 		.buffer = buf, .len = 8u, .timestamp = timestamp, .y = (void *)id};
 
+	TRACE(TRACE_EV_CANIOT_TELEMETRY, did, 0u);
+
 	return ha_dev_register_data(&addr, &pl);
 }
 
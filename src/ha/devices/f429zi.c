@@ -25,7 +25,7 @@ static const struct ha_data_descr ha_ds_f429zi_descr[] = {
 				  HA_ASSIGN_SOC_TEMPERATURE),
 };
 
-static struct ha_device_endpoint_config ep = {
+static const struct ha_device_endpoint_config ep = {
 	.eid				   = HA_DEV_EP_NUCLEO_F429ZI,
 	.data_size			   = sizeof(struct ha_ds_f429zi),
 	.expected_payload_size = sizeof(float),
@@ -36,18 +36,20 @@ static struct ha_device_endpoint_config ep = {
 	.command			   = NULL,
 };
 
-static int init_endpoints(const ha_dev_addr_t *addr,
-						  struct ha_device_endpoint *endpoints,
-						  uint8_t *endpoints_count)
-{
-	endpoints[0].cfg = &ep;
-	*endpoints_count = 1U;
+static const struct ha_device_class cls = {
+	.endpoints		 = {&ep},
+	.endpoints_count = 1u,
+	.select_endpoint = HA_DEV_EP_SELECT_0_CB,
+};
 
-	return 0;
+static const struct ha_device_class *get_class(const ha_dev_addr_t *addr)
+{
+	return &cls;
 }
 
 const struct ha_device_api ha_device_api_f429zi = {
-	.init_endpoints = init_endpoints, .select_endpoint = HA_DEV_EP_SELECT_0_CB};
+	.get_class = get_class,
+};
 
 int ha_dev_register_die_temperature(uint32_t timestamp, float die_temperature)
 {
@@ -88,7 +88,7 @@ struct ha_ds_xiaomi {
 
 #define HA_DEV_BLE_MAC_INIT(_b0, _b1, _b2, _b3, _b4, _b5)                                \
 	{                                                                                    \
-		.medium = HA_DEV_MEDIUM_CAN, .addr = {                                           \
+		.medium = HA_DEV_MEDIUM_BLE, .addr = {                                           \
 			.ble = HA_BT_ADDR_LE_PUBLIC_INIT(_b0, _b1, _b2, _b3, _b4, _b5)               \
 		}                                                                                \
 	}
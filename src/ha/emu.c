@@ -15,6 +15,7 @@
 #include "caniot_controller.h"
 #endif
 
+#include "datalogger.h"
 #include "ha/core/ha.h"
 #include "ha/core/room.h"
 #include "ha/core/subs_extended.h"
@@ -35,6 +36,9 @@ LOG_MODULE_REGISTER(ha_emu, LOG_LEVEL_INF);
 #define COMMAND_THREADS_START_DELAY_MS	3000u
 #define CANIOT_THREADS_START_DELAY_MS	1000u
 
+/* Maximum number of events dequeued at once by the consumer threads */
+#define EMU_CONSUMER_EV_BATCH 8u
+
 static uint32_t get_rdm_delay_ms(uint32_t min, uint32_t max)
 {
 	if (min >= max) {
@@ -55,6 +59,8 @@ void emu_caniot_broadcast_thread(void *_a, void *_b, void *_c);
 void emu_caniot_cmd_thread(void *_a, void *_b, void *_c);
 void emu_caniot_devices_thread(void *_a, void *_b, void *_c);
 
+/* The load generator replaces the emulated Xiaomi sensors */
+#if !defined(CONFIG_APP_HA_EMU_LOADGEN)
 K_THREAD_DEFINE(emu_ble_device1,
 				1024u,
 				emu_ble_device,
@@ -82,6 +88,7 @@ K_THREAD_DEFINE(emu_ble_device3,
 				K_PRIO_COOP(4u),
 				0u,
 				PRODUCER_THREADS_START_DELAY_MS);
+#endif /* CONFIG_APP_HA_EMU_LOADGEN */
 
 K_THREAD_DEFINE(emu_consumer1,
 				1024u,
@@ -241,30 +248,173 @@ void emu_ble_device(void *_a, void *_b, void *_c)
 	}
 }
 
+#if defined(CONFIG_APP_HA_DATALOGGER_BENCHMARK)
+
+#define DL_BENCHMARK_START_DELAY_MS 10000u
+#define DL_BENCHMARK_DURATION_MS	10000u
+
+/* Register xiaomi records as fast as possible and measure how many records
+ * the datalogger ingests */
+void emu_datalogger_benchmark(void *_a, void *_b, void *_c)
+{
+	xiaomi_record_t record;
+	struct datalogger_stats before, after;
+	uint32_t registered = 0u, failed = 0u;
+
+	datalogger_stats_get(&before);
+
+	const uint32_t start = k_uptime_get_32();
+
+	for (uint32_t i = 0u; k_uptime_get_32() - start < DL_BENCHMARK_DURATION_MS; i++) {
+		bt_addr_le_copy(&record.addr, &addrs[i % ARRAY_SIZE(addrs)]);
+
+		record.time						  = sys_time_get();
+		record.measurements.battery_level = i % 100;
+		record.measurements.battery_mv	  = (i % 100) * 3.3;
+		record.measurements.humidity	  = i % 1000;
+		record.measurements.temperature	  = i % 1000;
+		record.measurements.rssi		  = i % 100;
+
+		if (ha_dev_xiaomi_register_record(&record) < 0) {
+			failed++; /* Events pool exhausted */
+		} else {
+			registered++;
+		}
+	}
+
+	const uint32_t elapsed = k_uptime_get_32() - start;
+
+	datalogger_stats_get(&after);
+
+	LOG_INF("Datalogger benchmark: %u events registered (%u failed) in %u ms",
+			registered, failed, elapsed);
+	LOG_INF("Datalogger benchmark: %u records/s, %u pages written, %u records dropped",
+			(after.records - before.records) * MSEC_PER_SEC / elapsed,
+			after.pages - before.pages, after.records_dropped - before.records_dropped);
+}
+
+/* Lower priority than the datalogger thread, so that it keeps up */
+K_THREAD_DEFINE(emu_dl_benchmark,
+				1024u,
+				emu_datalogger_benchmark,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10u),
+				0u,
+				DL_BENCHMARK_START_DELAY_MS);
+
+#endif /* CONFIG_APP_HA_DATALOGGER_BENCHMARK */
+
+#if defined(CONFIG_APP_HA_EV_BATCH_BENCHMARK)
+
+#define EV_BENCHMARK_START_DELAY_MS 8000u
+#define EV_BENCHMARK_ROUNDS			16u
+
+static const uint8_t ev_benchmark_batches[] = {1u, 8u, 32u};
+
+/* Fill a subscription queue and measure the cost per event of draining it
+ * (dequeue and unref), for each batch size */
+void emu_ev_batch_benchmark(void *_a, void *_b, void *_c)
+{
+	xiaomi_record_t record;
+	ha_ev_subs_t *sub;
+	ha_ev_t *events[32u];
+
+	struct ha_ev_subs_conf conf = {
+		.flags		 = HA_EV_SUBS_CONF_DEVICE_DATA | HA_EV_SUBS_CONF_DEVICE_TYPE,
+		.device_type = HA_DEV_TYPE_XIAOMI_MIJIA,
+		.queue_limit = HA_SUBS_QUEUE_MAX_LEN,
+		.overflow	 = HA_EV_SUBS_OVERFLOW_DROP_NEWEST,
+	};
+
+	int ret = ha_subscribe(&conf, &sub);
+	if (ret != 0) {
+		LOG_ERR("Event batch benchmark failed to subscribe, ret=%d", ret);
+		return;
+	}
+
+	for (size_t b = 0u; b < ARRAY_SIZE(ev_benchmark_batches); b++) {
+		const size_t batch = MIN(ev_benchmark_batches[b], ARRAY_SIZE(events));
+		uint64_t cycles	   = 0u;
+		uint32_t dequeued  = 0u;
+
+		for (uint32_t r = 0u; r < EV_BENCHMARK_ROUNDS; r++) {
+			for (uint32_t i = 0u; i < HA_SUBS_QUEUE_MAX_LEN; i++) {
+				bt_addr_le_copy(&record.addr, &addrs[i % ARRAY_SIZE(addrs)]);
+
+				record.time						  = sys_time_get();
+				record.measurements.battery_level = i % 100;
+				record.measurements.battery_mv	  = (i % 100) * 3.3;
+				record.measurements.humidity	  = i % 1000;
+				record.measurements.temperature	  = i % 1000;
+				record.measurements.rssi		  = i % 100;
+
+				(void)ha_dev_xiaomi_register_record(&record);
+			}
+
+			const uint32_t start = k_cycle_get_32();
+
+			while ((ret = ha_ev_wait_many(sub, events, batch, K_NO_WAIT)) > 0) {
+				ha_ev_unref_many(events, ret);
+				dequeued += ret;
+			}
+
+			cycles += k_cycle_get_32() - start;
+		}
+
+		LOG_INF("Event batch benchmark: batch %u, %u events, %u ns/event",
+				(uint32_t)batch, dequeued,
+				(uint32_t)(k_cyc_to_ns_floor64(cycles) / MAX(dequeued, 1u)));
+	}
+
+	ha_unsubscribe(sub);
+}
+
+K_THREAD_DEFINE(emu_ev_batch_benchmark_thread,
+				1024u,
+				emu_ev_batch_benchmark,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10u),
+				0u,
+				EV_BENCHMARK_START_DELAY_MS);
+
+#endif /* CONFIG_APP_HA_EV_BATCH_BENCHMARK */
+
 void emu_consumer(void *_a, void *_b, void *_c)
 {
 
 	ha_subs_ext_lt_t lt;
 	ha_ev_subs_t *sub;
-	ha_ev_t *event;
+	ha_ev_t *events[EMU_CONSUMER_EV_BATCH];
 
 	struct ha_ev_subs_conf conf = {.flags		= HA_EV_SUBS_CONF_DEVICE_TYPE,
 								   .device_type = HA_DEV_TYPE_XIAOMI_MIJIA};
 
-	ha_subs_ext_conf_set(&conf, &lt, HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID,
-						 HA_SUBS_EXT_FILTERING_TYPE_INTERVAL,
-						 HA_SUBS_EXT_FILTERING_PARAM_INTERVAL(20u));
+	int ret = ha_subs_ext_conf_set(&conf, &lt, HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID,
+								   HA_SUBS_EXT_FILTERING_TYPE_INTERVAL,
+								   HA_SUBS_EXT_FILTERING_PARAM_INTERVAL(20u));
+	if (ret != 0) {
+		LOG_ERR("(thread %p) Failed to set the interval filter, ret=%d", _current, ret);
+		return;
+	}
 
-	int ret = ha_subscribe(&conf, &sub);
+	ret = ha_subscribe(&conf, &sub);
 	if (ret != 0) {
 		LOG_ERR("(thread %p) Failed to subscribe to events, ret=%d", _current, ret);
+		ha_subs_ext_lt_clear(&lt);
 		return;
 	}
 
 	for (uint32_t i = 0u;; i++) {
-		event = ha_ev_wait(sub, K_MSEC(get_rdm_delay_ms_1()));
+		ret = ha_ev_wait_many(sub, events, ARRAY_SIZE(events),
+							  K_MSEC(get_rdm_delay_ms_1()));
+
+		for (int j = 0; j < ret; j++) {
+			ha_ev_t *const event = events[j];
 
-		if (event != NULL) {
 			LOG_DBG("(thread %p) ev %p (refc = %u) - dev=%p "
 					"time=%u temp=%d",
 					_current, event, (uint32_t)atomic_get(&event->ref_count), event->dev,
@@ -275,8 +425,10 @@ void emu_consumer(void *_a, void *_b, void *_c)
 				LOG_DBG("(%p %p %p) Room: %s", event, event->dev, event->dev->room,
 						event->dev->room->name);
 			}
+		}
 
-			ha_ev_unref(event);
+		if (ret > 0) {
+			ha_ev_unref_many(events, ret);
 		}
 
 		/* Remove this delay because it could lead to a huge memory
@@ -350,6 +502,12 @@ void emu_caniot_cmd_thread(void *_a, void *_b, void *_c)
 	}
 }
 
+/* Frames handled by the emulated CANIOT boards */
+static struct {
+	uint32_t frames;
+	uint32_t lost; /* Dropped on purpose (CONFIG_APP_HA_EMU_CAN_LOSS_PERCENT) */
+} emu_can_stats;
+
 struct emu_caniot_device {
 	const struct caniot_device_id id;
 	struct caniot_device dev;
@@ -504,6 +662,19 @@ void emu_caniot_devices_thread(void *_a, void *_b, void *_c)
 		ret = k_msgq_get(&emu_caniot_txq, &req, K_FOREVER);
 		if (ret) goto error;
 
+		emu_can_stats.frames++;
+
+#if CONFIG_APP_HA_EMU_CAN_LOSS_PERCENT > 0
+		if (sys_rand32_get() % 100u < CONFIG_APP_HA_EMU_CAN_LOSS_PERCENT) {
+			emu_can_stats.lost++;
+			continue;
+		}
+#endif
+
+#if CONFIG_APP_HA_EMU_CAN_LATENCY_MS > 0
+		k_sleep(K_MSEC(get_rdm_delay_ms(0u, CONFIG_APP_HA_EMU_CAN_LATENCY_MS)));
+#endif
+
 		for (emu_dev = caniot_devices;
 			 emu_dev < caniot_devices + ARRAY_SIZE(caniot_devices); emu_dev++) {
 			if (caniot_deviceid_match(emu_dev->id.did,
@@ -523,4 +694,269 @@ error:
 int emu_caniot_send(struct caniot_frame *f)
 {
 	return k_msgq_put(&emu_caniot_txq, f, K_NO_WAIT);
-}
\ No newline at end of file
+}
+#if defined(CONFIG_APP_HA_EMU_LOADGEN)
+
+#define LOADGEN_START_DELAY_MS 5000u
+#define LOADGEN_DEVICES		   CONFIG_APP_HA_EMU_LOADGEN_DEVICES
+
+/* Ingestion latency histogram, bucket i counts latencies in [2^(i-1), 2^i[ us */
+#define LOADGEN_LATENCY_BUCKETS 24u
+
+/* Byte 3 of the loadgen addresses, distinguishes them from the regular
+ * emulated sensors, bytes 4 and 5 hold the device index */
+#define LOADGEN_ADDR_TAG 0x0Bu
+
+static struct {
+	uint32_t offered;  /* Records passed to the HA core */
+	uint32_t ingested; /* Records accepted by the HA core */
+	uint32_t notified; /* Events received by the loadgen subscription */
+
+	uint32_t can_queries;
+	uint32_t can_answered;
+	uint32_t can_rtt_max_ms;
+
+	uint32_t latency[LOADGEN_LATENCY_BUCKETS];
+
+	bool running;
+} loadgen;
+
+static void loadgen_offer(uint32_t i)
+{
+	xiaomi_record_t record;
+	const uint16_t idx = i % LOADGEN_DEVICES;
+	uint32_t cycles;
+
+	bt_addr_le_copy(&record.addr, &addrs[0]);
+	record.addr.a.val[3u] = LOADGEN_ADDR_TAG;
+	record.addr.a.val[4u] = idx >> 8u;
+	record.addr.a.val[5u] = idx & 0xFFu;
+
+	record.time						  = sys_time_get();
+	record.measurements.battery_level = i % 100;
+	record.measurements.temperature	  = i % 1000;
+	record.measurements.rssi		  = i % 100;
+
+	/* The record carries the cycle count when it is offered, several records
+	 * of the same device can be in flight (see loadgen_offered_cycles()) */
+	cycles						   = k_cycle_get_32();
+	record.measurements.humidity   = cycles >> 16u;
+	record.measurements.battery_mv = cycles & 0xFFFFu;
+	loadgen.offered++;
+
+	if (ha_dev_xiaomi_register_record(&record) == 0) {
+		loadgen.ingested++;
+	}
+}
+
+static uint32_t loadgen_latency_percentile(uint32_t total, uint32_t percent)
+{
+	uint32_t cumul		 = 0u;
+	const uint32_t limit = DIV_ROUND_UP(total * percent, 100u);
+
+	for (uint32_t b = 0u; b < LOADGEN_LATENCY_BUCKETS; b++) {
+		cumul += loadgen.latency[b];
+		if (cumul >= limit) {
+			return 1u << b; /* Bucket upper bound (us) */
+		}
+	}
+
+	return 1u << (LOADGEN_LATENCY_BUCKETS - 1u);
+}
+
+static void loadgen_report(const struct ha_stats *before,
+						   const struct ha_stats *after,
+						   uint32_t elapsed)
+{
+	const uint32_t total = loadgen.notified;
+
+#define LOADGEN_DELTA(_field) (after->_field - before->_field)
+
+	LOG_INF("Loadgen: %u devices, %u ms, %u events offered (%u/s), %u ingested, "
+			"%u notified",
+			LOADGEN_DEVICES, elapsed, loadgen.offered,
+			loadgen.offered * MSEC_PER_SEC / MAX(elapsed, 1u), loadgen.ingested,
+			loadgen.notified);
+	LOG_INF("Loadgen: drops ev=%u data=%u no_mem=%u no_ep=%u ep=%u payload_size=%u "
+			"no_data_mem=%u ingest=%u never_ref=%u",
+			LOADGEN_DELTA(ev_dropped), LOADGEN_DELTA(ev_data_dropped),
+			LOADGEN_DELTA(ev_no_mem), LOADGEN_DELTA(ev_no_ep), LOADGEN_DELTA(ev_ep),
+			LOADGEN_DELTA(ev_payload_size), LOADGEN_DELTA(ev_no_data_mem),
+			LOADGEN_DELTA(ev_ingest), LOADGEN_DELTA(ev_never_ref));
+	LOG_INF("Loadgen: devices dropped=%u no_mem=%u, events in use %u (remaining %u)",
+			LOADGEN_DELTA(dev_dropped), LOADGEN_DELTA(dev_no_mem), after->mem_ev_count,
+			after->mem_ev_remaining);
+
+#undef LOADGEN_DELTA
+
+	if (total != 0u) {
+		LOG_INF("Loadgen: ingestion latency p50 <%u us p90 <%u us p99 <%u us",
+				loadgen_latency_percentile(total, 50u),
+				loadgen_latency_percentile(total, 90u),
+				loadgen_latency_percentile(total, 99u));
+	}
+
+	LOG_INF("Loadgen: CAN %u queries, %u answered (rtt max %u ms), %u frames, %u lost",
+			loadgen.can_queries, loadgen.can_answered, loadgen.can_rtt_max_ms,
+			emu_can_stats.frames, emu_can_stats.lost);
+}
+
+void emu_loadgen_thread(void *_a, void *_b, void *_c)
+{
+	struct ha_stats before, after;
+	uint32_t seq = 0u, steady = 0u, bursts = 0u;
+
+	ha_stats_copy(&before);
+
+	loadgen.running		 = true;
+	const uint32_t start = k_uptime_get_32();
+	uint32_t elapsed	 = 0u;
+
+	while (elapsed < CONFIG_APP_HA_EMU_LOADGEN_DURATION_MS) {
+		/* Steady rate */
+		const uint64_t due = (uint64_t)elapsed * CONFIG_APP_HA_EMU_LOADGEN_RATE /
+							 MSEC_PER_SEC;
+		for (; steady < due; steady++) {
+			loadgen_offer(seq++);
+		}
+
+		/* Bursts on top of the steady rate */
+		if (CONFIG_APP_HA_EMU_LOADGEN_BURST_SIZE > 0 &&
+			elapsed / CONFIG_APP_HA_EMU_LOADGEN_BURST_PERIOD_MS >= bursts) {
+			for (uint32_t b = 0u; b < CONFIG_APP_HA_EMU_LOADGEN_BURST_SIZE; b++) {
+				loadgen_offer(seq++);
+			}
+			bursts++;
+		}
+
+		k_sleep(K_MSEC(1u));
+		elapsed = k_uptime_get_32() - start;
+	}
+
+	loadgen.running = false;
+
+	/* Let the subscriber drain the pending events */
+	k_sleep(K_MSEC(500u));
+
+	ha_stats_copy(&after);
+
+	loadgen_report(&before, &after, elapsed);
+}
+
+/* Humidity (upper half) and battery voltage (lower half) fields are copied as
+ * is from the record to the event data */
+static uint32_t loadgen_offered_cycles(const ha_ev_t *ev)
+{
+	const struct ha_ds_xiaomi *ds = ev->data;
+
+	return ((uint32_t)ds->humidity.value << 16u) | ds->battery_level.voltage;
+}
+
+/* Count the notified events and measure the time since they were offered */
+void emu_loadgen_consumer(void *_a, void *_b, void *_c)
+{
+	ha_ev_subs_t *sub;
+	ha_ev_t *events[EMU_CONSUMER_EV_BATCH];
+
+	struct ha_ev_subs_conf conf = {
+		.flags		 = HA_EV_SUBS_CONF_DEVICE_DATA | HA_EV_SUBS_CONF_DEVICE_TYPE,
+		.device_type = HA_DEV_TYPE_XIAOMI_MIJIA,
+	};
+
+	int ret = ha_subscribe(&conf, &sub);
+	if (ret != 0) {
+		LOG_ERR("Loadgen failed to subscribe to events, ret=%d", ret);
+		return;
+	}
+
+	for (;;) {
+		ret = ha_ev_wait_many(sub, events, ARRAY_SIZE(events), K_FOREVER);
+		if (ret <= 0) continue;
+
+		const uint32_t now = k_cycle_get_32();
+
+		for (int i = 0; i < ret; i++) {
+			const uint8_t *val = events[i]->dev->addr.mac.addr.ble.a.val;
+			const uint16_t idx = (val[4u] << 8u) | val[5u];
+
+			if ((val[3u] == LOADGEN_ADDR_TAG) && (idx < LOADGEN_DEVICES)) {
+				const uint32_t us =
+					k_cyc_to_us_floor32(now - loadgen_offered_cycles(events[i]));
+				const uint32_t b = (us == 0u) ? 0u : LOG2(us) + 1u;
+
+				loadgen.latency[MIN(b, LOADGEN_LATENCY_BUCKETS - 1u)]++;
+				loadgen.notified++;
+			}
+		}
+
+		ha_ev_unref_many(events, ret);
+	}
+}
+
+K_THREAD_DEFINE(emu_loadgen,
+				1024u,
+				emu_loadgen_thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10u),
+				0u,
+				LOADGEN_START_DELAY_MS);
+
+/* Higher priority than the producer, so that events are drained */
+K_THREAD_DEFINE(emu_loadgen_consumer1,
+				1024u,
+				emu_loadgen_consumer,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(9u),
+				0u,
+				CONSUMER_THREADS_START_DELAY_MS);
+
+#if CONFIG_APP_HA_EMU_LOADGEN_CAN_QUERY_RATE > 0
+
+/* Query the telemetry of the emulated CANIOT boards while the load is
+ * generated */
+void emu_loadgen_can_thread(void *_a, void *_b, void *_c)
+{
+	struct caniot_frame req;
+	struct caniot_frame resp;
+
+	while (!loadgen.running) {
+		k_sleep(K_MSEC(100u));
+	}
+
+	while (loadgen.running) {
+		const struct emu_caniot_device *emu_dev =
+			&caniot_devices[sys_rand32_get() % ARRAY_SIZE(caniot_devices)];
+		uint32_t timeout = 200u;
+
+		caniot_build_query_telemetry(&req, CANIOT_ENDPOINT_BOARD_CONTROL);
+
+		/* On answer, timeout holds the round trip time */
+		int ret = ha_caniot_controller_query(&req, &resp, emu_dev->id.did, &timeout);
+
+		loadgen.can_queries++;
+		if (ret > 0) {
+			loadgen.can_answered++;
+			loadgen.can_rtt_max_ms = MAX(loadgen.can_rtt_max_ms, timeout);
+		}
+
+		k_sleep(K_MSEC(MSEC_PER_SEC / CONFIG_APP_HA_EMU_LOADGEN_CAN_QUERY_RATE));
+	}
+}
+
+K_THREAD_DEFINE(emu_loadgen_can,
+				1024u,
+				emu_loadgen_can_thread,
+				NULL,
+				NULL,
+				NULL,
+				K_PRIO_PREEMPT(10u),
+				0u,
+				LOADGEN_START_DELAY_MS);
+
+#endif /* CONFIG_APP_HA_EMU_LOADGEN_CAN_QUERY_RATE > 0 */
+
+#endif /* CONFIG_APP_HA_EMU_LOADGEN */
@@ -10,6 +10,9 @@ struct json_device_base {
 	// int32_t rel_time;
 
 	uint32_t timestamp;
+
+	/* Milliseconds since the epoch */
+	int64_t timestamp_ms;
 };
 
 struct json_xiaomi_record_measures {
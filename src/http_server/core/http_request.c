@@ -107,7 +107,7 @@ static void mark_discarded(http_request_t *req, http_request_discard_reason_t re
 	((http_request_t *)CONTAINER_OF(p_parser, http_request_t, parser))
 
 /* forward declaration */
-static void reset_header_buffers_cursor(void);
+static void reset_headers(http_request_t *req);
 
 int on_message_begin(struct http_parser *parser)
 {
@@ -116,7 +116,7 @@ int on_message_begin(struct http_parser *parser)
 	LOG_DBG("(%p) on_message_begin", req);
 
 	/* Reset headers buffer context */
-	reset_header_buffers_cursor();
+	reset_headers(req);
 
 	return 0;
 }
@@ -233,37 +233,59 @@ static int header_content_type_handler(http_request_t *req,
 	return 0;
 }
 
-static char hdrbuf[CONFIG_APP_HTTP_REQUEST_HEADERS_BUFFER_SIZE];
-static size_t hdr_allocated = 0U;
+static uint32_t header_name_hash(const char *name)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
 
-static struct http_header *alloc_header_buffer(size_t value_size)
+static struct http_header **header_index_slot(http_request_t *req,
+											  const char *name,
+											  uint32_t hash,
+											  bool free_slot)
 {
-	struct http_header *hdr = NULL;
-	const size_t allocsize	= sizeof(struct http_header) + value_size;
+	const uint32_t mask = HTTP_REQUEST_HEADERS_INDEX_SIZE - 1u;
 
-	if (hdr_allocated + allocsize <= sizeof(hdrbuf)) {
-		hdr = (struct http_header *)&hdrbuf[hdr_allocated];
-		hdr_allocated += allocsize;
+	for (uint32_t i = 0u; i < HTTP_REQUEST_HEADERS_INDEX_SIZE; i++) {
+		struct http_header **slot = &req->hdr_index[(hash + i) & mask];
+
+		if (*slot == NULL) {
+			return free_slot ? slot : NULL;
+		} else if (!free_slot && ((*slot)->hash == hash) &&
+				   (strcmp((*slot)->name, name) == 0)) {
+			return slot;
+		}
 	}
 
-	return hdr;
+	return NULL;
 }
 
-static void reset_header_buffers_cursor(void)
+static void reset_headers(http_request_t *req)
 {
-	hdr_allocated = 0U;
+	if (req->hdr_arena != NULL) {
+		kcontig_reset(req->hdr_arena);
+	}
+
+	sys_dlist_init(&req->headers);
+	memset(req->hdr_index, 0, sizeof(req->hdr_index));
+	req->hdr_retained = 0u;
+	req->hdr_dropped  = 0u;
 }
 
 /**
  * @brief Store the header (name and value) to a buffer and keep it until
  *  the application finishes to process the request.
  *
- * If cannot allocate context for the header, the request is discarded.
- *
- * Header name and value are stored until a certain size.
- * - Header name max size: 24
- * - Header value max size: 64
- * - Maximal number of headers: 8
+ * Headers are allocated from the session arena and indexed by name hash.
+ * If the arena (or the index) is full, the header is dropped and counted
+ * in "hdr_dropped".
  *
  * @param req
  * @param hdr
@@ -275,15 +297,29 @@ static int header_keep(http_request_t *req,
 					   const char *value,
 					   size_t length)
 {
-	/* We should include EOS in the length */
-	struct http_header *buf = alloc_header_buffer(length + 1U);
+	struct http_header *buf	  = NULL;
+	struct http_header **slot = NULL;
+	const uint32_t hash		  = header_name_hash(hdr->name);
+
+	if (req->hdr_arena != NULL) {
+		slot = header_index_slot(req, hdr->name, hash, true);
+	}
+
+	if (slot != NULL) {
+		/* We should include EOS in the length */
+		buf = kcontig_alloc(req->hdr_arena, sizeof(struct http_header) + length + 1U);
+	}
 
 	if (buf != NULL) {
 		buf->name = hdr->name;
+		buf->hash = hash;
 		memcpy(buf->value, value, length);
 		buf->value[length] = '\0';
 		sys_dlist_append(&req->headers, &buf->handle);
+		*slot			  = buf;
+		req->hdr_retained = kcontig_allocated(req->hdr_arena);
 	} else {
+		req->hdr_dropped++;
 		LOG_WRN("(%p) Cannot allocate header buffer for %s", req, hdr->name);
 	}
 
@@ -302,6 +338,12 @@ static const struct header headers[] = {
 	HEADER("App-Script-Filename", header_keep),
 	HEADER("App-sha1", header_keep),
 
+#if defined(CONFIG_APP_HTTP_WEBSOCKET)
+	HEADER("Upgrade", header_keep),
+	HEADER("Sec-WebSocket-Key", header_keep),
+	HEADER("Sec-WebSocket-Version", header_keep),
+#endif /* CONFIG_APP_HTTP_WEBSOCKET */
+
 #if defined(CONFIG_APP_HTTP_TEST_SERVER)
 	HEADER("App-Test-Header1", header_keep),
 	HEADER("App-Test-Header2", header_keep),
@@ -358,9 +400,9 @@ static int on_headers_complete(struct http_parser *parser)
 	const bool content_length_present = parser->flags & F_CONTENTLENGTH;
 	const int content_length = content_length_present ? parser->content_length : -1;
 
-	LOG_INF("(%p) Headers complete %s %s content len=%d [hdr buf %u/%u]", req,
-			http_method_str(method), req->url, content_length, hdr_allocated,
-			CONFIG_APP_HTTP_REQUEST_HEADERS_BUFFER_SIZE);
+	LOG_INF("(%p) Headers complete %s %s content len=%d [hdr buf %u/%u dropped %u]",
+			req, http_method_str(method), req->url, content_length, req->hdr_retained,
+			CONFIG_APP_HTTP_REQUEST_HEADERS_BUFFER_SIZE, req->hdr_dropped);
 
 	/* For debug */
 	if (req->_url_copy != NULL) {
@@ -465,13 +507,10 @@ static int on_message_complete(struct http_parser *parser)
 	/* Force the parser to pause and give control back to the application
 	 * so that it can process it and send the response.
 	 *
-	 * Note: in case of bad implementation of the HTTP client :
-	 * If two HTTP requests are being received and parsed in the
-	 * same "http_parser_execute" call, before a reponse is sent from the
-	 * current server for the 1st request. Then it means that the client
-	 * sent (TCP) two HTTP requests while not waiting for the response for
-	 * the 1st request. If this case happens the current server will closes
-	 * the connection.
+	 * Note: If the client pipelines requests (i.e. sends the next request
+	 * before receiving the response for the current one), the bytes
+	 * following the current request are left unparsed and kept by the
+	 * session to be processed once the current response is sent.
 	 */
 	http_parser_pause(parser, 1);
 
@@ -533,31 +572,29 @@ int http_req_route_arg_get_number_by_index(http_request_t *req,
 											 (uint32_t)rel_index, value);
 }
 
-bool http_request_parse_buf(http_request_t *req, char *buf, size_t len)
+int http_request_parse_buf(http_request_t *req, char *buf, size_t len)
 {
 	__ASSERT_NO_MSG(req != NULL);
 	__ASSERT_NO_MSG(buf != NULL);
 
-	bool success		= true;
 	const size_t parsed = http_parser_execute(&req->parser, &parser_settings, buf, len);
 
 	if (parsed != len) {
 		const bool paused = HTTP_PARSER_ERRNO(&req->parser) == HPE_PAUSED;
 
 		if (paused && req->complete) {
-			LOG_ERR("(%p) Request malformed, more "
-					"data to parse rem=%u",
-					req, len);
+			/* Pipelined request(s) following the current one */
+			LOG_DBG("(%p) Request complete, %u B left to parse", req,
+					len - parsed);
 		} else {
 			LOG_ERR("Unexpected HTTP parser pause parsed/len = "
 					"%u/%u",
 					parsed, len);
+			return -EINVAL;
 		}
-
-		success = false;
 	}
 
-	return success;
+	return (int)parsed;
 }
 
 void http_request_discard(http_request_t *req, http_request_discard_reason_t reason)
@@ -570,16 +607,10 @@ void http_request_discard(http_request_t *req, http_request_discard_reason_t rea
 
 const char *http_header_get_value(http_request_t *req, const char *hdr_name)
 {
-	const char *value		= NULL;
-	struct http_header *hdr = NULL;
-	SYS_DLIST_FOR_EACH_CONTAINER (&req->headers, hdr, handle) {
-		if (strcmp(hdr->name, hdr_name) == 0) {
-			value = (const char *)hdr->value;
-			break;
-		}
-	}
+	struct http_header **slot =
+		header_index_slot(req, hdr_name, header_name_hash(hdr_name), false);
 
-	return value;
+	return slot ? (const char *)(*slot)->value : NULL;
 }
 
 int http_req_route_arg_get(http_request_t *req, const char *name, uint32_t *value)
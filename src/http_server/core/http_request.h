@@ -10,6 +10,7 @@
 #include "http_utils.h"
 #include "routes.h"
 #include "utils/buffers.h"
+#include "utils/contig_alloc.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -71,9 +72,13 @@ typedef enum {
 
 #define HTTP_HEADER_FROM_HANDLE(hp) CONTAINER_OF(hp, struct http_header, handle)
 
+/* Number of slots of the request headers hash index (power of 2) */
+#define HTTP_REQUEST_HEADERS_INDEX_SIZE 16u
+
 struct http_header {
 	sys_dnode_t handle;
 	const char *name;
+	uint32_t hash;
 	char value[];
 };
 
@@ -130,10 +135,25 @@ struct http_request {
 	/* Header currently being parsed */
 	const struct http_header_handler *_parsing_cur_header;
 
-	/* TODO headers values (dynamically allocated and freed, using
-	 * HEAP/MEMSLAB ) like authentication, etc ... */
+	/* Kept headers values (e.g. Authorization), allocated from "hdr_arena" */
 	sys_dlist_t headers;
 
+	/**
+	 * @brief Arena the kept headers are allocated from, owned by the session
+	 *
+	 * Note: If NULL, no header is kept
+	 */
+	struct kcontig *hdr_arena;
+
+	/* Open addressing index of the kept headers, by name hash */
+	struct http_header *hdr_index[HTTP_REQUEST_HEADERS_INDEX_SIZE];
+
+	/* Number of header bytes retained in the arena for this request */
+	uint16_t hdr_retained;
+
+	/* Number of headers which could not be kept (arena or index full) */
+	uint8_t hdr_dropped;
+
 	/**
 	 * @brief Request content type
 	 */
@@ -245,6 +265,15 @@ struct http_request {
 	 */
 	size_t flush_len;
 
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+	/* Uptime (ms) and cycle counter when the first byte was received */
+	uint32_t first_byte_ms;
+	uint32_t first_byte_cycles;
+
+	/* Bytes received for the request (headers and payload) */
+	uint32_t rx_bytes;
+#endif
+
 	/**
 	 * @brief One parser per connection
 	 * - In order to process connections asynchronously
@@ -318,13 +347,16 @@ int http_req_route_arg_get_string(http_request_t *req, const char *name, char **
 /**
  * @brief Parse the received buffer as a HTTP request
  *
+ * Parsing stops once the request is complete, the remaining bytes
+ * (if any) belong to the next (pipelined) request.
+ *
  * @param req Current HTTP request
  * @param data Received data
  * @param len Length of the received data
- * @return true On success
- * @return false On error
+ * @return int Number of bytes consumed by the request on success,
+ *  negative value on error
  */
-bool http_request_parse_buf(http_request_t *req, char *buf, size_t len);
+int http_request_parse_buf(http_request_t *req, char *buf, size_t len);
 
 /**
  * @brief Mark the request as discarded
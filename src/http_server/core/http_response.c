@@ -6,6 +6,8 @@
 
 #include "http_response.h"
 
+#include <errno.h>
+
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(http_response, LOG_LEVEL_WRN);
 
@@ -88,4 +90,52 @@ void http_response_enable_chunk_encoding(http_response_t *resp)
 bool http_response_is_chunked(http_response_t *resp)
 {
 	return (bool)resp->chunked;
-}
\ No newline at end of file
+}
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+static int push_set(http_response_t *resp,
+					const struct http_push_handler *handler,
+					void *ctx,
+					bool raw)
+{
+	if (!handler || !handler->fill || !handler->close) {
+		return -EINVAL;
+	}
+
+	if (set_header_check(resp, "Push") == false) {
+		return -EALREADY;
+	}
+
+	resp->push.handler = handler;
+	resp->push.ctx	   = ctx;
+	resp->push.raw	   = raw;
+
+	return 0;
+}
+
+int http_response_push(http_response_t *resp,
+					   const struct http_push_handler *handler,
+					   void *ctx)
+{
+	int ret = push_set(resp, handler, ctx, false);
+
+	if (ret == 0) {
+		http_response_enable_chunk_encoding(resp);
+	}
+
+	return ret;
+}
+
+int http_response_upgrade(http_response_t *resp,
+						  const struct http_push_handler *handler,
+						  void *ctx)
+{
+	int ret = push_set(resp, handler, ctx, true);
+
+	if (ret == 0) {
+		resp->status_code = HTTP_STATUS_SWITCHING_PROTOCOLS;
+	}
+
+	return ret;
+}
+#endif
@@ -15,6 +15,52 @@
 
 #define HTTP_DEFAULT_RESP_STATUS_CODE HTTP_STATUS_OK
 
+/* Base64 encoded SHA-1 */
+#define HTTP_WS_ACCEPT_STR_LEN 28u
+
+struct http_push_handler {
+	/**
+	 * @brief Fill the buffer with the data to push to the client
+	 *
+	 * Note: Called from the HTTP server thread when notified with
+	 *  http_server_push_notify() or when the session is idle.
+	 *
+	 * @param ctx Push context given to http_response_push()
+	 * @param buf Buffer to fill, can be left empty if nothing to push
+	 * @param idle True if nothing was pushed for the session timeout, the
+	 *  handler should push something to keep the connection alive.
+	 * @return int 0 on success, negative value to end the response
+	 */
+	int (*fill)(void *ctx, buffer_t *buf, bool idle);
+
+	/**
+	 * @brief Release the push context, called once when the response ends
+	 * (connection closed or fill() error)
+	 */
+	void (*close)(void *ctx);
+
+	/**
+	 * @brief Handle data received from the client while pushing (optional,
+	 * received data is discarded if NULL)
+	 *
+	 * @param ctx Push context
+	 * @param data Received data
+	 * @param len Length of the received data
+	 * @param reply Buffer to fill with data to send back to the client
+	 * @return int 0 on success, negative value to end the response
+	 */
+	int (*recv)(void *ctx, char *data, size_t len, buffer_t *reply);
+};
+
+struct http_push {
+	const struct http_push_handler *handler;
+	void *ctx;
+
+	/* Data is pushed as is (no chunked encoding), e.g. after a protocol
+	 * upgrade */
+	uint8_t raw : 1u;
+};
+
 typedef struct http_response {
 	/**
 	 * @brief Content-type to be encoded in the header
@@ -69,6 +115,22 @@ typedef struct http_response {
 	 * Total number of bytes sent in the payload
 	 */
 	size_t payload_sent;
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+	/**
+	 * @brief If set, the response is kept open once the handler completes
+	 * and the session pushes data (as chunks) when notified.
+	 */
+	struct http_push push;
+#endif
+
+#if defined(CONFIG_APP_HTTP_WEBSOCKET)
+	/**
+	 * @brief Sec-WebSocket-Accept header value, for
+	 * HTTP_STATUS_SWITCHING_PROTOCOLS responses
+	 */
+	char ws_accept[HTTP_WS_ACCEPT_STR_LEN + 1u];
+#endif
 } http_response_t;
 
 void http_response_init(http_response_t *resp);
@@ -96,4 +158,38 @@ void http_response_enable_chunk_encoding(http_response_t *resp);
 
 bool http_response_is_chunked(http_response_t *resp);
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+/**
+ * @brief Keep the response open after the handler completes, further data
+ * is pushed using the given handler (chunked encoding is enabled).
+ *
+ * Note: The push context is released with handler->close() in any case,
+ *  even if the response fails to be sent.
+ *
+ * @param resp
+ * @param handler Push handler
+ * @param ctx Push context
+ * @return int 0 on success, negative value on error
+ */
+int http_response_push(http_response_t *resp,
+					   const struct http_push_handler *handler,
+					   void *ctx);
+
+/**
+ * @brief Switch the connection to another protocol once the response
+ * headers are sent (status 101), data is then exchanged as is using the
+ * given handler.
+ *
+ * Note: The push context is released with handler->close() in any case.
+ *
+ * @param resp
+ * @param handler Push handler
+ * @param ctx Push context
+ * @return int 0 on success, negative value on error
+ */
+int http_response_upgrade(http_response_t *resp,
+						  const struct http_push_handler *handler,
+						  void *ctx);
+#endif
+
 #endif
\ No newline at end of file
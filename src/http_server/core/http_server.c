@@ -14,7 +14,9 @@
 #include "http_utils.h"
 #include "routes.h"
 #include "utils/buffers.h"
+#include "utils/log_ratelimit.h"
 #include "utils/misc.h"
+#include "utils/trace.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -30,11 +32,16 @@
 #include <zephyr/net/tls_verify_cb.h>
 #include <zephyr/posix/poll.h>
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+#include <sys/eventfd.h>
+#endif
+
 #include <fcntl.h>
 #include <mbedtls/oid.h>
 #include <mbedtls/x509_crt.h>
 #include <user/auth.h>
 LOG_MODULE_REGISTER(http_server, LOG_LEVEL_INF); /* INF */
+LOG_RATELIMIT_REGISTER(10u, 1000u);
 
 /* O_NONBLOCK */
 #define SOCK_BLOCKING_OPT 0u
@@ -52,6 +59,12 @@ LOG_MODULE_REGISTER(http_server, LOG_LEVEL_INF); /* INF */
 #error "No server socket configured"
 #endif
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+#define PUSH_FD_COUNT 1u
+#else
+#define PUSH_FD_COUNT 0u
+#endif
+
 // externs
 extern size_t strnlen(const char *, size_t);
 
@@ -87,6 +100,70 @@ __buf_noinit_section char buffer_internal[CONFIG_APP_HTTP_HEADERS_BUFFER_SIZE];
 
 static struct http_stats stats;
 
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_HTTP_ROUTE_STATS_SLOTS),
+			 "Route stats table size must be a power of 2");
+
+/* Per route statistics, open addressing table indexed by the route descriptor
+ * address. Only accessed from the HTTP server thread (route handlers included),
+ * so no locking is needed. */
+static struct http_route_stats route_stats[CONFIG_APP_HTTP_ROUTE_STATS_SLOTS];
+
+static struct http_route_stats *route_stats_lookup(const struct route_descr *route)
+{
+	const uint32_t mask = CONFIG_APP_HTTP_ROUTE_STATS_SLOTS - 1u;
+
+	/* Descriptors are word aligned, mix the address bits */
+	uint32_t slot = ((((uint32_t)(uintptr_t)route) >> 2u) * 0x9E3779B1u) >> 16u;
+
+	for (uint32_t i = 0u; i < CONFIG_APP_HTTP_ROUTE_STATS_SLOTS; i++) {
+		struct http_route_stats *const rs = &route_stats[slot & mask];
+
+		if (rs->route == route) {
+			return rs;
+		} else if (rs->route == NULL) {
+			rs->route = route;
+			return rs;
+		}
+
+		slot++;
+	}
+
+	/* Table full */
+	return NULL;
+}
+
+static void route_stats_record(const http_request_t *req, const http_response_t *resp)
+{
+	uint32_t duration_us;
+
+	if (req->route == NULL) {
+		return;
+	}
+
+	struct http_route_stats *const rs = route_stats_lookup(req->route);
+	if (rs == NULL) {
+		stats.route_stats_dropped++;
+		return;
+	}
+
+	/* The cycle counter wraps after a few seconds, long requests are
+	 * measured with the uptime */
+	const uint32_t elapsed_ms = k_uptime_get_32() - req->first_byte_ms;
+	if (elapsed_ms >= MSEC_PER_SEC) {
+		duration_us = MIN(elapsed_ms, UINT32_MAX / USEC_PER_MSEC) * USEC_PER_MSEC;
+	} else {
+		duration_us = k_cyc_to_us_floor32(k_cycle_get_32() - req->first_byte_cycles);
+	}
+
+	rs->count++;
+	rs->rx += req->rx_bytes;
+	rs->tx += resp->headers_sent + resp->payload_sent;
+	rs->duration_us += duration_us;
+	rs->buckets[http_route_hist_bucket(duration_us)]++;
+}
+#endif /* CONFIG_APP_HTTP_ROUTE_STATS */
+
 /**
  * @brief
  * - 1 TCP socket for HTTP
@@ -94,13 +171,16 @@ static struct http_stats stats;
  * - 3 client sockets
  */
 static union {
-	struct pollfd array[CONFIG_APP_HTTP_MAX_SESSIONS + SERVER_FD_COUNT];
+	struct pollfd array[CONFIG_APP_HTTP_MAX_SESSIONS + SERVER_FD_COUNT + PUSH_FD_COUNT];
 	struct {
 #if defined(CONFIG_APP_HTTP_SERVER_NONSECURE)
 		struct pollfd srv; /* unsecure server socket */
 #endif
 #if defined(CONFIG_APP_HTTP_SERVER_SECURE)
 		struct pollfd sec; /* secure server socket */
+#endif
+#if defined(CONFIG_APP_HTTP_PUSH)
+		struct pollfd push; /* eventfd notifying data to push */
 #endif
 		struct pollfd cli[CONFIG_APP_HTTP_MAX_SESSIONS];
 	};
@@ -285,6 +365,20 @@ int setup_sockets(void)
 	}
 #endif
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+	ret = eventfd(0, EFD_NONBLOCK);
+	if (ret < 0) {
+		LOG_ERR("Failed to create push eventfd = %d", ret);
+		goto exit;
+	}
+
+	fds.push.fd		= ret;
+	fds.push.events = POLLIN;
+
+	/* Polled along with the server sockets */
+	servers_count++;
+#endif
+
 	clients_count = 0;
 	ret			  = 0;
 exit:
@@ -337,8 +431,8 @@ static int srv_accept(int serv_sock, bool secure)
 		goto exit;
 	}
 
-	char ipv4_str[NET_IPV4_ADDR_LEN];
-	ipv4_to_str(&addr.sin_addr, ipv4_str, sizeof(ipv4_str));
+	/* The address bytes are logged as arguments rather than formatted here */
+	const uint8_t *const ip = addr.sin_addr.s4_addr;
 
 	LOG_DBG("(%d) Accepted session, cli sock = "
 			"(%d)",
@@ -347,16 +441,16 @@ static int srv_accept(int serv_sock, bool secure)
 	sess = http_session_alloc();
 	if (sess == NULL) {
 		stats.conn_alloc_failed++;
-		LOG_WRN("(%d) Connection refused from %s:%d, cli sock = (%d)", serv_sock,
-				ipv4_str, htons(addr.sin_port), sock);
+		LOG_WRN_RL("(%d) Connection refused from %u.%u.%u.%u:%d, cli sock = (%d)",
+				   serv_sock, ip[0], ip[1], ip[2], ip[3], ntohs(addr.sin_port), sock);
 
 		zsock_close(sock);
 
 		ret = -1;
 		goto exit;
 	} else {
-		LOG_INF("(%d) Connection accepted from %s:%d, cli sock = (%d)", serv_sock,
-				ipv4_str, htons(addr.sin_port), sock);
+		LOG_INF_RL("(%d) Connection accepted from %u.%u.%u.%u:%d, cli sock = (%d)",
+				   serv_sock, ip[0], ip[1], ip[2], ip[3], ntohs(addr.sin_port), sock);
 
 		__ASSERT_NO_MSG(clients_count < CONFIG_APP_HTTP_MAX_SESSIONS);
 
@@ -391,7 +485,129 @@ exit:
 	return ret;
 }
 
-static void handle_active_sessions(void)
+#if defined(CONFIG_APP_HTTP_PUSH)
+
+void http_server_push_notify(void)
+{
+	eventfd_write(fds.push.fd, 1);
+}
+
+static int sendall(int sock, char *buf, size_t len);
+static int send_chunk_data(int sock, const char *data, size_t len);
+
+static int push_send(http_session_t *sess, char *data, size_t len)
+{
+	if (sess->push.raw) {
+		return sendall(sess->sock, data, len);
+	} else {
+		return send_chunk_data(sess->sock, data, len);
+	}
+}
+
+static bool push_session(http_session_t *sess, bool idle)
+{
+	int ret;
+	buffer_t buf;
+
+	/* No request is being processed, the buffer is available */
+	buffer_init(&buf, buffer, sizeof(buffer));
+
+	ret = sess->push.handler->fill(sess->push.ctx, &buf, idle);
+
+	if ((buf.filling != 0u) && (push_send(sess, buf.data, buf.filling) < 0)) {
+		goto close;
+	}
+
+	if (ret < 0) {
+		LOG_INF("(%d) Push ended = %d", sess->sock, ret);
+		if (!sess->push.raw) {
+			sendall(sess->sock, "0\r\n\r\n", 5u);
+		}
+		goto close;
+	}
+
+	sess->keep_alive.last_activity = k_uptime_get_32();
+
+	return true;
+close:
+	return false;
+}
+
+/* Pass client data to the push handler */
+static bool push_session_handle_data(http_session_t *sess, char *data, size_t len)
+{
+	int ret;
+	buffer_t reply;
+
+	/* Data is discarded if the handler doesn't expect any */
+	if (sess->push.handler->recv == NULL) {
+		return true;
+	}
+
+	/* Headers buffer is not used while pushing */
+	buffer_init(&reply, buffer_internal, sizeof(buffer_internal));
+
+	ret = sess->push.handler->recv(sess->push.ctx, data, len, &reply);
+
+	if ((reply.filling != 0u) && (push_send(sess, reply.data, reply.filling) < 0)) {
+		return false;
+	}
+
+	if (ret < 0) {
+		LOG_INF("(%d) Push ended by recv = %d", sess->sock, ret);
+		return false;
+	}
+
+	sess->keep_alive.last_activity = k_uptime_get_32();
+
+	return true;
+}
+
+static bool push_session_recv(http_session_t *sess)
+{
+	/* 0 means the connection is closed by the peer */
+	int rc = zsock_recv(sess->sock, buffer, sizeof(buffer), ZSOCK_MSG_DONTWAIT);
+	if (rc <= 0) {
+		return (rc < 0) && (errno == EAGAIN);
+	}
+
+	stats.rx += rc;
+
+	return push_session_handle_data(sess, buffer, rc);
+}
+
+/* Handle the data received along with the request which switched the
+ * session to push. After a protocol upgrade (e.g. WebSocket), it belongs to
+ * the new protocol, otherwise the client is not expected to send anything. */
+static bool push_session_pipelined(http_session_t *sess)
+{
+	const size_t len   = sess->pipeline.len;
+	sess->pipeline.len = 0u;
+
+	if (len == 0u) {
+		return true;
+	} else if (sess->push.raw) {
+		return push_session_handle_data(sess, sess->pipeline.buf, len);
+	} else {
+		LOG_WRN("(%d) %u unexpected bytes after push request, closing", sess->sock,
+				len);
+		return false;
+	}
+}
+
+static void push_release(struct http_push *push)
+{
+	if (push->handler != NULL) {
+		push->handler->close(push->ctx);
+		push->handler = NULL;
+		push->ctx	  = NULL;
+		stats.push_closed_count++;
+	}
+}
+
+#endif /* CONFIG_APP_HTTP_PUSH */
+
+static void handle_active_sessions(bool push_notified)
 {
 	uint8_t idx = 0;
 	http_session_t *sess;
@@ -405,9 +621,33 @@ static void handle_active_sessions(void)
 		sess = http_session_get_by_sock(fds.cli[idx].fd);
 		__ASSERT_NO_MSG(sess != NULL);
 
-		if (fds.cli[idx].revents & POLLIN) {
-			/* data available */
-			close = process_request(sess) != true;
+		if (http_session_is_pushing(sess)) {
+#if defined(CONFIG_APP_HTTP_PUSH)
+			if (fds.cli[idx].revents & (POLLHUP | POLLERR)) {
+				close = true;
+			} else if (fds.cli[idx].revents & POLLIN) {
+				close = push_session_recv(sess) != true;
+			}
+
+			if (!close && (push_notified || http_session_is_outdated(sess))) {
+				close = push_session(sess, !push_notified) != true;
+			}
+#endif /* CONFIG_APP_HTTP_PUSH */
+		} else if (fds.cli[idx].revents & POLLIN) {
+			/* data available, pipelined requests are served in order
+			 * as their data is already received */
+			do {
+				close = process_request(sess) != true;
+			} while (!close && !http_session_is_pushing(sess) &&
+					 http_session_has_pipelined_data(sess));
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+			/* Data received after a request switching the session to
+			 * push is not HTTP */
+			if (!close && http_session_is_pushing(sess)) {
+				close = push_session_pipelined(sess) != true;
+			}
+#endif /* CONFIG_APP_HTTP_PUSH */
 		} else if (fds.cli[idx].revents & (POLLHUP | POLLERR)) {
 			/* Error or hangup detected on client connection -> unexpected
 			 * close */
@@ -427,6 +667,9 @@ static void handle_active_sessions(void)
 		if (close) {
 			stats.conn_closed_count++;
 			LOG_INF("(%d) Closing sock sess %p", sess->sock, sess);
+#if defined(CONFIG_APP_HTTP_PUSH)
+			push_release(&sess->push);
+#endif
 			zsock_close(sess->sock);
 			http_session_free(sess);
 			remove_pollfd_by_index(idx);
@@ -468,7 +711,18 @@ static void http_srv_thread(void *_a, void *_b, void *_c)
 			}
 #endif /* CONFIG_APP_HTTP_SERVER_SECURE */
 
-			handle_active_sessions();
+			bool push_notified = false;
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+			if (fds.push.revents & POLLIN) {
+				/* Clear the event */
+				eventfd_t _val;
+				eventfd_read(fds.push.fd, &_val);
+				push_notified = true;
+			}
+#endif /* CONFIG_APP_HTTP_PUSH */
+
+			handle_active_sessions(push_notified);
 		} else {
 			LOG_ERR("unexpected poll(%p, %d, %d) return value = %d", &fds,
 					clients_count + servers_count, SYS_FOREVER_MS, errno);
@@ -526,12 +780,18 @@ static bool send_headers(http_session_t *sess)
 	http_response_t *const resp = sess->resp;
 
 	ret = http_encode_status(&buf, resp->status_code);
-	ret = http_encode_header_connection(&buf, sess->keep_alive.enabled);
-	ret = http_encode_header_content_type(&buf, resp->content_type);
-	if (resp->chunked == 1u) {
-		ret = http_encode_header_transer_encoding_chunked(&buf);
+	if (resp->status_code == HTTP_STATUS_SWITCHING_PROTOCOLS) {
+#if defined(CONFIG_APP_HTTP_WEBSOCKET)
+		ret = http_encode_header_websocket_upgrade(&buf, resp->ws_accept);
+#endif
 	} else {
-		ret = http_encode_header_content_length(&buf, resp->content_length);
+		ret = http_encode_header_connection(&buf, sess->keep_alive.enabled);
+		ret = http_encode_header_content_type(&buf, resp->content_type);
+		if (resp->chunked == 1u) {
+			ret = http_encode_header_transer_encoding_chunked(&buf);
+		} else {
+			ret = http_encode_header_content_length(&buf, resp->content_length);
+		}
 	}
 	ret = http_encode_header_end(&buf);
 
@@ -581,6 +841,21 @@ static int sock_recv(int sock, char *buf, size_t len)
 	return rc;
 }
 
+static void keep_pipelined_data(http_session_t *sess, const char *data, size_t len)
+{
+	if (len <= sizeof(sess->pipeline.buf)) {
+		memcpy(sess->pipeline.buf, data, len);
+		sess->pipeline.len = len;
+	} else {
+		/* Cannot keep the next request(s), close the connection
+		 * once the current response is sent */
+		stats.req_pipeline_overflow++;
+		sess->req->keep_alive = 0u;
+		LOG_WRN("(%d) Pipelined data too large %u > %u, closing after response",
+				sess->sock, len, sizeof(sess->pipeline.buf));
+	}
+}
+
 static bool handle_request(http_session_t *sess)
 {
 	ssize_t rc;
@@ -589,6 +864,15 @@ static bool handle_request(http_session_t *sess)
 	char *p			  = buffer;
 	ssize_t remaining = sizeof(buffer);
 
+	/* Data of the current request already received along with
+	 * the previous one (pipelining) */
+	size_t pending = sess->pipeline.len;
+	if (pending != 0u) {
+		memcpy(buffer, sess->pipeline.buf, pending);
+		sess->pipeline.len = 0u;
+		stats.req_pipelined_count++;
+	}
+
 	while (req->complete == 0U) {
 		if (remaining <= 0) {
 			http_request_discard(req, HTTP_REQUEST_PAYLOAD_TOO_LARGE);
@@ -599,12 +883,35 @@ static bool handle_request(http_session_t *sess)
 			LOG_WRN("(%d) Request payload too large, discarding", sess->sock);
 		}
 
-		rc = sock_recv(sess->sock, p, remaining);
+		if (pending != 0u) {
+			rc		= pending;
+			pending = 0u;
+		} else {
+			rc = sock_recv(sess->sock, p, remaining);
+		}
+
 		if (rc > 0) {
-			if (http_request_parse_buf(req, p, rc) == false) {
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+			if (req->rx_bytes == 0u) {
+				req->first_byte_ms	   = k_uptime_get_32();
+				req->first_byte_cycles = k_cycle_get_32();
+			}
+#endif
+
+			const int parsed = http_request_parse_buf(req, p, rc);
+			if (parsed < 0) {
 				goto close;
 			}
 
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+			req->rx_bytes += parsed;
+#endif
+
+			/* Keep the beginning of the next request(s) */
+			if (parsed < rc) {
+				keep_pipelined_data(sess, p + parsed, rc - parsed);
+			}
+
 			/* If not streaming, we need to keep the data in
 			 * the buffer for later processing.
 			 */
@@ -650,42 +957,54 @@ close:
 	return false;
 }
 
-static bool send_chunk(http_session_t *sess)
+static int send_chunk_data(int sock, const char *data, size_t len)
 {
 	int ret;
-	http_response_t *const resp = sess->resp;
-
-	__ASSERT_NO_MSG(resp->chunked == 1u);
-
-	if (resp->buffer.filling == 0u) {
-		/* Nothing to send */
-		return true;
-	}
 
 	/* Prepare chunk header */
 	char chunk_header[16];
-	ret = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", resp->buffer.filling);
+	ret = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", len);
 	if (ret < 0) {
-		goto close;
+		goto exit;
 	}
 
 	/* Send chunk header */
-	ret = sendall(sess->sock, chunk_header, ret);
+	ret = sendall(sock, chunk_header, ret);
 	if (ret < 0) {
-		goto close;
+		goto exit;
 	}
 
 	/* Send chunk data */
-	ret = sendall(sess->sock, resp->buffer.data, resp->buffer.filling);
-	if (ret >= 0) {
-		resp->payload_sent += ret;
-	} else {
-		goto close;
+	ret = sendall(sock, (char *)data, len);
+	if (ret < 0) {
+		goto exit;
 	}
 
 	/* Send end of chunk */
-	ret = sendall(sess->sock, "\r\n", 2u);
-	if (ret < 0) {
+	if (sendall(sock, "\r\n", 2u) < 0) {
+		ret = -EIO;
+	}
+
+exit:
+	return ret;
+}
+
+static bool send_chunk(http_session_t *sess)
+{
+	int ret;
+	http_response_t *const resp = sess->resp;
+
+	__ASSERT_NO_MSG(resp->chunked == 1u);
+
+	if (resp->buffer.filling == 0u) {
+		/* Nothing to send */
+		return true;
+	}
+
+	ret = send_chunk_data(sess->sock, resp->buffer.data, resp->buffer.filling);
+	if (ret >= 0) {
+		resp->payload_sent += ret;
+	} else {
 		goto close;
 	}
 
@@ -790,6 +1109,12 @@ static bool send_error_response(http_session_t *sess)
 	return send_headers(sess) && send_buffer(sess);
 }
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+#define PUSH_PENDING(_resp) ((_resp)->push.handler != NULL)
+#else
+#define PUSH_PENDING(_resp) false
+#endif
+
 static bool send_response(http_session_t *sess)
 {
 	int ret;
@@ -859,6 +1184,13 @@ static bool send_response(http_session_t *sess)
 				resp->buffer.filling = 0u;
 			}
 
+#if defined(CONFIG_APP_HTTP_PUSH)
+			/* Pushing responses are kept open */
+			if (PUSH_PENDING(resp)) {
+				sess->keep_alive.enabled = 1u;
+			}
+#endif /* CONFIG_APP_HTTP_PUSH */
+
 			/* Headers sent after handler first call */
 			if (!send_headers(sess)) goto close;
 		}
@@ -870,8 +1202,8 @@ static bool send_response(http_session_t *sess)
 		}
 	} while (resp->complete == 0U);
 
-	/* End of chunked encoding */
-	if (http_response_is_chunked(resp)) {
+	/* End of chunked encoding, unless the response is kept open */
+	if (http_response_is_chunked(resp) && !PUSH_PENDING(resp)) {
 		ret = send_end_of_chunked_encoding(sess);
 		if (ret <= 0) {
 			goto close;
@@ -898,6 +1230,9 @@ static bool process_request(http_session_t *sess)
 	sess->req  = &req;
 	sess->resp = &resp;
 
+	/* Kept headers are allocated from the session arena */
+	req.hdr_arena = &sess->hdr_arena;
+
 	/* Forward secure flag to "request" structure (TODO ugly change this)*/
 	sess->req->secure = sess->secure;
 
@@ -905,10 +1240,18 @@ static bool process_request(http_session_t *sess)
 	char url_copy[HTTP_URL_MAX_LEN];
 	req._url_copy = url_copy;
 
+	TRACE(TRACE_EV_HTTP_REQ_BEGIN, sess->sock, 0u);
+
 	if (handle_request(sess) == false) {
 		goto close;
 	}
 
+	TRACE(TRACE_EV_HTTP_REQ_HANDLED, sess->sock, resp.status_code);
+
+	stats.req_hdr_retained += req.hdr_retained;
+	stats.req_hdr_retained_max = MAX(stats.req_hdr_retained_max, req.hdr_retained);
+	stats.req_hdr_dropped += req.hdr_dropped;
+
 	/* We update the session keep_alive configuration
 	 * based on the request. Before sending headers.
 	 */
@@ -921,10 +1264,29 @@ static bool process_request(http_session_t *sess)
 		goto close;
 	}
 
-	LOG_INF("(%d) Req %s %s [%u B] -> Status %d [%u B] "
+	TRACE(TRACE_EV_HTTP_RESP_SENT, sess->sock, resp.payload_sent);
+
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+	route_stats_record(&req, &resp);
+#endif
+
+	LOG_INF("(%d) Req %s %s [%u B] hdr [%u B] -> Status %d [%u B] "
 			"(keep-alive=%d)",
 			sess->sock, http_method_str(req.method), url_copy, req.payload_len,
-			resp.status_code, resp.payload_sent, sess->keep_alive.enabled);
+			req.hdr_retained, resp.status_code, resp.payload_sent,
+			sess->keep_alive.enabled);
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+	if (PUSH_PENDING(&resp)) {
+		/* Response kept open, the session now pushes data */
+		sess->push					   = resp.push;
+		sess->keep_alive.last_activity = k_uptime_get_32();
+		resp.push.handler			   = NULL;
+		stats.push_opened_count++;
+		LOG_INF("(%d) Session pushing (raw=%u)", sess->sock, sess->push.raw);
+		return true;
+	}
+#endif /* CONFIG_APP_HTTP_PUSH */
 
 	/* Update last activity time */
 	if (sess->keep_alive.enabled) {
@@ -934,10 +1296,35 @@ static bool process_request(http_session_t *sess)
 	}
 
 close:
+#if defined(CONFIG_APP_HTTP_PUSH)
+	/* Release the push context if the response could not be sent */
+	if (PUSH_PENDING(&resp)) {
+		stats.push_failed_count++;
+		resp.push.handler->close(resp.push.ctx);
+	}
+#endif /* CONFIG_APP_HTTP_PUSH */
 	return false;
 }
 
 void http_server_get_stats(struct http_stats *dest)
 {
 	memcpy(dest, &stats, sizeof(stats));
+}
+
+int http_server_route_stats_get(uint32_t *index, struct http_route_stats *dest)
+{
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+	for (uint32_t i = *index; i < CONFIG_APP_HTTP_ROUTE_STATS_SLOTS; i++) {
+		if (route_stats[i].route != NULL) {
+			memcpy(dest, &route_stats[i], sizeof(*dest));
+			*index = i + 1u;
+			return 0;
+		}
+	}
+
+	*index = CONFIG_APP_HTTP_ROUTE_STATS_SLOTS;
+	return -ENOENT;
+#else
+	return -ENOTSUP;
+#endif
 }
\ No newline at end of file
@@ -27,4 +27,25 @@
 
 void http_server_get_stats(struct http_stats *dest);
 
+/**
+ * @brief Get the statistics of the next route served, in table order
+ *
+ * Note: Must be called from the HTTP server thread (e.g. a route handler)
+ *
+ * @param index In: table index to start from (0 for the first route), out:
+ * index to pass to get the next route
+ * @param dest
+ * @return int 0 on success, -ENOENT if there are no more routes, -ENOTSUP if
+ * CONFIG_APP_HTTP_ROUTE_STATS is disabled
+ */
+int http_server_route_stats_get(uint32_t *index, struct http_route_stats *dest);
+
+/**
+ * @brief Notify the HTTP server that data is available to be pushed
+ * to the pushing sessions (see http_response_push())
+ *
+ * Note: Can be called from any thread
+ */
+void http_server_push_notify(void);
+
 #endif
\ No newline at end of file
@@ -39,6 +39,8 @@ http_session_t *http_session_alloc(void)
 	if ((node = sys_slist_get(&sessions_free_list)) != NULL) {
 		http_session_t *sess = CONTAINER_OF(node, http_session_t, _alloc_handle);
 		clear_sess(sess);
+		kcontig_init(&sess->hdr_arena, (uint8_t *)sess->hdr_arena_buf,
+					 sizeof(sess->hdr_arena_buf));
 		sys_dlist_append(&sessions_list, &sess->_handle);
 		return sess;
 	}
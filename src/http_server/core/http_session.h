@@ -9,6 +9,7 @@
 
 #include "http_request.h"
 #include "http_response.h"
+#include "utils/contig_alloc.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -60,6 +61,23 @@ struct http_session {
 	/* Authenticated user */
 	const struct user *auth;
 
+	/* Arena where the request headers values are kept, reset on
+	 * every new request of the session */
+	struct kcontig hdr_arena;
+	__aligned(4u) char hdr_arena_buf[CONFIG_APP_HTTP_REQUEST_HEADERS_BUFFER_SIZE];
+
+	/* Data received after the end of the current request (pipelined
+	 * requests), processed in order once the current response is sent */
+	struct {
+		size_t len;
+		char buf[CONFIG_APP_HTTP_PIPELINE_BUFFER_SIZE];
+	} pipeline;
+
+#if defined(CONFIG_APP_HTTP_PUSH)
+	/* Set if the session pushes data (response kept open) */
+	struct http_push push;
+#endif
+
 	/* STATS TODO */
 	size_t requests_count;
 	size_t rx_bytes;
@@ -80,6 +98,20 @@ bool http_session_is_closed(http_session_t *sess);
 
 bool http_session_is_outdated(http_session_t *sess);
 
+static inline bool http_session_has_pipelined_data(http_session_t *sess)
+{
+	return sess->pipeline.len != 0u;
+}
+
+static inline bool http_session_is_pushing(http_session_t *sess)
+{
+#if defined(CONFIG_APP_HTTP_PUSH)
+	return sess->push.handler != NULL;
+#else
+	return false;
+#endif
+}
+
 // Function to get the next time we need to process an outdated session
 int http_session_time_to_next_outdated(void);
 
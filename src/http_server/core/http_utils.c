@@ -24,6 +24,8 @@ struct code_str {
 };
 
 static const struct code_str status[] = {
+	{HTTP_STATUS_SWITCHING_PROTOCOLS, "Switching Protocols"},
+
 	{HTTP_STATUS_OK, "OK"},
 	{HTTP_STATUS_CREATED, "Created"},
 	{HTTP_STATUS_ACCEPTED, "Accepted"},
@@ -95,6 +97,15 @@ int http_encode_header_content_type(buffer_t *buf, http_content_type_t type)
 	return buffer_snprintf(buf, "Content-Type: %s\r\n", http_content_type_to_str(type));
 }
 
+int http_encode_header_websocket_upgrade(buffer_t *buf, const char *accept)
+{
+	return buffer_snprintf(buf,
+						   "Upgrade: websocket\r\n"
+						   "Connection: Upgrade\r\n"
+						   "Sec-WebSocket-Accept: %s\r\n",
+						   accept);
+}
+
 int http_encode_endline(buffer_t *buf)
 {
 	return buffer_snprintf(buf, "\r\n");
@@ -115,9 +126,10 @@ const char *http_content_type_to_str(http_content_type_t content_type)
 		[HTTP_CONTENT_TYPE_APPLICATION_JSON]		 = "application/json",
 		[HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA]		 = "multipart/form-data",
 		[HTTP_CONTENT_TYPE_APPLICATION_OCTET_STREAM] = "application/octet-stream",
+		[HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM]		 = "text/event-stream",
 	};
 
-	if (content_type >= ARRAY_SIZE(strs)) {
+	if ((content_type >= ARRAY_SIZE(strs)) || (strs[content_type] == NULL)) {
 		content_type = HTTP_CONTENT_TYPE_TEXT_PLAIN;
 	}
 
@@ -628,4 +640,55 @@ const char *http_test_result_to_str(http_test_result_t result)
 	}
 }
 
-#endif /* CONFIG_APP_HTTP_TEST */
\ No newline at end of file
+#endif /* CONFIG_APP_HTTP_TEST */
+uint32_t http_route_hist_bucket(uint32_t duration_us)
+{
+	if (duration_us < BIT(HTTP_ROUTE_HIST_MIN_LOG2)) {
+		return 0u;
+	}
+
+	const uint32_t log2 = LOG2(duration_us);
+	if (log2 >= HTTP_ROUTE_HIST_MAX_LOG2) {
+		return HTTP_ROUTE_HIST_BUCKETS - 1u;
+	}
+
+	/* Linear position within the power of 2 */
+	const uint32_t sub =
+		(duration_us >> (log2 - HTTP_ROUTE_HIST_SUB_LOG2)) & (HTTP_ROUTE_HIST_SUB - 1u);
+
+	return ((log2 - HTTP_ROUTE_HIST_MIN_LOG2) << HTTP_ROUTE_HIST_SUB_LOG2) + sub;
+}
+
+uint32_t http_route_hist_bound_us(uint32_t bucket)
+{
+	if (bucket >= HTTP_ROUTE_HIST_BUCKETS - 1u) {
+		return UINT32_MAX;
+	}
+
+	const uint32_t log2 = HTTP_ROUTE_HIST_MIN_LOG2 + (bucket >> HTTP_ROUTE_HIST_SUB_LOG2);
+	const uint32_t sub	= bucket & (HTTP_ROUTE_HIST_SUB - 1u);
+
+	return BIT(log2) + ((sub + 1u) << (log2 - HTTP_ROUTE_HIST_SUB_LOG2));
+}
+
+uint32_t http_route_hist_percentile_us(const struct http_route_stats *stats,
+									   uint32_t percent)
+{
+	if (stats->count == 0u) {
+		return 0u;
+	}
+
+	/* Rank of the sample, rounded up */
+	const uint32_t rank = DIV_ROUND_UP((uint64_t)stats->count * MIN(percent, 100u), 100u);
+	uint32_t cumulated	= 0u;
+	uint32_t bucket;
+
+	for (bucket = 0u; bucket < HTTP_ROUTE_HIST_BUCKETS - 1u; bucket++) {
+		cumulated += stats->buckets[bucket];
+		if (cumulated >= MAX(rank, 1u)) {
+			break;
+		}
+	}
+
+	return http_route_hist_bound_us(bucket);
+}
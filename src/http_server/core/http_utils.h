@@ -29,10 +29,14 @@ typedef enum {
 	HTTP_CONTENT_TYPE_APPLICATION_JPEG,
 	HTTP_CONTENT_TYPE_APPLICATION_PNG,
 	HTTP_CONTENT_TYPE_APPLICATION_TIFF,
+	HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM,
 } http_content_type_t;
 
 typedef enum {
-	/* 400 */
+	/* 100 */
+	HTTP_STATUS_SWITCHING_PROTOCOLS = 101,
+
+	/* 200 */
 	HTTP_STATUS_OK		   = 200,
 	HTTP_STATUS_CREATED	   = 201,
 	HTTP_STATUS_ACCEPTED   = 202,
@@ -84,6 +88,15 @@ int http_encode_header_connection(buffer_t *buf, bool keep_alive);
 
 int http_encode_header_content_type(buffer_t *buf, http_content_type_t type);
 
+/**
+ * @brief Encode the headers of a WebSocket upgrade response
+ *
+ * @param buf
+ * @param accept Sec-WebSocket-Accept value
+ * @return int
+ */
+int http_encode_header_websocket_upgrade(buffer_t *buf, const char *accept);
+
 int http_encode_endline(buffer_t *buf);
 
 static inline int http_encode_header_end(buffer_t *buf)
@@ -271,8 +284,65 @@ struct http_stats {
 	uint32_t req_discarded_count;
 	uint32_t req_handler_failed;
 	uint32_t resp_handler_failed;
+	uint32_t req_hdr_retained;	   /* Total header bytes retained (all requests) */
+	uint32_t req_hdr_retained_max; /* Max header bytes retained by a single request */
+	uint32_t req_hdr_dropped;	   /* Headers dropped because the arena was full */
+	uint32_t req_pipelined_count;  /* Requests served from pipelined data */
+	uint32_t req_pipeline_overflow; /* Pipelined data too large to be kept */
+	uint32_t push_opened_count;		/* Responses kept open to push data */
+	uint32_t push_closed_count;
+	uint32_t push_failed_count;		/* Push responses which could not be started */
 	uint32_t rx;
 	uint32_t tx;
+	uint32_t route_stats_dropped; /* Requests not fitting the route stats table */
 };
 
+/* Log-linear latency histogram of the routes: HTTP_ROUTE_HIST_SUB buckets per
+ * power of 2 between 2^HTTP_ROUTE_HIST_MIN_LOG2 us and 2^HTTP_ROUTE_HIST_MAX_LOG2 us,
+ * the last bucket counts the requests above. */
+#define HTTP_ROUTE_HIST_MIN_LOG2 7u	 /* 128 us */
+#define HTTP_ROUTE_HIST_MAX_LOG2 23u /* 8.4 s */
+#define HTTP_ROUTE_HIST_SUB_LOG2 1u
+#define HTTP_ROUTE_HIST_SUB		 (1u << HTTP_ROUTE_HIST_SUB_LOG2)
+#define HTTP_ROUTE_HIST_OCTAVES	 (HTTP_ROUTE_HIST_MAX_LOG2 - HTTP_ROUTE_HIST_MIN_LOG2)
+#define HTTP_ROUTE_HIST_BUCKETS	 ((HTTP_ROUTE_HIST_OCTAVES << HTTP_ROUTE_HIST_SUB_LOG2) + 1u)
+
+struct route_descr;
+
+struct http_route_stats {
+	const struct route_descr *route;
+	uint32_t count;		  /* Requests served */
+	uint32_t rx;		  /* Bytes received (headers and payload) */
+	uint32_t tx;		  /* Bytes sent (headers and payload) */
+	uint64_t duration_us; /* Sum of the durations, first byte received to last sent */
+	uint32_t buckets[HTTP_ROUTE_HIST_BUCKETS];
+};
+
+/**
+ * @brief Get the histogram bucket of a request duration
+ *
+ * @param duration_us
+ * @return uint32_t Bucket index, HTTP_ROUTE_HIST_BUCKETS - 1 for the overflow
+ */
+uint32_t http_route_hist_bucket(uint32_t duration_us);
+
+/**
+ * @brief Get the (exclusive) upper bound of a histogram bucket
+ *
+ * @param bucket Bucket index
+ * @return uint32_t Upper bound in us, UINT32_MAX for the overflow bucket
+ */
+uint32_t http_route_hist_bound_us(uint32_t bucket);
+
+/**
+ * @brief Estimate a percentile of a route latency histogram
+ *
+ * @param stats
+ * @param percent Percentile (0-100)
+ * @return uint32_t Upper bound of the bucket containing the percentile in us,
+ * 0 if no request was served
+ */
+uint32_t http_route_hist_percentile_us(const struct http_route_stats *stats,
+									   uint32_t percent);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#if defined(CONFIG_APP_HTTP_WEBSOCKET)
+
+#include "crypto/crypto.h"
+#include "http_websocket.h"
+#include "utils/misc.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/base64.h>
+#include <zephyr/sys/byteorder.h>
+LOG_MODULE_REGISTER(http_ws, LOG_LEVEL_INF);
+
+#define WS_GUID		"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_VERSION	"13"
+#define WS_KEY_LEN	24u /* Base64 encoded 16 bytes */
+#define WS_MASK_LEN 4u
+
+static int compute_accept(const char *key, char accept[HTTP_WS_ACCEPT_STR_LEN + 1u])
+{
+	int ret;
+	size_t olen;
+	uint8_t sha1[20u];
+	char concat[WS_KEY_LEN + sizeof(WS_GUID)];
+
+	memcpy(concat, key, WS_KEY_LEN);
+	memcpy(&concat[WS_KEY_LEN], WS_GUID, sizeof(WS_GUID));
+
+	ret = crypt_sha1((const unsigned char *)concat, sizeof(concat) - 1u, sha1);
+	if (ret != 0) {
+		return -EIO;
+	}
+
+	return base64_encode((uint8_t *)accept, HTTP_WS_ACCEPT_STR_LEN + 1u, &olen, sha1,
+						 sizeof(sha1));
+}
+
+int http_ws_upgrade(http_request_t *req,
+					http_response_t *resp,
+					const struct http_push_handler *handler,
+					void *ctx)
+{
+	int ret;
+
+	const char *upgrade = http_header_get_value(req, "Upgrade");
+	const char *key		= http_header_get_value(req, "Sec-WebSocket-Key");
+	const char *version = http_header_get_value(req, "Sec-WebSocket-Version");
+
+	if (!upgrade || strcicmp(upgrade, "websocket") || !key ||
+		(strlen(key) != WS_KEY_LEN)) {
+		LOG_WRN("(%p) Invalid upgrade request", req);
+		return -EINVAL;
+	}
+
+	if (!version || strcmp(version, WS_VERSION)) {
+		LOG_WRN("(%p) Unsupported WebSocket version %s", req, version ? version : "");
+		return -EINVAL;
+	}
+
+	ret = compute_accept(key, resp->ws_accept);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return http_response_upgrade(resp, handler, ctx);
+}
+
+int http_ws_frame_decode(char *data, size_t len, struct http_ws_frame *frame)
+{
+	size_t hdr_len = 2u;
+	uint64_t payload_len;
+	const uint8_t *p = (const uint8_t *)data;
+
+	if (len < hdr_len) {
+		return 0;
+	}
+
+	/* Client frames must be masked */
+	if ((p[1] & 0x80u) == 0u) {
+		return -EINVAL;
+	}
+
+	payload_len = p[1] & 0x7Fu;
+	if (payload_len == 126u) {
+		hdr_len += 2u;
+		if (len < hdr_len) return 0;
+		payload_len = sys_get_be16(&p[2]);
+	} else if (payload_len == 127u) {
+		hdr_len += 8u;
+		if (len < hdr_len) return 0;
+		payload_len = sys_get_be64(&p[2]);
+	}
+
+	hdr_len += WS_MASK_LEN;
+
+	/* Frame can't be received at once */
+	if (payload_len > (CONFIG_APP_HTTP_BUFFER_SIZE - hdr_len)) {
+		return -EMSGSIZE;
+	}
+
+	if (len < hdr_len + payload_len) {
+		return 0;
+	}
+
+	const uint8_t *mask = &p[hdr_len - WS_MASK_LEN];
+
+	frame->fin	   = (p[0] & 0x80u) ? 1u : 0u;
+	frame->opcode  = p[0] & 0x0Fu;
+	frame->payload = &data[hdr_len];
+	frame->len	   = (size_t)payload_len;
+
+	for (size_t i = 0u; i < frame->len; i++) {
+		frame->payload[i] ^= mask[i % WS_MASK_LEN];
+	}
+
+	return (int)(hdr_len + payload_len);
+}
+
+int http_ws_frame_encode_header(char *hdr, uint8_t opcode, size_t len)
+{
+	uint8_t *p = (uint8_t *)hdr;
+
+	p[0] = 0x80u | (opcode & 0x0Fu);
+
+	if (len < 126u) {
+		p[1] = (uint8_t)len;
+		return 2;
+	} else if (len <= UINT16_MAX) {
+		p[1] = 126u;
+		sys_put_be16((uint16_t)len, &p[2]);
+		return 4;
+	}
+
+	return -EMSGSIZE;
+}
+
+int http_ws_frame_append(buffer_t *buf, uint8_t opcode, const char *payload, size_t len)
+{
+	int ret;
+
+	if (buffer_remaining(buf) < HTTP_WS_FRAME_HEADER_MAX_SIZE + len) {
+		return -ENOMEM;
+	}
+
+	ret = http_ws_frame_encode_header(&buf->data[buf->filling], opcode, len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	buf->filling += ret;
+	if (len != 0u) {
+		memcpy(&buf->data[buf->filling], payload, len);
+		buf->filling += len;
+	}
+
+	return 0;
+}
+
+#endif /* CONFIG_APP_HTTP_WEBSOCKET */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _HTTP_WEBSOCKET_H_
+#define _HTTP_WEBSOCKET_H_
+
+#include "http_request.h"
+#include "http_response.h"
+#include "utils/buffers.h"
+
+#include <stdint.h>
+
+#define HTTP_WS_OPCODE_CONTINUATION 0x0u
+#define HTTP_WS_OPCODE_TEXT			0x1u
+#define HTTP_WS_OPCODE_BINARY		0x2u
+#define HTTP_WS_OPCODE_CLOSE		0x8u
+#define HTTP_WS_OPCODE_PING			0x9u
+#define HTTP_WS_OPCODE_PONG			0xAu
+
+/* Close frame status codes (RFC 6455 section 7.4.1) */
+#define HTTP_WS_CLOSE_MESSAGE_TOO_BIG 1009u
+
+/* Frames sent by the server are limited to 65535 B of payload */
+#define HTTP_WS_FRAME_HEADER_MAX_SIZE 4u
+
+struct http_ws_frame {
+	uint8_t opcode : 4u;
+	uint8_t fin : 1u;
+
+	/* Unmasked payload */
+	char *payload;
+	size_t len;
+};
+
+/**
+ * @brief Accept a WebSocket upgrade request (RFC 6455), the connection is
+ * switched to the WebSocket protocol once the response is sent.
+ *
+ * Frames received from the client are passed to handler->recv(), which
+ * can decode them with http_ws_frame_decode().
+ *
+ * Note: The push context is released with handler->close() in any case.
+ *
+ * @param req
+ * @param resp
+ * @param handler
+ * @param ctx
+ * @return int 0 on success, -EINVAL if the request is not a valid upgrade
+ * request
+ */
+int http_ws_upgrade(http_request_t *req,
+					http_response_t *resp,
+					const struct http_push_handler *handler,
+					void *ctx);
+
+/**
+ * @brief Decode a frame sent by the client, the payload is unmasked in place
+ *
+ * @param data Received data
+ * @param len Length of the received data
+ * @param frame Decoded frame
+ * @return int Number of bytes of the frame on success, 0 if the frame is not
+ * complete, negative value on error (e.g. frame not masked)
+ */
+int http_ws_frame_decode(char *data, size_t len, struct http_ws_frame *frame);
+
+/**
+ * @brief Encode a frame header (FIN set, not masked)
+ *
+ * @param hdr Buffer of at least HTTP_WS_FRAME_HEADER_MAX_SIZE bytes
+ * @param opcode
+ * @param len Payload length
+ * @return int Size of the header, negative value on error
+ */
+int http_ws_frame_encode_header(char *hdr, uint8_t opcode, size_t len);
+
+/**
+ * @brief Append a complete frame to the buffer
+ *
+ * @param buf
+ * @param opcode
+ * @param payload
+ * @param len
+ * @return int 0 on success, -ENOMEM if the buffer is too small
+ */
+int http_ws_frame_append(buffer_t *buf, uint8_t opcode, const char *payload, size_t len);
+
+#endif /* _HTTP_WEBSOCKET_H_ */
@@ -73,6 +73,54 @@ int http_routes_iterate(route_tree_iter_cb_t cb, void *arg)
 	return route_tree_iterate(routes_root, routes_root_size, cb, arg);
 }
 
+struct route_url_lookup {
+	const struct route_descr *route;
+	char *url;
+	size_t len;
+	int ret;
+};
+
+static bool route_url_lookup_cb(const struct route_descr *descr,
+								const struct route_descr *parents[],
+								size_t depth,
+								void *user_data)
+{
+	struct route_url_lookup *const lookup = user_data;
+
+	if (descr != lookup->route) {
+		return true;
+	}
+
+	int written = route_build_url(lookup->url, lookup->len, parents, depth);
+	if (written >= 0) {
+		const int ret =
+			snprintf(lookup->url + written, lookup->len - written, "%s", descr->part.str);
+		written = ((ret >= 0) && (written + ret < lookup->len)) ? written + ret : -ENOMEM;
+	}
+	lookup->ret = written;
+
+	/* Stop iterating */
+	return false;
+}
+
+int http_route_build_url(const struct route_descr *route, char *url, size_t len)
+{
+	struct route_url_lookup lookup = {
+		.route = route,
+		.url   = url,
+		.len   = len,
+		.ret   = -ENOENT,
+	};
+
+	if ((route == NULL) || (url == NULL) || (len == 0u)) {
+		return -EINVAL;
+	}
+
+	http_routes_iterate(route_url_lookup_cb, &lookup);
+
+	return lookup.ret;
+}
+
 uint32_t http_method_to_route_flag(enum http_method method)
 {
 	switch (method) {
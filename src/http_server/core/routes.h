@@ -89,6 +89,18 @@ http_content_type_t http_route_resp_default_content_type(const struct route_desc
  */
 int http_routes_iterate(route_tree_iter_cb_t cb, void *arg);
 
+/**
+ * @brief Build the URL of a route (e.g. "/api/ha/stats"), the route tree is
+ * walked to find its parents so it should not be called on the hot path.
+ *
+ * @param route Leaf route
+ * @param url Output buffer
+ * @param len Output buffer size
+ * @return int Length of the URL on success, -ENOENT if the route is not part
+ * of the tree, other negative error code on error
+ */
+int http_route_build_url(const struct route_descr *route, char *url, size_t len);
+
 static inline http_handler_t route_get_req_handler(const struct route_descr *route)
 {
 	return (http_handler_t)route->req_handler;
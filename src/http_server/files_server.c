@@ -15,6 +15,7 @@
 #include <zephyr/net/http/parser.h>
 
 #include <libgen.h>
+#include <strings.h>
 LOG_MODULE_REGISTER(files_server, LOG_LEVEL_DBG);
 
 #define FILES_SERVER_DEBUG_SPEED 0u
@@ -86,6 +87,12 @@ filepath_build(char *path_parts[], size_t path_parts_size, char filepath[], size
 
 	for (int i = 0; i < path_parts_size; i++) {
 		const uint32_t pp_len = strlen(path_parts[i]);
+
+		/* Don't leave the mount point nor bypass filepath_protected() */
+		if (strcmp(path_parts[i], "..") == 0) {
+			return -EINVAL;
+		}
+
 		const int remaining	  = size - (p - filepath);
 		if (pp_len >= remaining - 1) {
 			LOG_ERR("Given filepath too long");
@@ -102,6 +109,23 @@ filepath_build(char *path_parts[], size_t path_parts_size, char filepath[], size
 	return 0;
 }
 
+/* Tells whether the file can't be written through the files routes */
+static bool filepath_protected(const char *filepath)
+{
+#if defined(CONFIG_APP_LUA_BYTECODE_CACHE)
+	/* Lua doesn't verify the bytecode loaded from the cache */
+	const size_t len = strlen(CONFIG_APP_LUA_BYTECODE_CACHE_DIR);
+
+	/* FAT names are case insensitive */
+	if ((strncasecmp(filepath, CONFIG_APP_LUA_BYTECODE_CACHE_DIR, len) == 0) &&
+		((filepath[len] == '\0') || (filepath[len] == '/'))) {
+		return true;
+	}
+#endif
+
+	return false;
+}
+
 struct file {
 #if defined(CONFIG_APP_FS_ASYNC_OPERATIONS)
 	uint8_t afile_buf[4096 * 2u];
@@ -301,6 +325,13 @@ int http_file_upload(struct http_request *req, struct http_response *resp)
 			goto exit;
 		}
 
+		if (filepath_protected(filepath)) {
+			LOG_WRN("Upload to %s denied", filepath);
+			http_request_discard(req, HTTP_REQUEST_UNSECURE_ACCESS);
+			ret = 0;
+			goto exit;
+		}
+
 #if FILES_SERVER_CREATE_DIR_IF_NOT_EXISTS && !FILES_SERVER_DEBUG_SPEED
 		ret = app_fs_mkdir_intermediate(filepath, true);
 		if (ret < 0) {
@@ -40,6 +40,8 @@
 #include "ha/devices/f429zi.h"
 #include "ha/devices/garage.h"
 #include "ha/devices/xiaomi.h"
+#include "http_server/core/http_server.h"
+#include "net_time.h"
 #include "prometheus_client.h"
 #include "utils/buffers.h"
 
@@ -56,14 +58,18 @@ typedef enum {
 	VALUE_ENCODING_TYPE_FLOAT_DIGITS,
 	VALUE_ENCODING_TYPE_EXP,
 	VALUE_ENCODING_TYPE_EXP_DIGITS,
+	VALUE_ENCODING_TYPE_TIMESTAMP_MS, /* ms timestamp encoded as seconds */
+	VALUE_ENCODING_TYPE_DURATION_US,  /* us duration encoded as seconds */
 } metric_encoding_type_t;
 
 struct metric_value {
 	/* The value of the metric */
 	union {
-		float fvalue;	 /* store value as float */
-		uint32_t uvalue; /* store value as unsigned */
-		int32_t svalue;	 /* store value as signed */
+		float fvalue;		/* store value as float */
+		uint32_t uvalue;	/* store value as unsigned */
+		int32_t svalue;		/* store value as signed */
+		uint64_t msvalue;	/* store value as ms timestamp */
+		uint64_t usvalue;	/* store value as us duration */
 	};
 
 	/* Encoding type in the case of a float value */
@@ -195,6 +201,61 @@ const struct metric_definition mdef_device_measurements_last_timestamp =
 					device_measurement_tags,
 					"Timestamp of the last device measurement (UTC time)");
 
+const struct metric_definition mdef_sntp_syncs =
+	METRIC_DEF("sntp_syncs_total", COUNTER, "SNTP successful synchronizations");
+
+const struct metric_definition mdef_sntp_failures =
+	METRIC_DEF("sntp_failures_total", COUNTER, "SNTP rounds without valid answer");
+
+const struct metric_definition mdef_sntp_offset =
+	METRIC_DEF("sntp_offset_us", GAUGE, "Last SNTP correction applied (in us)");
+
+const struct metric_definition mdef_sntp_jitter =
+	METRIC_DEF("sntp_jitter_us", GAUGE, "Average SNTP correction (in us)");
+
+const struct metric_definition mdef_sntp_rtt = METRIC_DEF(
+	"sntp_rtt_us", GAUGE, "Round trip delay of the selected SNTP server (in us)");
+
+const struct metric_definition mdef_sntp_servers =
+	METRIC_DEF("sntp_servers", GAUGE, "SNTP servers which answered the last round");
+
+static const struct metric_tag http_route_tags[] = {
+	/* request method : GET, POST, ... */
+	METRIC_TAG("method"),
+
+	/* route url, e.g. /api/devices/caniot/:u/endpoint/:u/telemetry */
+	METRIC_TAG("route"),
+};
+
+static const struct metric_tag http_route_bucket_tags[] = {
+	METRIC_TAG("method"),
+	METRIC_TAG("route"),
+
+	/* histogram bucket upper bound (in s) */
+	METRIC_TAG("le"),
+};
+
+const struct metric_definition mdef_http_route_duration =
+	METRIC_DEF_TAGS("http_route_duration_seconds",
+					HISTOGRAM,
+					http_route_tags,
+					"HTTP requests duration, first byte received to last sent (in s)");
+
+const struct metric_definition mdef_http_route_duration_bucket = METRIC_DEF_TAGS(
+	"http_route_duration_seconds_bucket", HISTOGRAM, http_route_bucket_tags, NULL);
+
+const struct metric_definition mdef_http_route_duration_sum =
+	METRIC_DEF_TAGS("http_route_duration_seconds_sum", HISTOGRAM, http_route_tags, NULL);
+
+const struct metric_definition mdef_http_route_duration_count = METRIC_DEF_TAGS(
+	"http_route_duration_seconds_count", HISTOGRAM, http_route_tags, NULL);
+
+const struct metric_definition mdef_http_route_rx = METRIC_DEF_TAGS(
+	"http_route_rx_bytes_total", COUNTER, http_route_tags, "HTTP request bytes received");
+
+const struct metric_definition mdef_http_route_tx = METRIC_DEF_TAGS(
+	"http_route_tx_bytes_total", COUNTER, http_route_tags, "HTTP responses bytes sent");
+
 static bool validate_metric_value(struct metric_value *value)
 {
 	bool success = value != NULL;
@@ -231,6 +292,16 @@ static ssize_t encode_value(char *buf, size_t buf_size, struct metric_value *val
 	case VALUE_ENCODING_TYPE_UINT32:
 		ret = snprintf(buf, buf_size, "%u", value->uvalue);
 		break;
+	case VALUE_ENCODING_TYPE_TIMESTAMP_MS:
+		ret = snprintf(buf, buf_size, "%u.%03u",
+					   (uint32_t)(value->msvalue / MSEC_PER_SEC),
+					   (uint32_t)(value->msvalue % MSEC_PER_SEC));
+		break;
+	case VALUE_ENCODING_TYPE_DURATION_US:
+		ret = snprintf(buf, buf_size, "%u.%06u",
+					   (uint32_t)(value->usvalue / USEC_PER_SEC),
+					   (uint32_t)(value->usvalue % USEC_PER_SEC));
+		break;
 	case VALUE_ENCODING_TYPE_FLOAT_DIGITS:
 		ret = snprintf(buf, buf_size, "%.*f", (int)value->encoding.digits, (double)value->fvalue);
 		break;
@@ -249,6 +320,44 @@ static ssize_t encode_value(char *buf, size_t buf_size, struct metric_value *val
 	return ret;
 }
 
+/**
+ * @brief Encode the meta data HELP and TYPE of a metric
+ *
+ * @param buffer
+ * @param metric Metric definition
+ * @return ssize_t
+ */
+static ssize_t encode_metric_meta(buffer_t *buffer,
+								  const struct metric_definition *metric)
+{
+	int ret;
+	ssize_t appended = 0U;
+
+	const char *const metric_name = metric->name;
+
+	if (metric->help != NULL) {
+		const char *strings[] = {
+			"# HELP ", metric_name, " ", metric->help, "\n",
+		};
+		ret = buffer_append_strings(buffer, strings, ARRAY_SIZE(strings));
+		if (ret < 0) {
+			return ret;
+		}
+		appended += ret;
+	}
+
+	const char *strings[] = {
+		"# TYPE ", metric_name, " ", get_metric_type_str(metric->type), "\n",
+	};
+
+	ret = buffer_append_strings(buffer, strings, ARRAY_SIZE(strings));
+	if (ret < 0) {
+		return ret;
+	}
+
+	return appended + ret;
+}
+
 /**
  * @brief Encode metric value using the metric definition
  *
@@ -277,22 +386,7 @@ static ssize_t encode_metric(buffer_t *buffer,
 
 	/* encode meta information HELP and TYPE */
 	if (meta) {
-		if (metric->help != NULL) {
-			const char *strings[] = {
-				"# HELP ", metric_name, " ", metric->help, "\n",
-			};
-			ret = buffer_append_strings(buffer, strings, ARRAY_SIZE(strings));
-			if (ret < 0) {
-				return ret;
-			}
-			appended += ret;
-		}
-
-		const char *strings[] = {
-			"# TYPE ", metric_name, " ", get_metric_type_str(metric->type), "\n",
-		};
-
-		ret = buffer_append_strings(buffer, strings, ARRAY_SIZE(strings));
+		ret = encode_metric_meta(buffer, metric);
 		if (ret < 0) {
 			return ret;
 		}
@@ -502,11 +596,11 @@ union measurements_tags_values {
 	const char *list[6];
 };
 
-static void prom_metric_feed_dev_measurement_timestamp(uint32_t timestamp,
+static void prom_metric_feed_dev_measurement_timestamp(const ha_ev_t *ev,
 													   struct metric_value *val)
 {
-	val->encoding.type = VALUE_ENCODING_TYPE_UINT32;
-	val->uvalue		   = timestamp;
+	val->encoding.type = VALUE_ENCODING_TYPE_TIMESTAMP_MS;
+	val->msvalue	   = ha_ev_timestamp_ms(ev);
 }
 
 static void prom_metric_feed_xiaomi_temperature(const struct ha_ds_xiaomi *dt,
@@ -588,7 +682,7 @@ static bool prom_ha_devs_iterate_cb(ha_dev_t *dev, void *user_data)
 		encode_metric(buffer, &val, &mdef_device_battery_voltage, false);
 
 		ha_ev_t *last_ev = ha_dev_get_last_event(dev, 0u);
-		prom_metric_feed_dev_measurement_timestamp(last_ev->timestamp, &val);
+		prom_metric_feed_dev_measurement_timestamp(last_ev, &val);
 		encode_metric(buffer, &val, &mdef_device_measurements_last_timestamp, false);
 
 	} else if (dev->addr.type == HA_DEV_TYPE_CANIOT) {
@@ -615,7 +709,7 @@ static bool prom_ha_devs_iterate_cb(ha_dev_t *dev, void *user_data)
 												.digits = 2,
 									}};
 
-		switch (dev->endpoints[0].cfg->eid) {
+		switch (dev->cls->endpoints[0]->eid) {
 		case HA_DEV_EP_CANIOT_BLC0: {
 			const struct ha_ds_caniot_blc0 *const dt =
 				HA_DEV_EP_0_GET_CAST_LAST_DATA(dev, const struct ha_ds_caniot_blc0);
@@ -651,7 +745,7 @@ static bool prom_ha_devs_iterate_cb(ha_dev_t *dev, void *user_data)
 		}
 
 		ha_ev_t *last_ev = ha_dev_get_last_event(dev, 0u);
-		prom_metric_feed_dev_measurement_timestamp(last_ev->timestamp, &val);
+		prom_metric_feed_dev_measurement_timestamp(last_ev, &val);
 		encode_metric(buffer, &val, &mdef_device_measurements_last_timestamp, false);
 
 	} else if (dev->addr.type == HA_DEV_TYPE_NUCLEO_F429ZI) {
@@ -676,13 +770,40 @@ static bool prom_ha_devs_iterate_cb(ha_dev_t *dev, void *user_data)
 		encode_metric(buffer, &val, &mdef_device_temperature, false);
 
 		ha_ev_t *last_ev = ha_dev_get_last_event(dev, 0u);
-		prom_metric_feed_dev_measurement_timestamp(last_ev->timestamp, &val);
+		prom_metric_feed_dev_measurement_timestamp(last_ev, &val);
 		encode_metric(buffer, &val, &mdef_device_measurements_last_timestamp, false);
 	}
 
 	return true;
 }
 
+static void prom_sntp_metrics(buffer_t *buffer)
+{
+	struct net_time_stats st;
+	struct metric_value val = {.encoding.type = VALUE_ENCODING_TYPE_UINT32};
+
+	net_time_stats_get(&st);
+
+	val.uvalue = st.syncs;
+	encode_metric(buffer, &val, &mdef_sntp_syncs, true);
+
+	val.uvalue = st.failures;
+	encode_metric(buffer, &val, &mdef_sntp_failures, true);
+
+	val.uvalue = st.jitter_us;
+	encode_metric(buffer, &val, &mdef_sntp_jitter, true);
+
+	val.uvalue = st.rtt_us;
+	encode_metric(buffer, &val, &mdef_sntp_rtt, true);
+
+	val.uvalue = st.servers;
+	encode_metric(buffer, &val, &mdef_sntp_servers, true);
+
+	val.encoding.type = VALUE_ENCODING_TYPE_INT32;
+	val.svalue		  = st.offset_us;
+	encode_metric(buffer, &val, &mdef_sntp_offset, true);
+}
+
 int prometheus_metrics(http_request_t *req, http_response_t *resp)
 {
 	/* Next index to encode metric into buffer */
@@ -695,6 +816,8 @@ int prometheus_metrics(http_request_t *req, http_response_t *resp)
 		/* Enable chunked transfer encoding, because we don't know
 		 * the size of the response in advance */
 		http_response_enable_chunk_encoding(resp);
+
+		prom_sntp_metrics(&resp->buffer);
 	}
 
 	const ha_dev_filter_t filter = {
@@ -720,7 +843,129 @@ int prometheus_metrics(http_request_t *req, http_response_t *resp)
 
 #endif
 
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+
+/* Each metric family is encoded for all the routes before the next one,
+ * as required by the exposition format */
+enum {
+	PROM_HTTP_ROUTE_DURATION = 0u,
+	PROM_HTTP_ROUTE_RX,
+	PROM_HTTP_ROUTE_TX,
+	PROM_HTTP_ROUTE_FAMILIES,
+};
+
+static void prom_http_route_metrics(buffer_t *buffer,
+									uint32_t family,
+									const struct http_route_stats *rs,
+									bool meta)
+{
+	char url[CONFIG_APP_HTTP_URL_MAX_LENGTH];
+	char le[16u];
+	const char *tags_values[] = {
+		http_method_str(http_route_get_method(rs->route)),
+		url,
+		le,
+	};
+	struct metric_value val = {
+		.encoding.type	   = VALUE_ENCODING_TYPE_UINT32,
+		.tags_values	   = tags_values,
+		.tags_values_count = 2u,
+	};
+
+	if (http_route_build_url(rs->route, url, sizeof(url)) < 0) {
+		strcpy(url, "?");
+	}
+
+	switch (family) {
+	case PROM_HTTP_ROUTE_DURATION: {
+		uint32_t cumulated = 0u;
+
+		if (meta) {
+			encode_metric_meta(buffer, &mdef_http_route_duration);
+		}
+
+		/* Cumulative buckets */
+		val.tags_values_count = 3u;
+		for (uint32_t b = 0u; b < HTTP_ROUTE_HIST_BUCKETS; b++) {
+			const uint32_t bound = http_route_hist_bound_us(b);
+
+			if (bound == UINT32_MAX) {
+				strcpy(le, "+Inf");
+			} else {
+				snprintf(le, sizeof(le), "%u.%06u", bound / USEC_PER_SEC,
+						 bound % USEC_PER_SEC);
+			}
+
+			cumulated += rs->buckets[b];
+			val.uvalue = cumulated;
+			encode_metric(buffer, &val, &mdef_http_route_duration_bucket, false);
+		}
+		val.tags_values_count = 2u;
+
+		val.encoding.type = VALUE_ENCODING_TYPE_DURATION_US;
+		val.usvalue		  = rs->duration_us;
+		encode_metric(buffer, &val, &mdef_http_route_duration_sum, false);
+
+		val.encoding.type = VALUE_ENCODING_TYPE_UINT32;
+		val.uvalue		  = rs->count;
+		encode_metric(buffer, &val, &mdef_http_route_duration_count, false);
+		break;
+	}
+	case PROM_HTTP_ROUTE_RX:
+		val.uvalue = rs->rx;
+		encode_metric(buffer, &val, &mdef_http_route_rx, meta);
+		break;
+	case PROM_HTTP_ROUTE_TX:
+		val.uvalue = rs->tx;
+		encode_metric(buffer, &val, &mdef_http_route_tx, meta);
+		break;
+	default:
+		break;
+	}
+}
+
+int prometheus_metrics_controller(http_request_t *req, http_response_t *resp)
+{
+	/* Metric family being encoded and next route stats index */
+	static uint32_t family;
+	static uint32_t index;
+
+	struct http_route_stats rs;
+
+	if (http_response_is_first_call(resp)) {
+		family = PROM_HTTP_ROUTE_DURATION;
+		index  = 0u;
+
+		http_response_enable_chunk_encoding(resp);
+	}
+
+	/* A single route is encoded per call, its histogram takes a few KB */
+	while (family < PROM_HTTP_ROUTE_FAMILIES) {
+		const bool first = index == 0u;
+
+		if (http_server_route_stats_get(&index, &rs) == 0) {
+			prom_http_route_metrics(&resp->buffer, family, &rs, first);
+			break;
+		}
+
+		family++;
+		index = 0u;
+	}
+
+	if (family < PROM_HTTP_ROUTE_FAMILIES) {
+		http_response_mark_not_complete(resp);
+	}
+
+	resp->status_code = 200;
+
+	return 0;
+}
+
+#else
+
 int prometheus_metrics_controller(http_request_t *req, http_response_t *resp)
 {
 	return -EINVAL;
 }
+
+#endif /* CONFIG_APP_HTTP_ROUTE_STATS */
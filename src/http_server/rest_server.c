@@ -14,6 +14,7 @@
 #include "ha/core/config.h"
 #include "ha/core/ha.h"
 #include "ha/core/utils.h"
+#include "ha/datalogger.h"
 #include "ha/devices/all.h"
 #include "ha/json.h"
 #include "http_server/core/http_server.h"
@@ -23,6 +24,7 @@
 #include "rest_server.h"
 #include "system.h"
 #include "utils/buffers.h"
+#include "utils/trace.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -49,6 +51,10 @@ LOG_MODULE_REGISTER(rest_server, LOG_LEVEL_INF);
 
 #define REST_CANIOT_QUERY_MAX_TIMEOUT_MS (1000u)
 
+/* Discovery probes timeout, if not set with the request timeout */
+#define REST_CANIOT_DISCOVERY_PROBE_TIMEOUT_MS	   (50u)
+#define REST_CANIOT_DISCOVERY_PROBE_MAX_TIMEOUT_MS (200u)
+
 #define REST_HA_DEVICES_MAX_COUNT_PER_PAGE 10u
 #define JSON_HA_MAX_DEVICES				   MIN(HA_DEVICES_MAX_COUNT, REST_HA_DEVICES_MAX_COUNT_PER_PAGE)
 
@@ -368,6 +374,19 @@ int rest_info(http_request_t *req, http_response_t *resp)
 	return rest_encode_response_json(resp, &data, info_descr, ARRAY_SIZE(info_descr));
 }
 
+int rest_reboot(http_request_t *req, http_response_t *resp)
+{
+	/* Let the response be sent before rebooting */
+	int ret = system_reboot(K_SECONDS(1));
+	if (ret == 0) {
+		http_response_set_status_code(resp, HTTP_STATUS_ACCEPTED);
+	}
+
+	LOG_INF("POST /reboot -> %d", ret);
+
+	return ret;
+}
+
 struct json_net_interface_config {
 	char *ethernet_mac;
 	char *unicast;
@@ -831,15 +850,16 @@ static bool devices_cb(ha_dev_t *dev, void *user_data)
 
 	jd->endpoints_count = 0u;
 
-	for (uint32_t i = 0u; i < dev->endpoints_count; i++) {
-		struct ha_device_endpoint *ep = ha_dev_ep_get(dev, i);
+	for (uint32_t i = 0u; i < dev->cls->endpoints_count; i++) {
+		struct ha_device_endpoint *ep				   = ha_dev_ep_get(dev, i);
+		const struct ha_device_endpoint_config *ep_cfg = ha_dev_ep_cfg_get(dev, i);
 		if (ep) {
 			struct json_device_endpoint *jep = &jd->endpoints[jd->endpoints_count];
-			jep->eid						 = ep->cfg->eid;
-			jep->data_size					 = ep->cfg->data_size;
-			jep->in_data_size				 = ep->cfg->expected_payload_size;
-			jep->telemetry					 = (uint32_t)ep->cfg->ingest;
-			jep->command					 = (uint32_t)ep->cfg->command;
+			jep->eid						 = ep_cfg->eid;
+			jep->data_size					 = ep_cfg->data_size;
+			jep->in_data_size				 = ep_cfg->expected_payload_size;
+			jep->telemetry					 = (uint32_t)ep_cfg->ingest;
+			jep->command					 = (uint32_t)ep_cfg->command;
 
 			jd->endpoints_count++;
 
@@ -931,6 +951,10 @@ static const struct json_obj_descr json_ha_stats_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, ev_no_data_mem, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, ev_ingest, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, ev_never_ref, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, cmd_sent, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, cmd_completed, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, cmd_timeout, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, cmd_no_mem, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_ev_count, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_ev_remaining, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_device_count, JSON_TOK_NUMBER),
@@ -939,6 +963,10 @@ static const struct json_obj_descr json_ha_stats_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_sub_remaining, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_heap_alloc, JSON_TOK_NUMBER),
 	JSON_OBJ_DESCR_PRIM(struct ha_stats, mem_heap_total, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, sub_ev_dropped, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, sub_ev_coalesced, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, sub_ev_held, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_stats, sub_ev_held_max, JSON_TOK_NUMBER),
 };
 
 int rest_ha_stats(http_request_t *req, http_response_t *resp)
@@ -950,6 +978,136 @@ int rest_ha_stats(http_request_t *req, http_response_t *resp)
 									 ARRAY_SIZE(json_ha_stats_descr));
 }
 
+/* Default threshold (%) under which a battery is considered low */
+#define REST_HA_VALUES_BATTERY_LOW 20
+
+struct json_ha_values {
+	uint32_t rid;
+	struct ha_values_aggregate temperature;
+	struct ha_values_aggregate humidity;
+	struct ha_values_aggregate battery_level;
+	struct ha_values_aggregate rssi;
+	uint32_t battery_low;
+	uint32_t digital_active;
+};
+
+static const struct json_obj_descr json_ha_values_aggregate_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct ha_values_aggregate, count, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_values_aggregate, min, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_values_aggregate, max, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ha_values_aggregate, avg, JSON_TOK_NUMBER),
+};
+
+static const struct json_obj_descr json_ha_values_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct json_ha_values, rid, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_OBJECT(
+		struct json_ha_values, temperature, json_ha_values_aggregate_descr),
+	JSON_OBJ_DESCR_OBJECT(
+		struct json_ha_values, humidity, json_ha_values_aggregate_descr),
+	JSON_OBJ_DESCR_OBJECT(
+		struct json_ha_values, battery_level, json_ha_values_aggregate_descr),
+	JSON_OBJ_DESCR_OBJECT(
+		struct json_ha_values, rssi, json_ha_values_aggregate_descr),
+	JSON_OBJ_DESCR_PRIM(struct json_ha_values, battery_low, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_ha_values, digital_active, JSON_TOK_NUMBER),
+};
+
+int rest_ha_values(http_request_t *req, http_response_t *resp)
+{
+	int ret;
+	int count = 0;
+	char *val;
+	struct query_arg qal[2u];
+	uint32_t rid		= HA_ROOM_ANY;
+	int32_t battery_low = REST_HA_VALUES_BATTERY_LOW;
+	struct json_ha_values jv;
+
+	if (req->query_string != NULL) {
+		count = query_args_parse(req->query_string, qal, ARRAY_SIZE(qal));
+	}
+
+	if ((val = query_arg_get(qal, count, "room")) != NULL) {
+		rid = strtoul(val, NULL, 10);
+	}
+
+	if ((val = query_arg_get(qal, count, "battery_low")) != NULL) {
+		battery_low = strtol(val, NULL, 10);
+	}
+
+	if ((count < 0) ||
+		((rid != HA_ROOM_ANY) && (ha_room_get_by_rid((ha_room_id_t)rid) == NULL))) {
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	jv.rid = rid;
+	ha_values_aggregate(HA_VALUE_TEMPERATURE, (ha_room_id_t)rid, &jv.temperature);
+	ha_values_aggregate(HA_VALUE_HUMIDITY, (ha_room_id_t)rid, &jv.humidity);
+	ha_values_aggregate(HA_VALUE_BATTERY_LEVEL, (ha_room_id_t)rid, &jv.battery_level);
+	ret = ha_values_aggregate(HA_VALUE_RSSI, (ha_room_id_t)rid, &jv.rssi);
+	if (ret < 0) {
+		http_response_set_status_code(resp, HTTP_STATUS_INTERNAL_SERVER_ERROR);
+		return 0;
+	}
+
+	jv.battery_low =
+		ha_values_count_below(HA_VALUE_BATTERY_LEVEL, (ha_room_id_t)rid, battery_low);
+	jv.digital_active = ha_values_count_digital((ha_room_id_t)rid, UINT32_MAX);
+
+	return rest_encode_response_json(resp, &jv, json_ha_values_descr,
+									 ARRAY_SIZE(json_ha_values_descr));
+}
+
+#if defined(CONFIG_APP_HA_DATALOGGER)
+int rest_ha_datalogger(http_request_t *req, http_response_t *resp)
+{
+	int ret;
+	int count = 0;
+	char *val;
+	struct query_arg qal[3u];
+	uint32_t sdevuid = 0u, from = 0u, to = UINT32_MAX;
+	buffer_t *const buf = &resp->buffer;
+
+	if (req->query_string != NULL) {
+		count = query_args_parse(req->query_string, qal, ARRAY_SIZE(qal));
+	}
+
+	if ((val = query_arg_get(qal, count, "dev")) != NULL) {
+		sdevuid = strtoul(val, NULL, 10);
+	}
+
+	if ((val = query_arg_get(qal, count, "from")) != NULL) {
+		from = strtoul(val, NULL, 10);
+	}
+
+	if ((val = query_arg_get(qal, count, "to")) != NULL) {
+		to = strtoul(val, NULL, 10);
+	}
+
+	if ((count < 0) || (sdevuid == 0u) || (sdevuid > UINT16_MAX) || (from > to)) {
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	/* Records are copied straight into the response buffer */
+	ret = datalogger_query((uint16_t)sdevuid, from, to,
+						   (struct datalogger_record *)&buf->data[buf->filling],
+						   buffer_remaining(buf) / sizeof(struct datalogger_record));
+	if (ret < 0) {
+		LOG_ERR("Datalogger query failed ret=%d", ret);
+		http_response_set_status_code(resp, HTTP_STATUS_INTERNAL_SERVER_ERROR);
+		return 0;
+	}
+
+	buf->filling += ret * sizeof(struct datalogger_record);
+
+	LOG_INF("GET /api/ha/datalogger dev=%u [%u, %u] -> %d records", sdevuid, from, to,
+			ret);
+
+	return 0;
+}
+#endif /* CONFIG_APP_HA_DATALOGGER */
+
 static bool room_devices_cb(ha_dev_t *dev, void *user_data)
 {
 	buffer_t *const buf = (buffer_t *)user_data;
@@ -961,12 +1119,20 @@ static bool room_devices_cb(ha_dev_t *dev, void *user_data)
 
 int rest_room_devices_list(http_request_t *req, http_response_t *resp)
 {
+	uint32_t rid = HA_ROOM_MY;
+	route_arg_get(req, "rid", &rid);
+
 	const ha_dev_filter_t filter = {
 		.flags = HA_DEV_FILTER_ROOM_ID,
-		.rid   = HA_ROOM_MY,
+		.rid   = (ha_room_id_t)rid,
 	};
 
-	ha_dev_iterate(room_devices_cb, &filter, &HA_DEV_ITER_OPT_LOCK_ALL(), &resp->buffer);
+	/* Only the room members are iterated */
+	ssize_t ret = ha_dev_iterate(room_devices_cb, &filter, &HA_DEV_ITER_OPT_LOCK_ALL(),
+								 &resp->buffer);
+	if (ret == -ENOENT) {
+		http_response_set_status_code(resp, HTTP_STATUS_NOT_FOUND);
+	}
 
 	return 0;
 }
@@ -1190,6 +1356,96 @@ int caniot_q_ct_to_json_resp(struct caniot_frame *q,
 	return 0;
 }
 
+struct json_cmd_async {
+	uint32_t id;
+};
+
+static const struct json_obj_descr json_cmd_async_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct json_cmd_async, id, JSON_TOK_NUMBER),
+};
+
+/* Whether the client asked not to block the server ("?async=1") */
+static bool caniot_query_async(http_request_t *req)
+{
+	int count;
+	const char *val;
+	struct query_arg qal[4u];
+
+	if (req->query_string == NULL) {
+		return false;
+	}
+
+	count = query_args_parse(req->query_string, qal, ARRAY_SIZE(qal));
+	if (count < 0) {
+		return false;
+	}
+
+	val = query_arg_get(qal, count, "async");
+
+	return (val != NULL) && (strcmp(val, "1") == 0);
+}
+
+/* Submit the command without waiting for the device to answer, the result
+ * is notified as an HA_EV_TYPE_COMMAND event (see GET /api/ha/events).
+ *
+ * Only the board control and application endpoints are reachable through
+ * the HA device endpoints. */
+static int caniot_command_async(caniot_did_t did,
+								uint32_t ep,
+								ha_dev_cmd_type_t type,
+								uint8_t *buf,
+								size_t len,
+								uint32_t timeout,
+								http_response_t *resp)
+{
+	int ret;
+	const ha_dev_addr_t addr = {
+		.type = HA_DEV_TYPE_CANIOT,
+		.mac  = {.medium = HA_DEV_MEDIUM_CAN, .addr.caniot = did},
+	};
+	ha_dev_cmd_t cmd = {
+		.type	= type,
+		.buffer = buf,
+		.len	= len,
+	};
+	struct ha_cmd_query query = {
+		.dev	 = ha_dev_get_by_addr(&addr),
+		.cmd	 = &cmd,
+		.timeout = K_MSEC(timeout),
+		.flags	 = HA_CMD_FLAG_ASYNC,
+	};
+
+	if (query.dev == NULL) {
+		http_response_set_status_code(resp, HTTP_STATUS_NOT_FOUND);
+		return 0;
+	}
+
+	if (ep == CANIOT_ENDPOINT_BOARD_CONTROL) {
+		query.endpoint_index = HA_DEV_EP_INDEX(0);
+	} else if (ep == CANIOT_ENDPOINT_APP) {
+		query.endpoint_index = HA_DEV_EP_INDEX(1);
+	} else {
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	ret = ha_dev_command(&query, NULL);
+	if (ret == -ENOMEM) {
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	} else if (ret < 0) {
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	struct json_cmd_async json = {.id = query.id};
+
+	http_response_set_status_code(resp, HTTP_STATUS_ACCEPTED);
+
+	return rest_encode_response_json(resp, &json, json_cmd_async_descr,
+									 ARRAY_SIZE(json_cmd_async_descr));
+}
+
 int rest_devices_caniot_telemetry(http_request_t *req, http_response_t *resp)
 {
 	/* get ids */
@@ -1197,13 +1453,22 @@ int rest_devices_caniot_telemetry(http_request_t *req, http_response_t *resp)
 	route_arg_get(req, "did", &did);
 	route_arg_get(req, "ep", &ep);
 
+	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
+
+	if (caniot_query_async(req)) {
+		int ret =
+			caniot_command_async(did, ep, HA_DEV_CMD_TYPE_PING, NULL, 0u, timeout, resp);
+		LOG_INF("GET /devices/caniot/%u/endpoints/%u/telemetry?async -> %d", did, ep,
+				ret);
+		return ret;
+	}
+
 	/* build CANIOT query */
 	struct caniot_frame q;
 	caniot_build_query_telemetry(&q, ep);
 
 	/* execute and build appropriate response */
-	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
-	int ret			 = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
+	int ret = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
 	LOG_INF("GET /devices/caniot/%u/endpoints/%u/telemetry -> %d [in %u "
 			"ms]",
 			did, ep, ret, timeout);
@@ -1266,14 +1531,23 @@ int rest_devices_caniot_blc0_command(http_request_t *req, http_response_t *resp)
 	uint32_t did = 0;
 	route_arg_get(req, "did", &did);
 
+	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
+
+	if (caniot_query_async(req)) {
+		ret = caniot_command_async(did, CANIOT_ENDPOINT_BOARD_CONTROL,
+								   HA_DEV_CMD_TYPE_COMMAND, (uint8_t *)&cmd, sizeof(cmd),
+								   timeout, resp);
+		LOG_INF("POST /devices/caniot/%u/endpoints/blc0/command?async -> %d", did, ret);
+		goto exit;
+	}
+
 	/* build CANIOT query */
 	struct caniot_frame q;
 	caniot_build_query_command(&q, CANIOT_ENDPOINT_BOARD_CONTROL, (uint8_t *)&cmd,
 							   sizeof(cmd));
 
 	/* execute and build appropriate response */
-	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
-	ret				 = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
+	ret = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
 
 	LOG_INF("GET /devices/caniot/%u/endpoints/blc/command -> %d [in %u ms]", did, ret,
 			timeout);
@@ -1323,16 +1597,25 @@ int rest_devices_caniot_blc1_command(http_request_t *req, http_response_t *resp)
 		caniot_cmd_blc1_set_xps(&cmd, i, xps);
 	}
 
+	LOG_HEXDUMP_INF((uint8_t *)&cmd, sizeof(cmd), "BLC1 command: ");
+
+	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
+
+	if (caniot_query_async(req)) {
+		ret = caniot_command_async(did, CANIOT_ENDPOINT_BOARD_CONTROL,
+								   HA_DEV_CMD_TYPE_COMMAND, (uint8_t *)&cmd, sizeof(cmd),
+								   timeout, resp);
+		LOG_INF("POST /devices/caniot/%u/endpoints/blc/command?async -> %d", did, ret);
+		goto exit;
+	}
+
 	/* Convert to CANIOT command */
 	struct caniot_frame q;
 	caniot_build_query_command(&q, CANIOT_ENDPOINT_BOARD_CONTROL, (uint8_t *)&cmd,
 							   sizeof(cmd));
 
-	LOG_HEXDUMP_INF((uint8_t *)&cmd, sizeof(cmd), "BLC1 command: ");
-
 	/* execute and build appropriate response */
-	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
-	ret				 = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
+	ret = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
 
 	LOG_INF("POST /devices/caniot/%u/endpoints/blc/command -> %d", did, ret);
 
@@ -1367,13 +1650,23 @@ int rest_devices_caniot_command(http_request_t *req, http_response_t *resp)
 		goto exit;
 	}
 
+	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
+
+	/* Don't block the server on "?async=1" */
+	if (caniot_query_async(req)) {
+		ret = caniot_command_async(did, ep, HA_DEV_CMD_TYPE_COMMAND, can_buf, dlc,
+								   timeout, resp);
+		LOG_INF("POST /devices/caniot/%u/endpoints/%u/command?async -> %d", did, ep,
+				ret);
+		goto exit;
+	}
+
 	/* build CANIOT query */
 	struct caniot_frame q;
 	caniot_build_query_command(&q, ep, can_buf, dlc);
 
 	/* execute and build appropriate response */
-	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
-	ret				 = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
+	ret = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
 
 	LOG_INF("POST /devices/caniot/%u/endpoints/%u/command -> %d [in %u ms]", did, ep, ret,
 			timeout);
@@ -1570,14 +1863,23 @@ int rest_devices_caniot_blc_action(http_request_t *req, http_response_t *resp)
 		caniot_blc_sys_req_factory_reset(&cmd.sys);
 	}
 
+	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
+
+	if (caniot_query_async(req)) {
+		ret = caniot_command_async(did, CANIOT_ENDPOINT_BOARD_CONTROL,
+								   HA_DEV_CMD_TYPE_COMMAND, (uint8_t *)&cmd, sizeof(cmd),
+								   timeout, resp);
+		LOG_INF("POST /devices/caniot/%u/%s?async -> %d", did, descr->part.str, ret);
+		goto exit;
+	}
+
 	ret = caniot_build_query_command(&q, CANIOT_ENDPOINT_BOARD_CONTROL, (uint8_t *)&cmd,
 									 sizeof(cmd));
 	if (ret) {
 		goto exit;
 	}
 
-	uint32_t timeout = MIN(req->timeout_ms, REST_CANIOT_QUERY_MAX_TIMEOUT_MS);
-	ret				 = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
+	ret = caniot_q_ct_to_json_resp(&q, did, &timeout, resp);
 
 	LOG_INF("POST /devices/caniot/%u/%s -> %d [in %u ms]", did, descr->part.str, ret,
 			timeout);
@@ -1585,10 +1887,70 @@ exit:
 	return ret;
 }
 
+struct json_caniot_discovery {
+	uint32_t duration_ms;
+	uint32_t probed;
+	uint32_t errors;
+	uint32_t found;
+	uint32_t dids[CANIOT_DID_MAX_COUNT];
+	size_t dids_count;
+};
+
+static const struct json_obj_descr json_caniot_discovery_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct json_caniot_discovery, duration_ms, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_caniot_discovery, probed, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_caniot_discovery, errors, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_caniot_discovery, found, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_ARRAY(struct json_caniot_discovery,
+						 dids,
+						 CANIOT_DID_MAX_COUNT,
+						 dids_count,
+						 JSON_TOK_NUMBER),
+};
+
+int rest_devices_caniot_discover(http_request_t *req, http_response_t *resp)
+{
+	int ret;
+	struct ha_ciot_discovery_result result;
+	struct json_caniot_discovery json;
+
+	const uint32_t timeout = (req->timeout_ms != 0u)
+								 ? MIN(req->timeout_ms,
+									   REST_CANIOT_DISCOVERY_PROBE_MAX_TIMEOUT_MS)
+								 : REST_CANIOT_DISCOVERY_PROBE_TIMEOUT_MS;
+
+	ret = ha_controller_caniot_discover(timeout, NULL, NULL, &result);
+	if (ret == -EBUSY) {
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	} else if (ret < 0) {
+		return ret;
+	}
+
+	json.duration_ms = result.duration_ms;
+	json.probed		 = result.probed;
+	json.errors		 = result.errors;
+	json.found		 = result.found;
+	json.dids_count	 = 0u;
+
+	for (uint32_t did = 0u; did < CANIOT_DID_MAX_COUNT; did++) {
+		if (result.dids & BIT64(did)) {
+			json.dids[json.dids_count++] = did;
+		}
+	}
+
+	LOG_INF("POST /devices/caniot/discover -> %d [in %u ms]", ret, result.duration_ms);
+
+	return rest_encode_response_json(resp, &json, json_caniot_discovery_descr,
+									 ARRAY_SIZE(json_caniot_discovery_descr));
+}
+
 #endif /* CONFIG_APP_HA_CANIOT_CONTROLLER */
 
 #if defined(CONFIG_APP_CAN_INTERFACE)
 
+#define REST_CAN_TX_TIMEOUT_MS 100u
+
 int rest_if_can(http_request_t *req, http_response_t *resp)
 {
 	int ret = 0;
@@ -1607,7 +1969,8 @@ int rest_if_can(http_request_t *req, http_response_t *resp)
 	frame.id	= arbitration_id;
 	frame.flags = (arbitration_id > CAN_STD_ID_MASK) ? CAN_FRAME_IDE : 0u;
 	frame.dlc	= dlc;
-	ret			= if_can_send(CAN_BUS_CANIOT, &frame);
+	/* Don't block the HTTP server thread if the TX mailboxes are full */
+	ret = if_can_send_timeout(CAN_BUS_CANIOT, &frame, K_MSEC(REST_CAN_TX_TIMEOUT_MS));
 
 	LOG_INF("POST /if/can/%x [dlc=%u] -> %d", frame.id, dlc, ret);
 exit:
@@ -1623,6 +1986,13 @@ exit:
 struct json_fs_file_entry {
 	char *name;
 	uint32_t size;
+
+	/* Last run statistics, zeroed if the script wasn't run */
+	uint32_t runs;
+	int32_t lua_ret;
+	uint32_t peak_bytes;
+	uint32_t instructions;
+	uint32_t wall_time_ms;
 };
 
 struct json_fs_file_entries_list {
@@ -1635,6 +2005,11 @@ struct json_fs_file_entries_list {
 static const struct json_obj_descr json_fs_file_entry_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, name, JSON_TOK_STRING),
 	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, size, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, runs, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, lua_ret, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, peak_bytes, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, instructions, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_fs_file_entry, wall_time_ms, JSON_TOK_NUMBER),
 };
 
 static const struct json_obj_descr json_fs_file_entries_array_descr[] = {
@@ -1651,18 +2026,31 @@ static bool fs_list_lua_scripts_detailled_cb(const char *path,
 {
 	bool ret							   = true;
 	struct json_fs_file_entries_list *data = user_data;
+	struct lua_orch_script_stats stats;
 
 	if (dirent->type == FS_DIR_ENTRY_FILE) {
-		data->entries[data->nb_entries].name = data->names[data->nb_entries];
-		strncpy(data->entries[data->nb_entries].name, dirent->name, 32U);
-		data->entries[data->nb_entries].size = dirent->size;
+		struct json_fs_file_entry *const entry = &data->entries[data->nb_entries];
+
+		entry->name = data->names[data->nb_entries];
+		strncpy(entry->name, dirent->name, 32U);
+		entry->size = dirent->size;
+
+		if (lua_orch_script_stats_get(dirent->name, &stats) != 0) {
+			memset(&stats, 0, sizeof(stats));
+		}
+
+		entry->runs			= stats.runs;
+		entry->lua_ret		= stats.lua_ret;
+		entry->peak_bytes	= stats.peak_bytes;
+		entry->instructions = stats.instructions;
+		entry->wall_time_ms = stats.wall_time_ms;
 
 		data->nb_entries++;
 
-		ret = data->nb_entries < 32U;
+		ret = data->nb_entries < REST_FS_FILES_LIST_MAX_COUNT;
 	}
 
-	return true;
+	return ret;
 }
 
 int rest_fs_list_lua_scripts(http_request_t *req, http_response_t *resp)
@@ -1689,12 +2077,17 @@ struct json_lua_run_script {
 	char *name;
 	size_t lua_ret;
 
-	/* TODO add execution time and other LUA debug info/context */
+	uint32_t peak_bytes;
+	uint32_t instructions;
+	uint32_t wall_time_ms;
 };
 
 static const struct json_obj_descr json_lua_run_script_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct json_lua_run_script, name, JSON_TOK_STRING),
 	JSON_OBJ_DESCR_PRIM(struct json_lua_run_script, lua_ret, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_lua_run_script, peak_bytes, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_lua_run_script, instructions, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_lua_run_script, wall_time_ms, JSON_TOK_NUMBER),
 };
 
 int rest_lua_run_script(http_request_t *req, http_response_t *resp)
@@ -1716,9 +2109,15 @@ int rest_lua_run_script(http_request_t *req, http_response_t *resp)
 		goto exit;
 	}
 
+	struct lua_orch_script_stats stats = {0};
+	lua_orch_script_stats_get(reqpath, &stats);
+
 	struct json_lua_run_script data;
-	data.name	 = path;
-	data.lua_ret = lua_ret;
+	data.name		  = path;
+	data.lua_ret	  = lua_ret;
+	data.peak_bytes	  = stats.peak_bytes;
+	data.instructions = stats.instructions;
+	data.wall_time_ms = stats.wall_time_ms;
 	ret			 = rest_encode_response_json(resp, &data, json_lua_run_script_descr,
 											 ARRAY_SIZE(json_lua_run_script_descr));
 
@@ -1867,29 +2266,131 @@ int rest_demo_json(http_request_t *req, http_response_t *resp)
 	// );
 }
 
+/* _member is the path to the struct http_stats in _struct, empty if _struct is
+ * struct http_stats itself */
+#define HTTP_STATS_FIELD_DESCR(_struct, _member, _field)                                 \
+	JSON_OBJ_DESCR_PRIM_NAMED(_struct, #_field, _member _field, JSON_TOK_NUMBER)
+
+#define HTTP_STATS_DESCR(_struct, _member)                                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_opened_count),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_closed_count),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_error_count),                          \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_keep_alive_count),                     \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_open_failed),                          \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_alloc_failed),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_outdated_count),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, conn_process_failed),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, accept_failed),                             \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, recv_failed),                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, recv_eagain),                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, recv_closed),                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, send_eagain),                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, send_failed),                               \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, headers_send_failed),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_discarded_count),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_handler_failed),                        \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, resp_handler_failed),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_hdr_retained),                          \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_hdr_retained_max),                      \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_hdr_dropped),                           \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_pipelined_count),                       \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, req_pipeline_overflow),                     \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, push_opened_count),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, push_closed_count),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, push_failed_count),                         \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, rx),                                        \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, tx),                                        \
+	HTTP_STATS_FIELD_DESCR(_struct, _member, route_stats_dropped)
+
 static const struct json_obj_descr http_stats_descr[] = {
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_opened_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_closed_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_error_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_keep_alive_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_open_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_alloc_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_outdated_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, conn_process_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, accept_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, recv_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, recv_eagain, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, recv_closed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, send_eagain, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, send_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, headers_send_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, req_discarded_count, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, req_handler_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, resp_handler_failed, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, rx, JSON_TOK_NUMBER),
-	JSON_OBJ_DESCR_PRIM(struct http_stats, tx, JSON_TOK_NUMBER),
+	HTTP_STATS_DESCR(struct http_stats, ),
+};
+
+#if defined(CONFIG_APP_HTTP_ROUTE_STATS)
+
+/* Latency percentiles are estimated from the route histogram, the full
+ * histograms are exported on GET /metrics_controller */
+struct json_http_route_stats {
+	const char *method;
+	char *route;
+	uint32_t count;
+	uint32_t rx;
+	uint32_t tx;
+	uint32_t duration_ms;
+	uint32_t p50_us;
+	uint32_t p90_us;
+	uint32_t p99_us;
+};
+
+static const struct json_obj_descr json_http_route_stats_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, method, JSON_TOK_STRING),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, route, JSON_TOK_STRING),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, count, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, rx, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, tx, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, duration_ms, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, p50_us, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, p90_us, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct json_http_route_stats, p99_us, JSON_TOK_NUMBER),
+};
+
+struct json_http_stats {
+	struct http_stats stats;
+	struct json_http_route_stats routes[CONFIG_APP_HTTP_ROUTE_STATS_SLOTS];
+	uint32_t routes_count;
+};
+
+/* Global counters are kept at the top level, next to the routes */
+static const struct json_obj_descr json_http_stats_descr[] = {
+	HTTP_STATS_DESCR(struct json_http_stats, stats.),
+	JSON_OBJ_DESCR_OBJ_ARRAY(struct json_http_stats,
+							 routes,
+							 CONFIG_APP_HTTP_ROUTE_STATS_SLOTS,
+							 routes_count,
+							 json_http_route_stats_descr,
+							 ARRAY_SIZE(json_http_route_stats_descr)),
 };
 
+int rest_http_stats(http_request_t *req, http_response_t *resp)
+{
+	/* Static as the route handlers are only called from the HTTP server
+	 * thread, too large for its stack */
+	static struct json_http_stats data;
+	static char urls[CONFIG_APP_HTTP_ROUTE_STATS_SLOTS][CONFIG_APP_HTTP_URL_MAX_LENGTH];
+
+	uint32_t index = 0u;
+	struct http_route_stats rs;
+
+	http_server_get_stats(&data.stats);
+	data.routes_count = 0u;
+
+	while (http_server_route_stats_get(&index, &rs) == 0) {
+		struct json_http_route_stats *const jr = &data.routes[data.routes_count];
+		char *const url						   = urls[data.routes_count];
+
+		if (http_route_build_url(rs.route, url, sizeof(urls[0])) < 0) {
+			strcpy(url, "?");
+		}
+
+		jr->method		= http_method_str(http_route_get_method(rs.route));
+		jr->route		= url;
+		jr->count		= rs.count;
+		jr->rx			= rs.rx;
+		jr->tx			= rs.tx;
+		jr->duration_ms = (uint32_t)(rs.duration_us / USEC_PER_MSEC);
+		jr->p50_us		= http_route_hist_percentile_us(&rs, 50u);
+		jr->p90_us		= http_route_hist_percentile_us(&rs, 90u);
+		jr->p99_us		= http_route_hist_percentile_us(&rs, 99u);
+
+		data.routes_count++;
+	}
+
+	return rest_encode_response_json(resp, &data, json_http_stats_descr,
+									 ARRAY_SIZE(json_http_stats_descr));
+}
+
+#else
+
 int rest_http_stats(http_request_t *req, http_response_t *resp)
 {
 	int ret;
@@ -1901,4 +2402,87 @@ int rest_http_stats(http_request_t *req, http_response_t *resp)
 									ARRAY_SIZE(http_stats_descr));
 
 	return ret;
-}
\ No newline at end of file
+}
+
+#endif /* CONFIG_APP_HTTP_ROUTE_STATS */
+#if defined(CONFIG_APP_TRACE)
+int rest_trace_dump(http_request_t *req, http_response_t *resp)
+{
+	/* Ring being dumped and index of its next record */
+	static uint32_t cpu;
+	static uint32_t from;
+	static bool was_enabled;
+	/* Recording paused by a dump, which may not have completed (e.g. the
+	 * client disconnected) */
+	static bool paused;
+
+	int ret;
+	buffer_t *const buf = &resp->buffer;
+
+	if (http_response_is_first_call(resp)) {
+		int count = 0;
+		char *val;
+		struct query_arg qal[1u];
+
+		if (req->query_string != NULL) {
+			count = query_args_parse(req->query_string, qal, ARRAY_SIZE(qal));
+		}
+
+		/* Restore the recording state left by an aborted dump */
+		if (paused) {
+			trace_enable(was_enabled);
+			paused = false;
+		}
+
+		/* Only start or stop the recording */
+		if ((val = query_arg_get(qal, count, "enable")) != NULL) {
+			const bool enable = strtoul(val, NULL, 10) != 0u;
+			trace_enable(enable);
+			LOG_INF("GET /api/trace tracing %s", enable ? "enabled" : "disabled");
+			return 0;
+		}
+
+		/* Recording is paused during the dump, so that the rings are not
+		 * overwritten by the trace points of the response itself */
+		was_enabled = trace_enable(false);
+		paused		= true;
+		cpu			= 0u;
+		from		= 0u;
+
+		http_response_enable_chunk_encoding(resp);
+
+		struct trace_dump_header hdr;
+		trace_dump_header(&hdr);
+		buffer_append(buf, (char *)&hdr, sizeof(hdr));
+	}
+
+	while (cpu < CONFIG_MP_MAX_NUM_CPUS) {
+		const size_t room = buffer_remaining(buf) / sizeof(struct trace_record);
+		if (room == 0u) {
+			break;
+		}
+
+		ret = trace_read(cpu, &from,
+						 (struct trace_record *)&buf->data[buf->filling], room);
+		if (ret < 0) {
+			LOG_ERR("Trace read failed ret=%d", ret);
+			cpu = CONFIG_MP_MAX_NUM_CPUS;
+		} else if (ret == 0) {
+			/* Ring exhausted */
+			cpu++;
+			from = 0u;
+		} else {
+			buf->filling += ret * sizeof(struct trace_record);
+		}
+	}
+
+	if (cpu < CONFIG_MP_MAX_NUM_CPUS) {
+		http_response_mark_not_complete(resp);
+	} else {
+		trace_enable(was_enabled);
+		paused = false;
+	}
+
+	return 0;
+}
+#endif /* CONFIG_APP_TRACE */
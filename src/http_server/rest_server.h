@@ -32,6 +32,8 @@ int rest_index(http_request_t *req, http_response_t *resp);
 
 int rest_info(http_request_t *req, http_response_t *resp);
 
+int rest_reboot(http_request_t *req, http_response_t *resp);
+
 int rest_interface(http_request_t *req, http_response_t *resp);
 
 int rest_interfaces_list(http_request_t *req, http_response_t *resp);
@@ -48,6 +50,27 @@ int rest_device_get(http_request_t *req, http_response_t *resp);
 
 int rest_ha_stats(http_request_t *req, http_response_t *resp);
 
+/**
+ * @brief Get the records logged for a device, as an array of
+ * struct datalogger_record
+ *
+ * Query parameters: "dev" (sdevuid, mandatory), "from" and "to" (timestamps,
+ * optional). The response is truncated to the response buffer size, use
+ * the timestamp of the last record to get the next ones.
+ */
+int rest_ha_datalogger(http_request_t *req, http_response_t *resp);
+
+/**
+ * @brief Aggregates of the devices latest values (min/max/avg temperature,
+ * humidity, battery level and RSSI, number of low battery sensors and of
+ * devices with an active digital pin)
+ *
+ * Query parameters (optional): "room" (room id, 0 for the devices without
+ * room, all devices if not set), "battery_low" (threshold in %, default 20).
+ * The "rid" returned is 255 (HA_ROOM_ANY) when all devices are aggregated.
+ */
+int rest_ha_values(http_request_t *req, http_response_t *resp);
+
 int rest_room_devices_list(http_request_t *req, http_response_t *resp);
 
 int rest_caniot_info(http_request_t *req, http_response_t *resp);
@@ -78,6 +101,8 @@ int rest_devices_caniot_attr_read_write(http_request_t *req, http_response_t *re
 
 int rest_devices_caniot_blc_action(http_request_t *req, http_response_t *resp);
 
+int rest_devices_caniot_discover(http_request_t *req, http_response_t *resp);
+
 int rest_fs_list_lua_scripts(http_request_t *req, http_response_t *resp);
 
 int rest_fs_remove_lua_script(http_request_t *req, http_response_t *resp);
@@ -92,4 +117,13 @@ int rest_demo_json(http_request_t *req, http_response_t *resp);
 
 int rest_http_stats(http_request_t *req, http_response_t *resp);
 
+/**
+ * @brief Dump the trace rings (struct trace_dump_header followed by the
+ * struct trace_record of each CPU ring, oldest first)
+ *
+ * Query parameters (optional): "enable" (0 or 1) only stops or starts the
+ * recording.
+ */
+int rest_trace_dump(http_request_t *req, http_response_t *resp);
+
 #endif
\ No newline at end of file
@@ -11,8 +11,10 @@
 #include "files_server.h"
 #include "prometheus_client.h"
 #include "rest_server.h"
+#include "sse_server.h"
 #include "test_server.h"
 #include "web_server.h"
+#include "ws_can_server.h"
 
 #include <embedc-url/parser.h>
 #include <embedc-url/parser_internal.h>
@@ -79,6 +81,9 @@ static const struct route_descr root_api_test[] = {
 
 #if defined(CONFIG_APP_CAN_INTERFACE)
 static const struct route_descr root_api_if_can[] = {
+#if defined(CONFIG_APP_HTTP_WS_CAN)
+	LEAF("ws", GET, ws_can_server_bridge, NULL, 0u),
+#endif
 	LEAF("id:x", POST | ARG_HEX, rest_if_can, NULL, 0u),
 };
 #endif
@@ -92,7 +97,14 @@ static const struct route_descr root_api_if[] = {
 #if defined(CONFIG_APP_HA)
 static const struct route_descr root_api_ha[] = {
 	LEAF("stats", GET, rest_ha_stats, NULL, 0u),
+	LEAF("values", GET, rest_ha_values, NULL, 0u),
 	LEAF("telemetry", GET, debug_server_ha_telemetry, NULL, TEXT),
+#if defined(CONFIG_APP_HTTP_SSE)
+	LEAF("events", GET, sse_server_ha_events, NULL, TEXT),
+#endif
+#if defined(CONFIG_APP_HA_DATALOGGER)
+	LEAF("datalogger", GET, rest_ha_datalogger, NULL, BINARY),
+#endif
 };
 #endif
 
@@ -181,6 +193,7 @@ static const struct route_descr root_api_devices_caniot[] = {
 #if defined(CONFIG_APP_HA)
 	LEAF("", GET, rest_caniot_records, NULL, 0u),
 #endif
+	LEAF("discover", POST, rest_devices_caniot_discover, NULL, 0u),
 	SECTION("did:u",
 			ARG_UINT,
 			root_api_devices_caniot_didzu,
@@ -210,7 +223,7 @@ static const struct route_descr root_api_devices[] = {
 
 #if defined(CONFIG_APP_HA)
 static const struct route_descr root_api_room[] = {
-	LEAF(":u", GET | ARG_UINT, rest_room_devices_list, NULL, 0u),
+	LEAF("rid:u", GET | ARG_UINT, rest_room_devices_list, NULL, 0u),
 };
 #endif
 
@@ -295,6 +308,7 @@ static const struct route_descr root_api_interface[] = {
 
 static const struct route_descr root_api[] = {
 	LEAF("info", GET, rest_info, NULL, 0u),
+	LEAF("reboot", POST, rest_reboot, NULL, 0u),
 	SECTION("interface", 0u, root_api_interface, ARRAY_SIZE(root_api_interface), 0u),
 #if defined(CONFIG_APP_CREDS_FLASH)
 	SECTION(
@@ -310,6 +324,9 @@ static const struct route_descr root_api[] = {
 	SECTION("dfu", 0u, root_api_dfu, ARRAY_SIZE(root_api_dfu), 0u),
 #endif
 	SECTION("http", 0u, root_api_http, ARRAY_SIZE(root_api_http), REST),
+#if defined(CONFIG_APP_TRACE)
+	LEAF("trace", GET, rest_trace_dump, NULL, BINARY),
+#endif
 #if defined(CONFIG_APP_HA)
 	SECTION("room", 0u, root_api_room, ARRAY_SIZE(root_api_room), 0u),
 #endif
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "core/http_server.h"
+#include "ha/core/ha.h"
+#include "ha/core/subs_extended.h"
+#include "sse_server.h"
+#include "utils/buffers.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <embedc-url/parser.h>
+LOG_MODULE_REGISTER(sse_server, LOG_LEVEL_INF);
+
+/* Maximum size of a single encoded event */
+#define SSE_EVENT_MAX_SIZE 384u
+
+struct sse_stream {
+	/* Subscription, NULL if the stream is free */
+	struct ha_ev_subs *sub;
+
+	struct ha_ev_subs_conf conf;
+
+	/* Lookup table, used if subs_extended filtering is requested */
+	struct ha_subs_ext_lookup_table lt;
+	bool lt_used;
+
+	/* Id of the last event sent */
+	uint32_t last_id;
+
+	/* Events dropped by the subscription, last count reported to the client */
+	uint32_t dropped;
+};
+
+static struct sse_stream streams[CONFIG_APP_HTTP_SSE_MAX_STREAMS];
+
+static struct sse_stream *stream_alloc(void)
+{
+	for (struct sse_stream *s = streams; s < streams + ARRAY_SIZE(streams); s++) {
+		if (s->sub == NULL) {
+			memset(s, 0, sizeof(*s));
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+static void stream_free(struct sse_stream *s)
+{
+	ha_unsubscribe(s->sub);
+	if (s->lt_used) {
+		ha_subs_ext_lt_clear(&s->lt);
+	}
+	s->sub = NULL;
+}
+
+static void on_queued(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	ARG_UNUSED(sub);
+	ARG_UNUSED(event);
+
+	/* Called from the thread registering the event */
+	http_server_push_notify();
+}
+
+static int encode_data_value(buffer_t *buf, ha_data_type_t type, const void *p)
+{
+	switch (type) {
+	case HA_DATA_TEMPERATURE:
+		return buffer_snprintf(buf, "[%u,%d]", type,
+							   ((const struct ha_data_temperature *)p)->value);
+	case HA_DATA_HUMIDITY:
+		return buffer_snprintf(buf, "[%u,%u]", type,
+							   ((const struct ha_data_humidity *)p)->value);
+	case HA_DATA_BATTERY_LEVEL:
+		return buffer_snprintf(buf, "[%u,%u,%u]", type,
+							   ((const struct ha_data_battery_level *)p)->level,
+							   ((const struct ha_data_battery_level *)p)->voltage);
+	case HA_DATA_RSSI:
+		return buffer_snprintf(buf, "[%u,%d]", type,
+							   ((const struct ha_data_rssi *)p)->value);
+	case HA_DATA_DIGITAL_INOUT:
+	case HA_DATA_DIGITAL_IN:
+	case HA_DATA_DIGITAL_OUT:
+		return buffer_snprintf(buf, "[%u,%u,%u]", type,
+							   ((const struct ha_data_digital *)p)->value,
+							   ((const struct ha_data_digital *)p)->mask);
+	case HA_DATA_ANALOG:
+		return buffer_snprintf(buf, "[%u,%u]", type,
+							   ((const struct ha_data_analog *)p)->value);
+	case HA_DATA_SHUTTER_POSITION:
+		return buffer_snprintf(buf, "[%u,%u,%u]", type,
+							   ((const struct ha_shutter_position *)p)->position,
+							   ((const struct ha_shutter_position *)p)->moving);
+#if defined(CONFIG_CANIOT_LIB)
+	case HA_DATA_HEATER_MODE:
+		return buffer_snprintf(buf, "[%u,%u]", type,
+							   ((const struct ha_heater_mode *)p)->mode);
+	case HA_DATA_XPS:
+		return buffer_snprintf(buf, "[%u,%u]", type,
+							   ((const struct ha_data_xps *)p)->cmd);
+	case HA_DATA_TS:
+		return buffer_snprintf(buf, "[%u,%u]", type, ((const struct ha_data_ts *)p)->cmd);
+	case HA_DATA_ONOFF:
+		return buffer_snprintf(buf, "[%u,%u]", type,
+							   ((const struct ha_data_onoff *)p)->status);
+#endif
+	default:
+		return buffer_snprintf(buf, "[%u]", type);
+	}
+}
+
+static int encode_event(struct sse_stream *s, ha_ev_t *ev, buffer_t *buf)
+{
+	int ret;
+	size_t len			 = 0u;
+	const size_t filling = buf->filling;
+	char addr_str[HA_DEV_ADDR_STR_MAX_LEN];
+
+	ha_dev_t *const dev = ev->dev;
+	const struct ha_device_endpoint_config *ep_cfg = ha_dev_ep_cfg_get(dev, ev->ep_index);
+
+	ha_dev_addr_to_str(&dev->addr, addr_str, sizeof(addr_str));
+
+	ret = buffer_snprintf(buf,
+						  "id: %u\ndata: {\"dev\":%u,\"ep\":%u,\"eid\":%u,\"type\":%u,"
+						  "\"ts\":%u,\"addr\":\"%s\",\"data\":[",
+						  s->last_id + 1u, dev->sdevuid, ev->ep_index,
+						  ep_cfg ? ep_cfg->eid : HA_DEV_EP_NONE, ev->type, ev->timestamp,
+						  addr_str);
+	if (ret < 0) goto exit;
+	len += ret;
+
+	if (ev->data && (ev->type == HA_EV_TYPE_COMMAND)) {
+		const struct ha_cmd_result *r = ev->data;
+
+		/* Command result: [id, status, duration, command type] */
+		ret = buffer_snprintf(buf, "%u,%d,%u,%u", r->id, r->status, r->duration,
+							  r->type);
+		if (ret < 0) goto exit;
+		len += ret;
+	} else if (ev->data && ep_cfg && ep_cfg->data_descr) {
+		for (uint8_t i = 0u; i < ep_cfg->data_descr_size; i++) {
+			const struct ha_data_descr *d = &ep_cfg->data_descr[i];
+
+			if (i != 0u) {
+				if ((ret = buffer_snprintf(buf, ",")) < 0) goto exit;
+				len += ret;
+			}
+
+			ret = encode_data_value(buf, d->type, (uint8_t *)ev->data + d->offset);
+			if (ret < 0) goto exit;
+			len += ret;
+		}
+	}
+
+	ret = buffer_snprintf(buf, "]}\n\n");
+	if (ret < 0) goto exit;
+	len += ret;
+
+exit:
+	/* buffer_snprintf() doesn't move the filling on truncation,
+	 * so any mismatch means the event didn't fit */
+	if ((ret < 0) || (buf->filling - filling != len) || (buffer_remaining(buf) == 0u)) {
+		buf->filling = filling;
+		return -ENOMEM;
+	}
+
+	s->last_id++;
+
+	return 0;
+}
+
+/* Tell the client the subscription dropped events since the last report */
+static void report_dropped(struct sse_stream *s, buffer_t *buf)
+{
+	struct ha_ev_subs_stats stats;
+
+	if ((ha_subs_stats_get(s->sub, &stats) == 0) && (stats.dropped != s->dropped) &&
+		(buffer_snprintf(buf, "event: dropped\ndata: {\"dropped\":%u}\n\n",
+						 stats.dropped) > 0)) {
+		s->dropped = stats.dropped;
+	}
+}
+
+static int stream_fill(void *ctx, buffer_t *buf, bool idle)
+{
+	ha_ev_t *ev;
+	struct sse_stream *const s = ctx;
+
+	report_dropped(s, buf);
+
+	while (buffer_remaining(buf) >= SSE_EVENT_MAX_SIZE) {
+		ev = ha_ev_wait(s->sub, K_NO_WAIT);
+		if (ev == NULL) {
+			break;
+		}
+
+		if (encode_event(s, ev, buf) < 0) {
+			LOG_WRN("(%p) Event %p too large, skipped", s, ev);
+		}
+
+		ha_ev_unref(ev);
+	}
+
+	if (buffer_remaining(buf) < SSE_EVENT_MAX_SIZE) {
+		/* Buffer full, come back for the remaining events */
+		http_server_push_notify();
+	} else if (idle && (buf->filling == 0u)) {
+		/* Comment line, to keep the connection alive */
+		buffer_append_string(buf, ":\n\n");
+	}
+
+	return 0;
+}
+
+static void stream_close(void *ctx)
+{
+	struct sse_stream *const s = ctx;
+
+	LOG_INF("(%p) Stream closed, %u events sent, %u dropped", s, s->last_id,
+			s->dropped);
+
+	stream_free(s);
+}
+
+static const struct http_push_handler stream_handler = {
+	.fill  = stream_fill,
+	.close = stream_close,
+};
+
+struct sse_filter_name {
+	const char *name;
+	uint32_t value;
+};
+
+static const struct sse_filter_name type_names[] = {
+	{"data", HA_EV_SUBS_CONF_DEVICE_DATA},
+	{"command", HA_EV_SUBS_CONF_DEVICE_COMMAND},
+	{"error", HA_EV_SUBS_CONF_DEVICE_ERROR},
+};
+
+static const struct sse_filter_name filtering_names[] = {
+	{"none", HA_SUBS_EXT_FILTERING_TYPE_NONE},
+	{"duplicate", HA_SUBS_EXT_FILTERING_TYPE_DUPLICATE},
+	{"count", HA_SUBS_EXT_FILTERING_TYPE_COUNT},
+	{"interval", HA_SUBS_EXT_FILTERING_TYPE_INTERVAL},
+	{"interval_ms", HA_SUBS_EXT_FILTERING_TYPE_INTERVAL_MS},
+	{"subsampling", HA_SUBS_EXT_FILTERING_TYPE_SUBSAMPLING},
+};
+
+static const struct sse_filter_name lookup_names[] = {
+	{"any", HA_SUBS_EXT_LOOKUP_TYPE_ANY},
+	{"sdevuid", HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID},
+	{"sdevuid_endpoint", HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID_ENDPOINT},
+	{"devaddr", HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR},
+	{"devaddr_endpoint", HA_SUBS_EXT_LOOKUP_TYPE_DEVADDR_ENDPOINT},
+	{"endpointid", HA_SUBS_EXT_LOOKUP_TYPE_ENDPOINTID},
+};
+
+static int filter_name_get(const struct sse_filter_name *names,
+						   size_t count,
+						   const char *name,
+						   uint32_t *value)
+{
+	for (size_t i = 0u; i < count; i++) {
+		if (strcmp(names[i].name, name) == 0) {
+			*value = names[i].value;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int stream_configure(struct sse_stream *s, char *query_string)
+{
+	int ret;
+	int count = 0;
+	char *val;
+	struct query_arg qal[5u];
+	uint32_t filtering, lookup = HA_SUBS_EXT_LOOKUP_TYPE_SDEVUID, type;
+
+	ha_ev_subs_conf_init(&s->conf);
+	s->conf.flags		 = HA_EV_SUBS_CONF_ON_QUEUED_HOOK;
+	s->conf.on_queued_cb = on_queued;
+
+	if (query_string != NULL) {
+		count = query_args_parse(query_string, qal, ARRAY_SIZE(qal));
+		if (count < 0) {
+			return -EINVAL;
+		}
+	}
+
+	if ((val = query_arg_get(qal, count, "type")) != NULL) {
+		ret = filter_name_get(type_names, ARRAY_SIZE(type_names), val, &type);
+		if (ret < 0) return ret;
+		s->conf.flags |= type;
+	}
+
+	if ((val = query_arg_get(qal, count, "lookup")) != NULL) {
+		ret = filter_name_get(lookup_names, ARRAY_SIZE(lookup_names), val, &lookup);
+		if (ret < 0) return ret;
+	}
+
+	if ((val = query_arg_get(qal, count, "latest")) != NULL) {
+		if (strcmp(val, "1") == 0) {
+			s->conf.flags |= HA_EV_SUBS_CONF_LATEST_VALUE;
+		} else if (strcmp(val, "0") != 0) {
+			return -EINVAL;
+		}
+	}
+
+	if ((val = query_arg_get(qal, count, "filter")) != NULL) {
+		ret = filter_name_get(filtering_names, ARRAY_SIZE(filtering_names), val,
+							  &filtering);
+		if (ret < 0) return ret;
+
+		ha_subs_ext_filtering_param_t param = HA_SUBS_EXT_FILTERING_PARAM_NONE;
+		if ((val = query_arg_get(qal, count, "param")) != NULL) {
+			param.any = strtoul(val, NULL, 10);
+		}
+
+		ret = ha_subs_ext_conf_set(&s->conf, &s->lt, lookup, filtering, param);
+		if (ret < 0) return ret;
+
+		s->lt_used = true;
+	}
+
+	/* Events are only drained when the server pushes, absorb the bursts (the
+	 * latest value queues are already sized for all the devices) */
+	if ((s->conf.flags & HA_EV_SUBS_CONF_LATEST_VALUE) == 0u) {
+		s->conf.queue_limit = HA_SUBS_QUEUE_MAX_LEN;
+	}
+
+	return 0;
+}
+
+int sse_server_ha_events(http_request_t *req, http_response_t *resp)
+{
+	int ret;
+	struct sse_stream *s = stream_alloc();
+
+	if (s == NULL) {
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	}
+
+	ret = stream_configure(s, req->query_string);
+	if (ret == -ENOMEM) {
+		/* Lookup tables pool exhausted */
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	} else if (ret < 0) {
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	ret = ha_subscribe(&s->conf, &s->sub);
+	if (ret < 0) {
+		LOG_ERR("Failed to subscribe to HA events = %d", ret);
+		if (s->lt_used) {
+			ha_subs_ext_lt_clear(&s->lt);
+		}
+		s->sub = NULL;
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	}
+
+	http_response_set_content_type(resp, HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM);
+
+	/* The subscription is released by stream_close() in any case */
+	ret = http_response_push(resp, &stream_handler, s);
+	if (ret < 0) {
+		stream_free(s);
+		return ret;
+	}
+
+	/* Client reconnection delay */
+	buffer_append_string(&resp->buffer, "retry: 3000\n\n");
+
+	LOG_INF("(%p) Stream opened, sub %p", s, s->sub);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _HTTP_SSE_SERVER_H_
+#define _HTTP_SSE_SERVER_H_
+
+#include "core/http_request.h"
+#include "core/http_response.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Stream HA events as Server-Sent Events (text/event-stream)
+ *
+ * Query parameters (all optional):
+ * - type: "data", "command" or "error" (default: all)
+ * - filter: "none", "duplicate", "count", "interval", "interval_ms" or
+ *   "subsampling"
+ * - param: filter parameter (e.g. interval in seconds, or in milliseconds for
+ *   "interval_ms")
+ * - lookup: "any", "sdevuid", "sdevuid_endpoint", "devaddr", "devaddr_endpoint"
+ *   or "endpointid" (default: "sdevuid")
+ * - latest: "1" to only keep the latest pending event of each device endpoint
+ *   when the client falls behind (default: "0"), 503 when all the latest value
+ *   queues (CONFIG_APP_HA_SUBS_LATEST_VALUE_MAX_COUNT) are in use
+ *
+ * Each event is sent as a compact JSON object:
+ *  {"dev":1,"ep":0,"eid":2,"type":0,"ts":1672531200,"addr":"...","data":[[1,2312],...]}
+ * with "data" the list of [data type, value] of the endpoint data.
+ *
+ * When the client falls behind and the subscription queue overflows, the
+ * total number of events dropped so far is reported before the next events:
+ *  event: dropped
+ *  data: {"dropped":12}
+ */
+int sse_server_ha_events(http_request_t *req, http_response_t *resp);
+
+#endif /* _HTTP_SSE_SERVER_H_ */
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "can/can_interface.h"
+#include "core/http_server.h"
+#include "core/http_websocket.h"
+#include "utils/buffers.h"
+#include "ws_can_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <embedc-url/parser.h>
+LOG_MODULE_REGISTER(ws_can, LOG_LEVEL_INF);
+
+/* Timestamp, identifier and DLC */
+#define RECORD_HEADER_SIZE	  9u
+#define RECORD_MAX_SIZE		  (RECORD_HEADER_SIZE + CAN_MAX_DLEN)
+#define TX_RECORD_HEADER_SIZE 5u
+
+/* Largest client message accepted, frame header included */
+#define CONN_RX_BUF_SIZE CONFIG_APP_HTTP_WS_CAN_RX_MAX_SIZE
+
+/* Maximum time the HTTP server thread waits for a free CAN TX mailbox */
+#define CAN_TX_TIMEOUT_MS 10u
+
+struct ws_can_item {
+	uint32_t timestamp;
+	bool tx;
+	struct can_frame frame;
+};
+
+struct ws_can_conn {
+	bool active;
+
+	/* Filter */
+	uint32_t id;
+	uint32_t mask;
+
+	/* Frames to forward to the client */
+	struct k_msgq rxq;
+	char rxq_buf[CONFIG_APP_HTTP_WS_CAN_QUEUE_SIZE * sizeof(struct ws_can_item)];
+	uint32_t dropped;
+
+	/* Data received from the client, not yet decoded */
+	size_t rx_len;
+	char rx_buf[CONN_RX_BUF_SIZE];
+};
+
+static struct ws_can_conn conns[CONFIG_APP_HTTP_WS_CAN_MAX_CONNECTIONS];
+
+/* Protects connections (de)activation against the tap callback */
+static K_MUTEX_DEFINE(conns_mutex);
+
+static bool tap_registered;
+
+static bool frame_match(const struct ws_can_conn *conn, const struct can_frame *frame)
+{
+	return ((frame->id ^ conn->id) & conn->mask) == 0u;
+}
+
+static void tap(can_bus_id_t canbus, const struct can_frame *frame, bool tx, void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	bool notify = false;
+	const struct ws_can_item item = {
+		.timestamp = k_uptime_get_32(),
+		.tx		   = tx,
+		.frame	   = *frame,
+	};
+
+	if (canbus != CAN_BUS_CANIOT) {
+		return;
+	}
+
+	k_mutex_lock(&conns_mutex, K_FOREVER);
+	for (struct ws_can_conn *c = conns; c < conns + ARRAY_SIZE(conns); c++) {
+		if (c->active && frame_match(c, frame)) {
+			if (k_msgq_put(&c->rxq, &item, K_NO_WAIT) == 0) {
+				notify = true;
+			} else {
+				c->dropped++;
+			}
+		}
+	}
+	k_mutex_unlock(&conns_mutex);
+
+	if (notify) {
+		http_server_push_notify();
+	}
+}
+
+static struct ws_can_conn *conn_alloc(void)
+{
+	struct ws_can_conn *conn = NULL;
+
+	k_mutex_lock(&conns_mutex, K_FOREVER);
+	for (struct ws_can_conn *c = conns; c < conns + ARRAY_SIZE(conns); c++) {
+		if (!c->active) {
+			c->id	   = 0u;
+			c->mask	   = 0u;
+			c->dropped = 0u;
+			c->rx_len  = 0u;
+			k_msgq_init(&c->rxq, c->rxq_buf, sizeof(struct ws_can_item),
+						CONFIG_APP_HTTP_WS_CAN_QUEUE_SIZE);
+			c->active = true;
+			conn	  = c;
+			break;
+		}
+	}
+	k_mutex_unlock(&conns_mutex);
+
+	return conn;
+}
+
+static void conn_free(struct ws_can_conn *conn)
+{
+	k_mutex_lock(&conns_mutex, K_FOREVER);
+	conn->active = false;
+	k_msgq_purge(&conn->rxq);
+	k_mutex_unlock(&conns_mutex);
+}
+
+static void conn_set_filter(struct ws_can_conn *conn, uint32_t id, uint32_t mask)
+{
+	k_mutex_lock(&conns_mutex, K_FOREVER);
+	conn->id   = id & WS_CAN_ID_MASK;
+	conn->mask = mask & WS_CAN_ID_MASK;
+	k_msgq_purge(&conn->rxq);
+	k_mutex_unlock(&conns_mutex);
+
+	LOG_INF("(%p) Filter id=%x mask=%x", conn, conn->id, conn->mask);
+}
+
+static size_t record_encode(uint8_t *p, const struct ws_can_item *item)
+{
+	uint32_t id = item->frame.id;
+
+	if (item->frame.flags & CAN_FRAME_IDE) id |= WS_CAN_ID_FLAG_EXTENDED;
+	if (item->frame.flags & CAN_FRAME_RTR) id |= WS_CAN_ID_FLAG_RTR;
+	if (item->tx) id |= WS_CAN_ID_FLAG_TX;
+
+	const uint8_t dlc = MIN(item->frame.dlc, CAN_MAX_DLEN);
+
+	sys_put_le32(item->timestamp, &p[0]);
+	sys_put_le32(id, &p[4]);
+	p[8] = dlc;
+	memcpy(&p[RECORD_HEADER_SIZE], item->frame.data, dlc);
+
+	return RECORD_HEADER_SIZE + dlc;
+}
+
+static int conn_fill(void *ctx, buffer_t *buf, bool idle)
+{
+	int ret;
+	size_t len = 0u;
+	struct ws_can_item item;
+	struct ws_can_conn *const conn = ctx;
+
+	/* Records are written after the largest header, as the payload length
+	 * is only known once the batch is complete */
+	char *const base	   = &buf->data[buf->filling];
+	uint8_t *const payload = (uint8_t *)&base[HTTP_WS_FRAME_HEADER_MAX_SIZE];
+	const size_t capacity  = MIN(buffer_remaining(buf) - HTTP_WS_FRAME_HEADER_MAX_SIZE,
+								 CONFIG_APP_HTTP_WS_CAN_BATCH_MAX_SIZE);
+
+	while ((capacity - len >= RECORD_MAX_SIZE) &&
+		   (k_msgq_get(&conn->rxq, &item, K_NO_WAIT) == 0)) {
+		len += record_encode(&payload[len], &item);
+	}
+
+	if (len != 0u) {
+		ret = http_ws_frame_encode_header(base, HTTP_WS_OPCODE_BINARY, len);
+		if (ret < 0) {
+			return ret;
+		}
+
+		/* Move the payload right after the actual header */
+		memmove(&base[ret], payload, len);
+		buf->filling += ret + len;
+
+		if (k_msgq_num_used_get(&conn->rxq) != 0u) {
+			/* More frames to forward */
+			http_server_push_notify();
+		}
+	} else if (idle) {
+		return http_ws_frame_append(buf, HTTP_WS_OPCODE_PING, NULL, 0u);
+	}
+
+	return 0;
+}
+
+static int handle_tx_records(struct ws_can_conn *conn,
+							 const uint8_t *p,
+							 size_t len,
+							 buffer_t *reply)
+{
+	int ret;
+	struct can_frame frame;
+
+	while (len >= TX_RECORD_HEADER_SIZE) {
+		const uint32_t id  = sys_get_le32(p);
+		const uint8_t dlc  = p[4];
+		const size_t rsize = TX_RECORD_HEADER_SIZE + dlc;
+
+		if ((dlc > CAN_MAX_DLEN) || (len < rsize)) {
+			return -EINVAL;
+		}
+
+		memset(&frame, 0, sizeof(frame));
+		frame.id  = id & WS_CAN_ID_MASK;
+		frame.dlc = dlc;
+		if (id & WS_CAN_ID_FLAG_EXTENDED) frame.flags |= CAN_FRAME_IDE;
+		if (id & WS_CAN_ID_FLAG_RTR) frame.flags |= CAN_FRAME_RTR;
+		memcpy(frame.data, &p[TX_RECORD_HEADER_SIZE], dlc);
+
+		ret = if_can_send_timeout(CAN_BUS_CANIOT, &frame, K_MSEC(CAN_TX_TIMEOUT_MS));
+		if (ret < 0) {
+			char err[32u];
+
+			LOG_WRN("(%p) Failed to send frame %x = %d", conn, frame.id, ret);
+
+			/* Report the frame not sent, nothing is reported if the reply
+			 * is full */
+			ret = snprintf(err, sizeof(err), "error %x %d", id, ret);
+			(void)http_ws_frame_append(reply, HTTP_WS_OPCODE_TEXT, err, ret);
+		}
+
+		p += rsize;
+		len -= rsize;
+	}
+
+	return (len == 0u) ? 0 : -EINVAL;
+}
+
+static int handle_message(struct ws_can_conn *conn, struct http_ws_frame *frame, buffer_t *reply)
+{
+	uint32_t id, mask;
+
+	switch (frame->opcode) {
+	case HTTP_WS_OPCODE_BINARY:
+		return handle_tx_records(conn, (const uint8_t *)frame->payload, frame->len,
+								 reply);
+	case HTTP_WS_OPCODE_TEXT:
+		/* Payload is not null-terminated */
+		if (frame->len < 32u) {
+			char cmd[32u];
+			memcpy(cmd, frame->payload, frame->len);
+			cmd[frame->len] = '\0';
+			if (sscanf(cmd, "filter %x %x", &id, &mask) == 2) {
+				conn_set_filter(conn, id, mask);
+				return 0;
+			}
+		}
+		return -EINVAL;
+	case HTTP_WS_OPCODE_PING:
+		return http_ws_frame_append(reply, HTTP_WS_OPCODE_PONG, frame->payload,
+									frame->len);
+	case HTTP_WS_OPCODE_PONG:
+		return 0;
+	case HTTP_WS_OPCODE_CLOSE:
+		/* Echo the close frame and end the connection */
+		http_ws_frame_append(reply, HTTP_WS_OPCODE_CLOSE, frame->payload,
+							 MIN(frame->len, 2u));
+		return -ECONNRESET;
+	default:
+		/* Fragmented messages are not supported */
+		return -ENOTSUP;
+	}
+}
+
+/* Tell the client why the connection is closed */
+static void reply_close(buffer_t *reply, uint16_t code)
+{
+	uint8_t payload[2u];
+
+	sys_put_be16(code, payload);
+	(void)http_ws_frame_append(reply, HTTP_WS_OPCODE_CLOSE, (const char *)payload,
+							   sizeof(payload));
+}
+
+static int conn_recv(void *ctx, char *data, size_t len, buffer_t *reply)
+{
+	int ret;
+	struct http_ws_frame frame;
+	struct ws_can_conn *const conn = ctx;
+
+	while (len != 0u) {
+		const size_t chunk = MIN(len, sizeof(conn->rx_buf) - conn->rx_len);
+		if (chunk == 0u) {
+			LOG_WRN("(%p) Message too large", conn);
+			reply_close(reply, HTTP_WS_CLOSE_MESSAGE_TOO_BIG);
+			return -EMSGSIZE;
+		}
+
+		memcpy(&conn->rx_buf[conn->rx_len], data, chunk);
+		conn->rx_len += chunk;
+		data += chunk;
+		len -= chunk;
+
+		while ((ret = http_ws_frame_decode(conn->rx_buf, conn->rx_len, &frame)) > 0) {
+			const size_t consumed = ret;
+
+			if ((frame.fin == 0u) || (frame.opcode == HTTP_WS_OPCODE_CONTINUATION)) {
+				return -ENOTSUP;
+			}
+
+			ret = handle_message(conn, &frame, reply);
+			if (ret < 0) {
+				return ret;
+			}
+
+			conn->rx_len -= consumed;
+			memmove(conn->rx_buf, &conn->rx_buf[consumed], conn->rx_len);
+		}
+
+		if (ret == -EMSGSIZE) {
+			reply_close(reply, HTTP_WS_CLOSE_MESSAGE_TOO_BIG);
+		}
+
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void conn_close(void *ctx)
+{
+	struct ws_can_conn *const conn = ctx;
+
+	LOG_INF("(%p) Connection closed, %u frames dropped", conn, conn->dropped);
+
+	conn_free(conn);
+}
+
+static const struct http_push_handler conn_handler = {
+	.fill  = conn_fill,
+	.close = conn_close,
+	.recv  = conn_recv,
+};
+
+int ws_can_server_bridge(http_request_t *req, http_response_t *resp)
+{
+	int ret;
+	char *val;
+	uint32_t id = 0u, mask = 0u;
+	struct ws_can_conn *conn;
+
+	if (req->query_string != NULL) {
+		struct query_arg qal[2u];
+		int count = query_args_parse(req->query_string, qal, ARRAY_SIZE(qal));
+		if (count < 0) {
+			http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+			return 0;
+		}
+
+		if ((val = query_arg_get(qal, count, "id")) != NULL) {
+			id = strtoul(val, NULL, 0);
+		}
+
+		if ((val = query_arg_get(qal, count, "mask")) != NULL) {
+			mask = strtoul(val, NULL, 0);
+		}
+	}
+
+	if (!tap_registered) {
+		ret = if_can_tap_set(tap, NULL);
+		if (ret < 0) {
+			LOG_ERR("Failed to register CAN tap = %d", ret);
+			http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+			return 0;
+		}
+		tap_registered = true;
+	}
+
+	conn = conn_alloc();
+	if (conn == NULL) {
+		http_response_set_status_code(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+		return 0;
+	}
+
+	conn_set_filter(conn, id, mask);
+
+	ret = http_ws_upgrade(req, resp, &conn_handler, conn);
+	if (ret == -EINVAL) {
+		conn_free(conn);
+		http_response_set_status_code(resp, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	} else if (ret < 0) {
+		conn_free(conn);
+		return ret;
+	}
+
+	LOG_INF("(%p) CAN bridge opened", conn);
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _HTTP_WS_CAN_SERVER_H_
+#define _HTTP_WS_CAN_SERVER_H_
+
+#include "core/http_request.h"
+#include "core/http_response.h"
+
+#include <stdint.h>
+
+/* Flags encoded in the upper bits of the record identifier */
+#define WS_CAN_ID_FLAG_EXTENDED BIT(31u)
+#define WS_CAN_ID_FLAG_RTR		BIT(30u)
+#define WS_CAN_ID_FLAG_TX		BIT(29u) /* Frame sent by the controller */
+#define WS_CAN_ID_MASK			0x1FFFFFFFu
+
+/**
+ * @brief Bridge the CAN bus to a WebSocket
+ *
+ * Query parameters (optional): "id" and "mask" to filter the frames
+ * forwarded to the client (a frame is forwarded if
+ * (frame id & mask) == (id & mask)).
+ *
+ * Binary messages sent to the client contain a batch of records (little
+ * endian): u32 timestamp (ms), u32 id | flags, u8 dlc, u8 data[dlc]
+ *
+ * Binary messages received from the client contain frames to send:
+ * u32 id | flags, u8 dlc, u8 data[dlc]
+ * Messages larger than CONFIG_APP_HTTP_WS_CAN_RX_MAX_SIZE close the connection
+ * with the status code 1009 (message too big).
+ *
+ * Text message "filter <id> <mask>" updates the connection filter.
+ *
+ * A frame which could not be sent (e.g. no TX mailbox available within a
+ * few milliseconds) is reported with the text message "error <id> <err>".
+ */
+int ws_can_server_bridge(http_request_t *req, http_response_t *resp);
+
+#endif /* _HTTP_WS_CAN_SERVER_H_ */
@@ -35,6 +35,7 @@ struct emblua {
 /* find a way to somehow automatically generate this list */
 DECLARE_EMB_LUA_SCRIPT(helloworld);
 DECLARE_EMB_LUA_SCRIPT(entry);
+DECLARE_EMB_LUA_SCRIPT(rules);
 // DECLARE_EMB_LUA_SCRIPT(entry1);
 
 // DECLARE_EMB_LUA_SCRIPT(all);
@@ -28,7 +28,11 @@ LOG_MODULE_REGISTER(lua_mod, LOG_LEVEL_DBG);
 
 /* Custom modules */
 #define LUA_DUMMYLIB_ENABLED  1
-#define LUA_HA_ENABLED		  1
+#if defined(CONFIG_APP_HA)
+#define LUA_HA_ENABLED 1
+#else
+#define LUA_HA_ENABLED 0
+#endif
 #define LUA_ZEPHYRLIB_ENABLED 0
 #define LUA_CLOUDLIB_ENABLED  0
 
@@ -91,29 +95,6 @@ static int lm_luaopen_dummy(lua_State *L)
 	return 1;
 }
 
-/* TODO
- * https://stackoverflow.com/questions/12096281/how-to-have-a-lua-iterator-return-a-c-struct
- */
-static int lm_ha_list_devices(lua_State *L)
-{
-	/* Get the first argument and return it */
-	return 1;
-}
-
-static const struct luaL_Reg lm_ha_functions[] = {{"devices", lm_ha_list_devices},
-												  {"rooms", NULL},
-												  {"subscribe", NULL},
-												  {"pend", NULL},
-												  {"command", NULL},
-												  {"can", NULL},
-												  {NULL, NULL}};
-
-static int lm_luaopen_ha(lua_State *L)
-{
-	luaL_newlib(L, lm_ha_functions);
-	return 1;
-}
-
 static const luaL_Reg lm_lua_modules[] = {
 #if LUA_GNAME_ENABLED == 1
 	{LUA_GNAME, luaopen_base},
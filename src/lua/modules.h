@@ -11,4 +11,26 @@
 
 void lm_openlibs(lua_State *L);
 
+/* "ha" library, see modules_ha.c */
+int lm_luaopen_ha(lua_State *L);
+
+#if defined(CONFIG_APP_HA)
+#include "ha/core/ha.h"
+
+/**
+ * @brief Push a view of the event, the reference held on the event is
+ * transferred to the view.
+ *
+ * If reuse_arg is a valid stack index of an event view, the view is reused
+ * (and the event it was referencing is released).
+ */
+void lm_ha_push_event(lua_State *L, ha_ev_t *ev, int reuse_arg);
+
+/**
+ * @brief Build a subscription configuration from the options table at "arg"
+ * (see ha.subscribe()), raise a Lua error if the options are invalid.
+ */
+void lm_ha_check_subs_conf(lua_State *L, int arg, ha_ev_subs_conf_t *conf);
+#endif
+
 #endif /* _LUA_MODULES_H_ */
\ No newline at end of file
@@ -0,0 +1,786 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* "ha" Lua library
+ *
+ * Devices and events are exposed as userdata views over the HA core
+ * structures, nothing is copied into Lua tables:
+ * - a device view holds a pointer to the (never freed) device, views are
+ *   cached in the registry so that a device is always the same Lua value
+ * - an event view holds a reference on the event, released on garbage
+ *   collection or with ev:release(). A view can be passed back to
+ *   ha.pend() to be reused for the next event without allocating.
+ *
+ * Example:
+ *
+ *  local sub = ha.subscribe({data = true, type = "xiaomi_mijia"})
+ *  local ev = nil
+ *  while true do
+ *      ev = ha.pend(sub, 1000, ev)
+ *      if ev then
+ *          print(ev:device():addr(), ev:get("temperature"))
+ *      end
+ *  end
+ */
+
+#include "ha/core/config.h"
+#include "ha/core/ha.h"
+#include "ha/core/utils.h"
+#include "modules.h"
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#if defined(CONFIG_APP_HA_CANIOT_CONTROLLER)
+#include "ha/caniot_controller.h"
+
+#include <caniot/caniot.h>
+#endif
+
+#include <lua/lauxlib.h>
+#include <lua/lua.h>
+#include <lua/lualib.h>
+LOG_MODULE_REGISTER(lua_ha, LOG_LEVEL_INF);
+
+#define LM_HA_DEVICE_MT		  "ha.device"
+#define LM_HA_EVENT_MT		  "ha.event"
+#define LM_HA_SUBSCRIPTION_MT "ha.subscription"
+
+/* Registry key of the table caching the device views */
+static const char lm_ha_devices_cache_key = 'D';
+
+/* Maximum time a CANIOT query can block the script */
+#define LM_HA_CAN_MAX_TIMEOUT_MS 5000u
+
+struct lm_ha_device {
+	ha_dev_t *dev;
+};
+
+struct lm_ha_event {
+	ha_ev_t *ev;
+};
+
+struct lm_ha_subscription {
+	struct ha_ev_subs *sub;
+
+	/* Referenced by the subscription for its whole lifetime */
+	ha_ev_subs_conf_t conf;
+};
+
+static const struct {
+	const char *name;
+	ha_data_type_t type;
+} lm_ha_data_types[] = {
+	{"temperature", HA_DATA_TEMPERATURE},
+	{"humidity", HA_DATA_HUMIDITY},
+	{"battery", HA_DATA_BATTERY_LEVEL},
+	{"rssi", HA_DATA_RSSI},
+	{"digital", HA_DATA_DIGITAL_INOUT},
+	{"digital_in", HA_DATA_DIGITAL_IN},
+	{"digital_out", HA_DATA_DIGITAL_OUT},
+	{"analog", HA_DATA_ANALOG},
+	{"heater", HA_DATA_HEATER_MODE},
+	{"shutter", HA_DATA_SHUTTER_POSITION},
+};
+
+static const char *const lm_ha_values[_HA_VALUE_COUNT + 1u] = {
+	[HA_VALUE_TEMPERATURE]	 = "temperature",
+	[HA_VALUE_HUMIDITY]		 = "humidity",
+	[HA_VALUE_BATTERY_LEVEL] = "battery",
+	[HA_VALUE_RSSI]			 = "rssi",
+	[HA_VALUE_DIGITAL]		 = "digital",
+	[_HA_VALUE_COUNT]		 = NULL,
+};
+
+static int lm_ha_parse_dev_type(lua_State *L, int arg, ha_dev_type_t *type)
+{
+	static const ha_dev_type_t types[] = {
+		HA_DEV_TYPE_XIAOMI_MIJIA,
+		HA_DEV_TYPE_CANIOT,
+		HA_DEV_TYPE_NUCLEO_F429ZI,
+	};
+
+	const char *name = luaL_checkstring(L, arg);
+
+	for (size_t i = 0u; i < ARRAY_SIZE(types); i++) {
+		if (strcmp(name, ha_dev_type_to_str(types[i])) == 0) {
+			*type = types[i];
+			return 0;
+		}
+	}
+
+	return luaL_argerror(L, arg, "unknown device type");
+}
+
+/* Device views */
+
+static void lm_ha_push_device(lua_State *L, ha_dev_t *dev)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &lm_ha_devices_cache_key);
+
+	if (lua_rawgetp(L, -1, dev) == LUA_TNIL) {
+		lua_pop(L, 1);
+
+		struct lm_ha_device *const ud = lua_newuserdatauv(L, sizeof(*ud), 0);
+		ud->dev						  = dev;
+		luaL_setmetatable(L, LM_HA_DEVICE_MT);
+
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, -3, dev);
+	}
+
+	/* Remove the cache table */
+	lua_remove(L, -2);
+}
+
+static ha_dev_t *lm_ha_check_device(lua_State *L, int arg)
+{
+	return ((struct lm_ha_device *)luaL_checkudata(L, arg, LM_HA_DEVICE_MT))->dev;
+}
+
+static int lm_ha_dev_sdevuid(lua_State *L)
+{
+	lua_pushinteger(L, lm_ha_check_device(L, 1)->sdevuid);
+	return 1;
+}
+
+static int lm_ha_dev_addr(lua_State *L)
+{
+	char addr_str[HA_DEV_ADDR_STR_MAX_LEN];
+	ha_dev_t *const dev = lm_ha_check_device(L, 1);
+
+	ha_dev_addr_to_str(&dev->addr, addr_str, sizeof(addr_str));
+	lua_pushstring(L, addr_str);
+	return 1;
+}
+
+static int lm_ha_dev_type(lua_State *L)
+{
+	lua_pushstring(L, ha_dev_type_to_str(lm_ha_check_device(L, 1)->addr.type));
+	return 1;
+}
+
+static int lm_ha_dev_room(lua_State *L)
+{
+	ha_dev_t *const dev = lm_ha_check_device(L, 1);
+
+	if (dev->room == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushinteger(L, dev->room->rid);
+	lua_pushstring(L, dev->room->name);
+	return 2;
+}
+
+static int lm_ha_dev_value(lua_State *L)
+{
+	int32_t value;
+	ha_dev_t *const dev = lm_ha_check_device(L, 1);
+	const int index		= luaL_checkoption(L, 2, NULL, lm_ha_values);
+
+	if (ha_values_get(dev, (ha_value_t)index, &value) == 0) {
+		lua_pushinteger(L, value);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+
+struct lm_ha_last_ctx {
+	uint8_t ep_index;
+	ha_ev_t *ev;
+};
+
+/* Called with the last events of the device locked */
+static bool lm_ha_last_cb(ha_dev_t *dev, void *user_data)
+{
+	struct lm_ha_last_ctx *const ctx = user_data;
+
+	ctx->ev = ha_dev_get_last_event(dev, ctx->ep_index);
+	if (ctx->ev != NULL) {
+		ha_ev_ref(ctx->ev);
+	}
+
+	return false;
+}
+
+static int lm_ha_dev_last(lua_State *L)
+{
+	ha_dev_t *const dev = lm_ha_check_device(L, 1);
+	const lua_Integer ep = luaL_optinteger(L, 2, 0);
+	const int index		 = ha_dev_get_index(dev);
+	struct lm_ha_last_ctx ctx = {.ev = NULL};
+
+	luaL_argcheck(L, ha_dev_ep_exists(dev, (uint8_t)ep), 2, "invalid endpoint");
+
+	const ha_dev_filter_t filter = {
+		.flags		= HA_DEV_FILTER_FROM_INDEX | HA_DEV_FILTER_TO_COUNT,
+		.from_index = index,
+		.to_count	= 1u,
+	};
+
+	ctx.ep_index = (uint8_t)ep;
+	ha_dev_iterate(lm_ha_last_cb, &filter, &HA_DEV_ITER_OPT_LOCK_ALL(), &ctx);
+
+	if (ctx.ev == NULL) {
+		lua_pushnil(L);
+	} else {
+		lm_ha_push_event(L, ctx.ev, 0);
+	}
+
+	return 1;
+}
+
+static int lm_ha_dev_tostring(lua_State *L)
+{
+	char addr_str[HA_DEV_ADDR_STR_MAX_LEN];
+	ha_dev_t *const dev = lm_ha_check_device(L, 1);
+
+	ha_dev_addr_to_str(&dev->addr, addr_str, sizeof(addr_str));
+	lua_pushfstring(L, "ha.device(%d, %s, %s)", (int)dev->sdevuid,
+					ha_dev_type_to_str(dev->addr.type), addr_str);
+	return 1;
+}
+
+static const struct luaL_Reg lm_ha_device_methods[] = {
+	{"sdevuid", lm_ha_dev_sdevuid},
+	{"addr", lm_ha_dev_addr},
+	{"type", lm_ha_dev_type},
+	{"room", lm_ha_dev_room},
+	{"value", lm_ha_dev_value},
+	{"last", lm_ha_dev_last},
+	{NULL, NULL},
+};
+
+/* Event views */
+
+static struct lm_ha_event *lm_ha_check_event(lua_State *L, int arg)
+{
+	return (struct lm_ha_event *)luaL_checkudata(L, arg, LM_HA_EVENT_MT);
+}
+
+static ha_ev_t *lm_ha_check_event_valid(lua_State *L, int arg)
+{
+	struct lm_ha_event *const ud = lm_ha_check_event(L, arg);
+
+	luaL_argcheck(L, ud->ev != NULL, arg, "released event");
+
+	return ud->ev;
+}
+
+void lm_ha_push_event(lua_State *L, ha_ev_t *ev, int reuse_arg)
+{
+	struct lm_ha_event *ud = NULL;
+
+	if (reuse_arg != 0) {
+		ud = luaL_testudata(L, reuse_arg, LM_HA_EVENT_MT);
+	}
+
+	if (ud != NULL) {
+		if (ud->ev != NULL) {
+			ha_ev_unref(ud->ev);
+		}
+		lua_pushvalue(L, reuse_arg);
+	} else {
+		ud = lua_newuserdatauv(L, sizeof(*ud), 0);
+		luaL_setmetatable(L, LM_HA_EVENT_MT);
+	}
+
+	ud->ev = ev;
+}
+
+static int lm_ha_ev_release(lua_State *L)
+{
+	struct lm_ha_event *const ud = lm_ha_check_event(L, 1);
+
+	if (ud->ev != NULL) {
+		ha_ev_unref(ud->ev);
+		ud->ev = NULL;
+	}
+
+	return 0;
+}
+
+static int lm_ha_ev_type(lua_State *L)
+{
+	static const char *const types[] = {
+		[HA_EV_TYPE_DATA]	 = "data",
+		[1u]				 = "unknown",
+		[HA_EV_TYPE_COMMAND] = "command",
+		[HA_EV_TYPE_ERROR]	 = "error",
+	};
+
+	const ha_ev_t *const ev = lm_ha_check_event_valid(L, 1);
+
+	lua_pushstring(L, (ev->type < ARRAY_SIZE(types)) ? types[ev->type] : "unknown");
+	return 1;
+}
+
+static int lm_ha_ev_device(lua_State *L)
+{
+	const ha_ev_t *const ev = lm_ha_check_event_valid(L, 1);
+
+	if (ev->dev != NULL) {
+		lm_ha_push_device(L, ev->dev);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int lm_ha_ev_timestamp(lua_State *L)
+{
+	lua_pushinteger(L, lm_ha_check_event_valid(L, 1)->timestamp);
+	return 1;
+}
+
+static int lm_ha_ev_ep(lua_State *L)
+{
+	lua_pushinteger(L, lm_ha_check_event_valid(L, 1)->ep_index);
+	return 1;
+}
+
+static bool lm_ha_data_to_integer(ha_data_type_t type, const void *p, lua_Integer *out)
+{
+	switch (type) {
+	case HA_DATA_TEMPERATURE:
+		*out = ((const struct ha_data_temperature *)p)->value;
+		break;
+	case HA_DATA_HUMIDITY:
+		*out = ((const struct ha_data_humidity *)p)->value;
+		break;
+	case HA_DATA_BATTERY_LEVEL:
+		*out = ((const struct ha_data_battery_level *)p)->level;
+		break;
+	case HA_DATA_RSSI:
+		*out = ((const struct ha_data_rssi *)p)->value;
+		break;
+	case HA_DATA_DIGITAL_INOUT:
+	case HA_DATA_DIGITAL_IN:
+	case HA_DATA_DIGITAL_OUT:
+		*out = ((const struct ha_data_digital *)p)->value &
+			   ((const struct ha_data_digital *)p)->mask;
+		break;
+	case HA_DATA_ANALOG:
+		*out = ((const struct ha_data_analog *)p)->value;
+		break;
+	case HA_DATA_SHUTTER_POSITION:
+		*out = ((const struct ha_shutter_position *)p)->position;
+		break;
+#if defined(CONFIG_CANIOT_LIB)
+	case HA_DATA_HEATER_MODE:
+		*out = ((const struct ha_heater_mode *)p)->mode;
+		break;
+#endif
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/* ev:get(type [, occurrence]) -> integer in the HA data unit, nil if the event
+ * doesn't contain such data */
+static int lm_ha_ev_get(lua_State *L)
+{
+	lua_Integer value;
+	const ha_ev_t *const ev		= lm_ha_check_event_valid(L, 1);
+	const char *const name		= luaL_checkstring(L, 2);
+	const lua_Integer occurence = luaL_optinteger(L, 3, 0);
+	const void *p				= NULL;
+	size_t i;
+
+	for (i = 0u; i < ARRAY_SIZE(lm_ha_data_types); i++) {
+		if (strcmp(name, lm_ha_data_types[i].name) == 0) {
+			break;
+		}
+	}
+
+	luaL_argcheck(L, i < ARRAY_SIZE(lm_ha_data_types), 2, "unknown data type");
+
+	const struct ha_device_endpoint_config *const ep_cfg =
+		(ev->type == HA_EV_TYPE_DATA) ? ha_dev_ep_cfg_get(ev->dev, ev->ep_index) : NULL;
+
+	if ((ep_cfg != NULL) && (ev->data != NULL)) {
+		p = ha_data_get(ev->data, ep_cfg->data_descr, ep_cfg->data_descr_size,
+						lm_ha_data_types[i].type, (uint8_t)occurence);
+	}
+
+	if ((p != NULL) && lm_ha_data_to_integer(lm_ha_data_types[i].type, p, &value)) {
+		lua_pushinteger(L, value);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int lm_ha_ev_tostring(lua_State *L)
+{
+	struct lm_ha_event *const ud = lm_ha_check_event(L, 1);
+
+	if (ud->ev == NULL) {
+		lua_pushliteral(L, "ha.event(released)");
+	} else {
+		lua_pushfstring(L, "ha.event(%d, dev %d, ep %d)", (int)ud->ev->timestamp,
+						ud->ev->dev ? (int)ud->ev->dev->sdevuid : 0,
+						(int)ud->ev->ep_index);
+	}
+
+	return 1;
+}
+
+static const struct luaL_Reg lm_ha_event_methods[] = {
+	{"type", lm_ha_ev_type},
+	{"device", lm_ha_ev_device},
+	{"timestamp", lm_ha_ev_timestamp},
+	{"ep", lm_ha_ev_ep},
+	{"get", lm_ha_ev_get},
+	{"release", lm_ha_ev_release},
+	{NULL, NULL},
+};
+
+/* Subscriptions */
+
+static struct lm_ha_subscription *lm_ha_check_subscription(lua_State *L, int arg)
+{
+	return (struct lm_ha_subscription *)luaL_checkudata(L, arg, LM_HA_SUBSCRIPTION_MT);
+}
+
+static int lm_ha_sub_close(lua_State *L)
+{
+	struct lm_ha_subscription *const ud = lm_ha_check_subscription(L, 1);
+
+	if (ud->sub != NULL) {
+		ha_unsubscribe(ud->sub);
+		ud->sub = NULL;
+	}
+
+	return 0;
+}
+
+/* ha.pend(sub, timeout_ms [, ev]) -> event view, nil on timeout
+ *
+ * A negative timeout waits forever. If an event view is given, it is
+ * reused for the new event. */
+static int lm_ha_pend(lua_State *L)
+{
+	struct lm_ha_subscription *const ud = lm_ha_check_subscription(L, 1);
+	const lua_Integer timeout_ms		= luaL_optinteger(L, 2, 0);
+	ha_ev_t *ev;
+
+	luaL_argcheck(L, ud->sub != NULL, 1, "closed subscription");
+
+	ev = ha_ev_wait(ud->sub, (timeout_ms < 0) ? K_FOREVER : K_MSEC(timeout_ms));
+	if (ev == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	/* The reference taken when the event was queued is kept by the view */
+	lm_ha_push_event(L, ev, lua_isnoneornil(L, 3) ? 0 : 3);
+
+	return 1;
+}
+
+static const struct luaL_Reg lm_ha_subscription_methods[] = {
+	{"pend", lm_ha_pend},
+	{"close", lm_ha_sub_close},
+	{NULL, NULL},
+};
+
+void lm_ha_check_subs_conf(lua_State *L, int arg, ha_ev_subs_conf_t *conf)
+{
+	ha_ev_subs_conf_init(conf);
+
+	if (!lua_istable(L, arg)) {
+		conf->flags = HA_EV_SUBS_CONF_DEVICE_DATA;
+		return;
+	}
+
+	if (lua_getfield(L, arg, "data") != LUA_TNIL) {
+		conf->flags |= lua_toboolean(L, -1) ? HA_EV_SUBS_CONF_DEVICE_DATA : 0u;
+	}
+	if (lua_getfield(L, arg, "command") != LUA_TNIL) {
+		conf->flags |= lua_toboolean(L, -1) ? HA_EV_SUBS_CONF_DEVICE_COMMAND : 0u;
+	}
+	if (lua_getfield(L, arg, "type") != LUA_TNIL) {
+		lm_ha_parse_dev_type(L, lua_gettop(L), &conf->device_type);
+		conf->flags |= HA_EV_SUBS_CONF_DEVICE_TYPE;
+	}
+	if (lua_getfield(L, arg, "device") != LUA_TNIL) {
+		ha_dev_t *const dev = lm_ha_check_device(L, lua_gettop(L));
+		conf->device_mac	= dev->addr.mac;
+		conf->device_type	= dev->addr.type;
+		conf->flags |= HA_EV_SUBS_CONF_DEVICE_ADDR | HA_EV_SUBS_CONF_DEVICE_TYPE;
+	}
+	lua_pop(L, 4);
+
+	luaL_argcheck(
+		L,
+		(conf->flags & (HA_EV_SUBS_CONF_DEVICE_DATA | HA_EV_SUBS_CONF_DEVICE_COMMAND)) !=
+			(HA_EV_SUBS_CONF_DEVICE_DATA | HA_EV_SUBS_CONF_DEVICE_COMMAND),
+		arg, "data and command are exclusive");
+}
+
+/* ha.subscribe([{data = bool, command = bool, type = str, device = dev}])
+ *
+ * Without options, only data events are received. With options, "data" and
+ * "command" restrict the events to their type (all events if none is set). */
+static int lm_ha_subscribe(lua_State *L)
+{
+	int ret;
+	struct lm_ha_subscription *ud;
+
+	ud		= lua_newuserdatauv(L, sizeof(*ud), 0);
+	ud->sub = NULL;
+	luaL_setmetatable(L, LM_HA_SUBSCRIPTION_MT);
+
+	lm_ha_check_subs_conf(L, 1, &ud->conf);
+
+	ret = ha_subscribe(&ud->conf, &ud->sub);
+	if (ret != 0) {
+		return luaL_error(L, "subscription failed (%d)", ret);
+	}
+
+	return 1;
+}
+
+/* Devices */
+
+struct lm_ha_iter_ctx {
+	ha_dev_t *dev;
+};
+
+static bool lm_ha_iter_cb(ha_dev_t *dev, void *user_data)
+{
+	((struct lm_ha_iter_ctx *)user_data)->dev = dev;
+	return false;
+}
+
+/* Upvalues: next index, filter flags, device type, room id */
+static int lm_ha_devices_next(lua_State *L)
+{
+	struct lm_ha_iter_ctx ctx = {.dev = NULL};
+	const lua_Integer index	  = lua_tointeger(L, lua_upvalueindex(1));
+
+	if (index >= HA_DEVICES_MAX_COUNT) {
+		return 0;
+	}
+
+	const ha_dev_filter_t filter = {
+		.flags = HA_DEV_FILTER_FROM_INDEX | HA_DEV_FILTER_TO_COUNT |
+				 (ha_dev_filter_flags_t)lua_tointeger(L, lua_upvalueindex(2)),
+		.device_type = (ha_dev_type_t)lua_tointeger(L, lua_upvalueindex(3)),
+		.rid		 = (ha_room_id_t)lua_tointeger(L, lua_upvalueindex(4)),
+		.from_index	 = (uint32_t)index,
+		.to_count	 = 1u,
+	};
+
+	if ((ha_dev_iterate(lm_ha_iter_cb, &filter, NULL, &ctx) <= 0) || (ctx.dev == NULL)) {
+		return 0;
+	}
+
+	lua_pushinteger(L, ha_dev_get_index(ctx.dev) + 1);
+	lua_replace(L, lua_upvalueindex(1));
+
+	lm_ha_push_device(L, ctx.dev);
+	return 1;
+}
+
+/* ha.devices([{type = str, room = rid}]) -> iterator over the device views */
+static int lm_ha_devices(lua_State *L)
+{
+	ha_dev_filter_flags_t flags = 0u;
+	ha_dev_type_t type			= HA_DEV_TYPE_NONE;
+	lua_Integer rid				= HA_ROOM_NONE;
+
+	if (lua_istable(L, 1)) {
+		if (lua_getfield(L, 1, "type") != LUA_TNIL) {
+			lm_ha_parse_dev_type(L, lua_gettop(L), &type);
+			flags |= HA_DEV_FILTER_DEVICE_TYPE;
+		}
+		if (lua_getfield(L, 1, "room") != LUA_TNIL) {
+			rid = luaL_checkinteger(L, lua_gettop(L));
+			flags |= HA_DEV_FILTER_ROOM_ID;
+		}
+		lua_pop(L, 2);
+	}
+
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, flags);
+	lua_pushinteger(L, type);
+	lua_pushinteger(L, rid);
+	lua_pushcclosure(L, lm_ha_devices_next, 4);
+
+	return 1;
+}
+
+/* Upvalue: next index in the rooms configuration */
+static int lm_ha_rooms_next(lua_State *L)
+{
+	const lua_Integer index = lua_tointeger(L, lua_upvalueindex(1));
+
+	if ((size_t)index >= ha_cfg_rooms_count) {
+		return 0;
+	}
+
+	lua_pushinteger(L, index + 1);
+	lua_replace(L, lua_upvalueindex(1));
+
+	lua_pushinteger(L, ha_cfg_rooms[index].rid);
+	lua_pushstring(L, ha_cfg_rooms[index].name);
+	lua_pushinteger(L, atomic_get(&ha_cfg_rooms[index].devices_count));
+	return 3;
+}
+
+/* ha.rooms() -> iterator over rid, name, devices count */
+static int lm_ha_rooms(lua_State *L)
+{
+	lua_pushinteger(L, 0);
+	lua_pushcclosure(L, lm_ha_rooms_next, 1);
+	return 1;
+}
+
+/* Commands */
+
+/* ha.command(dev, ep, payload [, timeout_ms]) -> 0 on success, negative
+ * error code otherwise */
+static int lm_ha_command(lua_State *L)
+{
+	size_t len;
+	ha_dev_t *const dev		 = lm_ha_check_device(L, 1);
+	const lua_Integer ep	 = luaL_checkinteger(L, 2);
+	const char *payload		 = luaL_checklstring(L, 3, &len);
+	const lua_Integer timeout = luaL_optinteger(L, 4, 1000);
+
+	luaL_argcheck(L, ha_dev_ep_check_cmd_support(dev, (uint8_t)ep), 2,
+				  "endpoint doesn't support commands");
+	luaL_argcheck(L, timeout >= 0, 4, "timeout must be positive");
+
+	ha_dev_cmd_t cmd = {
+		.type	= HA_DEV_CMD_TYPE_COMMAND,
+		.buffer = (uint8_t *)payload,
+		.len	= len,
+	};
+
+	struct ha_cmd_query query = {
+		.dev			= dev,
+		.endpoint_index = (uint8_t)ep,
+		.cmd			= &cmd,
+		.timeout		= K_MSEC(timeout),
+	};
+
+	lua_pushinteger(L, ha_dev_command(&query, NULL));
+	return 1;
+}
+
+#if defined(CONFIG_APP_HA_CANIOT_CONTROLLER)
+/* ha.can(did, ep [, payload [, timeout_ms]]) -> status, response payload
+ *
+ * Query the telemetry of a CANIOT device endpoint, or send it a command if a
+ * payload is given. Status is the ha_caniot_controller_query() return value.
+ */
+static int lm_ha_can(lua_State *L)
+{
+	int ret;
+	size_t len = 0u;
+	struct caniot_frame q, r;
+	const lua_Integer did = luaL_checkinteger(L, 1);
+	const lua_Integer ep  = luaL_checkinteger(L, 2);
+	const char *payload	  = luaL_optlstring(L, 3, NULL, &len);
+	uint32_t timeout	  = (uint32_t)luaL_optinteger(L, 4, 1000);
+
+	luaL_argcheck(L, (did >= 0) && (did < CANIOT_DID_MAX_COUNT), 1, "invalid device id");
+	luaL_argcheck(L, (ep >= 0) && (ep <= CANIOT_ENDPOINT_BOARD_CONTROL), 2,
+				  "invalid endpoint");
+	luaL_argcheck(L, len <= 8u, 3, "payload too long");
+
+	timeout = MIN(timeout, LM_HA_CAN_MAX_TIMEOUT_MS);
+
+	if (payload != NULL) {
+		caniot_build_query_command(&q, (caniot_endpoint_t)ep, (const uint8_t *)payload,
+								   len);
+	} else {
+		caniot_build_query_telemetry(&q, (caniot_endpoint_t)ep);
+	}
+
+	ret = ha_caniot_controller_query(&q, &r, (caniot_did_t)did, &timeout);
+
+	lua_pushinteger(L, ret);
+	if (ret == 1) {
+		lua_pushlstring(L, (const char *)r.buf, r.len);
+		return 2;
+	}
+
+	return 1;
+}
+#endif /* CONFIG_APP_HA_CANIOT_CONTROLLER */
+
+static const struct luaL_Reg lm_ha_functions[] = {
+	{"devices", lm_ha_devices},
+	{"rooms", lm_ha_rooms},
+	{"subscribe", lm_ha_subscribe},
+	{"pend", lm_ha_pend},
+	{"command", lm_ha_command},
+#if defined(CONFIG_APP_HA_CANIOT_CONTROLLER)
+	{"can", lm_ha_can},
+#endif
+	{NULL, NULL},
+};
+
+static void lm_ha_new_metatable(lua_State *L,
+								const char *name,
+								const struct luaL_Reg *methods,
+								lua_CFunction tostring,
+								lua_CFunction gc)
+{
+	luaL_newmetatable(L, name);
+
+	luaL_newlib(L, methods);
+	lua_setfield(L, -2, "__index");
+
+	if (tostring != NULL) {
+		lua_pushcfunction(L, tostring);
+		lua_setfield(L, -2, "__tostring");
+	}
+
+	if (gc != NULL) {
+		lua_pushcfunction(L, gc);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_pop(L, 1);
+}
+
+int lm_luaopen_ha(lua_State *L)
+{
+	lm_ha_new_metatable(L, LM_HA_DEVICE_MT, lm_ha_device_methods, lm_ha_dev_tostring,
+						NULL);
+	lm_ha_new_metatable(L, LM_HA_EVENT_MT, lm_ha_event_methods, lm_ha_ev_tostring,
+						lm_ha_ev_release);
+	lm_ha_new_metatable(L, LM_HA_SUBSCRIPTION_MT, lm_ha_subscription_methods, NULL,
+						lm_ha_sub_close);
+
+	/* Device views cache, values are weak so that unused views can be
+	 * collected */
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushliteral(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &lm_ha_devices_cache_key);
+
+	luaL_newlib(L, lm_ha_functions);
+	return 1;
+}
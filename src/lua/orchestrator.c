@@ -9,7 +9,14 @@
 #include "orchestrator.h"
 #include "utils.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/fs/fs.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/sys_heap.h>
 
 #include <lua/lauxlib.h>
 #include <lua/lua.h>
@@ -20,22 +27,27 @@ LOG_MODULE_REGISTER(lua, LOG_LEVEL_DBG);
 #define CONFIG_LUA_ORCHESTRATOR_CONTEXTS_COUNT	  2u
 #define CONFIG_LUA_ORCHESTRATOR_WORK_Q_PRIORITY	  K_PRIO_COOP(5)
 
-// __buf_noinit_section
-K_THREAD_STACK_DEFINE(work_q_stack, CONFIG_LUA_ORCHESTRATOR_WORK_Q_STACK_SIZE);
+/* Maximum size of a script source */
+#define LUA_ORCH_SCRIPT_MAX_SIZE (32u * 1024u)
 
-static struct k_work_q lua_work_q;
+/* Instructions between two calls of the budget hook, the instructions count
+ * of the scripts have this granularity */
+#define LUA_ORCH_HOOK_COUNT 1000u
 
-int lua_orch_init(void)
-{
-	k_work_queue_init(&lua_work_q);
+/* Number of scripts the statistics are kept for */
+#define LUA_ORCH_STATS_MAX_COUNT 16u
 
-	/* Workqueue should yield between scripts execution (yield by default)
-	 */
-	k_work_queue_start(&lua_work_q, work_q_stack, K_THREAD_STACK_SIZEOF(work_q_stack),
-					   CONFIG_LUA_ORCHESTRATOR_WORK_Q_PRIORITY, NULL);
+/* Registry keys of the VM tables caching the loaded chunks, by path */
+static const char chunks_fn_key	 = 'F'; /* Chunk function */
+static const char chunks_crc_key = 'C'; /* CRC32 of the source it was loaded from */
 
-	return 0;
-}
+/* Registry key of the metatable of the scripts environments */
+static const char env_mt_key = 'E';
+
+// __buf_noinit_section
+K_THREAD_STACK_DEFINE(work_q_stack, CONFIG_LUA_ORCHESTRATOR_WORK_Q_STACK_SIZE);
+
+static struct k_work_q lua_work_q;
 
 typedef enum {
 	LUA_ORCH_RET_OK = 0u,
@@ -44,8 +56,19 @@ typedef enum {
 struct script_context {
 	struct k_work _work;
 	struct k_sem _sem;
+
+	/* VM kept warm (libraries loaded, chunks cached) between scripts */
 	lua_State *L;
 
+	/* Arena the VM allocates from, its size is the VM memory hard cap */
+	struct sys_heap heap;
+	uint32_t mem;	   /* Bytes currently allocated by the VM */
+	uint32_t mem_peak; /* Peak of the running script */
+
+	/* Instructions executed by the running script */
+	uint32_t instructions;
+	uint32_t wall_time_ms;
+
 	int lua_ret;
 
 	/**
@@ -54,79 +77,575 @@ struct script_context {
 	lua_orch_script_status_t res;
 };
 
-K_MEM_SLAB_DEFINE_STATIC(works_pool,
-						 sizeof(struct script_context),
-						 CONFIG_LUA_ORCHESTRATOR_CONTEXTS_COUNT,
-						 4u);
+static struct script_context contexts[CONFIG_LUA_ORCHESTRATOR_CONTEXTS_COUNT];
+
+/* Kept in SRAM even with CONFIG_APP_BIG_BUFFER_TO_CCM, the arenas don't fit in
+ * the 64 KB of CCM next to the other big buffers */
+static __noinit uint8_t arenas[CONFIG_LUA_ORCHESTRATOR_CONTEXTS_COUNT]
+							  [CONFIG_APP_LUA_ORCH_ARENA_SIZE] __aligned(8);
+
+/* Statistics of the last scripts run */
+static struct lua_orch_script_stats scripts_stats[LUA_ORCH_STATS_MAX_COUNT];
+static uint32_t scripts_stats_seq;
+static struct k_spinlock scripts_stats_lock;
+
+/* Contexts available */
+K_MSGQ_DEFINE(contexts_msgq,
+			  sizeof(struct script_context *),
+			  CONFIG_LUA_ORCHESTRATOR_CONTEXTS_COUNT,
+			  4u);
+
+static void lua_orch_script_handler(struct k_work *work);
+
+struct k_work_q *lua_orch_work_q(void)
+{
+	return &lua_work_q;
+}
+
+void lua_orch_vm_setup(lua_State *L)
+{
+	lm_openlibs(L);
+
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &chunks_fn_key);
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &chunks_crc_key);
+
+	/* Scripts globals are looked up in _G if not defined by the script */
+	lua_newtable(L);
+	lua_pushglobaltable(L);
+	lua_setfield(L, -2, "__index");
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &env_mt_key);
+}
+
+static void *vm_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct script_context *const sx = ud;
+	const size_t old				= (ptr != NULL) ? osize : 0u;
+
+	if (nsize == 0u) {
+		sys_heap_free(&sx->heap, ptr);
+		sx->mem -= old;
+		return NULL;
+	}
+
+	/* Fails when the arena is exhausted, the script gets a memory error */
+	ptr = sys_heap_realloc(&sx->heap, ptr, nsize);
+	if (ptr != NULL) {
+		sx->mem += nsize - old;
+		sx->mem_peak = MAX(sx->mem_peak, sx->mem);
+	}
+
+	return ptr;
+}
+
+static int vm_panic(lua_State *L)
+{
+	LOG_ERR("Unprotected error in Lua VM: %s",
+			lua_isstring(L, -1) ? lua_tostring(L, -1) : "?");
+	return 0;
+}
+
+static void vm_hook(lua_State *L, lua_Debug *ar)
+{
+	struct script_context *sx;
+
+	lua_getallocf(L, (void **)&sx);
+
+	sx->instructions += LUA_ORCH_HOOK_COUNT;
+
+#if CONFIG_APP_LUA_ORCH_INSTR_BUDGET > 0
+	if (sx->instructions > CONFIG_APP_LUA_ORCH_INSTR_BUDGET) {
+		luaL_error(L, "instructions budget exceeded");
+	}
+#endif
+}
+
+/* (Re)create the VM of the context in its emptied arena */
+static lua_State *vm_create(struct script_context *sx)
+{
+	const size_t index = sx - contexts;
+	lua_State *L;
+
+	sys_heap_init(&sx->heap, arenas[index], sizeof(arenas[index]));
+	sx->mem		 = 0u;
+	sx->mem_peak = 0u;
+
+	L = lua_newstate(vm_alloc, sx);
+	if (L != NULL) {
+		lua_atpanic(L, vm_panic);
+		lua_sethook(L, vm_hook, LUA_MASKCOUNT, LUA_ORCH_HOOK_COUNT);
+		lua_orch_vm_setup(L);
+	}
+
+	return L;
+}
+
+int lua_orch_init(void)
+{
+	k_work_queue_init(&lua_work_q);
+
+	/* Workqueue should yield between scripts execution (yield by default)
+	 */
+	k_work_queue_start(&lua_work_q, work_q_stack, K_THREAD_STACK_SIZEOF(work_q_stack),
+					   CONFIG_LUA_ORCHESTRATOR_WORK_Q_PRIORITY, NULL);
+
+	for (size_t i = 0u; i < ARRAY_SIZE(contexts); i++) {
+		struct script_context *sx = &contexts[i];
+
+		k_work_init(&sx->_work, lua_orch_script_handler);
+		k_sem_init(&sx->_sem, 0u, 1u);
+
+		sx->L = vm_create(sx);
+		if (sx->L == NULL) {
+			LOG_ERR("Failed to create Lua VM %u", i);
+			continue;
+		}
+
+		k_msgq_put(&contexts_msgq, &sx, K_NO_WAIT);
+	}
+
+	return 0;
+}
+
+#if defined(CONFIG_APP_LUA_BYTECODE_CACHE)
+
+#define BC_CACHE_MAGIC 0x3242554Cu /* "LUB2" */
+
+/* Header of the bytecode cache files, followed by the lua_dump() output.
+ *
+ * Lua doesn't verify the bytecode it loads, a corrupted file could crash
+ * the VM: the bytecode CRC is checked before loading it. The cache
+ * directory is not writable through the files server routes. */
+struct bc_cache_header {
+	uint32_t magic;
+	uint32_t lua_version;
+	uint32_t src_size; /* Size of the source the bytecode was compiled from */
+	uint32_t src_crc;  /* CRC32 of the source */
+	uint32_t bc_size;  /* Size of the bytecode which follows */
+	uint32_t bc_crc;   /* CRC32 of the bytecode */
+};
+
+struct bc_dump {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/* FAT short file name, from the script path */
+static void bc_cache_path(const char *path, char *cpath, size_t size)
+{
+	snprintf(cpath, size, "%s/%08x.lbc", CONFIG_APP_LUA_BYTECODE_CACHE_DIR,
+			 crc32_ieee((const uint8_t *)path, strlen(path)));
+}
+
+static int bc_dump_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	struct bc_dump *const dump = ud;
+
+	if (dump->len + sz > dump->size) {
+		const size_t size = MAX(dump->size * 2u, dump->len + sz);
+		char *buf		  = realloc(dump->buf, size);
+		if (buf == NULL) {
+			return 1;
+		}
+		dump->buf  = buf;
+		dump->size = size;
+	}
+
+	memcpy(&dump->buf[dump->len], p, sz);
+	dump->len += sz;
+
+	return 0;
+}
+
+/* Push the chunk compiled from the source matching size/crc if cached */
+static int bc_cache_load(lua_State *L, const char *path, size_t src_size, uint32_t crc)
+{
+	int ret;
+	char *bc = NULL;
+	char cpath[64u];
+	struct fs_file_t file;
+	struct bc_cache_header hdr;
+
+	bc_cache_path(path, cpath, sizeof(cpath));
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, cpath, FS_O_READ);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = fs_read(&file, &hdr, sizeof(hdr));
+	if ((ret != (int)sizeof(hdr)) || (hdr.magic != BC_CACHE_MAGIC) ||
+		(hdr.lua_version != LUA_VERSION_NUM) || (hdr.src_size != src_size) ||
+		(hdr.src_crc != crc) || (hdr.bc_size > 2u * LUA_ORCH_SCRIPT_MAX_SIZE)) {
+		ret = -ESTALE;
+		goto exit;
+	}
+
+	bc = malloc(hdr.bc_size);
+	if (bc == NULL) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	ret = fs_read(&file, bc, hdr.bc_size);
+	if (ret != (int)hdr.bc_size) {
+		ret = -EIO;
+		goto exit;
+	}
+
+	if (crc32_ieee((const uint8_t *)bc, hdr.bc_size) != hdr.bc_crc) {
+		LOG_WRN("Corrupted bytecode cache for %s", path);
+		ret = -EBADMSG;
+		goto exit;
+	}
+
+	/* lua_load() also checks the bytecode format (version, sizes, ...) */
+	ret = (luaL_loadbufferx(L, bc, hdr.bc_size, path, "b") == LUA_OK) ? 0 : -EINVAL;
+	if (ret < 0) {
+		lua_pop(L, 1); /* error message */
+	}
+
+exit:
+	free(bc);
+	fs_close(&file);
+	return ret;
+}
+
+/* Dump the chunk on top of the stack to the cache */
+static int bc_cache_store(lua_State *L, const char *path, size_t src_size, uint32_t crc)
+{
+	int ret;
+	char cpath[64u];
+	struct fs_file_t file;
+	struct bc_dump dump = {NULL, 0u, 0u};
+
+	/* Keep debug information for the errors line numbers */
+	if (lua_dump(L, bc_dump_writer, &dump, 0) != 0) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	const struct bc_cache_header hdr = {
+		.magic		 = BC_CACHE_MAGIC,
+		.lua_version = LUA_VERSION_NUM,
+		.src_size	 = src_size,
+		.src_crc	 = crc,
+		.bc_size	 = dump.len,
+		.bc_crc		 = crc32_ieee((const uint8_t *)dump.buf, dump.len),
+	};
+
+	bc_cache_path(path, cpath, sizeof(cpath));
+
+	fs_mkdir(CONFIG_APP_LUA_BYTECODE_CACHE_DIR);
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, cpath, FS_O_CREATE | FS_O_WRITE);
+	if (ret < 0) {
+		goto exit;
+	}
+
+	ret = fs_truncate(&file, 0);
+	if (ret == 0) {
+		ret = fs_write(&file, &hdr, sizeof(hdr));
+	}
+	if (ret >= 0) {
+		ret = fs_write(&file, dump.buf, dump.len);
+	}
+
+	fs_close(&file);
+
+	if (ret < 0) {
+		fs_unlink(cpath);
+	}
+
+exit:
+	free(dump.buf);
+	return ret;
+}
+
+#endif /* CONFIG_APP_LUA_BYTECODE_CACHE */
+
+static int script_read(const char *path, char **src, size_t *size)
+{
+	int ret;
+	struct fs_dirent entry;
+	struct fs_file_t file;
+
+	ret = fs_stat(path, &entry);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if ((entry.type != FS_DIR_ENTRY_FILE) || (entry.size > LUA_ORCH_SCRIPT_MAX_SIZE)) {
+		return -EINVAL;
+	}
+
+	*src = malloc(MAX(entry.size, 1u));
+	if (*src == NULL) {
+		return -ENOMEM;
+	}
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, path, FS_O_READ);
+	if (ret == 0) {
+		ret = fs_read(&file, *src, entry.size);
+		fs_close(&file);
+	}
+
+	if (ret != (int)entry.size) {
+		free(*src);
+		*src = NULL;
+		return (ret < 0) ? ret : -EIO;
+	}
+
+	*size = entry.size;
+
+	return 0;
+}
+
+/* Note: Zephyr FS API doesn't expose files modification time, scripts are
+ * identified by their path and the CRC32 of their source. */
+int lua_orch_script_load(lua_State *L, const char *path)
+{
+	int ret;
+	char *src = NULL;
+	size_t size;
+	uint32_t crc;
+
+	ret = script_read(path, &src, &size);
+	if (ret < 0) {
+		LOG_ERR("Failed to read %s: %d", path, ret);
+		return ret;
+	}
+
+	crc = crc32_ieee((const uint8_t *)src, size);
+
+	/* VM cache */
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &chunks_crc_key);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &chunks_fn_key);
+	lua_getfield(L, -2, path);
+	if (lua_isinteger(L, -1) && ((uint32_t)lua_tointeger(L, -1) == crc)) {
+		lua_pop(L, 1);
+		lua_getfield(L, -1, path);
+		LOG_DBG("%s loaded from VM cache", path);
+		goto exit;
+	}
+	lua_pop(L, 1);
+
+#if defined(CONFIG_APP_LUA_BYTECODE_CACHE)
+	if (bc_cache_load(L, path, size, crc) == 0) {
+		LOG_DBG("%s loaded from bytecode cache", path);
+		goto cache;
+	}
+#endif
+
+	ret = luaL_loadbufferx(L, src, size, path, "t");
+	if (ret != LUA_OK) {
+		LOG_ERR("Failed to load %s: %s", path, lua_tostring(L, -1));
+		lua_pop(L, 3);
+		ret = -EINVAL;
+		goto exit;
+	}
+
+#if defined(CONFIG_APP_LUA_BYTECODE_CACHE)
+	ret = bc_cache_store(L, path, size, crc);
+	if (ret < 0) {
+		LOG_WRN("Failed to cache %s bytecode: %d", path, ret);
+	}
+	ret = 0;
+
+cache:
+#endif
+	/* Cache the chunk in the VM */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -3, path);
+	lua_pushinteger(L, crc);
+	lua_setfield(L, -4, path);
+
+exit:
+	if (ret == 0) {
+		/* Keep only the chunk on the stack */
+		lua_replace(L, -3);
+		lua_pop(L, 1);
+	}
+
+	free(src);
+	return ret;
+}
+
+/* Give the script a fresh environment so that globals it defines don't leak
+ * into the next scripts run by the VM */
+static void script_set_env(lua_State *L)
+{
+	lua_newtable(L);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &env_mt_key);
+	lua_setmetatable(L, -2);
+
+	/* First upvalue of a main chunk is _ENV */
+	if (lua_setupvalue(L, -2, 1) == NULL) {
+		lua_pop(L, 1);
+	}
+}
 
-void lua_orch_script_handler(struct k_work *work)
+static void lua_orch_script_handler(struct k_work *work)
 {
 	struct script_context *const sx = CONTAINER_OF(work, struct script_context, _work);
 
 	LOG_DBG("(%p) Executing script ...", sx);
 
-	/* Init LUA context */
-	sx->lua_ret = lua_pcall(sx->L, 0, LUA_MULTRET, 0);
+	const int64_t start = k_uptime_get();
+
+	/* Keep a reference to the (cached) chunk below the called copy */
+	lua_pushvalue(sx->L, 1);
+
+	sx->instructions = 0u;
+	sx->mem_peak	 = sx->mem;
+	sx->lua_ret		 = lua_pcall(sx->L, 0, LUA_MULTRET, 0);
+	sx->wall_time_ms = k_uptime_get() - start;
 
 	/* TODO Handle script returned values */
-	lua_close(sx->L);
+	lua_settop(sx->L, 1);
+
+	/* The cached chunk holds the environment of this run as its _ENV upvalue,
+	 * drop it so that the globals of the script (e.g. HA subscriptions) are
+	 * collected below. A fresh environment is set before each run. */
+	lua_pushnil(sx->L);
+	if (lua_setupvalue(sx->L, 1, 1) == NULL) {
+		lua_pop(sx->L, 1);
+	}
+
+	lua_settop(sx->L, 0);
+
+	/* Release what the script allocated (e.g. HA events referenced by
+	 * event views) before the next run */
+	lua_gc(sx->L, LUA_GCCOLLECT);
 
 	LOG_DBG("(%p) Script returned res=%d...", sx, sx->lua_ret);
 
-	/* Free context */
 	k_sem_give(&sx->_sem);
 }
 
+static const char *script_name(const char *path)
+{
+	const char *const sep = strrchr(path, '/');
+
+	return (sep != NULL) ? sep + 1 : path;
+}
+
+static void script_stats_update(const char *path, const struct script_context *sx)
+{
+	const char *const name				 = script_name(path);
+	struct lua_orch_script_stats *stats = NULL;
+
+	K_SPINLOCK(&scripts_stats_lock)
+	{
+		/* Entry of the script, or the least recently updated one */
+		for (size_t i = 0u; i < ARRAY_SIZE(scripts_stats); i++) {
+			struct lua_orch_script_stats *const entry = &scripts_stats[i];
+
+			if (strncmp(entry->name, name, sizeof(entry->name)) == 0) {
+				stats = entry;
+				break;
+			} else if ((stats == NULL) || (entry->seq < stats->seq)) {
+				stats = entry;
+			}
+		}
+
+		if (strncmp(stats->name, name, sizeof(stats->name)) != 0) {
+			memset(stats, 0, sizeof(*stats));
+			strncpy(stats->name, name, sizeof(stats->name) - 1u);
+		}
+
+		stats->seq			= ++scripts_stats_seq;
+		stats->runs++;
+		stats->lua_ret		= sx->lua_ret;
+		stats->peak_bytes	= sx->mem_peak;
+		stats->instructions = sx->instructions;
+		stats->wall_time_ms = sx->wall_time_ms;
+	}
+}
+
+int lua_orch_script_stats_get(const char *name, struct lua_orch_script_stats *stats)
+{
+	int ret = -ENOENT;
+
+	K_SPINLOCK(&scripts_stats_lock)
+	{
+		for (size_t i = 0u; i < ARRAY_SIZE(scripts_stats); i++) {
+			if ((scripts_stats[i].runs != 0u) &&
+				(strncmp(scripts_stats[i].name, name, sizeof(stats->name)) == 0)) {
+				*stats = scripts_stats[i];
+				ret	   = 0;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
 int lua_orch_run_script(const char *path, int *lua_ret)
 {
 	int res;
 	struct script_context *sx;
 
-	/* Allocate context */
-	res = k_mem_slab_alloc(&works_pool, (void **)&sx, K_NO_WAIT);
-	if (res == 0) {
-		/* Context init */
-		k_work_init(&sx->_work, lua_orch_script_handler);
-		k_sem_init(&sx->_sem, 0u, 1u);
-		sx->res		= LUA_ORCH_RET_OK;
-		sx->lua_ret = 0u;
-
-		/* Init LUA context */
-		sx->L = luaL_newstate();
-		lm_openlibs(sx->L);
-		res = luaL_loadfile(sx->L, path);
-		if (res != LUA_OK) {
-			goto exit;
-		}
+	/* Take a VM */
+	res = k_msgq_get(&contexts_msgq, &sx, K_NO_WAIT);
+	if (res != 0) {
+		return -ENOMEM;
+	}
+
+	sx->res		= LUA_ORCH_RET_OK;
+	sx->lua_ret = 0u;
 
-		/* Schedule script execution */
-		k_work_submit_to_queue(&lua_work_q, &sx->_work);
+	res = lua_orch_script_load(sx->L, path);
+	if (res != 0) {
+		goto exit;
+	}
 
-		/* Wait for script end */
-		k_sem_take(&sx->_sem, K_FOREVER);
+	script_set_env(sx->L);
 
-		/* Forward lua return value */
-		if (lua_ret != NULL) {
-			*lua_ret = sx->lua_ret;
-		}
+	/* Schedule script execution */
+	k_work_submit_to_queue(&lua_work_q, &sx->_work);
 
-		/* Check for script execution error */
-		if (sx->lua_ret >= LUA_ERRRUN) {
-			LOG_WRN("(%p) Script returned error %d (%s)", sx, sx->lua_ret,
-					lua_utils_luaret2str(sx->lua_ret));
-		} else {
-			LOG_INF("(%p) Script returned %d (%s)", sx, sx->lua_ret,
-					lua_utils_luaret2str(sx->lua_ret));
-		}
+	/* Wait for script end */
+	k_sem_take(&sx->_sem, K_FOREVER);
+
+	/* Forward lua return value */
+	if (lua_ret != NULL) {
+		*lua_ret = sx->lua_ret;
+	}
+
+	/* Check for script execution error */
+	if (sx->lua_ret >= LUA_ERRRUN) {
+		LOG_WRN("(%p) Script returned error %d (%s)", sx, sx->lua_ret,
+				lua_utils_luaret2str(sx->lua_ret));
+	} else {
+		LOG_INF("(%p) Script returned %d (%s)", sx, sx->lua_ret,
+				lua_utils_luaret2str(sx->lua_ret));
+	}
+
+	script_stats_update(path, sx);
+
+	/* State can't be trusted after a memory error, start over */
+	if (sx->lua_ret == LUA_ERRMEM) {
+		lua_close(sx->L);
+		sx->L = vm_create(sx);
 	}
 
 exit:
 	if (res != 0) {
-		lua_close(sx->L);
 		LOG_ERR("(%p) Script execution failed", sx);
 	}
 
-	k_mem_slab_free(&works_pool, (void *)sx);
+	if (sx->L != NULL) {
+		k_msgq_put(&contexts_msgq, &sx, K_NO_WAIT);
+	} else {
+		LOG_ERR("(%p) Failed to recreate Lua VM", sx);
+	}
 
 	return res;
-}
\ No newline at end of file
+}
@@ -11,8 +11,61 @@
 
 #include <zephyr/kernel.h>
 
+struct lua_State;
+
 int lua_orch_init(void);
 
+/**
+ * @brief Get the workqueue Lua scripts are executed on
+ *
+ * @return struct k_work_q*
+ */
+struct k_work_q *lua_orch_work_q(void);
+
+/**
+ * @brief Open the libraries and create the tables the orchestrator expects
+ * in a newly created VM (chunks cache, environments metatable).
+ *
+ * @param L
+ */
+void lua_orch_vm_setup(struct lua_State *L);
+
+/**
+ * @brief Push the chunk of the script on the VM stack
+ *
+ * The chunk is taken from the VM cache if the script didn't change since it
+ * was last loaded, otherwise from the bytecode cache on the filesystem, and is
+ * compiled from the source as a last resort.
+ *
+ * @param L VM set up with lua_orch_vm_setup()
+ * @param path Script path
+ * @return int 0 on success, negative error code otherwise
+ */
+int lua_orch_script_load(struct lua_State *L, const char *path);
+
+struct lua_orch_script_stats {
+	char name[32u]; /* Script file name */
+	uint32_t seq;	/* Update sequence number */
+	uint32_t runs;
+
+	/* Last run */
+	int32_t lua_ret;
+	uint32_t peak_bytes;   /* Peak memory allocated by the VM */
+	uint32_t instructions; /* Instructions executed (thousands granularity) */
+	uint32_t wall_time_ms;
+};
+
+/**
+ * @brief Get the statistics of the last run of a script
+ *
+ * Note: Statistics are kept for the 16 scripts run last.
+ *
+ * @param name Script file name
+ * @param stats
+ * @return int 0 on success, -ENOENT if the script wasn't run
+ */
+int lua_orch_script_stats_get(const char *name, struct lua_orch_script_stats *stats);
+
 /* TODO add run context */
 /**
  * @brief Execute a LUA script
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Lua rules engine
+ *
+ * Rules live in a dedicated VM, each execution of a rule handler is a Lua
+ * coroutine resumed by a single delayable work item on the Lua workqueue:
+ * - a count hook yields the running coroutine every
+ *   CONFIG_APP_LUA_RULES_INSTR_QUANTUM instructions, so that a busy rule
+ *   delays neither the other rules nor the scripts run by the orchestrator.
+ * - the VM allocator accounts the memory allocated by each rule execution
+ *   and fails the allocations beyond CONFIG_APP_LUA_RULES_MEM_MAX (the rule
+ *   fails with a memory error).
+ * - HA events are received through a single subscription and dispatched to
+ *   the queues of the matching event rules, the events which don't fit in a
+ *   queue are dropped. Events dropped by the subscription itself, before the
+ *   dispatch, are reported as "sub_dropped" by rules.stats().
+ *
+ * Note: rules must not block (e.g. ha.pend() with a timeout), rules.sleep()
+ * suspends the rule without blocking the workqueue.
+ */
+
+#include "ha/core/ha.h"
+#include "modules.h"
+#include "orchestrator.h"
+#include "rules.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <lua/lauxlib.h>
+#include <lua/lua.h>
+#include <lua/lualib.h>
+LOG_MODULE_REGISTER(lua_rules, LOG_LEVEL_INF);
+
+#define LM_LUA_RULESLIB "rules"
+
+/* The rule a coroutine runs for is stored in its extra space */
+BUILD_ASSERT(LUA_EXTRASPACE >= sizeof(void *));
+
+typedef enum {
+	RULE_TYPE_SCRIPT = 0u, /* Script main chunk, run once */
+	RULE_TYPE_EVENT,	   /* Run on matching HA events */
+	RULE_TYPE_TIMER,	   /* Run periodically */
+} rule_type_t;
+
+typedef enum {
+	RULE_STATE_FREE = 0u,
+	RULE_STATE_IDLE,	 /* Waiting for an event or for its period */
+	RULE_STATE_READY,	 /* Coroutine to be resumed */
+	RULE_STATE_SLEEPING, /* Coroutine suspended by rules.sleep() */
+} rule_state_t;
+
+struct rule {
+	uint8_t type;
+	uint8_t state;
+
+	/* Removed while running, freed once its coroutine yields or returns */
+	uint8_t removed;
+
+	/* Number of arguments pushed on the coroutine stack for the next resume */
+	uint8_t nargs;
+
+	lua_State *co;
+	int co_ref;
+	int fn_ref;
+
+	/* Event view passed to the handler, reused for every event */
+	int view_ref;
+
+	/* Next period (timer rules) or wake up time (sleeping rules) */
+	int64_t deadline;
+	uint32_t period_ms;
+
+	/* Memory allocated minus freed during the current execution, frees of
+	 * garbage left by other rules are accounted to the running rule */
+	int32_t mem;
+
+	uint32_t runs;
+	uint32_t preemptions;
+	uint32_t errors;
+	uint32_t dropped; /* Events dropped because of a full queue */
+
+	/* Event rules filter and queue */
+	ha_ev_subs_conf_t conf;
+	uint8_t evq_head;
+	uint8_t evq_count;
+	ha_ev_t *evq[CONFIG_APP_LUA_RULES_EVENT_QUEUE_SIZE];
+};
+
+static struct {
+	lua_State *L;
+	struct k_work_delayable work;
+	struct ha_ev_subs *sub;
+
+	/* Rule being resumed */
+	struct rule *current;
+
+	/* Memory allocated by the rules VM */
+	int32_t mem;
+} engine;
+
+static struct rule rules[CONFIG_APP_LUA_RULES_MAX_COUNT];
+
+/* Protects the rules VM and the rules */
+K_MUTEX_DEFINE(rules_mutex);
+
+static void rules_on_queued(struct ha_ev_subs *sub, ha_ev_t *event);
+
+/* Catch-all subscription feeding all the rules, it is drained while rules run
+ * so it gets the largest queue */
+static const ha_ev_subs_conf_t rules_subs_conf = {
+	.flags		  = HA_EV_SUBS_CONF_ON_QUEUED_HOOK,
+	.on_queued_cb = rules_on_queued,
+	.queue_limit  = HA_SUBS_QUEUE_MAX_LEN,
+};
+
+static void rules_kick(void)
+{
+	k_work_reschedule_for_queue(lua_orch_work_q(), &engine.work, K_NO_WAIT);
+}
+
+static void rules_on_queued(struct ha_ev_subs *sub, ha_ev_t *event)
+{
+	ARG_UNUSED(sub);
+	ARG_UNUSED(event);
+
+	rules_kick();
+}
+
+static void *rules_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct rule *const rule = engine.current;
+	const int32_t delta		= (int32_t)nsize - (int32_t)((ptr != NULL) ? osize : 0u);
+	void *nptr				= NULL;
+
+	ARG_UNUSED(ud);
+
+	/* Limits only apply to the rules, not to the engine bookkeeping */
+	if ((rule != NULL) && (delta > 0) &&
+		((engine.mem + delta > CONFIG_APP_LUA_RULES_HEAP_MAX) ||
+		 (rule->mem + delta > CONFIG_APP_LUA_RULES_MEM_MAX))) {
+		return NULL;
+	}
+
+	if (nsize == 0u) {
+		free(ptr);
+	} else {
+		nptr = realloc(ptr, nsize);
+		if (nptr == NULL) {
+			return NULL;
+		}
+	}
+
+	engine.mem += delta;
+	if (rule != NULL) {
+		rule->mem += delta;
+	}
+
+	return nptr;
+}
+
+static int rules_panic(lua_State *L)
+{
+	LOG_ERR("Unprotected error in rules VM: %s",
+			lua_isstring(L, -1) ? lua_tostring(L, -1) : "?");
+	return 0;
+}
+
+static inline uint32_t rule_id(const struct rule *rule)
+{
+	return rule - rules;
+}
+
+static inline struct rule *rule_running(lua_State *L)
+{
+	return *(struct rule **)lua_getextraspace(L);
+}
+
+/* Preempt the running rule, it is resumed on the next scheduler pass */
+static void rules_hook(lua_State *L, lua_Debug *ar)
+{
+	if ((ar->event == LUA_HOOKCOUNT) && lua_isyieldable(L)) {
+		lua_yield(L, 0);
+	}
+}
+
+static lua_State *rule_coroutine(struct rule *rule)
+{
+	if (rule->co == NULL) {
+		rule->co	 = lua_newthread(engine.L);
+		rule->co_ref = luaL_ref(engine.L, LUA_REGISTRYINDEX);
+
+		*(struct rule **)lua_getextraspace(rule->co) = rule;
+		lua_sethook(rule->co, rules_hook, LUA_MASKCOUNT,
+					CONFIG_APP_LUA_RULES_INSTR_QUANTUM);
+	}
+
+	return rule->co;
+}
+
+/* Allocate a rule for the function on top of the stack (popped on success) */
+static struct rule *rule_alloc(lua_State *L, rule_type_t type)
+{
+	for (struct rule *rule = rules; rule < &rules[ARRAY_SIZE(rules)]; rule++) {
+		if (rule->state == RULE_STATE_FREE) {
+			rule->type	   = type;
+			rule->state	   = RULE_STATE_IDLE;
+			rule->co_ref   = LUA_NOREF;
+			rule->view_ref = LUA_NOREF;
+			rule->fn_ref   = luaL_ref(L, LUA_REGISTRYINDEX);
+			return rule;
+		}
+	}
+
+	return NULL;
+}
+
+static ha_ev_t *rule_evq_pop(struct rule *rule)
+{
+	ha_ev_t *const ev = rule->evq[rule->evq_head];
+
+	rule->evq_head = (rule->evq_head + 1u) % CONFIG_APP_LUA_RULES_EVENT_QUEUE_SIZE;
+	rule->evq_count--;
+
+	return ev;
+}
+
+/* Release the event referenced by the rule event view (ev:release()) */
+static void rule_view_release(struct rule *rule)
+{
+	if (rule->view_ref != LUA_NOREF) {
+		lua_rawgeti(engine.L, LUA_REGISTRYINDEX, rule->view_ref);
+		if (luaL_callmeta(engine.L, -1, "__gc")) {
+			lua_pop(engine.L, 1);
+		}
+		lua_pop(engine.L, 1);
+	}
+}
+
+static void rule_free(struct rule *rule)
+{
+	rule_view_release(rule);
+
+	luaL_unref(engine.L, LUA_REGISTRYINDEX, rule->view_ref);
+	luaL_unref(engine.L, LUA_REGISTRYINDEX, rule->co_ref);
+	luaL_unref(engine.L, LUA_REGISTRYINDEX, rule->fn_ref);
+
+	while (rule->evq_count > 0u) {
+		ha_ev_unref(rule_evq_pop(rule));
+	}
+
+	LOG_DBG("Rule %u freed (runs: %u preemptions: %u errors: %u dropped: %u)",
+			rule_id(rule), rule->runs, rule->preemptions, rule->errors, rule->dropped);
+
+	memset(rule, 0, sizeof(*rule));
+}
+
+static void rule_remove(struct rule *rule)
+{
+	if (rule == engine.current) {
+		rule->removed = 1u;
+	} else {
+		rule_free(rule);
+	}
+}
+
+static void rules_dispatch(ha_ev_t *ev)
+{
+	for (struct rule *rule = rules; rule < &rules[ARRAY_SIZE(rules)]; rule++) {
+		if ((rule->state == RULE_STATE_FREE) || (rule->type != RULE_TYPE_EVENT) ||
+			rule->removed || !ha_ev_subs_conf_match(&rule->conf, ev)) {
+			continue;
+		}
+
+		if (rule->evq_count == CONFIG_APP_LUA_RULES_EVENT_QUEUE_SIZE) {
+			rule->dropped++;
+			continue;
+		}
+
+		ha_ev_ref(ev);
+		rule->evq[(rule->evq_head + rule->evq_count) %
+				  CONFIG_APP_LUA_RULES_EVENT_QUEUE_SIZE] = ev;
+		rule->evq_count++;
+	}
+}
+
+/* Start a new execution of an idle rule if it has something to process */
+static void rule_start(struct rule *rule, int64_t now)
+{
+	lua_State *co;
+
+	if (rule->type == RULE_TYPE_EVENT) {
+		if (rule->evq_count == 0u) {
+			return;
+		}
+	} else if ((rule->type != RULE_TYPE_TIMER) || (rule->deadline > now)) {
+		return;
+	}
+
+	co = rule_coroutine(rule);
+	lua_rawgeti(co, LUA_REGISTRYINDEX, rule->fn_ref);
+
+	if (rule->type == RULE_TYPE_EVENT) {
+		/* The view takes over the reference held by the queue */
+		lua_rawgeti(co, LUA_REGISTRYINDEX, rule->view_ref);
+		lm_ha_push_event(co, rule_evq_pop(rule), lua_gettop(co));
+		lua_remove(co, -2);
+
+		if (rule->view_ref == LUA_NOREF) {
+			lua_pushvalue(co, -1);
+			rule->view_ref = luaL_ref(co, LUA_REGISTRYINDEX);
+		}
+
+		rule->nargs = 1u;
+	} else {
+		/* Skip the periods missed */
+		rule->deadline += rule->period_ms;
+		if (rule->deadline <= now) {
+			rule->deadline = now + rule->period_ms;
+		}
+
+		rule->nargs = 0u;
+	}
+
+	rule->mem	= 0;
+	rule->state = RULE_STATE_READY;
+	rule->runs++;
+}
+
+/* Resume the rule coroutine for one slice at most */
+static void rule_resume(struct rule *rule)
+{
+	int ret, nres;
+	lua_State *const co = rule->co;
+
+	engine.current = rule;
+	ret			   = lua_resume(co, engine.L, rule->nargs, &nres);
+	engine.current = NULL;
+
+	rule->nargs = 0u;
+
+	if (ret == LUA_YIELD) {
+		lua_pop(co, nres);
+
+		/* Still ready if not suspended by rules.sleep() */
+		if (rule->state == RULE_STATE_READY) {
+			rule->preemptions++;
+		}
+	} else {
+		if (ret == LUA_OK) {
+			lua_settop(co, 0);
+		} else {
+			LOG_ERR("Rule %u failed: %s (%s)", rule_id(rule),
+					lua_isstring(co, -1) ? lua_tostring(co, -1) : "?",
+					lua_utils_luaret2str(ret));
+			rule->errors++;
+
+			/* A coroutine which raised an error can't be resumed anymore */
+			luaL_unref(engine.L, LUA_REGISTRYINDEX, rule->co_ref);
+			rule->co	 = NULL;
+			rule->co_ref = LUA_NOREF;
+		}
+
+		rule_view_release(rule);
+		rule->state = RULE_STATE_IDLE;
+
+		if (rule->type == RULE_TYPE_SCRIPT) {
+			rule->removed = 1u;
+		}
+	}
+
+	if (rule->removed) {
+		rule_free(rule);
+	}
+}
+
+static void rules_schedule(struct k_work *work)
+{
+	ha_ev_t *ev;
+	int64_t now;
+	int64_t next = INT64_MAX;
+	bool pending = false;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&rules_mutex, K_FOREVER);
+
+	/* Dispatch the events received since the last pass */
+	while ((ev = ha_ev_wait(engine.sub, K_NO_WAIT)) != NULL) {
+		rules_dispatch(ev);
+		ha_ev_unref(ev);
+	}
+
+	now = k_uptime_get();
+
+	for (struct rule *rule = rules; rule < &rules[ARRAY_SIZE(rules)]; rule++) {
+		if ((rule->state == RULE_STATE_SLEEPING) && (rule->deadline <= now)) {
+			rule->state = RULE_STATE_READY;
+		} else if (rule->state == RULE_STATE_IDLE) {
+			rule_start(rule, now);
+		}
+
+		if (rule->state == RULE_STATE_READY) {
+			rule_resume(rule);
+		}
+
+		/* Find out when the rule needs to run again */
+		if ((rule->state == RULE_STATE_READY) ||
+			((rule->state == RULE_STATE_IDLE) && (rule->evq_count > 0u))) {
+			pending = true;
+		} else if ((rule->state == RULE_STATE_SLEEPING) ||
+				   ((rule->state == RULE_STATE_IDLE) &&
+					(rule->type == RULE_TYPE_TIMER))) {
+			next = MIN(next, rule->deadline);
+		}
+	}
+
+	k_mutex_unlock(&rules_mutex);
+
+	/* Doesn't delay a pass already submitted (e.g. new events). The workqueue
+	 * is cooperative, wait a tick before the next slices so that busy rules
+	 * don't starve the lower priority threads. */
+	if (pending) {
+		k_work_schedule_for_queue(lua_orch_work_q(), &engine.work, K_TICKS(1));
+	} else if (next != INT64_MAX) {
+		k_work_schedule_for_queue(lua_orch_work_q(), &engine.work,
+								  K_MSEC(MAX(next - k_uptime_get(), 0)));
+	}
+}
+
+/* rules.on([filter], fn) -> rule id
+ *
+ * Call fn(ev) for each event matching the filter (see ha.subscribe()). The
+ * event view is released when fn returns. */
+static int lr_on(lua_State *L)
+{
+	int ret;
+	struct rule *rule;
+	ha_ev_subs_conf_t conf;
+
+	lm_ha_check_subs_conf(L, 1, &conf);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+
+	if (engine.sub == NULL) {
+		ret = ha_subscribe(&rules_subs_conf, &engine.sub);
+		if (ret != 0) {
+			return luaL_error(L, "subscription failed (%d)", ret);
+		}
+	}
+
+	rule = rule_alloc(L, RULE_TYPE_EVENT);
+	if (rule == NULL) {
+		return luaL_error(L, "too many rules");
+	}
+
+	rule->conf = conf;
+
+	lua_pushinteger(L, rule_id(rule));
+	return 1;
+}
+
+/* rules.every(period_ms, fn) -> rule id */
+static int lr_every(lua_State *L)
+{
+	struct rule *rule;
+	const lua_Integer period_ms = luaL_checkinteger(L, 1);
+
+	luaL_argcheck(L, (period_ms > 0) && (period_ms <= UINT32_MAX), 1, "invalid period");
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+
+	rule = rule_alloc(L, RULE_TYPE_TIMER);
+	if (rule == NULL) {
+		return luaL_error(L, "too many rules");
+	}
+
+	rule->period_ms = period_ms;
+	rule->deadline	= k_uptime_get() + period_ms;
+
+	lua_pushinteger(L, rule_id(rule));
+	return 1;
+}
+
+/* rules.sleep(ms) */
+static int lr_sleep(lua_State *L)
+{
+	struct rule *const rule = rule_running(L);
+	const lua_Integer ms	= luaL_checkinteger(L, 1);
+
+	if ((rule == NULL) || !lua_isyieldable(L)) {
+		return luaL_error(L, "can't sleep here");
+	}
+
+	rule->deadline = k_uptime_get() + MAX(ms, 0);
+	rule->state	   = RULE_STATE_SLEEPING;
+
+	return lua_yield(L, 0);
+}
+
+static struct rule *lr_check_rule(lua_State *L, int arg)
+{
+	const lua_Integer id = luaL_checkinteger(L, arg);
+
+	luaL_argcheck(L,
+				  (id >= 0) && (id < (lua_Integer)ARRAY_SIZE(rules)) &&
+					  (rules[id].state != RULE_STATE_FREE) &&
+					  (rules[id].type != RULE_TYPE_SCRIPT),
+				  arg, "invalid rule");
+
+	return &rules[id];
+}
+
+/* rules.remove(id) */
+static int lr_remove(lua_State *L)
+{
+	rule_remove(lr_check_rule(L, 1));
+
+	return 0;
+}
+
+/* rules.stats(id) -> {runs, preemptions, errors, dropped, sub_dropped}
+ *
+ * sub_dropped: events dropped by the subscription of the engine before being
+ * dispatched (shared by all the rules) */
+static int lr_stats(lua_State *L)
+{
+	struct rule *const rule = lr_check_rule(L, 1);
+	struct ha_ev_subs_stats sub_stats = {0};
+
+	if (engine.sub != NULL) {
+		(void)ha_subs_stats_get(engine.sub, &sub_stats);
+	}
+
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, rule->runs);
+	lua_setfield(L, -2, "runs");
+	lua_pushinteger(L, rule->preemptions);
+	lua_setfield(L, -2, "preemptions");
+	lua_pushinteger(L, rule->errors);
+	lua_setfield(L, -2, "errors");
+	lua_pushinteger(L, rule->dropped);
+	lua_setfield(L, -2, "dropped");
+	lua_pushinteger(L, sub_stats.dropped);
+	lua_setfield(L, -2, "sub_dropped");
+
+	return 1;
+}
+
+static const struct luaL_Reg lr_functions[] = {
+	{"on", lr_on},
+	{"every", lr_every},
+	{"sleep", lr_sleep},
+	{"remove", lr_remove},
+	{"stats", lr_stats},
+	{NULL, NULL},
+};
+
+static int lr_luaopen(lua_State *L)
+{
+	luaL_newlib(L, lr_functions);
+	return 1;
+}
+
+int lua_rules_init(void)
+{
+	lua_State *L;
+
+	k_work_init_delayable(&engine.work, rules_schedule);
+
+	L = lua_newstate(rules_alloc, NULL);
+	if (L == NULL) {
+		return -ENOMEM;
+	}
+
+	lua_atpanic(L, rules_panic);
+
+	/* Not a rule */
+	*(struct rule **)lua_getextraspace(L) = NULL;
+
+	lua_orch_vm_setup(L);
+
+	luaL_requiref(L, LM_LUA_RULESLIB, lr_luaopen, 1);
+	lua_pop(L, 1);
+
+	engine.L = L;
+
+	return 0;
+}
+
+int lua_rules_load(const char *path)
+{
+	int ret;
+	struct rule *rule;
+
+	if (engine.L == NULL) {
+		return -EAGAIN;
+	}
+
+	k_mutex_lock(&rules_mutex, K_FOREVER);
+
+	ret = lua_orch_script_load(engine.L, path);
+	if (ret == 0) {
+		rule = rule_alloc(engine.L, RULE_TYPE_SCRIPT);
+		if (rule != NULL) {
+			lua_rawgeti(rule_coroutine(rule), LUA_REGISTRYINDEX, rule->fn_ref);
+			rule->state = RULE_STATE_READY;
+			rule->runs++;
+
+			LOG_INF("Rules script %s loaded (%u)", path, rule_id(rule));
+		} else {
+			lua_pop(engine.L, 1);
+			ret = -ENOMEM;
+		}
+	}
+
+	k_mutex_unlock(&rules_mutex);
+
+	if (ret == 0) {
+		rules_kick();
+	}
+
+	return ret;
+}
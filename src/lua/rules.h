@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _LUA_RULES_H_
+#define _LUA_RULES_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Initialize the rules engine, must be called after lua_orch_init()
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int lua_rules_init(void);
+
+/**
+ * @brief Load a rules script and schedule its execution in the rules VM.
+ *
+ * The script registers its rules with the "rules" library, e.g.:
+ *
+ *  rules.on({data = true, type = "xiaomi_mijia"}, function(ev)
+ *      print(ev:device():addr(), ev:get("temperature"))
+ *  end)
+ *
+ *  rules.every(60000, function()
+ *      rules.sleep(100)
+ *  end)
+ *
+ * Scripts share the globals of the rules VM.
+ *
+ * @param path Script path
+ * @return int 0 on success, negative error code otherwise
+ */
+int lua_rules_load(const char *path);
+
+#endif /* _LUA_RULES_H_ */
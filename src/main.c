@@ -35,14 +35,18 @@
 #include "ble/ble.h"
 #endif /* CONFIG_APP_BLE_INTERFACE */
 
-#ifndef CONFIG_QEMU_TARGET
+#if !defined(CONFIG_QEMU_TARGET) || defined(CONFIG_APP_HA_DEV_STORAGE)
 #include "ha/core/ha.h"
-#endif /* CONFIG_QEMU_TARGET */
+#endif
 
 #ifdef CONFIG_LUA
 #include "lua/utils.h"
 #endif
 
+#if defined(CONFIG_APP_LUA_RULES)
+#include "lua/rules.h"
+#endif
+
 #include <stdio.h>
 
 #include <zephyr/logging/log.h>
@@ -132,6 +136,11 @@ int main(void)
 	creds_manager_init();
 #endif
 
+#if defined(CONFIG_APP_HA_DEV_STORAGE)
+	/* Restore devices before any of them registers */
+	ha_dev_storage_load(NULL);
+#endif
+
 	crypto_mbedtls_heap_init();
 	net_interface_init();
 
@@ -147,10 +156,14 @@ int main(void)
 	lua_fs_populate();
 #endif
 
-#if defined(CONFIUG_LUA)
+#if defined(CONFIG_LUA)
 	lua_orch_init();
 #endif
 
+#if defined(CONFIG_APP_LUA_RULES)
+	lua_rules_init();
+#endif
+
 #ifdef TEMP_NODE
 	die_temp_dev_init();
 #endif /* TEMP_NODE */
@@ -161,6 +174,9 @@ int main(void)
 
 #if defined(CONFIG_APP_LUA_AUTORUN_SCRIPTS)
 	lua_utils_execute_fs_script2("/RAM:/lua/entry.lua");
+#if defined(CONFIG_APP_LUA_RULES)
+	lua_rules_load("/RAM:/lua/rules.lua");
+#endif
 #endif
 
 	uint32_t counter = 0;
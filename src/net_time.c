@@ -6,99 +6,385 @@
 
 #include "net_time.h"
 
-#include <zephyr/logging/log.h>
-#include <zephyr/net/sntp.h>
+#include <stdlib.h>
+
+#include <zephyr/net/socket.h>
 #include <zephyr/posix/time.h>
+#include <zephyr/random/random.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(net_time, LOG_LEVEL_INF);
 
-static void sntp_handler(struct k_work *work);
+/* https://www.pool.ntp.org/zone/fr */
+static const char *const sntp_servers[] = {
+	"0.fr.pool.ntp.org",
+	"1.fr.pool.ntp.org",
+	"2.fr.pool.ntp.org",
+};
 
-struct sntp_context {
-	const char *server; /* SNTP server */
+#define SNTP_PORT				"123"
+#define SNTP_RESPONSE_TIMEOUT_MS 2000u
+
+/* Answers with a larger round trip delay are discarded */
+#define SNTP_MAX_DELAY_US (500u * USEC_PER_MSEC)
+
+/* Poll interval once synced, and retry interval bounds on failure */
+#define SNTP_POLL_INTERVAL_S  1024u
+#define SNTP_RETRY_MIN_S	  5u
+#define SNTP_RETRY_MAX_S	  300u
+
+/* Offsets larger than this are stepped, smaller ones are slewed */
+#define SNTP_STEP_THRESHOLD_US (500u * USEC_PER_MSEC)
+
+/* Maximum slew rate (ppm), same as adjtime() */
+#define SNTP_SLEW_PPM 500u
+
+/* Seconds between 1900 (NTP epoch) and 1970 (Unix epoch) */
+#define NTP_UNIX_EPOCH_OFFSET 2208988800ull
+
+#define NTP_VERSION		 4u
+#define NTP_MODE_CLIENT	 3u
+#define NTP_MODE_SERVER	 4u
+#define NTP_MAX_STRATUM	 15u
+#define NTP_LI_VN_MODE(li, vn, mode) (((li) << 6u) | ((vn) << 3u) | (mode))
+
+struct ntp_packet {
+	uint8_t li_vn_mode;
+	uint8_t stratum;
+	uint8_t poll;
+	int8_t precision;
+	uint32_t root_delay;
+	uint32_t root_dispersion;
+	uint32_t ref_id;
+	uint32_t ref_ts[2u];
+	uint32_t orig_ts[2u];
+	uint32_t rx_ts[2u];
+	uint32_t tx_ts[2u];
+} __packed;
+
+/* One query per server per round */
+struct sntp_sample {
+	uint32_t cookie; /* Sent as transmit timestamp, echoed as origin timestamp */
+	int64_t t1;		 /* Uptime when the query was sent (us) */
+	int64_t offset;	 /* Offset between the server time and the uptime (us) */
+	int64_t delay;	 /* Round trip delay (us) */
+	bool answered;
+};
 
-	uint32_t failures; /* Number of failures */
-	uint32_t count;	   /* Number of times we synced time */
-	time_t last_sync;  /* Last time we synced time */
+static void sntp_thread(void *_a, void *_b, void *_c);
 
-	struct k_work_delayable dwork; /* Work item to sync time */
+K_THREAD_DEFINE(sntp, 0x800, sntp_thread, NULL, NULL, NULL, K_PRIO_PREEMPT(8), 0, 0);
+
+struct sntp_context {
+	struct net_time_stats stats;
+
+	struct k_sem trigger; /* Given to start a round immediately */
 
 	struct k_mutex mutex;	  /* Mutex to protect context access from other threads */
 	struct k_condvar condvar; /* Condvar to signal when the time is synced */
 };
 
+/* Offset between the epoch time and the uptime (us), 0 until the first
+ * sync. Timestamps are derived from the monotonic uptime so that an SNTP
+ * step backwards holds the time instead of rewinding it.
+ *
+ * Small corrections are slewed: the offset moves by at most
+ * SNTP_SLEW_PPM from slew_start until the slew correction is applied. */
+static struct {
+	struct k_spinlock lock;
+	int64_t offset_us;
+	int64_t slew_us;	   /* Correction to apply from slew_start */
+	int64_t slew_start_us; /* Uptime when the slew started */
+	int64_t last_ms;	   /* Last returned timestamp */
+} time_base;
+
 struct sntp_context sntp_ctx = {
-	.server	   = "fr.pool.ntp.org",
-	.failures  = 0U,
-	.count	   = 0U,
-	.last_sync = 0U,
-	.dwork	   = Z_WORK_DELAYABLE_INITIALIZER(sntp_handler),
-	.mutex	   = Z_MUTEX_INITIALIZER(sntp_ctx.mutex),
-	.condvar   = Z_CONDVAR_INITIALIZER(sntp_ctx.condvar),
+	.trigger = Z_SEM_INITIALIZER(sntp_ctx.trigger, 0u, 1u),
+	.mutex	 = Z_MUTEX_INITIALIZER(sntp_ctx.mutex),
+	.condvar = Z_CONDVAR_INITIALIZER(sntp_ctx.condvar),
 };
 
-static void sntp_handler(struct k_work *work)
+static inline int64_t uptime_us(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+/* Time base must be locked */
+static int64_t time_offset_us(int64_t now_us)
+{
+	const int64_t slewed = (now_us - time_base.slew_start_us) * SNTP_SLEW_PPM / 1000000;
+
+	if (time_base.slew_us >= 0) {
+		return time_base.offset_us + MIN(slewed, time_base.slew_us);
+	} else {
+		return time_base.offset_us + MAX(-slewed, time_base.slew_us);
+	}
+}
+
+/* Returns the correction between the measured and the current offset */
+static int64_t time_discipline(int64_t measured_us, bool first)
+{
+	int64_t correction;
+	const int64_t now = uptime_us();
+
+	K_SPINLOCK(&time_base.lock)
+	{
+		const int64_t current = time_offset_us(now);
+
+		correction = measured_us - current;
+
+		if (first || (llabs(correction) > SNTP_STEP_THRESHOLD_US)) {
+			time_base.offset_us = measured_us;
+			time_base.slew_us	= 0;
+		} else {
+			time_base.offset_us = current;
+			time_base.slew_us	= correction;
+		}
+		time_base.slew_start_us = now;
+	}
+
+	/* Keep the POSIX clock (e.g. used by TLS) aligned */
+	const uint64_t ms			= net_time_get_ms();
+	const struct timespec tspec = {
+		.tv_sec	 = ms / MSEC_PER_SEC,
+		.tv_nsec = (ms % MSEC_PER_SEC) * NSEC_PER_MSEC,
+	};
+	clock_settime(CLOCK_REALTIME, &tspec);
+
+	return correction;
+}
+
+static inline int64_t ntp_ts_to_us(const uint32_t ts[2u])
+{
+	const uint64_t sec	= sys_be32_to_cpu(ts[0u]) - NTP_UNIX_EPOCH_OFFSET;
+	const uint64_t frac = sys_be32_to_cpu(ts[1u]);
+
+	return (int64_t)(sec * USEC_PER_SEC + ((frac * USEC_PER_SEC) >> 32u));
+}
+
+static int sntp_query(int fd, const char *server, struct sntp_sample *sample)
 {
 	int ret;
-	struct sntp_time time;
-	struct timespec tspec;
-	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
-	struct sntp_context *ctx = CONTAINER_OF(dwork, struct sntp_context, dwork);
+	struct zsock_addrinfo *ai;
+	const struct zsock_addrinfo hints = {
+		.ai_family	 = AF_INET,
+		.ai_socktype = SOCK_DGRAM,
+	};
+
+	ret = zsock_getaddrinfo(server, SNTP_PORT, &hints, &ai);
+	if (ret != 0) {
+		LOG_WRN("Failed to resolve %s: %d", server, ret);
+		return -EHOSTUNREACH;
+	}
 
-	/* https://www.pool.ntp.org/zone/fr */
-	ret = sntp_simple(ctx->server, 10U * MSEC_PER_SEC, &time);
+	struct ntp_packet req = {
+		.li_vn_mode = NTP_LI_VN_MODE(0u, NTP_VERSION, NTP_MODE_CLIENT),
+	};
 
-	k_mutex_lock(&ctx->mutex, K_FOREVER);
+	sample->cookie	 = sys_rand32_get();
+	sample->answered = false;
+	req.tx_ts[1u]	 = sample->cookie;
 
-	if (ret == 0) {
-		tspec.tv_sec  = time.seconds;
-		tspec.tv_nsec = ((uint64_t)time.fraction * (1000LU * 1000LU * 1000LU)) >> 32;
+	sample->t1 = uptime_us();
+	ret = zsock_sendto(fd, &req, sizeof(req), 0, ai->ai_addr, ai->ai_addrlen);
 
-		clock_settime(CLOCK_REALTIME, &tspec);
+	zsock_freeaddrinfo(ai);
 
-		ctx->count++;
-		ctx->last_sync = tspec.tv_sec;
+	return (ret < 0) ? -errno : 0;
+}
 
-		ret = k_condvar_broadcast(&ctx->condvar);
+static void sntp_handle_response(struct ntp_packet *resp,
+								 struct sntp_sample *samples,
+								 size_t count)
+{
+	const int64_t t4 = uptime_us();
 
-		LOG_INF("SNTP time from %s:123 = %u, %d thread(s) signaled", ctx->server,
-				(uint32_t)time.seconds, ret);
-	} else {
-		ctx->failures++;
+	if (((resp->li_vn_mode & 0x7u) != NTP_MODE_SERVER) || (resp->stratum == 0u) ||
+		(resp->stratum > NTP_MAX_STRATUM)) {
+		return; /* Not a server answer, or Kiss-o'-Death */
+	}
+
+	for (size_t i = 0u; i < count; i++) {
+		struct sntp_sample *const s = &samples[i];
 
-		/* todo retry later */
-		LOG_ERR("sntp_simple() failed with error = %d", ret);
+		if (!s->answered && (resp->orig_ts[1u] == s->cookie)) {
+			const int64_t t2 = ntp_ts_to_us(resp->rx_ts);
+			const int64_t t3 = ntp_ts_to_us(resp->tx_ts);
 
-		/* Reschedule the work */
-		k_work_schedule(dwork, K_SECONDS(5));
+			s->offset	= ((t2 - s->t1) + (t3 - t4)) / 2;
+			s->delay	= (t4 - s->t1) - (t3 - t2);
+			s->answered = true;
+			break;
+		}
 	}
+}
+
+/* Query all servers at once and collect the answers in a poll loop,
+ * returns the index of the sample with the lowest round trip delay */
+static int sntp_round(struct sntp_sample *samples, size_t count, uint8_t *answered)
+{
+	int ret;
+	int best	   = -ENODATA;
+	size_t pending = 0u;
+	struct ntp_packet resp;
+
+	*answered = 0u;
+
+	const int fd = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) {
+		LOG_ERR("Failed to create socket: %d", errno);
+		return -errno;
+	}
+
+	for (size_t i = 0u; i < count; i++) {
+		samples[i].answered = false;
+		if (sntp_query(fd, sntp_servers[i], &samples[i]) == 0) {
+			pending++;
+		} else {
+			samples[i].cookie = 0u;
+		}
+	}
+
+	const int64_t deadline = k_uptime_get() + SNTP_RESPONSE_TIMEOUT_MS;
+	int64_t remaining;
+
+	while ((*answered < pending) && ((remaining = deadline - k_uptime_get()) > 0)) {
+		struct zsock_pollfd pfd = {.fd = fd, .events = ZSOCK_POLLIN};
+
+		ret = zsock_poll(&pfd, 1, (int)remaining);
+		if (ret <= 0) {
+			break; /* Timeout or error */
+		}
+
+		ret = zsock_recv(fd, &resp, sizeof(resp), 0);
+		if (ret == sizeof(resp)) {
+			sntp_handle_response(&resp, samples, count);
+		}
 
-	k_mutex_unlock(&ctx->mutex);
+		*answered = 0u;
+		for (size_t i = 0u; i < count; i++) {
+			*answered += samples[i].answered ? 1u : 0u;
+		}
+	}
+
+	zsock_close(fd);
+
+	for (size_t i = 0u; i < count; i++) {
+		const struct sntp_sample *const s = &samples[i];
+
+		if (s->answered && (s->delay >= 0) && (s->delay <= SNTP_MAX_DELAY_US) &&
+			((best < 0) || (s->delay < samples[best].delay))) {
+			best = i;
+		}
+	}
+
+	return best;
 }
 
-int net_time_sync(void)
+static void sntp_thread(void *_a, void *_b, void *_c)
 {
-	if (!k_work_is_pending(&sntp_ctx.dwork.work)) {
-		return k_work_schedule(&sntp_ctx.dwork, K_NO_WAIT);
-	} else {
-		return -EBUSY;
+	ARG_UNUSED(_a);
+	ARG_UNUSED(_b);
+	ARG_UNUSED(_c);
+
+	struct sntp_sample samples[ARRAY_SIZE(sntp_servers)];
+	uint32_t retry_s = SNTP_RETRY_MIN_S;
+	k_timeout_t next = K_FOREVER; /* Wait for net_time_sync() */
+	uint8_t answered;
+
+	for (;;) {
+		k_sem_take(&sntp_ctx.trigger, next);
+
+		const int best = sntp_round(samples, ARRAY_SIZE(samples), &answered);
+
+		k_mutex_lock(&sntp_ctx.mutex, K_FOREVER);
+
+		struct net_time_stats *const st = &sntp_ctx.stats;
+
+		st->servers = answered;
+
+		if (best >= 0) {
+			const struct sntp_sample *const s = &samples[best];
+			const bool first				  = st->syncs == 0u;
+			const int64_t correction		  = time_discipline(s->offset, first);
+
+			/* The first correction sets the time, it is not an error */
+			if (!first) {
+				/* Exponential average of the corrections, as NTP jitter */
+				const int64_t delta = llabs(correction) - (int64_t)st->jitter_us;
+
+				st->jitter_us = (uint32_t)(st->jitter_us + delta / 4);
+				st->offset_us = (int32_t)CLAMP(correction, INT32_MIN, INT32_MAX);
+			}
+
+			st->rtt_us	  = (uint32_t)s->delay;
+			st->last_sync = net_time_get();
+			st->syncs++;
+
+			k_condvar_broadcast(&sntp_ctx.condvar);
+
+			LOG_INF("SNTP sync from %s: offset %d us, rtt %u us, %u/%u server(s)",
+					sntp_servers[best], st->offset_us, st->rtt_us, answered,
+					ARRAY_SIZE(sntp_servers));
+
+			retry_s = SNTP_RETRY_MIN_S;
+			next	= K_SECONDS(SNTP_POLL_INTERVAL_S);
+		} else {
+			st->failures++;
+
+			LOG_ERR("SNTP round failed (%u answer(s)), retry in %u s", answered,
+					retry_s);
+
+			next	= K_SECONDS(retry_s);
+			retry_s = MIN(retry_s * 2u, SNTP_RETRY_MAX_S);
+		}
+
+		k_mutex_unlock(&sntp_ctx.mutex);
 	}
 }
 
+int net_time_sync(void)
+{
+	k_sem_give(&sntp_ctx.trigger);
+
+	return 0;
+}
+
 uint32_t net_time_get(void)
 {
-	struct timespec ts;
+	return (uint32_t)(net_time_get_ms() / MSEC_PER_SEC);
+}
+
+uint64_t net_time_get_ms(void)
+{
+	int64_t now;
+	const int64_t up = uptime_us();
+
+	K_SPINLOCK(&time_base.lock)
+	{
+		now = MAX((up + time_offset_us(up)) / USEC_PER_MSEC, time_base.last_ms);
+		time_base.last_ms = now;
+	}
+
+	return (uint64_t)now;
+}
+
+uint64_t net_time_from_uptime_ms(int64_t uptime_ms)
+{
+	int64_t offset_us;
 
-	if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
-		LOG_ERR("Invalid net time ! %d", -1);
-		return 0;
+	K_SPINLOCK(&time_base.lock)
+	{
+		offset_us = time_offset_us(uptime_us());
 	}
 
-	return ts.tv_sec;
+	return (uint64_t)MAX(uptime_ms + offset_us / USEC_PER_MSEC, 0);
 }
 
 static inline bool time_synced(void)
 {
-	return sntp_ctx.count > 0;
+	return sntp_ctx.stats.syncs > 0;
 }
 
 bool net_time_is_synced(void)
@@ -111,7 +397,22 @@ bool net_time_is_synced(void)
 
 	k_mutex_unlock(&sntp_ctx.mutex);
 
-	return false;
+	return synced;
+}
+
+int net_time_stats_get(struct net_time_stats *stats)
+{
+	if (stats == NULL) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&sntp_ctx.mutex, K_FOREVER);
+
+	*stats = sntp_ctx.stats;
+
+	k_mutex_unlock(&sntp_ctx.mutex);
+
+	return 0;
 }
 
 int net_time_wait_synced(k_timeout_t timeout)
@@ -142,4 +443,4 @@ void net_time_show(void)
 		   "%02d:%02d:%02d\n",
 		   time_infos.tm_year + 1900, time_infos.tm_mon + 1, time_infos.tm_mday,
 		   time_infos.tm_hour, time_infos.tm_min, time_infos.tm_sec);
-}
\ No newline at end of file
+}
@@ -23,8 +23,24 @@
 
 #include <zephyr/kernel.h>
 
+struct net_time_stats {
+	uint32_t syncs;		/* Number of successful synchronizations */
+	uint32_t failures;	/* Number of rounds without valid answer */
+	uint32_t last_sync; /* Timestamp of the last synchronization (s) */
+
+	int32_t offset_us;	/* Last correction applied (stepped or slewed) */
+	uint32_t jitter_us; /* Average of the corrections */
+	uint32_t rtt_us;	/* Round trip delay of the selected server */
+
+	uint8_t servers; /* Number of servers which answered the last round */
+};
+
 /**
- * @brief Schedule a work to sync the system time
+ * @brief Trigger a synchronization of the system time.
+ *
+ * The SNTP client queries all the configured servers at once, keeps the
+ * answer with the lowest round trip delay and slews the time toward it
+ * (large offsets are stepped). It then synchronizes periodically.
  *
  * @return int
  */
@@ -45,6 +61,28 @@ bool net_time_is_synced(void);
  */
 uint32_t net_time_get(void);
 
+/**
+ * @brief Get timestamp in milliseconds.
+ *
+ * The timestamp is the uptime shifted by the offset measured at the last
+ * SNTP sync, it never goes backwards (e.g. on an SNTP step adjustment the
+ * time is held until the uptime catches up).
+ *
+ * Note: Before the first sync, this is the uptime.
+ *
+ * @return uint64_t Milliseconds since the epoch
+ */
+uint64_t net_time_get_ms(void);
+
+/**
+ * @brief Convert an uptime (k_uptime_get()) to a timestamp in milliseconds
+ * using the current SNTP offset.
+ *
+ * @param uptime_ms
+ * @return uint64_t Milliseconds since the epoch
+ */
+uint64_t net_time_from_uptime_ms(int64_t uptime_ms);
+
 /**
  * @brief Show the current time in format: YYYY-MM-DD HH:MM:SS
  */
@@ -60,4 +98,12 @@ void net_time_show(void);
  */
 int net_time_wait_synced(k_timeout_t timeout);
 
+/**
+ * @brief Get the SNTP client statistics
+ *
+ * @param stats
+ * @return int 0 on success, negative error code otherwise
+ */
+int net_time_stats_get(struct net_time_stats *stats);
+
 #endif
\ No newline at end of file
@@ -8,8 +8,34 @@
 
 #include <zephyr/device.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/reboot.h>
+
+#if defined(CONFIG_APP_HA_DEV_STORAGE)
+#include "ha/core/ha.h"
+#endif
+LOG_MODULE_REGISTER(system, LOG_LEVEL_INF);
 
 controller_status_t controller_status = {
 	.has_ipv4_addr	   = 0,
 	.valid_system_time = 0,
-};
\ No newline at end of file
+};
+
+static void reboot_work_handler(struct k_work *work)
+{
+#if defined(CONFIG_APP_HA_DEV_STORAGE)
+	int ret = ha_dev_storage_save(NULL);
+	LOG_INF("Saved %d device(s) before reboot", ret);
+#endif
+
+	sys_reboot(SYS_REBOOT_COLD);
+}
+
+static K_WORK_DELAYABLE_DEFINE(reboot_work, reboot_work_handler);
+
+int system_reboot(k_timeout_t delay)
+{
+	int ret = k_work_schedule(&reboot_work, delay);
+
+	return ret < 0 ? ret : 0;
+}
@@ -18,6 +18,11 @@ static inline uint32_t sys_time_get(void)
 	return net_time_get();
 }
 
+static inline uint64_t sys_time_get_ms(void)
+{
+	return net_time_get_ms();
+}
+
 typedef union {
 	atomic_t atomic;
 	atomic_val_t atomic_val;
@@ -29,4 +34,13 @@ typedef union {
 
 extern controller_status_t controller_status;
 
+/**
+ * @brief Reboot the controller after the given delay, volatile state which
+ * can be persisted (e.g. HA devices registry) is saved before rebooting.
+ *
+ * @param delay
+ * @return int 0 on success, negative value on error
+ */
+int system_reboot(k_timeout_t delay);
+
 #endif
\ No newline at end of file
@@ -10,7 +10,7 @@
 
 #include <zephyr/kernel.h>
 
-int contig_block_init(struct contig *g, uint8_t *buffer, size_t size)
+int contig_init(struct contig *g, uint8_t *buffer, size_t size)
 {
 	if (!g || !buffer || !size) {
 		return -EINVAL;
@@ -30,7 +30,7 @@ int contig_remaining(struct contig *g)
 	return g->size - g->allocated;
 }
 
-int contig_block_reset(struct contig *g)
+int contig_reset(struct contig *g)
 {
 	g->allocated = 0;
 	return 0;
@@ -86,19 +86,16 @@ void *kcontig_alloc(struct kcontig *g, size_t size)
 		return NULL;
 	}
 
-	/* Round up to upper 4 bytes */
-	size = (size + 3) & ~0x3;
-
-	/* Add required size for the dlist */
-	size += sizeof(struct kcontig_block);
+	/* Round up to upper 4 bytes and add required size for the dlist */
+	size = KCONTIG_ALLOC_SIZE(size);
 
 	if (g->allocated + size > g->size) {
 		return NULL;
 	}
-	struct kcontig_block *block = (struct kcontig_block *)g->buf + g->allocated;
+	struct kcontig_block *block = (struct kcontig_block *)(g->buf + g->allocated);
 	sys_dlist_append(&g->dlist, &block->handle);
 	g->allocated += size;
-	return block;
+	return block->buf;
 }
 
 void *kcontig_remove(struct kcontig_block *b)
@@ -7,10 +7,12 @@
 #ifndef _UTILS_CONTIG_ALLOC_H_
 #define _UTILS_CONTIG_ALLOC_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <zephyr/sys/dlist.h>
+#include <zephyr/sys/util.h>
 
 #define Z_CONFIG_BUF_SYM(_name) (_contig_buf##_name)
 
@@ -33,7 +35,7 @@ struct contig {
 		.buf	   = Z_CONFIG_BUF_SYM(_name),                                            \
 	}
 
-#define CONTIG_DEFINE(_name, _buf, _size) struct contig name = CONTIG_INIT(_buf, _size)
+#define CONTIG_DEFINE(_name, _buf, _size) struct contig _name = CONTIG_INIT(_buf, _size)
 
 int contig_init(struct contig *g, uint8_t *buffer, size_t size);
 
@@ -51,11 +53,11 @@ struct kcontig {
 };
 
 #define KCONTIG_DEFINE(_name, _buf, _size)                                               \
-	struct kcontig name = {                                                              \
+	struct kcontig _name = {                                                             \
 		.allocated = 0u,                                                                 \
 		.size	   = _size,                                                              \
 		.buf	   = _buf,                                                               \
-		.dlist	   = SYS_DLIST_STATIC_INIT(&name.dlist),                                 \
+		.dlist	   = SYS_DLIST_STATIC_INIT(&_name.dlist),                                \
 	}
 
 #define KCONTIG_BUF_DEFINE(_name, _size)                                                 \
@@ -69,15 +71,36 @@ struct kcontig {
 
 struct kcontig_block {
 	sys_dnode_t handle;
-	char buf[];
+	char buf[] __aligned(4u);
 };
 
+#define KCONTIG_BLOCK_FROM_BUF(_buf) CONTAINER_OF(_buf, struct kcontig_block, buf)
+
+/**
+ * @brief Size actually consumed in the arena to allocate "size" bytes
+ */
+#define KCONTIG_ALLOC_SIZE(_size)                                                        \
+	(ROUND_UP(_size, 4u) + sizeof(struct kcontig_block))
+
 int kcontig_init(struct kcontig *g, uint8_t *buffer, size_t size);
 
+static inline size_t kcontig_allocated(const struct kcontig *g)
+{
+	return g->allocated;
+}
+
 int kcontig_remaining(struct kcontig *g);
 
 int kcontig_reset(struct kcontig *g);
 
+/**
+ * @brief Allocate "size" bytes from the arena
+ *
+ * @param g
+ * @param size
+ * @return void* Pointer to the usable (4 bytes aligned) memory, NULL if
+ *  the arena is full
+ */
 void *kcontig_alloc(struct kcontig *g, size_t size);
 
 void *kcontig_remove(struct kcontig_block *b);
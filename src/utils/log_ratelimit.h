@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _UTILS_LOG_RATELIMIT_H_
+#define _UTILS_LOG_RATELIMIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+/* Per-module log rate limiting.
+ *
+ * A module registers its limit once, after LOG_MODULE_REGISTER():
+ *
+ *   LOG_RATELIMIT_REGISTER(10u, 1000u);
+ *
+ * and uses LOG_INF_RL() (and friends) on its hot paths. At most "burst"
+ * messages are logged per period, the arguments of the suppressed messages
+ * are not evaluated. The number of suppressed messages is logged with the
+ * first message of the next period.
+ */
+struct log_ratelimit {
+	uint32_t start;		 /* Start of the current period (ms) */
+	uint16_t period_ms;
+	uint16_t burst;
+	uint16_t count;		 /* Messages logged in the current period */
+	uint16_t suppressed; /* Messages suppressed in the current period */
+};
+
+#if defined(CONFIG_APP_LOG_RATELIMIT)
+
+#define LOG_RATELIMIT_REGISTER(_burst, _period_ms)                                       \
+	static struct log_ratelimit __log_ratelimit = {                                      \
+		.start		= 0u,                                                                \
+		.period_ms	= (_period_ms),                                                      \
+		.burst		= (_burst),                                                          \
+		.count		= 0u,                                                                \
+		.suppressed = 0u,                                                                \
+	}
+
+/**
+ * @brief Take a message slot of the current period.
+ *
+ * Not atomic: concurrent callers of the same module can exceed the burst by
+ * a few messages, which is acceptable for logs.
+ *
+ * @param rl
+ * @param suppressed Number of messages suppressed during the previous period,
+ * set when a new period starts, 0 otherwise
+ * @return true if the message should be logged
+ */
+static inline bool log_ratelimit_take(struct log_ratelimit *rl, uint32_t *suppressed)
+{
+	const uint32_t now = k_uptime_get_32();
+
+	*suppressed = 0u;
+
+	if (now - rl->start >= rl->period_ms) {
+		*suppressed	   = rl->suppressed;
+		rl->start	   = now;
+		rl->count	   = 0u;
+		rl->suppressed = 0u;
+	}
+
+	if (rl->count < rl->burst) {
+		rl->count++;
+		return true;
+	}
+
+	if (rl->suppressed < UINT16_MAX) {
+		rl->suppressed++;
+	}
+
+	return false;
+}
+
+/* Messages of a level compiled out don't take a slot of the period */
+#define Z_LOG_RATELIMIT(_level, _log_macro, ...)                                         \
+	do {                                                                                 \
+		uint32_t _suppressed;                                                            \
+		if (Z_LOG_CONST_LEVEL_CHECK(_level) &&                                           \
+			log_ratelimit_take(&__log_ratelimit, &_suppressed)) {                        \
+			if (_suppressed != 0u) {                                                     \
+				LOG_WRN("%u messages suppressed", _suppressed);                          \
+			}                                                                            \
+			_log_macro(__VA_ARGS__);                                                     \
+		}                                                                                \
+	} while (0)
+
+#define LOG_ERR_RL(...) Z_LOG_RATELIMIT(LOG_LEVEL_ERR, LOG_ERR, __VA_ARGS__)
+#define LOG_WRN_RL(...) Z_LOG_RATELIMIT(LOG_LEVEL_WRN, LOG_WRN, __VA_ARGS__)
+#define LOG_INF_RL(...) Z_LOG_RATELIMIT(LOG_LEVEL_INF, LOG_INF, __VA_ARGS__)
+#define LOG_DBG_RL(...) Z_LOG_RATELIMIT(LOG_LEVEL_DBG, LOG_DBG, __VA_ARGS__)
+
+#else
+
+/* Declaration only, so that the trailing semicolon is valid at file scope */
+#define LOG_RATELIMIT_REGISTER(_burst, _period_ms)                                       \
+	extern struct log_ratelimit __log_ratelimit
+
+#define LOG_ERR_RL(...) LOG_ERR(__VA_ARGS__)
+#define LOG_WRN_RL(...) LOG_WRN(__VA_ARGS__)
+#define LOG_INF_RL(...) LOG_INF(__VA_ARGS__)
+#define LOG_DBG_RL(...) LOG_DBG(__VA_ARGS__)
+
+#endif /* CONFIG_APP_LOG_RATELIMIT */
+
+#endif /* _UTILS_LOG_RATELIMIT_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#if defined(CONFIG_APP_TRACE)
+
+struct trace_ring trace_rings[CONFIG_MP_MAX_NUM_CPUS];
+atomic_t trace_enabled = ATOMIC_INIT(IS_ENABLED(CONFIG_APP_TRACE_AT_BOOT));
+
+bool trace_enable(bool enable)
+{
+	return atomic_set(&trace_enabled, enable ? 1 : 0) != 0;
+}
+
+void trace_dump_header(struct trace_dump_header *hdr)
+{
+	hdr->magic			= TRACE_DUMP_MAGIC;
+	hdr->version		= TRACE_DUMP_VERSION;
+	hdr->cpus			= CONFIG_MP_MAX_NUM_CPUS;
+	hdr->record_size	= sizeof(struct trace_record);
+	hdr->cycles_per_sec = sys_clock_hw_cycles_per_sec();
+	hdr->capacity		= CONFIG_APP_TRACE_BUFFER_SIZE;
+}
+
+int trace_read(uint32_t cpu, uint32_t *from, struct trace_record *records, size_t count)
+{
+	if (cpu >= CONFIG_MP_MAX_NUM_CPUS || from == NULL || records == NULL) {
+		return -EINVAL;
+	}
+
+	struct trace_ring *const ring = &trace_rings[cpu];
+	const uint32_t head			  = (uint32_t)atomic_get(&ring->head);
+	uint32_t index				  = *from;
+	size_t copied				  = 0u;
+
+	/* Skip the records already overwritten */
+	if (head - index > CONFIG_APP_TRACE_BUFFER_SIZE) {
+		index = head - CONFIG_APP_TRACE_BUFFER_SIZE;
+	}
+
+	while (index != head && copied < count) {
+		const struct trace_record *const rec =
+			&ring->records[index & (CONFIG_APP_TRACE_BUFFER_SIZE - 1u)];
+
+		/* Skip the record if it was being written or got overwritten while
+		 * copied: its index must be the expected one before and after */
+		const uint16_t seq_before = rec->seq;
+		compiler_barrier();
+		memcpy(&records[copied], rec, sizeof(struct trace_record));
+		compiler_barrier();
+		const uint16_t seq_after = rec->seq;
+
+		if ((seq_before == (uint16_t)index) && (seq_after == (uint16_t)index) &&
+			(records[copied].id != TRACE_EV_NONE)) {
+			copied++;
+		}
+
+		index++;
+	}
+
+	*from = index;
+
+	return (int)copied;
+}
+
+#else
+
+bool trace_enable(bool enable)
+{
+	return false;
+}
+
+void trace_dump_header(struct trace_dump_header *hdr)
+{
+	memset(hdr, 0x00, sizeof(*hdr));
+}
+
+int trace_read(uint32_t cpu, uint32_t *from, struct trace_record *records, size_t count)
+{
+	return -ENOTSUP;
+}
+
+#endif /* CONFIG_APP_TRACE */
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2022 Lucas Dietrich <ld.adecy@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _UTILS_TRACE_H_
+#define _UTILS_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/* Trace points, keep the numbering stable as the host script
+ * (scripts/trace_histograms.py) relies on it. */
+typedef enum {
+	TRACE_EV_NONE = 0u,
+
+	/* CAN frame dequeued by the controller thread (arg0: CAN id) */
+	TRACE_EV_CAN_RXQ_GET = 1u,
+	/* Frame handed to the CANIOT controller (arg0: CAN id) */
+	TRACE_EV_CANIOT_RX_FRAME = 2u,
+	/* CANIOT telemetry registered to HA (arg0: did) */
+	TRACE_EV_CANIOT_TELEMETRY = 3u,
+	/* CAN frame put into the controller queue from the driver (arg0: CAN id) */
+	TRACE_EV_CAN_RXQ_PUT = 4u,
+
+	/* Event notification to the subscribers (arg0: event, arg1: device) */
+	TRACE_EV_HA_NOTIFY_BEGIN = 10u,
+	/* arg0: event, arg1: number of subscribers notified */
+	TRACE_EV_HA_NOTIFY_END = 11u,
+	/* Event queued to a subscriber (arg0: event, arg1: subscription) */
+	TRACE_EV_HA_EV_QUEUED = 12u,
+	/* Event dequeued by a subscriber (arg0: event, arg1: subscription) */
+	TRACE_EV_HA_EV_DEQUEUED = 13u,
+
+	/* Request processing (arg0: socket) */
+	TRACE_EV_HTTP_REQ_BEGIN = 20u,
+	/* Request parsed and route handler called (arg0: socket, arg1: status) */
+	TRACE_EV_HTTP_REQ_HANDLED = 21u,
+	/* Response sent (arg0: socket, arg1: payload bytes) */
+	TRACE_EV_HTTP_RESP_SENT = 22u,
+} trace_ev_t;
+
+/* Fixed-size binary record, 16 bytes */
+struct trace_record {
+	uint32_t cycles; /* k_cycle_get_32() at the trace point */
+	uint8_t id;		 /* trace_ev_t */
+	uint8_t cpu;
+	uint16_t seq; /* Lower bits of the write index, for torn record detection */
+	uint32_t arg0;
+	uint32_t arg1;
+} __packed;
+
+/* Header of the dump served on GET /api/trace, followed by the records of
+ * each CPU ring, oldest first */
+struct trace_dump_header {
+	uint32_t magic; /* TRACE_DUMP_MAGIC */
+	uint8_t version;
+	uint8_t cpus;
+	uint16_t record_size;
+	uint32_t cycles_per_sec;
+	uint32_t capacity; /* Records per CPU ring */
+} __packed;
+
+#define TRACE_DUMP_MAGIC   0x45435254u /* "TRCE" */
+#define TRACE_DUMP_VERSION 1u
+
+#if defined(CONFIG_APP_TRACE)
+
+BUILD_ASSERT((CONFIG_APP_TRACE_BUFFER_SIZE & (CONFIG_APP_TRACE_BUFFER_SIZE - 1)) == 0,
+			 "Trace buffer size must be a power of 2");
+
+struct trace_ring {
+	atomic_t head; /* Next write index, never wraps the mask */
+	struct trace_record records[CONFIG_APP_TRACE_BUFFER_SIZE];
+};
+
+extern struct trace_ring trace_rings[CONFIG_MP_MAX_NUM_CPUS];
+extern atomic_t trace_enabled;
+
+static inline uint8_t trace_cpu_id(void)
+{
+#if CONFIG_MP_MAX_NUM_CPUS > 1
+	return (uint8_t)arch_curr_cpu()->id;
+#else
+	return 0u;
+#endif
+}
+
+/**
+ * @brief Record a trace point, lock-free and callable from any context.
+ *
+ * The slot is reserved with a single atomic increment on the ring of the
+ * current CPU, a writer preempted on the same CPU only delays its own slot.
+ */
+static inline void trace_record(trace_ev_t id, uint32_t arg0, uint32_t arg1)
+{
+	if (!atomic_get(&trace_enabled)) {
+		return;
+	}
+
+	const uint8_t cpu			  = trace_cpu_id();
+	struct trace_ring *const ring = &trace_rings[cpu];
+	const uint32_t index		  = (uint32_t)atomic_inc(&ring->head);
+	struct trace_record *const rec =
+		&ring->records[index & (CONFIG_APP_TRACE_BUFFER_SIZE - 1u)];
+
+	/* Not a valid index for this slot until the record is written */
+	rec->seq = (uint16_t)(index + 1u);
+	compiler_barrier();
+
+	rec->cycles = k_cycle_get_32();
+	rec->id		= (uint8_t)id;
+	rec->cpu	= cpu;
+	rec->arg0	= arg0;
+	rec->arg1	= arg1;
+	compiler_barrier();
+	rec->seq	= (uint16_t)index;
+}
+
+#define TRACE(_id, _arg0, _arg1)                                                         \
+	trace_record(_id, (uint32_t)(uintptr_t)(_arg0), (uint32_t)(uintptr_t)(_arg1))
+
+#else
+
+#define TRACE(_id, _arg0, _arg1)                                                         \
+	do {                                                                                 \
+	} while (0)
+
+#endif /* CONFIG_APP_TRACE */
+
+/**
+ * @brief Enable or disable the recording of the trace points
+ *
+ * @param enable
+ * @return true if tracing was enabled before the call
+ */
+bool trace_enable(bool enable);
+
+/**
+ * @brief Fill the header describing the rings
+ *
+ * @param hdr
+ */
+void trace_dump_header(struct trace_dump_header *hdr);
+
+/**
+ * @brief Copy the records of a CPU ring, oldest first.
+ *
+ * Recording should be disabled while reading, records overwritten during the
+ * copy are detected and skipped.
+ *
+ * @param cpu CPU ring to read
+ * @param from In: absolute index of the first record to read (0 to start
+ * from the oldest one), out: index of the next record to read
+ * @param records Output array
+ * @param count Maximum number of records to copy
+ * @return int Number of records copied, 0 if the ring is exhausted, negative
+ * error code on error
+ */
+int trace_read(uint32_t cpu, uint32_t *from, struct trace_record *records, size_t count);
+
+#endif /* _UTILS_TRACE_H_ */